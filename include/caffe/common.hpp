@@ -1,6 +1,7 @@
 #ifndef CAFFE_COMMON_HPP_
 #define CAFFE_COMMON_HPP_
 
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -97,6 +98,8 @@ using std::vector;
 // Currently it initializes google flags and google logging.
 void GlobalInit(int* pargc, char*** pargv);
 
+class ThreadPool;
+
 // A singleton class to hold common caffe stuff, such as the handler that
 // caffe is going to use for cublas, curand, etc.
 class Caffe {
@@ -166,6 +169,21 @@ class Caffe {
   inline static bool multiprocess() { return Get().multiprocess_; }
   inline static void set_multiprocess(bool val) { Get().multiprocess_ = val; }
   inline static bool root_solver() { return Get().solver_rank_ == 0; }
+  // Intra-op parallelism: the number of threads parallel_for splits CPU
+  // layer work over, for the calling thread. Defaults to 1, which runs
+  // everything on the calling thread, and is inherited by InternalThreads.
+  inline static int intra_op_threads() { return Get().intra_op_threads_; }
+  static void set_intra_op_threads(int val);
+  // Calls body(begin, end) on disjoint blocks covering [0, size), on up to
+  // intra_op_threads() threads, and returns when all blocks are done. Blocks
+  // hold at least grain items unless size is smaller. Calls from within a
+  // body run on one thread, as the workers have one intra-op thread each.
+  static void parallel_for(int size, int grain,
+      const boost::function<void(int, int)>& body);
+  // The number of elementwise operations below which handing work to
+  // another thread costs more than it saves; a grain for parallel_for over
+  // single elements, to be divided by the work per item otherwise.
+  static const int kParallelGrain = 1 << 14;
 
  protected:
 #ifndef CPU_ONLY
@@ -181,6 +199,11 @@ class Caffe {
   int solver_rank_;
   bool multiprocess_;
 
+  // Intra-op parallelism, the pool is created by the first parallel_for and
+  // grown to the largest intra_op_threads_ it has run with
+  int intra_op_threads_;
+  shared_ptr<ThreadPool> intra_op_pool_;
+
  private:
   // The private constructor to avoid duplicate instantiation.
   Caffe();
@@ -25,6 +25,12 @@ class DataTransformer {
    */
   void InitRand();
 
+  /**
+   * @brief Initialize the Random number generations from the given seed,
+   *    e.g. for a transformer that runs on a worker thread.
+   */
+  void InitRand(unsigned int seed);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to the data.
@@ -37,6 +43,17 @@ class DataTransformer {
    */
   void Transform(const Datum& datum, Blob<Dtype>* transformed_blob);
 
+  /**
+   * @brief Applies the transformation to a Datum parsed by
+   * ParseDatumAliasing, whose data field was left in the buffer it was
+   * parsed from.
+   *
+   * @param data
+   *    The bytes of the data field of datum, size of them.
+   */
+  void Transform(const Datum& datum, const char* data, size_t size,
+                 Blob<Dtype>* transformed_blob);
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to a vector of Datum.
@@ -98,6 +115,9 @@ class DataTransformer {
    *    Datum containing the data to be transformed.
    */
   vector<int> InferBlobShape(const Datum& datum);
+  // The same for a Datum parsed by ParseDatumAliasing.
+  vector<int> InferBlobShape(const Datum& datum, const char* data,
+      size_t size);
   /**
    * @brief Infers the shape of transformed_blob will have when
    *    the transformation is applied to the data.
@@ -138,7 +158,8 @@ class DataTransformer {
    */
   virtual int Rand(int n);
 
-  void Transform(const Datum& datum, Dtype* transformed_data);
+  void Transform(const Datum& datum, const char* data, size_t size,
+                 Dtype* transformed_data);
   // Tranformation parameters
   TransformationParameter param_;
 
@@ -269,6 +269,22 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Return whether Forward may write top[0] over bottom[0].
+   *
+   * Layers that can run in place return true; Net's memory reuse then lets
+   * top[0] take the memory of bottom[0] when nothing reads bottom[0] later.
+   */
+  virtual inline bool AllowInPlace() const { return false; }
+
+  /**
+   * @brief Return whether Forward points the data of every top at the data
+   *        of bottom[0] rather than computing it.
+   *
+   * Net's memory reuse keeps such tops in the memory of bottom[0].
+   */
+  virtual inline bool ForwardSharesData() const { return false; }
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
@@ -34,6 +34,10 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   // we just called weight_cpu_gemm with the same input.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
       Dtype* output, bool skip_im2col = false);
+  // Like forward_cpu_gemm for batch consecutive images, lowered side by
+  // side into one column buffer for a single GEMM per group.
+  void forward_cpu_gemm_batch(const Dtype* input, const int batch,
+      const Dtype* weights, Dtype* output);
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
       Dtype* output);
@@ -90,8 +94,13 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int weight_offset_;
   int num_output_;
   bool bias_term_;
+  /// @brief Whether Forward applies a ReLU to the output.
+  bool relu_;
   bool is_1x1_;
   bool force_nd_im2col_;
+  /// @brief The number of images forward_cpu_gemm_batch may lower at once;
+  ///        1 if Forward lowers one image at a time.
+  int forward_batch_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -167,6 +176,9 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+  // column and output buffers of forward_cpu_gemm_batch
+  Blob<Dtype> batch_col_buffer_;
+  Blob<Dtype> batch_output_;
 };
 
 }  // namespace caffe
@@ -9,6 +9,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/sequencer.hpp"
 
 namespace caffe {
 
@@ -51,6 +52,15 @@ class Batch {
   Blob<Dtype> data_, label_;
 };
 
+/**
+ * @brief Fills batches on prefetch threads, ahead of Forward.
+ *
+ * With data_param.prefetch_threads() > 1, the threads load batches 0, N,
+ * 2N, ..., 1, N + 1, ..., and so on. They call load_batch in batch order,
+ * and each keeps the reading state of the layer to itself until it calls
+ * ReadDone, so a batch gets the same items whatever the timing; decoding and
+ * transforming after that overlap with the other threads.
+ */
 template <typename Dtype>
 class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype>, public InternalThread {
@@ -67,16 +77,48 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
+  // Stops all the prefetch threads.
+  void StopInternalThread();
+
+  int prefetch_threads() const { return prefetch_seq_.size(); }
+
  protected:
+  class PrefetchThread;
+
   virtual void InternalThreadEntry();
-  virtual void load_batch(Batch<Dtype>* batch) = 0;
+  // Loads batches on prefetch thread thread_id until interrupted.
+  void Prefetch(int thread_id);
+  /**
+   * Fills batch on prefetch thread thread_id. It must call ReadDone once it
+   * no longer uses the state shared by the threads (the source position and
+   * the random draws of the layer), and transform with transformer(thread_id)
+   * into transformed_data(thread_id).
+   */
+  virtual void load_batch(Batch<Dtype>* batch, int thread_id) = 0;
+  // Lets the next thread start reading its batch.
+  void ReadDone(int thread_id);
+  DataTransformer<Dtype>* transformer(int thread_id);
+  Blob<Dtype>* transformed_data(int thread_id);
 
   vector<shared_ptr<Batch<Dtype> > > prefetch_;
   BlockingQueue<Batch<Dtype>*> prefetch_free_;
   BlockingQueue<Batch<Dtype>*> prefetch_full_;
   Batch<Dtype>* prefetch_current_;
 
+  // used by prefetch thread 0, which runs on the InternalThread of the layer
   Blob<Dtype> transformed_data_;
+
+  // threads 1 to prefetch_threads() - 1, with their own transformers
+  vector<shared_ptr<PrefetchThread> > prefetch_threads_;
+  vector<shared_ptr<DataTransformer<Dtype> > > prefetch_transformers_;
+  vector<shared_ptr<Blob<Dtype> > > prefetch_transformed_data_;
+  // the batch each thread is loading
+  vector<uint64_t> prefetch_seq_;
+  // turns of the threads at reading, and at handing over batches when
+  // ordered_prefetch
+  Sequencer read_turn_;
+  Sequencer push_turn_;
+  bool ordered_prefetch_;
 };
 
 }  // namespace caffe
@@ -10,6 +10,7 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -30,11 +31,27 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   void Next();
   bool Skip();
-  virtual void load_batch(Batch<Dtype>* batch);
+  virtual void load_batch(Batch<Dtype>* batch, int thread_id);
+  // Runs on the transform pool: transforms every item i of the batch of
+  // prefetch thread prefetch_id with i % transform_pool_->size() == thread_id.
+  void TransformItems(int thread_id, int prefetch_id, Dtype* top_data);
 
   shared_ptr<db::DB> db_;
   shared_ptr<db::Cursor> cursor_;
   uint64_t offset_;
+
+  // only used with transform_threads > 1: the worker threads, with a
+  // transformer and a view into the batch for each of them
+  shared_ptr<ThreadPool> transform_pool_;
+  vector<shared_ptr<DataTransformer<Dtype> > > transformers_;
+  vector<shared_ptr<Blob<Dtype> > > transformed_data_views_;
+  // for each prefetch thread, the items of its batch, where their data
+  // fields are (left in the database when the cursor allows it), and with
+  // transform_threads > 1 the seeds of their transformers
+  vector<vector<Datum> > batch_datums_;
+  vector<vector<const char*> > batch_data_;
+  vector<vector<size_t> > batch_data_sizes_;
+  vector<vector<unsigned int> > item_seeds_;
 };
 
 }  // namespace caffe
@@ -38,6 +38,14 @@ class EltwiseLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // Forward_cpu and Backward_cpu on the elements [begin, end), run in
+  // blocks on the intra-op threads; bottom_diff[i] is NULL for the bottoms
+  // not to propagate down to.
+  void Forward_cpu_range(const vector<const Dtype*>& bottom_data,
+      Dtype* top_data, int* mask, int begin, int end);
+  void Backward_cpu_range(const vector<const Dtype*>& bottom_data,
+      const vector<Dtype*>& bottom_diff, const Dtype* top_data,
+      const Dtype* top_diff, const int* mask, int begin, int end);
 
   EltwiseParameter_EltwiseOp op_;
   vector<Dtype> coeffs_;
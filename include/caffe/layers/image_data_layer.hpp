@@ -35,10 +35,12 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
-  virtual void load_batch(Batch<Dtype>* batch);
+  virtual void load_batch(Batch<Dtype>* batch, int thread_id);
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  // the lines of the batch of each prefetch thread
+  vector<vector<std::pair<std::string, int> > > batch_lines_;
 };
 
 
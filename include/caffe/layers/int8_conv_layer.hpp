@@ -0,0 +1,72 @@
+#ifndef CAFFE_INT8_CONV_LAYER_HPP_
+#define CAFFE_INT8_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief CPU implementation of ConvolutionLayer in int8, for inference with
+ *        a trained net. Fallback to ConvolutionLayer for N-d convolution.
+ *
+ * The input is quantized by the range of quantization_param, as recorded by
+ * tools/calibrate_int8, and the filters by the largest magnitude of each
+ * output channel. The quantized input is lowered by im2col and multiplied
+ * by the filters with the products summed in int32, which are scaled back
+ * to the output as they are stored. The filters are quantized at the first
+ * pass, and again only after they have been written. A TEST net has no use
+ * for their floats after that, and frees them unless other blobs share
+ * them: blobs()[0] then reads as zeros, while ToProto writes the filters the
+ * int8 ones stand for.
+ *
+ * The backward pass and the GPU use the ConvolutionLayer implementation, so
+ * a TEST net that ran on the CPU needs its weights copied again for them.
+ */
+template <typename Dtype>
+class Int8ConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit Int8ConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), quantized_version_(0),
+        weights_freed_(false) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void ToProto(LayerParameter* param, bool write_diff = false);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  // quantizes the filters if they changed since the last pass
+  void update_weights();
+  void quantize_weights();
+
+  // false for N-d convolution, which uses the CAFFE engine
+  bool use_int8_;
+  // the input is quantized to round(input_scale_ * x)
+  Dtype input_scale_;
+  // the quantized filters, and the scale of each output channel that turns
+  // the int32 sums back to the output
+  vector<int8_t> weight_int8_;
+  vector<Dtype> output_scale_;
+  // the memory of the filters quantized and its version then, held so that
+  // its address is not reused by other filters, and whether their floats
+  // were freed
+  shared_ptr<SyncedMemory> quantized_data_;
+  size_t quantized_version_;
+  bool weights_freed_;
+  // the quantized input of an image, and its columns
+  vector<int8_t> input_int8_;
+  vector<int8_t> col_int8_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_INT8_CONV_LAYER_HPP_
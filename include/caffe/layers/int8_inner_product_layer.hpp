@@ -0,0 +1,68 @@
+#ifndef CAFFE_INT8_INNER_PRODUCT_LAYER_HPP_
+#define CAFFE_INT8_INNER_PRODUCT_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/inner_product_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief CPU implementation of InnerProductLayer in int8, for inference with
+ *        a trained net.
+ *
+ * The input is quantized by the range of quantization_param, as recorded by
+ * tools/calibrate_int8, and the weights by the largest magnitude of each
+ * output. The products are summed in int32, which are scaled back to the
+ * output before the bias is added. The weights are quantized at the first
+ * pass, and again only after they have been written. In the TEST phase
+ * their floats are then freed, unless shared with other blobs, so that the
+ * weights take a quarter of their float memory: blobs()[0] reads as zeros,
+ * and ToProto writes the weights the int8 ones stand for.
+ *
+ * The backward pass and the GPU use the InnerProductLayer implementation.
+ */
+template <typename Dtype>
+class Int8InnerProductLayer : public InnerProductLayer<Dtype> {
+ public:
+  explicit Int8InnerProductLayer(const LayerParameter& param)
+      : InnerProductLayer<Dtype>(param), quantized_version_(0),
+        weights_freed_(false) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void ToProto(LayerParameter* param, bool write_diff = false);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  // quantizes the weights if they changed since the last pass
+  void update_weights();
+  void quantize_weights();
+
+  // the input is quantized to round(input_scale_ * x)
+  Dtype input_scale_;
+  // the quantized weights, K_ x N_ whether transposed or not, packed by
+  // caffe_cpu_pack_int8, and the scale of each output that turns the int32
+  // sums back to the output
+  vector<int8_t> weight_int8_;
+  vector<Dtype> output_scale_;
+  // the memory of the weights quantized and its version then, held so that
+  // its address is not reused by other weights, and whether their floats
+  // were freed
+  shared_ptr<SyncedMemory> quantized_data_;
+  size_t quantized_version_;
+  bool weights_freed_;
+  // the quantized input
+  vector<int8_t> input_int8_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_INT8_INNER_PRODUCT_LAYER_HPP_
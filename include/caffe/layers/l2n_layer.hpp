@@ -1,5 +1,5 @@
-#ifndef CAFFE_ELTWISE_LAYER_HPP_
-#define CAFFE_ELTWISE_LAYER_HPP_
+#ifndef CAFFE_L2N_LAYER_HPP_
+#define CAFFE_L2N_LAYER_HPP_
 
 #include <vector>
 
@@ -10,7 +10,9 @@
 namespace caffe {
 
 /**
- * @brief Compute L2 *
+ * @brief Normalizes every position of the input to unit L2 norm across the
+ *        channels, y = x / sqrt(sum_c x_c^2 + eps).
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -24,6 +26,7 @@ class L2NLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "L2N"; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline bool AllowInPlace() const { return true; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -35,16 +38,12 @@ class L2NLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
-  // sum_multiplier_ is used to carry out sum using BLAS 1 * ch * 1 * 1
-  Blob<Dtype> sum_multiplier_;
-  // square result  n * ch * h * w
-  Blob<Dtype> square_;
-  // norm is an intermediate Blob to hold temporary results. n * 1 * h * w
-  Blob<Dtype> norm_;
-  // temp_dot  n * 1 * h * w
+  // 1 / norm of each position, n * 1 * h * w
+  Blob<Dtype> inv_norm_;
+  // cpu scratch for dot(t_diff, t_data) of a tile of positions, 1 * 1 * h * w
   Blob<Dtype> temp_dot_;
 };
 
 }  // namespace caffe
 
-#endif  // CAFFE_ELTWISE_LAYER_HPP_
+#endif  // CAFFE_L2N_LAYER_HPP_
@@ -55,6 +55,14 @@ class LRNLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void WithinChannelBackward(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // CrossChannel{Forward,Backward}_cpu on the images [begin, end), run in
+  // blocks of parallel_grain() images on the intra-op threads.
+  void CrossChannelForward_cpu_range(const Dtype* bottom_data,
+      Dtype* top_data, Dtype* scale_data, int begin, int end);
+  void CrossChannelBackward_cpu_range(const Dtype* top_diff,
+      const Dtype* top_data, const Dtype* bottom_data,
+      const Dtype* scale_data, Dtype* bottom_diff, int begin, int end);
+  int parallel_grain() const;
 
   int size_;
   int pre_pad_;
@@ -43,6 +43,13 @@ class PoolingLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // Forward_cpu and Backward_cpu on the channels [begin, end) of all images,
+  // run in blocks of parallel_grain() channels on the intra-op threads.
+  void Forward_cpu_range(const Dtype* bottom_data, Dtype* top_data,
+      int* mask, Dtype* top_mask, int begin, int end);
+  void Backward_cpu_range(const Dtype* top_diff, const int* mask,
+      const Dtype* top_mask, Dtype* bottom_diff, int begin, int end);
+  int parallel_grain() const;
 
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
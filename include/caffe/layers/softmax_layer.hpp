@@ -35,13 +35,21 @@ class SoftmaxLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // Forward_cpu and Backward_cpu on the outer indices [begin, end), run in
+  // blocks on the intra-op threads.
+  void Forward_cpu_range(const Dtype* bottom_data, Dtype* top_data,
+      Dtype* scale_data, const Dtype* multiplier_data, int begin, int end);
+  void Backward_cpu_range(const Dtype* top_diff, const Dtype* top_data,
+      Dtype* bottom_diff, Dtype* scale_data, const Dtype* multiplier_data,
+      int begin, int end);
 
   int outer_num_;
   int inner_num_;
   int softmax_axis_;
   /// sum_multiplier is used to carry out sum using BLAS
   Blob<Dtype> sum_multiplier_;
-  /// scale is an intermediate Blob to hold temporary results.
+  /// scale is an intermediate Blob to hold temporary results, one
+  /// inner_num_ slice per outer index.
   Blob<Dtype> scale_;
 };
 
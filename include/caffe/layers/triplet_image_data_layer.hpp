@@ -12,12 +12,19 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/identity_sampler.hpp"
+#include "caffe/util/image_shards.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
 /**
  * @brief Provides data to the Net from image files.
  *
+ * The images are listed with their labels in a text file (source), or
+ * packed by tools/convert_imageshards into shards that are memory-mapped
+ * and described by an ImageShardIndex (shard_index).
+ *
  * TODO(dox): thorough documentation for Forward and proto params.
  */
 template <typename Dtype>
@@ -35,11 +42,42 @@ class TripletImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
-  virtual void ShuffleImages();
-  virtual void load_batch(Batch<Dtype>* batch);
+  // Picks the pair_num identities and pair_size images of each of them for
+  // the next batch, the one of prefetch thread thread_id.
+  virtual void SampleBatch(int thread_id);
+  virtual void load_batch(Batch<Dtype>* batch, int thread_id);
+  // Reads and decodes image id from its file or its shard.
+  cv::Mat ReadImage(int id) const;
+  // Reads and transforms the images of pair group i of the batch of prefetch
+  // thread prefetch_id into its slice of the batch.
+  void DecodePairGroup(int prefetch_id, int i,
+      DataTransformer<Dtype>* transformer, Blob<Dtype>* transformed_data,
+      Dtype* prefetch_data, Dtype* prefetch_label, double* read_time,
+      double* trans_time);
+  // Runs on the decode pool: handles every pair group i with
+  // i % decode_pool_->size() == thread_id.
+  void DecodePairGroups(int thread_id, int prefetch_id, Dtype* prefetch_data,
+      Dtype* prefetch_label, vector<double>* read_times,
+      vector<double>* trans_times);
+
+  // picks the identities and images of the batches of this solver
+  shared_ptr<IdentitySampler> sampler_;
+  // identities and images picked for the batch of each prefetch thread
+  vector<vector<int> > batch_labels_;
+  vector<vector<int> > batch_images_;
+  // with a list file: the file name of every image
+  vector<std::string> image_files_;
+  // with shards: the mapped shards that hold every image
+  shared_ptr<ImageShards> shards_;
 
-  vector<int> labels_;
-  map< int, vector<std::string> > label2images_;
+  // only used with decode_threads > 1: the worker threads, with a
+  // transformer and a view into the batch for each of them
+  shared_ptr<ThreadPool> decode_pool_;
+  vector<shared_ptr<DataTransformer<Dtype> > > decode_transformers_;
+  vector<shared_ptr<Blob<Dtype> > > decode_data_;
+  // seed of the transformer for every pair group of the batch of each
+  // prefetch thread
+  vector<vector<unsigned int> > group_seeds_;
 };
 
 
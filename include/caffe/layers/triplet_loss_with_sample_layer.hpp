@@ -13,7 +13,10 @@ namespace caffe {
 	class TripletLossWithSampleLayer : public LossLayer<Dtype> {
 	public:
 		explicit TripletLossWithSampleLayer(const LayerParameter& param)
-			: LossLayer<Dtype>(param), iter_count_(0) {}
+			: LossLayer<Dtype>(param), iter_count_(0),
+			bank_capacity_(0), bank_next_(0), bank_filled_(0) {}
+		virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+				const vector<Blob<Dtype>*>& top);
 		virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
 				const vector<Blob<Dtype>*>& top);
 
@@ -35,9 +38,52 @@ namespace caffe {
 
 		int iter_count_;
 		void select_triplet(const vector<Blob<Dtype>*>& bottom);
+		void select_triplet_gpu(const vector<Blob<Dtype>*>& bottom);
+		// copy the current batch into the memory bank and compute the
+		// distances from the batch to every bank slot
+		void update_memory_bank(const vector<Blob<Dtype>*>& bottom);
+		// whether bank slot b holds a sample of an earlier batch
+		bool bank_slot_valid(int b, int num) const;
+
+		// one <anchor, positive, negative> triplet picked by select_triplet,
+		// with how far it violates the margin; a negative >= num refers to
+		// slot negative - num of the memory bank
+		struct Triplet {
+			int anchor;
+			int positive;
+			int negative;
+			Dtype violation;
+		};
+		// the triplets selected for the current batch on the cpu
+		vector<Triplet> triplets_;
 
+		// pairwise distances between the num samples, num * num
 		Blob<Dtype> dist_;
+		// squared L2 norm of each sample, only used by the EUCLIDEAN distance
+		Blob<Dtype> norm_;
+		// gpu only: 1 where negative j is selected by the (anchor, positive)
+		// pair, num * pair_size * num
 		Blob<Dtype> flag_;
+		// gpu only: random keys used to sample negatives, shaped like flag_
+		Blob<Dtype> rand_key_;
+		// gpu only: number of negatives selected by each (anchor, positive)
+		Blob<Dtype> flag_sum_;
+		// gpu only: vector of ones used to sum with BLAS, num
+		Blob<Dtype> sum_multiplier_;
+
+		// memory bank: the current batch plus the samples of earlier batches
+		// kept as extra negatives, bank_capacity_ * dim features and labels
+		int bank_capacity_;
+		// slot the next batch is written to, and number of slots written
+		int bank_next_;
+		int bank_filled_;
+		Blob<Dtype> bank_feat_;
+		Blob<Dtype> bank_label_;
+		// squared L2 norm of each bank sample, only used by EUCLIDEAN
+		Blob<Dtype> bank_norm_;
+		// distances from the batch to every bank slot, num * bank_capacity_;
+		// the diff gathers dL/ddist for the bank negatives
+		Blob<Dtype> bank_dist_;
 	};
 }
 
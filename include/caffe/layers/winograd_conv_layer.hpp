@@ -0,0 +1,87 @@
+#ifndef CAFFE_WINOGRAD_CONV_LAYER_HPP_
+#define CAFFE_WINOGRAD_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include <boost/weak_ptr.hpp>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief CPU implementation of ConvolutionLayer without im2col for the
+ *        common 3x3 and 1x1 filters. Fallback to ConvolutionLayer otherwise.
+ *
+ * 2D convolution with 3x3 filters, stride 1 and no dilation is computed by
+ * Winograd's minimal filtering algorithm F(m x m, 3x3) with m = 2 or 4
+ * (Lavin & Gray, Fast Algorithms for Convolutional Neural Networks, 2015):
+ * the filters and the overlapping (m + 2) x (m + 2) input tiles are
+ * transformed, multiplied elementwise, which for all channels amounts to
+ * (m + 2)^2 GEMMs, and transformed back into m x m output tiles. This takes
+ * 2.25 (m = 2) or 4 (m = 4) times fewer multiplications than the direct
+ * convolution, and a (m + 2)^2 / m^2 instead of a 9 times larger buffer
+ * than the input.
+ *
+ * The filters are transformed at the first pass, and again only after they
+ * have been written.
+ *
+ * 1x1 convolution without padding is a GEMM straight on the input, after
+ * subsampling it for strides larger than 1.
+ *
+ * The backward pass and the GPU use the ConvolutionLayer implementation.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), transformed_version_(0) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+ protected:
+  enum Algorithm { GEMM, WINOGRAD, DIRECT_1X1 };
+
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  // M is the output tile size
+  template <int M> void winograd_transform_weights(const Dtype* weights);
+  template <int M> void winograd_forward_cpu(const Dtype* input,
+      const int batch, Dtype* output);
+  void direct_1x1_forward_cpu(const Dtype* input, const Dtype* weights,
+      Dtype* output);
+
+  Algorithm algorithm_;
+  // the output tile size m, and the input tile size m + 2
+  int tile_;
+  int alpha_;
+  int tiles_h_;
+  int tiles_w_;
+  // the number of images transformed at once, see batch_col_buffer_mb
+  int winograd_batch_;
+  // The transformed filters, input tiles, and output tiles; for each of the
+  // alpha_ x alpha_ tile elements a matrix of
+  // output channels x input channels / group, input channels x tiles of
+  // winograd_batch_ images, and output channels x tiles.
+  Blob<Dtype> weight_transform_;
+  Blob<Dtype> input_transform_;
+  Blob<Dtype> output_transform_;
+  // the memory of the filters transformed and its version then; a weak
+  // pointer expires rather than match other filters at the same address,
+  // and does not count as sharing the filters for half_storage
+  boost::weak_ptr<SyncedMemory> transformed_data_;
+  size_t transformed_version_;
+  // the subsampled input of strided 1x1 convolution
+  Blob<Dtype> strided_input_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_WINOGRAD_CONV_LAYER_HPP_
@@ -108,7 +108,11 @@ class Net {
   // trained layers from another net parameter instance.
   /**
    * @brief For an already initialized net, copies the pre-trained layers from
-   *        another Net.
+   *        another Net. With fold_batch_norm, the layers folded into a layer
+   *        are found in param by name and folded as they were into this net,
+   *        whatever their parameters and place in param, e.g. in a snapshot
+   *        of the TRAIN net. A layer without them in param is taken as
+   *        already folded.
    */
   void CopyTrainedLayersFrom(const NetParameter& param);
   void CopyTrainedLayersFrom(const string trained_filename);
@@ -177,6 +181,14 @@ class Net {
   inline const vector<Blob<Dtype>*>& learnable_params() const {
     return learnable_params_;
   }
+  /**
+   * @brief With contiguous_params, returns a blob whose data and diff are
+   *        those of the learnable params laid end to end; NULL otherwise,
+   *        or once some params share the memory of another net.
+   */
+  inline Blob<Dtype>* contiguous_params() const {
+    return params_contiguous_ ? params_arena_.get() : NULL;
+  }
   /// @brief returns the learnable parameter learning rate multipliers
   inline const vector<float>& params_lr() const { return params_lr_; }
   inline const vector<bool>& has_params_lr() const { return has_params_lr_; }
@@ -252,6 +264,28 @@ class Net {
     after_backward_.push_back(value);
   }
 
+  // Invoked during Backward once the gradients of learnable params are
+  // complete, i.e. after the first layer of the net using them.
+  class ParamsReadyCallback {
+   protected:
+    virtual void params_ready(int layer,
+        const vector<int>& learnable_param_ids) = 0;
+
+    template <typename T>
+    friend class Net;
+  };
+  const vector<ParamsReadyCallback*>& params_ready() const {
+    return params_ready_;
+  }
+  void add_params_ready(ParamsReadyCallback* value) {
+    params_ready_.push_back(value);
+  }
+  /// @brief the learnable params whose gradients are complete after the
+  ///        backward of layer_id
+  inline const vector<int>& ready_params(int layer_id) const {
+    return ready_params_[layer_id];
+  }
+
  protected:
   // Helpers for Init.
   /// @brief Append a new top blob to the net.
@@ -265,6 +299,13 @@ class Net {
   /// @brief Append a new parameter blob to the net.
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
+  /// @brief Share memory between blobs whose lifetimes do not overlap.
+  void PlanMemoryReuse();
+  /// @brief Moves the learnable params into one arena, for contiguous_params.
+  void AllocateContiguousParams();
+  /// @brief Keeps the data of the blobs and params of a layer in half
+  ///        precision until it is read again, for half_storage.
+  void StoreHalf(const int layer_id);
 
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
@@ -326,15 +367,30 @@ class Net {
   /// the weight decay multipliers for learnable_params_
   vector<float> params_weight_decay_;
   vector<bool> has_params_decay_;
+  /// The arena of the learnable params with contiguous_params, and whether
+  /// they all still live in it.
+  shared_ptr<Blob<Dtype> > params_arena_;
+  bool params_contiguous_;
+  /// Whether BatchNorm was folded into the layers before it, and the
+  /// layers folded into each layer, by its name, without their blobs.
+  bool fold_batch_norm_;
+  map<string, vector<LayerParameter> > folded_chains_;
+  /// Whether the data is kept in half precision between the layers.
+  bool half_storage_;
   /// The bytes of memory used by this net
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// The intra-op threads of Forward and Backward, 0 to inherit them.
+  int intra_op_threads_;
   // Callbacks
   vector<Callback*> before_forward_;
   vector<Callback*> after_forward_;
   vector<Callback*> before_backward_;
   vector<Callback*> after_backward_;
+  vector<ParamsReadyCallback*> params_ready_;
+  /// The learnable params whose gradients each layer completes.
+  vector<vector<int> > ready_params_;
 
 DISABLE_COPY_AND_ASSIGN(Net);
 };
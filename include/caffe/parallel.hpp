@@ -1,9 +1,10 @@
 #ifndef CAFFE_PARALLEL_HPP_
 #define CAFFE_PARALLEL_HPP_
 
+#include <boost/date_time/posix_time/posix_time.hpp>
 #ifdef USE_NCCL
-
 #include <boost/thread.hpp>
+#endif
 
 #include <string>
 #include <vector>
@@ -16,7 +17,11 @@
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#ifdef USE_NCCL
 #include "caffe/util/nccl.hpp"
+#endif
+
+namespace boost { class barrier; }
 
 namespace caffe {
 
@@ -48,6 +53,146 @@ class Params {
 DISABLE_COPY_AND_ASSIGN(Params);
 };
 
+// Params stored in CPU memory.
+template<typename Dtype>
+class CPUParams : public Params<Dtype> {
+ public:
+  explicit CPUParams(shared_ptr<Solver<Dtype> > root_solver);
+  virtual ~CPUParams();
+
+  void Configure(Solver<Dtype>* solver) const;
+
+ protected:
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+/**
+ * Splits the flat gradient buffer of Params into buckets of about
+ * reduce_bucket_mb of consecutive learnable params, and hands each bucket
+ * to bucket_ready() as soon as Backward has completed all its gradients,
+ * so that its reduction overlaps with the backward of the layers below.
+ * Backward completes the params of the last layers first, so the buckets
+ * are formed from the end of the buffer, and all replicas see them in the
+ * same order. With iter_size > 1 the buckets are only handed over in the
+ * last backward pass of an iteration.
+ *
+ * Every display iterations rank 0 logs how long the reductions ran during
+ * the backward pass, and how long they kept the solver waiting after it.
+ */
+template<typename Dtype>
+class GradientBuckets : public Net<Dtype>::ParamsReadyCallback {
+ public:
+  explicit GradientBuckets(Solver<Dtype>* solver);
+  virtual ~GradientBuckets() {}
+
+  inline int num_buckets() const { return bucket_params_.size(); }
+  // The range of the flat buffers a bucket covers.
+  inline size_t bucket_offset(int bucket) const {
+    return bucket_begin_[bucket];
+  }
+  inline size_t bucket_count(int bucket) const {
+    return bucket_end_[bucket] - bucket_begin_[bucket];
+  }
+
+ protected:
+  void params_ready(int layer, const vector<int>& learnable_param_ids);
+  // Starts the reduction of a bucket.
+  virtual void bucket_ready(int bucket) = 0;
+
+  // To be called from on_gradients_ready: hands over the buckets Backward
+  // has not completed, e.g. after a partial pass, before waiting for the
+  // reductions, and then once they are done.
+  void BackwardDone();
+  void ReductionDone(int iter);
+
+  const int iter_size_;
+  const int display_;
+  vector<int> param_bucket_;
+  vector<size_t> bucket_begin_;
+  vector<size_t> bucket_end_;
+  vector<int> bucket_params_;
+  // the params of each bucket not ready yet in this backward pass
+  vector<int> bucket_pending_;
+  vector<bool> bucket_started_;
+  // the backward passes and the buckets completed in this iteration
+  int pass_;
+  int buckets_completed_;
+  int buckets_started_;
+  boost::posix_time::ptime first_start_;
+  boost::posix_time::ptime backward_done_;
+};
+
+/**
+ * Data-parallel training on the CPU, without NCCL: solver_count() solver
+ * replicas train in threads of one process, each on its own share of the
+ * data and with its own copy of the parameters in CPUParams. Before every
+ * update, the gradients are averaged by a ring allreduce over the diff
+ * buffers of the replicas. Each replica only reads the buffer of the
+ * previous one, so on a multi-socket machine the traffic between sockets
+ * stays on the links of the ring.
+ *
+ * With layer_wise_reduce, each replica reduces the gradient buckets on a
+ * communication thread of its own while the solver thread goes on with
+ * the backward pass.
+ */
+template<typename Dtype>
+class CPUSync : public CPUParams<Dtype>,
+                public Solver<Dtype>::Callback,
+                public GradientBuckets<Dtype>,
+                public InternalThread {
+ public:
+  explicit CPUSync(shared_ptr<Solver<Dtype> > solver);
+  virtual ~CPUSync();
+
+  /**
+   * Copies the weights of rank 0 to the other replicas.
+   */
+  void Broadcast();
+
+  /**
+   * Trains Caffe::solver_count() replicas of solver, this one on the
+   * calling thread as rank 0. restore is the snapshot the other replicas
+   * resume from, if any.
+   */
+  void Run(const char* restore);
+
+  // The replicas by rank, the barrier their solver threads wait on
+  // between steps, and the one of their communication threads.
+  void set_replicas(vector<CPUSync<Dtype>*>* syncs, boost::barrier* barrier,
+                    boost::barrier* reduce_barrier);
+
+  /**
+   * Installs the callbacks on the solver and its net, and starts the
+   * communication thread with layer_wise_reduce.
+   */
+  void Attach();
+
+ protected:
+  void on_start() {}
+  void on_gradients_ready();
+  void bucket_ready(int bucket);
+  // The communication thread.
+  void InternalThreadEntry();
+  // Averages [offset, offset + count) of the diff buffers of all replicas.
+  void RingAllreduce(size_t offset, size_t count, boost::barrier* barrier);
+
+  shared_ptr<Solver<Dtype> > solver_;
+  int rank_;
+  vector<CPUSync<Dtype>*>* syncs_;
+  boost::barrier* barrier_;
+  boost::barrier* reduce_barrier_;
+  // buckets to reduce, and reduced, by the communication thread
+  BlockingQueue<int> started_;
+  BlockingQueue<int> reduced_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+#ifdef USE_NCCL
+
 // Params stored in GPU memory.
 template<typename Dtype>
 class GPUParams : public Params<Dtype> {
@@ -66,7 +211,7 @@ class GPUParams : public Params<Dtype> {
 template<typename Dtype>
 class NCCL : public GPUParams<Dtype>,
              public Solver<Dtype>::Callback,
-             public Net<Dtype>::Callback {
+             public GradientBuckets<Dtype> {
  public:
   /**
    * Single process version.
@@ -103,7 +248,7 @@ class NCCL : public GPUParams<Dtype>,
  protected:
   void Init();
   void on_start() {}
-  void run(int layer);  // Net callback
+  void bucket_ready(int bucket);
   void on_gradients_ready();
 
   ncclComm_t comm_;
@@ -117,7 +262,8 @@ class NCCL : public GPUParams<Dtype>,
   using Params<Dtype>::diff_;
 };
 
+#endif  // USE_NCCL
+
 }  // namespace caffe
 
-#endif  // USE_NCCL
 #endif  // header
@@ -5,9 +5,31 @@
 #include <vector>
 
 #include "caffe/solver.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
+/**
+ * @brief What the fused update of a param needs of it, taken before the
+ *        pass splits over threads; see SGDSolver::FusedUpdate.
+ */
+template <typename Dtype>
+struct FusedUpdateParam {
+  Dtype* data;
+  Dtype* diff;
+  // 1 / iter_size, to counterbalance the accumulation as Normalize does
+  Dtype scale;
+  // the local weight decay, L1 if l1 and L2 otherwise
+  Dtype decay;
+  bool l1;
+
+  // The normalized and regularized gradient of element i.
+  inline Dtype gradient(int i) const {
+    const Dtype w = data[i];
+    return diff[i] * scale + decay * (l1 ? Dtype(caffe_sign(w)) : w);
+  }
+};
+
 /**
  * @brief Optimizes the parameters of a Net using
  *        stochastic gradient descent (SGD) with momentum.
@@ -25,12 +47,23 @@ class SGDSolver : public Solver<Dtype> {
 
  protected:
   void PreSolve();
+  void ContiguousHistory();
   Dtype GetLearningRate();
   virtual void ApplyUpdate();
   virtual void Normalize(int param_id);
   virtual void Regularize(int param_id);
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
   virtual void ClipGradients();
+  // With fused_update in CPU mode, does the work of Normalize, Regularize,
+  // ComputeUpdateValue and Net::Update for all params in a single pass over
+  // their data, diffs and history, split over the intra-op threads.
+  void FusedUpdate(Dtype rate);
+  void FusedUpdateBlock(Dtype rate, int begin, int end);
+  // Updates elements [begin, end) of a param in the fused pass: computes the
+  // update from the gradient of fused_params_, and the history, leaves it in
+  // the diff as ComputeUpdateValue does and subtracts it from the data.
+  virtual void ComputeUpdateValueFused(int param_id, Dtype rate, int begin,
+      int end);
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
   virtual void SnapshotSolverStateToHDF5(const string& model_filename);
@@ -41,6 +74,13 @@ class SGDSolver : public Solver<Dtype> {
   // temp maintains other information that might be needed in computation
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
+  // holds history_ with contiguous_params
+  shared_ptr<Blob<Dtype> > history_arena_;
+  // The params and the CPU history of the fused pass, and the offsets of
+  // the params in the range of elements it splits over threads.
+  vector<FusedUpdateParam<Dtype> > fused_params_;
+  vector<Dtype*> fused_history_;
+  vector<int> fused_offsets_;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -56,6 +96,8 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeUpdateValueFused(int param_id, Dtype rate, int begin,
+      int end);
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -71,6 +113,8 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeUpdateValueFused(int param_id, Dtype rate, int begin,
+      int end);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -91,6 +135,8 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeUpdateValueFused(int param_id, Dtype rate, int begin,
+      int end);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -115,6 +161,8 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeUpdateValueFused(int param_id, Dtype rate, int begin,
+      int end);
 
   DISABLE_COPY_AND_ASSIGN(AdaDeltaSolver);
 };
@@ -139,6 +187,8 @@ class AdamSolver : public SGDSolver<Dtype> {
  protected:
   void AdamPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeUpdateValueFused(int param_id, Dtype rate, int begin,
+      int end);
 
   DISABLE_COPY_AND_ASSIGN(AdamSolver);
 };
@@ -8,6 +8,7 @@
 #endif
 
 #include "caffe/common.hpp"
+#include "caffe/util/memory_pool.hpp"
 
 namespace caffe {
 
@@ -16,24 +17,42 @@ namespace caffe {
 // The improvement in performance seems negligible in the single GPU case,
 // but might be more significant for parallel training. Most importantly,
 // it improved stability for large models on many GPUs.
-inline void CaffeMallocHost(void** ptr, size_t size, bool* use_cuda) {
+// While MemoryPool::enabled(), the memory comes from a MemoryPool and
+// *pooled is set; it goes back to the pool in CaffeFreeHost.
+inline void CaffeMallocHost(void** ptr, size_t size, bool* use_cuda,
+    bool* pooled) {
+  *pooled = MemoryPool::enabled();
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
-    CUDA_CHECK(cudaMallocHost(ptr, size));
+    if (*pooled) {
+      *ptr = MemoryPool::Get(MemoryPool::PINNED_HOST).Allocate(size);
+    } else {
+      CUDA_CHECK(cudaMallocHost(ptr, size));
+    }
     *use_cuda = true;
     return;
   }
 #endif
+  *use_cuda = false;
+  if (*pooled) {
+    *ptr = MemoryPool::Get(MemoryPool::HOST).Allocate(size);
+    return;
+  }
 #ifdef USE_MKL
   *ptr = mkl_malloc(size ? size:1, 64);
 #else
   *ptr = malloc(size);
 #endif
-  *use_cuda = false;
   CHECK(*ptr) << "host allocation of size " << size << " failed";
 }
 
-inline void CaffeFreeHost(void* ptr, bool use_cuda) {
+inline void CaffeFreeHost(void* ptr, size_t size, bool use_cuda,
+    bool pooled) {
+  if (pooled) {
+    MemoryPool::Get(use_cuda ? MemoryPool::PINNED_HOST : MemoryPool::HOST)
+        .Free(ptr, size);
+    return;
+  }
 #ifndef CPU_ONLY
   if (use_cuda) {
     CUDA_CHECK(cudaFreeHost(ptr));
@@ -47,12 +66,32 @@ inline void CaffeFreeHost(void* ptr, bool use_cuda) {
 #endif
 }
 
+#ifndef CPU_ONLY
+inline void CaffeMallocDevice(void** ptr, size_t size, bool* pooled) {
+  *pooled = MemoryPool::enabled();
+  if (*pooled) {
+    *ptr = MemoryPool::Get(MemoryPool::DEVICE).Allocate(size);
+  } else {
+    CUDA_CHECK(cudaMalloc(ptr, size));
+  }
+}
+
+inline void CaffeFreeDevice(void* ptr, size_t size, bool pooled) {
+  if (pooled) {
+    MemoryPool::Get(MemoryPool::DEVICE).Free(ptr, size);
+  } else {
+    CUDA_CHECK(cudaFree(ptr));
+  }
+}
+#endif
+
 
 /**
  * @brief Manages memory allocation and synchronization between the host (CPU)
  *        and device (GPU).
  *
- * TODO(dox): more thorough description.
+ * Memory holding floats may also be kept on the host in half precision
+ * (fp16) only, see store_half; it is converted back to float when read.
  */
 class SyncedMemory {
  public:
@@ -65,9 +104,24 @@ class SyncedMemory {
   void set_gpu_data(void* data);
   void* mutable_cpu_data();
   void* mutable_gpu_data();
-  enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
+  // HEAD_AT_HALF: the data is only on the host, in half precision
+  enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED,
+      HEAD_AT_HALF };
   SyncedHead head() { return head_; }
   size_t size() { return size_; }
+  // Changes whenever the data may have been written, by mutable_*_data or
+  // set_*_data, so that data derived from it can tell when it is stale.
+  size_t version() const { return version_; }
+  /**
+   * @brief Keeps the data, floats at the head on the host, in half precision
+   *        only and frees the float host memory, until it is read again.
+   *
+   * This halves the memory the data takes while not in use, at the cost of
+   * its precision. The half precision copy is kept along with the floats
+   * when they are read back, and only converted again once they have been
+   * written. Memory set by set_cpu_data is not owned and stays as it is.
+   */
+  void store_half();
 
 #ifndef CPU_ONLY
   void async_gpu_push(const cudaStream_t& stream);
@@ -80,11 +134,19 @@ class SyncedMemory {
   void to_gpu();
   void* cpu_ptr_;
   void* gpu_ptr_;
+  // size_ / 2 bytes for the half precision copy, current if half_synced_
+  void* half_ptr_;
   size_t size_;
   SyncedHead head_;
+  bool half_synced_;
+  bool half_malloc_use_cuda_;
+  bool half_pooled_;
   bool own_cpu_data_;
   bool cpu_malloc_use_cuda_;
+  bool cpu_pooled_;
   bool own_gpu_data_;
+  bool gpu_pooled_;
+  size_t version_;
   int device_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
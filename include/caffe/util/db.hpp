@@ -18,6 +18,13 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  /**
+   * Points data at the value in the memory of the database instead of
+   * copying it, and sets size. The value must stay there until the cursor
+   * is destroyed, even when it moves on; backends that can not keep it
+   * return false, and value() has to be used instead.
+   */
+  virtual bool value_view(const char** data, size_t* size) { return false; }
   virtual bool valid() = 0;
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
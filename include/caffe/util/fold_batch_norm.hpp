@@ -0,0 +1,33 @@
+#ifndef CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
+#define CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters with the BatchNorm, Scale and ReLU layers that follow a
+// Convolution or InnerProduct layer folded into it, for inference: BatchNorm
+// with its stored statistics and Scale into the weights and bias, and ReLU
+// into the relu option. A chain is folded when each of its layers is the
+// only reader of the output of the one before, in the order BatchNorm,
+// Scale, ReLU, any of them left out. Layers with trained blobs have them
+// folded too, so that the same call turns a trained net into its folded
+// counterpart. If folded_chains is given, it receives the names of the
+// layers folded into each layer, by the name of that layer.
+void FoldBatchNorm(const NetParameter& param, NetParameter* param_folded,
+    map<string, vector<string> >* folded_chains = NULL);
+
+// Folds the trained blobs of the chain of layers FoldBatchNorm folded into
+// layer_param, in their order, into the blobs of layer_param, whose
+// Convolution or InnerProduct parameters are already the folded ones.
+void FoldTrainedBlobs(const vector<LayerParameter>& chain,
+    LayerParameter* layer_param);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
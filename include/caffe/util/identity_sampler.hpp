@@ -0,0 +1,58 @@
+#ifndef CAFFE_UTIL_IDENTITY_SAMPLER_HPP_
+#define CAFFE_UTIL_IDENTITY_SAMPLER_HPP_
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Samples the batches of TripletImageDataLayer: pair_num different
+ *        identities, with pair_size different images of each of them.
+ *
+ * An epoch visits every identity once. A batch never spans two epochs, so
+ * the few identities left over at the end of an epoch wait for the next
+ * one. Likewise an identity goes through all its images before it repeats
+ * one, pair_size images per visit.
+ */
+class IdentitySampler {
+ public:
+  // Samples the identities of labels with at least pair_size images, given
+  // as ids by identity_images. With solver_count > 1 it keeps only identity
+  // i with i % solver_count == solver_rank, so that the solvers of data
+  // parallel training sample disjoint shares of the identities.
+  IdentitySampler(const vector<int>& labels,
+      const vector<vector<int> >& identity_images, int pair_size,
+      int solver_count, int solver_rank);
+
+  int num_identities() const { return labels_.size(); }
+  const vector<int>& labels() const { return labels_; }
+  const vector<vector<int> >& identity_images() const {
+    return identity_images_;
+  }
+  // the epochs started before the current one
+  int epoch() const { return epoch_; }
+
+  // Picks the batch_labels->size() identities of the next batch, and the
+  // pair_size images of each of them into batch_images, group by group.
+  // Identities and images are shuffled by rng, or taken in order if NULL.
+  void Sample(rng_t* rng, vector<int>* batch_labels,
+      vector<int>* batch_images);
+
+ protected:
+  int pair_size_;
+  vector<int> labels_;
+  vector<vector<int> > identity_images_;
+  // order of the identities in the current epoch, shuffled lazily up to
+  // identity_cursor_, and how far each identity went through its images
+  vector<int> identity_order_;
+  int identity_cursor_;
+  vector<int> image_cursor_;
+  int epoch_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IDENTITY_SAMPLER_HPP_
@@ -0,0 +1,86 @@
+#ifndef CAFFE_UTIL_IMAGE_SHARDS_HPP_
+#define CAFFE_UTIL_IMAGE_SHARDS_HPP_
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Packs encoded images into shard files, the images of an identity
+ *        next to each other in one shard, and writes the ImageShardIndex
+ *        that locates them. See tools/convert_imageshards.
+ */
+class ImageShardWriter {
+ public:
+  // Writes prefix_00000.shard, prefix_00001.shard, ... and prefix.index. A
+  // new shard is started at an identity once the current one holds
+  // shard_limit bytes or more.
+  ImageShardWriter(const string& prefix, size_t shard_limit);
+
+  // Starts the images of identity label.
+  void AddIdentity(int label);
+  // Appends the encoded image data to the identity started last.
+  void AddImage(const string& data);
+  // Closes the last shard and writes the index.
+  void Finish();
+
+  const ImageShardIndex& index() const { return index_; }
+
+ protected:
+  void CloseShard();
+
+  string prefix_;
+  size_t shard_limit_;
+  ImageShardIndex index_;
+  std::ofstream shard_;
+  size_t shard_bytes_;
+
+DISABLE_COPY_AND_ASSIGN(ImageShardWriter);
+};
+
+/**
+ * @brief Memory-maps the shards of an ImageShardIndex, and locates every
+ *        encoded image in them. Images are numbered in the order of the
+ *        index, identity by identity.
+ */
+class ImageShards {
+ public:
+  // Maps the shards of index_file, which are named relative to it.
+  explicit ImageShards(const string& index_file);
+  ~ImageShards();
+
+  int num_images() const { return image_shard_.size(); }
+  // the label and the images of every identity
+  const vector<int>& labels() const { return labels_; }
+  const vector<vector<int> >& identity_images() const {
+    return identity_images_;
+  }
+  // the encoded data of image id, its size and where it lies
+  const char* image_data(int id) const {
+    return shard_data_[image_shard_[id]] + image_offset_[id];
+  }
+  int image_size(int id) const { return image_size_[id]; }
+  int image_shard(int id) const { return image_shard_[id]; }
+  size_t image_offset(int id) const { return image_offset_[id]; }
+
+ protected:
+  // the mapped shard files, NULL for empty ones
+  vector<const char*> shard_data_;
+  vector<size_t> shard_size_;
+  vector<int> labels_;
+  vector<vector<int> > identity_images_;
+  vector<int> image_shard_;
+  vector<size_t> image_offset_;
+  vector<int> image_size_;
+
+DISABLE_COPY_AND_ASSIGN(ImageShards);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_SHARDS_HPP_
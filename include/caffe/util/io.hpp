@@ -129,6 +129,14 @@ inline bool ReadImageToDatum(const string& filename, const int label,
 bool DecodeDatumNative(Datum* datum);
 bool DecodeDatum(Datum* datum, bool is_color);
 
+/**
+ * @brief Parses a serialized Datum without copying its data field: the
+ * field is left empty, and data and data_size point at its bytes inside
+ * buffer, for as long as buffer lives.
+ */
+bool ParseDatumAliasing(const char* buffer, size_t size, Datum* datum,
+    const char** data, size_t* data_size);
+
 #ifdef USE_OPENCV
 cv::Mat ReadImageToCVMat(const string& filename,
     const int height, const int width, const bool is_color);
@@ -141,8 +149,18 @@ cv::Mat ReadImageToCVMat(const string& filename,
 
 cv::Mat ReadImageToCVMat(const string& filename);
 
+// Decodes an encoded image held in memory, e.g. in a mapped file.
+cv::Mat DecodeImageToCVMat(const char* data, const size_t size,
+    const int height, const int width, const bool is_color);
+
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum);
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color);
+// The same for a Datum parsed by ParseDatumAliasing, whose encoded image is
+// the size bytes at data.
+cv::Mat DecodeDatumToCVMatNative(const Datum& datum, const char* data,
+    size_t size);
+cv::Mat DecodeDatumToCVMat(const Datum& datum, const char* data,
+    size_t size, bool is_color);
 
 void CVMatToDatum(const cv::Mat& cv_img, Datum* datum);
 #endif  // USE_OPENCV
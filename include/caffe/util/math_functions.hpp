@@ -2,6 +2,7 @@
 #define CAFFE_UTIL_MATH_FUNCTIONS_H_
 
 #include <stdint.h>
+#include <algorithm>  // for std::max
 #include <cmath>  // for std::fabs and std::signbit
 
 #include "glog/logging.h"
@@ -139,9 +140,43 @@ DEFINE_CAFFE_CPU_UNARY_FUNC(sgnbit, \
 
 DEFINE_CAFFE_CPU_UNARY_FUNC(fabs, y[i] = std::fabs(x[i]));
 
+DEFINE_CAFFE_CPU_UNARY_FUNC(relu, y[i] = std::max(x[i], Dtype(0)));
+
 template <typename Dtype>
 void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+// Quantizes x to int8: y = round(scale * x), saturated to [-127, 127].
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype scale, const Dtype* x,
+    int8_t* y);
+
+// B (K x N) packed for caffe_cpu_gemm_int8, in
+// caffe_cpu_packed_int8_size(N, K) bytes: with AVX2, in panels of 16
+// columns with the values of each 4 rows of a column adjacent and 0 past N
+// and K; as it is otherwise. The layout depends on the CPU, so packed B is
+// not to be stored.
+int caffe_cpu_packed_int8_size(const int N, const int K);
+void caffe_cpu_pack_int8(const int N, const int K, const int8_t* B,
+    int8_t* packed);
+void caffe_cpu_unpack_int8(const int N, const int K, const int8_t* packed,
+    int8_t* B);
+
+// C = A * B for row-major int8 A (M x K) and B (K x N), packed by
+// caffe_cpu_pack_int8 if B_packed, with the products summed in int32 and
+// scaled by row_scale[i] and col_scale[j], each 1 if NULL. Split over the
+// intra-op threads; 32 products at a time by pmaddubsw if the CPU has AVX2,
+// as checked at run time whatever the build flags.
+template <typename Dtype>
+void caffe_cpu_gemm_int8(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, const bool B_packed,
+    const Dtype* row_scale, const Dtype* col_scale, Dtype* C);
+
+// Converts between float and IEEE half precision (fp16) bits, rounding to
+// nearest even; eight values at a time by F16C if the CPU has it, as checked
+// at run time whatever the build flags.
+void caffe_cpu_float2half(const int n, const float* x, uint16_t* y);
+void caffe_cpu_half2float(const int n, const uint16_t* x, float* y);
+
 #ifndef CPU_ONLY  // GPU
 
 // Decaf gpu gemm provides an interface that is almost the same as the cpu
@@ -248,6 +283,9 @@ void caffe_gpu_sgnbit(const int n, const Dtype* x, Dtype* y);
 template <typename Dtype>
 void caffe_gpu_fabs(const int n, const Dtype* x, Dtype* y);
 
+template <typename Dtype>
+void caffe_gpu_relu(const int n, const Dtype* x, Dtype* y);
+
 template <typename Dtype>
 void caffe_gpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
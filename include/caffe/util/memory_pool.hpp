@@ -0,0 +1,75 @@
+#ifndef CAFFE_UTIL_MEMORY_POOL_HPP_
+#define CAFFE_UTIL_MEMORY_POOL_HPP_
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A caching allocator for the host and device memory of SyncedMemory.
+ *
+ * Sizes are rounded up to size classes, four per power of two, and freed
+ * blocks are kept on free lists of their class for the next allocation of
+ * that class instead of going back to the system. Every thread first uses
+ * its own free lists, which hold up to kThreadCacheBytes, and then the
+ * lists shared by all threads. Trim() returns all cached blocks to the
+ * system; it is also called when the system is out of memory.
+ *
+ * SyncedMemory allocates from the pools only while enabled() is true; each
+ * allocation remembers where it came from, so this may change at any time.
+ */
+class MemoryPool {
+ public:
+  enum Kind { HOST, PINNED_HOST, DEVICE };
+
+  struct Stats {
+    // bytes obtained from the system, in use or cached
+    size_t reserved;
+    // high watermark of reserved
+    size_t peak_reserved;
+    // bytes on the free lists
+    size_t cached;
+    // allocations served from the free lists, and from the system
+    uint64_t hits;
+    uint64_t misses;
+  };
+
+  // The bytes a thread keeps on its own free lists of each pool.
+  static const size_t kThreadCacheBytes = 64 << 20;
+
+  /// @brief A pool on its own, allocating memory of the given kind.
+  explicit MemoryPool(Kind kind);
+  /// @brief Frees the cached blocks; no thread may use the pool anymore.
+  ~MemoryPool();
+
+  /// @brief The process-wide pool of the given kind. For DEVICE, the pool
+  ///        of the current device.
+  static MemoryPool& Get(Kind kind);
+  static bool enabled();
+  static void set_enabled(bool enabled);
+  /// @brief The size of the class size falls in.
+  static size_t ClassSize(size_t size);
+
+  void* Allocate(size_t size);
+  /// @brief Takes back ptr, from Allocate(size) of this pool.
+  void Free(void* ptr, size_t size);
+  void Trim();
+  Stats stats();
+
+ protected:
+  /**
+   Move synchronization fields and the thread-local free lists out instead
+   of including boost/thread.hpp to avoid a boost/NVCC issues (#1009, #1010),
+   as in BlockingQueue.
+   */
+  class sync;
+
+  Kind kind_;
+  shared_ptr<sync> sync_;
+
+DISABLE_COPY_AND_ASSIGN(MemoryPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MEMORY_POOL_HPP_
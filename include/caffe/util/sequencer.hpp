@@ -0,0 +1,42 @@
+#ifndef CAFFE_UTIL_SEQUENCER_HPP_
+#define CAFFE_UTIL_SEQUENCER_HPP_
+
+#include <stdint.h>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Lets threads take turns in a fixed order.
+ *
+ * Turns are numbered from 0. Wait(seq) blocks until turns 0 to seq - 1 are
+ * done, and Done(seq) ends turn seq, so a thread that owns a turn runs its
+ * section after all the earlier ones and before all the later ones.
+ */
+class Sequencer {
+ public:
+  Sequencer();
+
+  void Wait(uint64_t seq);
+  // Ends turn seq; does nothing if it has already ended.
+  void Done(uint64_t seq);
+
+  uint64_t next() const;
+
+ protected:
+  /**
+   Move synchronization fields out instead of including boost/thread.hpp
+   to avoid a boost/NVCC issues (#1009, #1010), as in BlockingQueue.
+   */
+  class sync;
+
+  shared_ptr<sync> sync_;
+  uint64_t next_;
+
+DISABLE_COPY_AND_ASSIGN(Sequencer);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SEQUENCER_HPP_
@@ -0,0 +1,51 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <boost/function.hpp>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace boost { class thread; }
+
+namespace caffe {
+
+/**
+ * @brief A fixed set of worker threads that run one task at a time.
+ *
+ * Run(task) calls task(thread_id) once on every worker, with thread_id in
+ * [0, size()), and returns when all of them are done. The task splits the
+ * work by thread_id, so which thread handles which item is fixed. Run may
+ * be called from several threads; their tasks run one after the other.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  int size() const { return threads_.size(); }
+  void Run(const boost::function<void(int)>& task);
+
+ protected:
+  void entry(int thread_id);
+
+  /**
+   Move synchronization fields out instead of including boost/thread.hpp
+   to avoid a boost/NVCC issues (#1009, #1010), as in BlockingQueue.
+   */
+  class sync;
+
+  vector<shared_ptr<boost::thread> > threads_;
+  shared_ptr<sync> sync_;
+  boost::function<void(int)> task_;
+  // incremented by every Run, so each worker runs a task only once
+  int generation_;
+  int pending_;
+  bool stop_;
+
+DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
@@ -328,7 +328,7 @@ void Net_add_nccl(Net<Dtype>* net
 #endif
 ) {
 #ifdef USE_NCCL
-  net->add_after_backward(nccl);
+  net->add_params_ready(nccl);
 #endif
 }
 #ifndef USE_NCCL
@@ -1,11 +1,14 @@
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <glog/logging.h>
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <ctime>
 
 #include "caffe/common.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -49,11 +52,53 @@ void GlobalInit(int* pargc, char*** pargv) {
   ::google::InstallFailureSignalHandler();
 }
 
+const int Caffe::kParallelGrain;
+
+void Caffe::set_intra_op_threads(int val) {
+  CHECK_GE(val, 1) << "intra_op_threads must be positive";
+  Get().intra_op_threads_ = val;
+}
+
+// Runs block thread_id of the blocks parallel_for split [0, size) into.
+static void run_parallel_block(const boost::function<void(int, int)>& body,
+    int size, int blocks, int thread_id) {
+  if (thread_id >= blocks) {
+    return;
+  }
+  const int begin = static_cast<int64_t>(size) * thread_id / blocks;
+  const int end = static_cast<int64_t>(size) * (thread_id + 1) / blocks;
+  body(begin, end);
+}
+
+void Caffe::parallel_for(int size, int grain,
+    const boost::function<void(int, int)>& body) {
+  if (size <= 0) {
+    return;
+  }
+  Caffe& caffe = Get();
+  const int blocks = std::min(caffe.intra_op_threads_,
+      size / std::max(grain, 1));
+  if (blocks <= 1) {
+    body(0, size);
+    return;
+  }
+  // The pool only grows: nets and the solver may ask for fewer threads than
+  // the largest count so far, and the workers past blocks have nothing to
+  // do, rather than have the pool joined and spawned again.
+  if (!caffe.intra_op_pool_ ||
+      caffe.intra_op_pool_->size() < caffe.intra_op_threads_) {
+    caffe.intra_op_pool_.reset(new ThreadPool(caffe.intra_op_threads_));
+  }
+  caffe.intra_op_pool_->Run(
+      boost::bind(&run_parallel_block, boost::cref(body), size, blocks, _1));
+}
+
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
     : random_generator_(), mode_(Caffe::CPU),
-      solver_count_(1), solver_rank_(0), multiprocess_(false) { }
+      solver_count_(1), solver_rank_(0), multiprocess_(false),
+      intra_op_threads_(1) { }
 
 Caffe::~Caffe() { }
 
@@ -107,7 +152,8 @@ void* Caffe::RNG::generator() {
 Caffe::Caffe()
     : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
     mode_(Caffe::CPU),
-    solver_count_(1), solver_rank_(0), multiprocess_(false) {
+    solver_count_(1), solver_rank_(0), multiprocess_(false),
+    intra_op_threads_(1) {
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
   if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
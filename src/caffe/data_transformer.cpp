@@ -1,6 +1,10 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 #endif  // USE_OPENCV
+#include <stdint.h>
 
 #include <string>
 #include <vector>
@@ -38,10 +42,91 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
   }
 }
 
+// Vectorized part of transform_row() for bytes to float: converts the
+// first width / 16 * 16 pixels and returns how many. Does nothing for the
+// other types.
+template <bool kMirror, typename Src, typename Dtype>
+static int transform_row_simd(const Src* src, const Dtype* mean,
+    Dtype mean_value, Dtype scale, int width, Dtype* out) {
+  return 0;
+}
+
+#ifdef __SSE2__
+template <bool kMirror>
+static int transform_row_simd(const uint8_t* src, const float* mean,
+    float mean_value, float scale, int width, float* out) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 scale4 = _mm_set1_ps(scale);
+  const __m128 mean4 = _mm_set1_ps(mean_value);
+  int w = 0;
+  for (; w + 16 <= width; w += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + w));
+    const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    __m128 x[4];
+    x[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+    x[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+    x[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+    x[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+    for (int k = 0; k < 4; ++k) {
+      const __m128 m = mean ? _mm_loadu_ps(mean + w + 4 * k) : mean4;
+      const __m128 y = _mm_mul_ps(_mm_sub_ps(x[k], m), scale4);
+      if (kMirror) {
+        _mm_storeu_ps(out + width - w - 4 * k - 4,
+            _mm_shuffle_ps(y, y, _MM_SHUFFLE(0, 1, 2, 3)));
+      } else {
+        _mm_storeu_ps(out + w + 4 * k, y);
+      }
+    }
+  }
+  return w;
+}
+#endif  // __SSE2__
+
+// (src - mean) * scale for a row of width pixels, written backwards with
+// kMirror. mean is the row of the mean file, or NULL to subtract
+// mean_value.
+template <bool kMirror, typename Src, typename Dtype>
+static void transform_row(const Src* src, const Dtype* mean, Dtype mean_value,
+    Dtype scale, int width, Dtype* out) {
+  int w = transform_row_simd<kMirror>(src, mean, mean_value, scale, width,
+      out);
+  if (mean) {
+    for (; w < width; ++w) {
+      out[kMirror ? width - 1 - w : w] =
+          (static_cast<Dtype>(src[w]) - mean[w]) * scale;
+    }
+  } else {
+    for (; w < width; ++w) {
+      out[kMirror ? width - 1 - w : w] =
+          (static_cast<Dtype>(src[w]) - mean_value) * scale;
+    }
+  }
+}
+
+// Crops the height x width window at (h_off, w_off) out of every channel
+// of the datum_height x datum_width src.
+template <bool kMirror, typename Src, typename Dtype>
+static void transform_channels(const Src* src, int channels,
+    int datum_height, int datum_width, int height, int width, int h_off,
+    int w_off, const Dtype* mean, const vector<Dtype>& mean_values,
+    Dtype scale, Dtype* transformed_data) {
+  for (int c = 0; c < channels; ++c) {
+    const Dtype mean_value = mean_values.size() ? mean_values[c] : Dtype(0);
+    for (int h = 0; h < height; ++h) {
+      const int data_index = (c * datum_height + h_off + h) * datum_width
+          + w_off;
+      transform_row<kMirror>(src + data_index,
+          mean ? mean + data_index : NULL, mean_value, scale, width,
+          transformed_data + (c * height + h) * width);
+    }
+  }
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
-                                       Dtype* transformed_data) {
-  const string& data = datum.data();
+    const char* data, size_t size, Dtype* transformed_data) {
   const int datum_channels = datum.channels();
   const int datum_height = datum.height();
   const int datum_width = datum.width();
@@ -50,19 +135,19 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   const Dtype scale = param_.scale();
   const bool do_mirror = param_.mirror() && Rand(2);
   const bool has_mean_file = param_.has_mean_file();
-  const bool has_uint8 = data.size() > 0;
+  const bool has_uint8 = size > 0;
   const bool has_mean_values = mean_values_.size() > 0;
 
   CHECK_GT(datum_channels, 0);
   CHECK_GE(datum_height, crop_size);
   CHECK_GE(datum_width, crop_size);
 
-  Dtype* mean = NULL;
+  const Dtype* mean = NULL;
   if (has_mean_file) {
     CHECK_EQ(datum_channels, data_mean_.channels());
     CHECK_EQ(datum_height, data_mean_.height());
     CHECK_EQ(datum_width, data_mean_.width());
-    mean = data_mean_.mutable_cpu_data();
+    mean = data_mean_.cpu_data();
   }
   if (has_mean_values) {
     CHECK(mean_values_.size() == 1 || mean_values_.size() == datum_channels) <<
@@ -93,35 +178,29 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     }
   }
 
-  Dtype datum_element;
-  int top_index, data_index;
-  for (int c = 0; c < datum_channels; ++c) {
-    for (int h = 0; h < height; ++h) {
-      for (int w = 0; w < width; ++w) {
-        data_index = (c * datum_height + h_off + h) * datum_width + w_off + w;
-        if (do_mirror) {
-          top_index = (c * height + h) * width + (width - 1 - w);
-        } else {
-          top_index = (c * height + h) * width + w;
-        }
-        if (has_uint8) {
-          datum_element =
-            static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-        } else {
-          datum_element = datum.float_data(data_index);
-        }
-        if (has_mean_file) {
-          transformed_data[top_index] =
-            (datum_element - mean[data_index]) * scale;
-        } else {
-          if (has_mean_values) {
-            transformed_data[top_index] =
-              (datum_element - mean_values_[c]) * scale;
-          } else {
-            transformed_data[top_index] = datum_element * scale;
-          }
-        }
-      }
+  // Select the kernel for the source type and the mirroring once, instead
+  // of for every element.
+  if (has_uint8) {
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+    if (do_mirror) {
+      transform_channels<true>(src, datum_channels, datum_height,
+          datum_width, height, width, h_off, w_off, mean, mean_values_,
+          scale, transformed_data);
+    } else {
+      transform_channels<false>(src, datum_channels, datum_height,
+          datum_width, height, width, h_off, w_off, mean, mean_values_,
+          scale, transformed_data);
+    }
+  } else {
+    const float* src = datum.float_data().data();
+    if (do_mirror) {
+      transform_channels<true>(src, datum_channels, datum_height,
+          datum_width, height, width, h_off, w_off, mean, mean_values_,
+          scale, transformed_data);
+    } else {
+      transform_channels<false>(src, datum_channels, datum_height,
+          datum_width, height, width, h_off, w_off, mean, mean_values_,
+          scale, transformed_data);
     }
   }
 }
@@ -130,6 +209,13 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
                                        Blob<Dtype>* transformed_blob) {
+  Transform(datum, datum.data().data(), datum.data().size(),
+      transformed_blob);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const Datum& datum,
+    const char* data, size_t size, Blob<Dtype>* transformed_blob) {
   // If datum is encoded, decode and transform the cv::image.
   if (datum.encoded()) {
 #ifdef USE_OPENCV
@@ -138,9 +224,9 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     cv::Mat cv_img;
     if (param_.force_color() || param_.force_gray()) {
     // If force_color then decode in color otherwise decode in gray.
-      cv_img = DecodeDatumToCVMat(datum, param_.force_color());
+      cv_img = DecodeDatumToCVMat(datum, data, size, param_.force_color());
     } else {
-      cv_img = DecodeDatumToCVMatNative(datum);
+      cv_img = DecodeDatumToCVMatNative(datum, data, size);
     }
     // Transform the cv::image into blob.
     return Transform(cv_img, transformed_blob);
@@ -178,7 +264,7 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   }
 
   Dtype* transformed_data = transformed_blob->mutable_cpu_data();
-  Transform(datum, transformed_data);
+  Transform(datum, data, size, transformed_data);
 }
 
 template<typename Dtype>
@@ -440,6 +526,12 @@ void DataTransformer<Dtype>::Transform(Blob<Dtype>* input_blob,
 
 template<typename Dtype>
 vector<int> DataTransformer<Dtype>::InferBlobShape(const Datum& datum) {
+  return InferBlobShape(datum, datum.data().data(), datum.data().size());
+}
+
+template<typename Dtype>
+vector<int> DataTransformer<Dtype>::InferBlobShape(const Datum& datum,
+    const char* data, size_t size) {
   if (datum.encoded()) {
 #ifdef USE_OPENCV
     CHECK(!(param_.force_color() && param_.force_gray()))
@@ -447,9 +539,9 @@ vector<int> DataTransformer<Dtype>::InferBlobShape(const Datum& datum) {
     cv::Mat cv_img;
     if (param_.force_color() || param_.force_gray()) {
     // If force_color then decode in color otherwise decode in gray.
-      cv_img = DecodeDatumToCVMat(datum, param_.force_color());
+      cv_img = DecodeDatumToCVMat(datum, data, size, param_.force_color());
     } else {
-      cv_img = DecodeDatumToCVMatNative(datum);
+      cv_img = DecodeDatumToCVMatNative(datum, data, size);
     }
     // InferBlobShape using the cv::image.
     return InferBlobShape(cv_img);
@@ -531,6 +623,17 @@ void DataTransformer<Dtype>::InitRand() {
   }
 }
 
+template <typename Dtype>
+void DataTransformer<Dtype>::InitRand(unsigned int seed) {
+  const bool needs_rand = param_.mirror() ||
+      (phase_ == TRAIN && param_.crop_size());
+  if (needs_rand) {
+    rng_.reset(new Caffe::RNG(seed));
+  } else {
+    rng_.reset();
+  }
+}
+
 template <typename Dtype>
 int DataTransformer<Dtype>::Rand(int n) {
   CHECK(rng_);
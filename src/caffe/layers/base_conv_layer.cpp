@@ -139,6 +139,7 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     weight_shape.push_back(kernel_shape_data[i]);
   }
   bias_term_ = this->layer_param_.convolution_param().bias_term();
+  relu_ = this->layer_param_.convolution_param().relu();
   vector<int> bias_shape(bias_term_, num_output_);
   if (this->blobs_.size() > 0) {
     CHECK_EQ(1 + bias_term_, this->blobs_.size())
@@ -239,6 +240,25 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     }
   }
   col_buffer_.Reshape(col_buffer_shape_);
+  // Lower as many images at once as fit in batch_col_buffer_mb, counting
+  // the column buffer and the output buffer they are multiplied into.
+  forward_batch_ = 1;
+  const size_t batch_bytes = static_cast<size_t>(
+      this->layer_param_.convolution_param().batch_col_buffer_mb()) << 20;
+  if (batch_bytes > 0 && !reverse_dimensions() &&
+      (is_1x1_ || (!force_nd_im2col_ && num_spatial_axes_ == 2))) {
+    const size_t image_bytes = sizeof(Dtype) * conv_out_spatial_dim_ *
+        (kernel_dim_ * group_ + conv_out_channels_);
+    forward_batch_ = std::max<size_t>(1, std::min<size_t>(num_,
+        batch_bytes / image_bytes));
+  }
+  if (forward_batch_ > 1) {
+    vector<int> batch_shape(2, forward_batch_ * conv_out_spatial_dim_);
+    batch_shape[0] = kernel_dim_ * group_;
+    batch_col_buffer_.Reshape(batch_shape);
+    batch_shape[0] = conv_out_channels_;
+    batch_output_.Reshape(batch_shape);
+  }
   bottom_dim_ = bottom[0]->count(channel_axis_);
   top_dim_ = top[0]->count(channel_axis_);
   num_kernels_im2col_ = conv_in_channels_ * conv_out_spatial_dim_;
@@ -271,6 +291,47 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
   }
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_batch(const Dtype* input,
+    const int batch, const Dtype* weights, Dtype* output) {
+  // Image n takes the columns [n * spatial_dim, (n + 1) * spatial_dim) of
+  // every row of the buffers.
+  const int spatial_dim = conv_out_spatial_dim_;
+  const int cols = batch * spatial_dim;
+  Dtype* col_buff = batch_col_buffer_.mutable_cpu_data();
+  for (int n = 0; n < batch; ++n) {
+    const Dtype* image = input + n * bottom_dim_;
+    if (is_1x1_) {
+      for (int c = 0; c < conv_in_channels_; ++c) {
+        caffe_copy(spatial_dim, image + c * spatial_dim,
+            col_buff + c * cols + n * spatial_dim);
+      }
+    } else {
+      im2col_cpu(image, conv_in_channels_,
+          conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+          kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+          pad_.cpu_data()[0], pad_.cpu_data()[1],
+          stride_.cpu_data()[0], stride_.cpu_data()[1],
+          dilation_.cpu_data()[0], dilation_.cpu_data()[1],
+          col_buff + n * spatial_dim, cols);
+    }
+  }
+  Dtype* out_buff = batch_output_.mutable_cpu_data();
+  const int group_out_channels = conv_out_channels_ / group_;
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, group_out_channels,
+        cols, kernel_dim_, (Dtype)1., weights + weight_offset_ * g,
+        col_buff + kernel_dim_ * cols * g, (Dtype)0.,
+        out_buff + group_out_channels * cols * g);
+  }
+  for (int n = 0; n < batch; ++n) {
+    for (int c = 0; c < conv_out_channels_; ++c) {
+      caffe_copy(spatial_dim, out_buff + c * cols + n * spatial_dim,
+          output + n * top_dim_ + c * spatial_dim);
+    }
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
     const Dtype* bias) {
@@ -32,12 +32,31 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   DataLayerSetUp(bottom, top);
 }
 
+// Runs one of the prefetch threads after the first.
+template <typename Dtype>
+class BasePrefetchingDataLayer<Dtype>::PrefetchThread : public InternalThread {
+ public:
+  PrefetchThread(BasePrefetchingDataLayer<Dtype>* layer, int thread_id)
+      : layer_(layer), thread_id_(thread_id) {}
+
+ protected:
+  virtual void InternalThreadEntry() {
+    layer_->Prefetch(thread_id_);
+  }
+
+  BasePrefetchingDataLayer<Dtype>* layer_;
+  int thread_id_;
+};
+
 template <typename Dtype>
 BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
     const LayerParameter& param)
     : BaseDataLayer<Dtype>(param),
       prefetch_(param.data_param().prefetch()),
-      prefetch_free_(), prefetch_full_(), prefetch_current_() {
+      prefetch_free_(), prefetch_full_(), prefetch_current_(),
+      prefetch_seq_(param.data_param().prefetch_threads()),
+      ordered_prefetch_(param.data_param().ordered_prefetch()) {
+  CHECK_GT(prefetch_seq_.size(), 0) << "Need at least one prefetch thread.";
   for (int i = 0; i < prefetch_.size(); ++i) {
     prefetch_[i].reset(new Batch<Dtype>());
     prefetch_free_.push(prefetch_[i].get());
@@ -71,12 +90,43 @@ void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
 #endif
   DLOG(INFO) << "Initializing prefetch";
   this->data_transformer_->InitRand();
+  for (int i = 1; i < prefetch_threads(); ++i) {
+    prefetch_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+    prefetch_transformers_.back()->InitRand();
+    prefetch_transformed_data_.push_back(
+        shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    prefetch_transformed_data_.back()->ReshapeLike(transformed_data_);
+    prefetch_threads_.push_back(
+        shared_ptr<PrefetchThread>(new PrefetchThread(this, i)));
+  }
+  if (prefetch_threads() > 1) {
+    LOG_IF(INFO, Caffe::root_solver()) << "Prefetching with "
+        << prefetch_threads() << " threads"
+        << (ordered_prefetch_ ? ", in order" : "");
+  }
   StartInternalThread();
+  for (int i = 0; i < prefetch_threads_.size(); ++i) {
+    prefetch_threads_[i]->StartInternalThread();
+  }
   DLOG(INFO) << "Prefetch initialized.";
 }
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::StopInternalThread() {
+  for (int i = 0; i < prefetch_threads_.size(); ++i) {
+    prefetch_threads_[i]->StopInternalThread();
+  }
+  InternalThread::StopInternalThread();
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
+  Prefetch(0);
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::Prefetch(int thread_id) {
 #ifndef CPU_ONLY
   cudaStream_t stream;
   if (Caffe::mode() == Caffe::GPU) {
@@ -85,9 +135,16 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
 #endif
 
   try {
-    while (!must_stop()) {
+    for (uint64_t seq = thread_id;
+         !boost::this_thread::interruption_requested();
+         seq += prefetch_threads()) {
+      read_turn_.Wait(seq);
+      // take the free batch in turn too, so that the earlier batches get
+      // theirs first
       Batch<Dtype>* batch = prefetch_free_.pop();
-      load_batch(batch);
+      prefetch_seq_[thread_id] = seq;
+      load_batch(batch, thread_id);
+      ReadDone(thread_id);
 #ifndef CPU_ONLY
       if (Caffe::mode() == Caffe::GPU) {
         batch->data_.data().get()->async_gpu_push(stream);
@@ -97,7 +154,13 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
         CUDA_CHECK(cudaStreamSynchronize(stream));
       }
 #endif
+      if (ordered_prefetch_) {
+        push_turn_.Wait(seq);
+      }
       prefetch_full_.push(batch);
+      if (ordered_prefetch_) {
+        push_turn_.Done(seq);
+      }
     }
   } catch (boost::thread_interrupted&) {
     // Interrupted exception is expected on shutdown
@@ -109,6 +172,25 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
 #endif
 }
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::ReadDone(int thread_id) {
+  read_turn_.Done(prefetch_seq_[thread_id]);
+}
+
+template <typename Dtype>
+DataTransformer<Dtype>* BasePrefetchingDataLayer<Dtype>::transformer(
+    int thread_id) {
+  return thread_id == 0 ? this->data_transformer_.get() :
+      prefetch_transformers_[thread_id - 1].get();
+}
+
+template <typename Dtype>
+Blob<Dtype>* BasePrefetchingDataLayer<Dtype>::transformed_data(
+    int thread_id) {
+  return thread_id == 0 ? &transformed_data_ :
+      prefetch_transformed_data_[thread_id - 1].get();
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
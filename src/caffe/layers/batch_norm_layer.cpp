@@ -1,3 +1,4 @@
+#include <boost/bind.hpp>
 #include <algorithm>
 #include <vector>
 
@@ -83,6 +84,101 @@ void BatchNormLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+// The passes of Forward_cpu and Backward_cpu over the (n, c) rows
+// [begin, end) of spatial_dim values, run in blocks on the intra-op
+// threads; the reductions over n between them stay on the calling thread.
+// ones is the spatial sum multiplier, and row_stats holds one value per row,
+// i.e. it is num_by_chans_.
+
+// row_stats = alpha * the sums of the rows of data
+template <typename Dtype>
+static void row_sums_cpu(int spatial_dim, Dtype alpha, const Dtype* data,
+    const Dtype* ones, Dtype* row_stats, int begin, int end) {
+  caffe_cpu_gemv<Dtype>(CblasNoTrans, end - begin, spatial_dim, alpha,
+      data + begin * spatial_dim, ones, 0., row_stats + begin);
+}
+
+// top = bottom - row_stats, and then if temp is given, temp = top^2 and
+// row_stats = alpha * the sums of the rows of temp
+template <typename Dtype>
+static void center_rows_cpu(int spatial_dim, Dtype alpha,
+    const Dtype* bottom_data, const Dtype* ones, Dtype* row_stats,
+    Dtype* top_data, Dtype* temp_data, int begin, int end) {
+  const int offset = begin * spatial_dim;
+  const int count = (end - begin) * spatial_dim;
+  if (bottom_data != top_data) {
+    caffe_copy(count, bottom_data + offset, top_data + offset);
+  }
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, end - begin,
+      spatial_dim, 1, -1, row_stats + begin, ones, 1., top_data + offset);
+  if (temp_data) {
+    caffe_powx(count, top_data + offset, Dtype(2), temp_data + offset);
+    row_sums_cpu(spatial_dim, alpha, temp_data, ones, row_stats, begin, end);
+  }
+}
+
+// temp = row_stats replicated over the rows, top /= temp, x_norm = top
+template <typename Dtype>
+static void normalize_rows_cpu(int spatial_dim, const Dtype* row_stats,
+    const Dtype* ones, Dtype* temp_data, Dtype* top_data, Dtype* x_norm_data,
+    int begin, int end) {
+  const int offset = begin * spatial_dim;
+  const int count = (end - begin) * spatial_dim;
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, end - begin,
+      spatial_dim, 1, 1., row_stats + begin, ones, 0., temp_data + offset);
+  caffe_div(count, top_data + offset, temp_data + offset, top_data + offset);
+  caffe_copy(count, top_data + offset, x_norm_data + offset);
+}
+
+// bottom_diff = top_data * top_diff, row_stats = the sums of its rows
+template <typename Dtype>
+static void dot_rows_cpu(int spatial_dim, const Dtype* top_data,
+    const Dtype* top_diff, const Dtype* ones, Dtype* row_stats,
+    Dtype* bottom_diff, int begin, int end) {
+  const int offset = begin * spatial_dim;
+  caffe_mul((end - begin) * spatial_dim, top_data + offset, top_diff + offset,
+      bottom_diff + offset);
+  row_sums_cpu(spatial_dim, Dtype(1), bottom_diff, ones, row_stats, begin,
+      end);
+}
+
+// bottom_diff = row_stats replicated over the rows * top_data, and
+// row_stats = the sums of the rows of top_diff
+template <typename Dtype>
+static void project_rows_cpu(int spatial_dim, const Dtype* top_data,
+    const Dtype* top_diff, const Dtype* ones, Dtype* row_stats,
+    Dtype* bottom_diff, int begin, int end) {
+  const int offset = begin * spatial_dim;
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, end - begin,
+      spatial_dim, 1, 1., row_stats + begin, ones, 0., bottom_diff + offset);
+  caffe_mul((end - begin) * spatial_dim, top_data + offset,
+      bottom_diff + offset, bottom_diff + offset);
+  row_sums_cpu(spatial_dim, Dtype(1), top_diff, ones, row_stats, begin, end);
+}
+
+// bottom_diff = (top_diff + alpha * (bottom_diff + row_stats replicated
+// over the rows)) / temp
+template <typename Dtype>
+static void finish_rows_cpu(int spatial_dim, Dtype alpha,
+    const Dtype* top_diff, const Dtype* ones, const Dtype* row_stats,
+    const Dtype* temp_data, Dtype* bottom_diff, int begin, int end) {
+  const int offset = begin * spatial_dim;
+  const int count = (end - begin) * spatial_dim;
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, end - begin,
+      spatial_dim, 1, 1., row_stats + begin, ones, 1., bottom_diff + offset);
+  caffe_cpu_axpby(count, Dtype(1), top_diff + offset, alpha,
+      bottom_diff + offset);
+  caffe_div(count, bottom_diff + offset, temp_data + offset,
+      bottom_diff + offset);
+}
+
+template <typename Dtype>
+static void divide_rows_cpu(int spatial_dim, const Dtype* a, const Dtype* b,
+    Dtype* y, int begin, int end) {
+  const int offset = begin * spatial_dim;
+  caffe_div((end - begin) * spatial_dim, a + offset, b + offset, y + offset);
+}
+
 template <typename Dtype>
 void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
@@ -90,10 +186,10 @@ void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype* top_data = top[0]->mutable_cpu_data();
   int num = bottom[0]->shape(0);
   int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
-
-  if (bottom[0] != top[0]) {
-    caffe_copy(bottom[0]->count(), bottom_data, top_data);
-  }
+  const int rows = channels_ * num;
+  const int grain = std::max(Caffe::kParallelGrain / spatial_dim, 1);
+  const Dtype* ones = spatial_sum_multiplier_.cpu_data();
+  Dtype* row_stats = num_by_chans_.mutable_cpu_data();
 
   if (use_global_stats_) {
     // use the stored mean/variance estimates.
@@ -105,31 +201,24 @@ void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         this->blobs_[1]->cpu_data(), variance_.mutable_cpu_data());
   } else {
     // compute mean
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim,
-        1. / (num * spatial_dim), bottom_data,
-        spatial_sum_multiplier_.cpu_data(), 0.,
-        num_by_chans_.mutable_cpu_data());
+    Caffe::parallel_for(rows, grain, boost::bind(&row_sums_cpu<Dtype>,
+        spatial_dim, Dtype(1. / (num * spatial_dim)), bottom_data, ones,
+        row_stats, _1, _2));
     caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
         num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
         mean_.mutable_cpu_data());
   }
 
-  // subtract mean
+  // subtract mean, and compute variance using var(X) = E((X-EX)^2)
   caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
       batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
       num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, -1, num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 1., top_data);
+  Caffe::parallel_for(rows, grain, boost::bind(&center_rows_cpu<Dtype>,
+      spatial_dim, Dtype(1. / (num * spatial_dim)), bottom_data, ones,
+      row_stats, top_data,
+      use_global_stats_ ? NULL : temp_.mutable_cpu_data(), _1, _2));
 
   if (!use_global_stats_) {
-    // compute variance using var(X) = E((X-EX)^2)
-    caffe_powx(top[0]->count(), top_data, Dtype(2),
-        temp_.mutable_cpu_data());  // (X-EX)^2
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim,
-        1. / (num * spatial_dim), temp_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), 0.,
-        num_by_chans_.mutable_cpu_data());
     caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
         num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
         variance_.mutable_cpu_data());  // E((X_EX)^2)
@@ -151,18 +240,15 @@ void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   caffe_powx(variance_.count(), variance_.cpu_data(), Dtype(0.5),
              variance_.mutable_cpu_data());
 
-  // replicate variance to input size
+  // replicate variance to input size, and divide by it
   caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
       batch_sum_multiplier_.cpu_data(), variance_.cpu_data(), 0.,
       num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 0., temp_.mutable_cpu_data());
-  caffe_div(temp_.count(), top_data, temp_.cpu_data(), top_data);
   // TODO(cdoersch): The caching is only needed because later in-place layers
   //                 might clobber the data.  Can we skip this if they won't?
-  caffe_copy(x_norm_.count(), top_data,
-      x_norm_.mutable_cpu_data());
+  Caffe::parallel_for(rows, grain, boost::bind(&normalize_rows_cpu<Dtype>,
+      spatial_dim, num_by_chans_.cpu_data(), ones, temp_.mutable_cpu_data(),
+      top_data, x_norm_.mutable_cpu_data(), _1, _2));
 }
 
 template <typename Dtype>
@@ -177,13 +263,18 @@ void BatchNormLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     top_diff = x_norm_.cpu_diff();
   }
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  int num = bottom[0]->shape()[0];
+  int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
+  const int rows = channels_ * num;
+  const int grain = std::max(Caffe::kParallelGrain / spatial_dim, 1);
   if (use_global_stats_) {
-    caffe_div(temp_.count(), top_diff, temp_.cpu_data(), bottom_diff);
+    Caffe::parallel_for(rows, grain, boost::bind(&divide_rows_cpu<Dtype>,
+        spatial_dim, top_diff, temp_.cpu_data(), bottom_diff, _1, _2));
     return;
   }
   const Dtype* top_data = x_norm_.cpu_data();
-  int num = bottom[0]->shape()[0];
-  int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
+  const Dtype* ones = spatial_sum_multiplier_.cpu_data();
+  Dtype* row_stats = num_by_chans_.mutable_cpu_data();
   // if Y = (X-mean(X))/(sqrt(var(X)+eps)), then
   //
   // dE(Y)/dX =
@@ -197,48 +288,35 @@ void BatchNormLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   // dimensions except the channels dimension where required.
 
   // sum(dE/dY \cdot Y)
-  caffe_mul(temp_.count(), top_data, top_diff, bottom_diff);
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim, 1.,
-      bottom_diff, spatial_sum_multiplier_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
+  Caffe::parallel_for(rows, grain, boost::bind(&dot_rows_cpu<Dtype>,
+      spatial_dim, top_data, top_diff, ones, row_stats, bottom_diff, _1, _2));
   caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
       num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
       mean_.mutable_cpu_data());
 
-  // reshape (broadcast) the above
+  // reshape (broadcast) the above, to make sum(dE/dY \cdot Y) \cdot Y,
+  // and sum(dE/dY)
   caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
       batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
       num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 0., bottom_diff);
-
-  // sum(dE/dY \cdot Y) \cdot Y
-  caffe_mul(temp_.count(), top_data, bottom_diff, bottom_diff);
-
-  // sum(dE/dY)-sum(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim, 1.,
-      top_diff, spatial_sum_multiplier_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
+  Caffe::parallel_for(rows, grain, boost::bind(&project_rows_cpu<Dtype>,
+      spatial_dim, top_data, top_diff, ones, row_stats, bottom_diff, _1, _2));
   caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
       num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
       mean_.mutable_cpu_data());
+
   // reshape (broadcast) the above to make
-  // sum(dE/dY)-sum(dE/dY \cdot Y) \cdot Y
+  // sum(dE/dY)-sum(dE/dY \cdot Y) \cdot Y, then
+  // dE/dY - mean(dE/dY)-mean(dE/dY \cdot Y) \cdot Y
   caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
       batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
       num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num * channels_,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 1., bottom_diff);
-
-  // dE/dY - mean(dE/dY)-mean(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_axpby(temp_.count(), Dtype(1), top_diff,
-      Dtype(-1. / (num * spatial_dim)), bottom_diff);
 
   // note: temp_ still contains sqrt(var(X)+eps), computed during the forward
   // pass.
-  caffe_div(temp_.count(), bottom_diff, temp_.cpu_data(), bottom_diff);
+  Caffe::parallel_for(rows, grain, boost::bind(&finish_rows_cpu<Dtype>,
+      spatial_dim, Dtype(-1. / (num * spatial_dim)), top_diff, ones,
+      row_stats, temp_.cpu_data(), bottom_diff, _1, _2));
 }
 
 
@@ -1,6 +1,7 @@
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 #endif  // USE_OPENCV
+#include <boost/bind.hpp>
 #include <stdint.h>
 
 #include <vector>
@@ -8,6 +9,8 @@
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
@@ -54,6 +57,27 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       this->prefetch_[i]->label_.Reshape(label_shape);
     }
   }
+
+  const int transform_threads =
+      this->layer_param_.data_param().transform_threads();
+  if (transform_threads > 1) {
+    LOG_IF(INFO, Caffe::root_solver())
+        << "Transforming data with " << transform_threads << " threads";
+    for (int i = 0; i < transform_threads; ++i) {
+      transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+          new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+      transformed_data_views_.push_back(
+          shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    }
+    transform_pool_.reset(new ThreadPool(transform_threads));
+  }
+  batch_datums_.resize(this->prefetch_threads(), vector<Datum>(batch_size));
+  batch_data_.resize(this->prefetch_threads(),
+      vector<const char*>(batch_size));
+  batch_data_sizes_.resize(this->prefetch_threads(),
+      vector<size_t>(batch_size));
+  item_seeds_.resize(this->prefetch_threads(),
+      vector<unsigned int>(transform_pool_ ? batch_size : 0));
 }
 
 template <typename Dtype>
@@ -79,50 +103,78 @@ void DataLayer<Dtype>::Next() {
 
 // This function is called on prefetch thread
 template<typename Dtype>
-void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch, int thread_id) {
   CPUTimer batch_timer;
   batch_timer.Start();
   double read_time = 0;
   double trans_time = 0;
   CPUTimer timer;
   CHECK(batch->data_.count());
-  CHECK(this->transformed_data_.count());
+  Blob<Dtype>* transformed_data = this->transformed_data(thread_id);
+  CHECK(transformed_data->count());
   const int batch_size = this->layer_param_.data_param().batch_size();
+  vector<Datum>& datums = batch_datums_[thread_id];
+  vector<const char*>& data = batch_data_[thread_id];
+  vector<size_t>& data_sizes = batch_data_sizes_[thread_id];
+  vector<unsigned int>& seeds = item_seeds_[thread_id];
 
-  Datum datum;
+  // Read the batch in order, then transform its items once the other
+  // prefetch threads may go on reading.
+  Dtype* top_label = this->output_labels_ ?
+      batch->label_.mutable_cpu_data() : NULL;
+  timer.Start();
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    timer.Start();
     while (Skip()) {
       Next();
     }
-    datum.ParseFromString(cursor_->value());
-    read_time += timer.MicroSeconds();
-
-    if (item_id == 0) {
-      // Reshape according to the first datum of each batch
-      // on single input batches allows for inputs of varying dimension.
-      // Use data_transformer to infer the expected blob shape from datum.
-      vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
-      this->transformed_data_.Reshape(top_shape);
-      // Reshape batch according to the batch_size.
-      top_shape[0] = batch_size;
-      batch->data_.Reshape(top_shape);
+    const char* value;
+    size_t value_size;
+    if (cursor_->value_view(&value, &value_size)) {
+      // leave the pixels in the database, and transform them from there
+      CHECK(ParseDatumAliasing(value, value_size, &datums[item_id],
+          &data[item_id], &data_sizes[item_id])) << "Could not parse datum";
+    } else {
+      datums[item_id].ParseFromString(cursor_->value());
+      data[item_id] = datums[item_id].data().data();
+      data_sizes[item_id] = datums[item_id].data().size();
     }
-
-    // Apply data transformations (mirror, scale, crop...)
-    timer.Start();
-    int offset = batch->data_.offset(item_id);
-    Dtype* top_data = batch->data_.mutable_cpu_data();
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(datum, &(this->transformed_data_));
-    // Copy label.
-    if (this->output_labels_) {
-      Dtype* top_label = batch->label_.mutable_cpu_data();
-      top_label[item_id] = datum.label();
+    if (top_label) {
+      top_label[item_id] = datums[item_id].label();
+    }
+    if (transform_pool_) {
+      // draw the seeds in item order, so that the batch does not depend on
+      // which thread transforms which item
+      seeds[item_id] = caffe_rng_rand();
     }
-    trans_time += timer.MicroSeconds();
     Next();
   }
+  this->ReadDone(thread_id);
+  read_time += timer.MicroSeconds();
+
+  timer.Start();
+  // Reshape according to the first datum of each batch
+  // on single input batches allows for inputs of varying dimension.
+  // Use data_transformer to infer the expected blob shape from datum.
+  vector<int> top_shape = this->transformer(thread_id)->InferBlobShape(
+      datums[0], data[0], data_sizes[0]);
+  transformed_data->Reshape(top_shape);
+  // Reshape batch according to the batch_size.
+  top_shape[0] = batch_size;
+  batch->data_.Reshape(top_shape);
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  if (transform_pool_) {
+    transform_pool_->Run(boost::bind(&DataLayer<Dtype>::TransformItems, this,
+        _1, thread_id, top_data));
+  } else {
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      // Apply data transformations (mirror, scale, crop...)
+      int offset = batch->data_.offset(item_id);
+      transformed_data->set_cpu_data(top_data + offset);
+      this->transformer(thread_id)->Transform(datums[item_id], data[item_id],
+          data_sizes[item_id], transformed_data);
+    }
+  }
+  trans_time += timer.MicroSeconds();
   timer.Stop();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
@@ -130,6 +182,24 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+template<typename Dtype>
+void DataLayer<Dtype>::TransformItems(int thread_id, int prefetch_id,
+    Dtype* top_data) {
+  DataTransformer<Dtype>* transformer = transformers_[thread_id].get();
+  Blob<Dtype>* transformed_data = transformed_data_views_[thread_id].get();
+  const vector<Datum>& datums = batch_datums_[prefetch_id];
+  const vector<const char*>& data = batch_data_[prefetch_id];
+  const vector<size_t>& data_sizes = batch_data_sizes_[prefetch_id];
+  const vector<unsigned int>& seeds = item_seeds_[prefetch_id];
+  transformed_data->Reshape(this->transformed_data(prefetch_id)->shape());
+  for (int i = thread_id; i < datums.size(); i += transform_pool_->size()) {
+    transformer->InitRand(seeds[i]);
+    transformed_data->set_cpu_data(top_data + i * transformed_data->count());
+    transformer->Transform(datums[i], data[i], data_sizes[i],
+        transformed_data);
+  }
+}
+
 INSTANTIATE_CLASS(DataLayer);
 REGISTER_LAYER_CLASS(Data);
 
@@ -137,6 +137,8 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   for (int i = 0; i < this->prefetch_.size(); ++i) {
     this->prefetch_[i]->label_.Reshape(label_shape);
   }
+  batch_lines_.resize(this->prefetch_threads(),
+      vector<std::pair<std::string, int> >(batch_size));
 }
 
 int random_data(int i) {
@@ -172,14 +174,15 @@ void ImageDataLayer<Dtype>::ShuffleImages() {
 
 // This function is called on prefetch thread
 template <typename Dtype>
-void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch, int thread_id) {
   CPUTimer batch_timer;
   batch_timer.Start();
   double read_time = 0;
   double trans_time = 0;
   CPUTimer timer;
   CHECK(batch->data_.count());
-  CHECK(this->transformed_data_.count());
+  Blob<Dtype>* transformed_data = this->transformed_data(thread_id);
+  CHECK(transformed_data->count());
   ImageDataParameter image_data_param = this->layer_param_.image_data_param();
   const int batch_size = image_data_param.batch_size();
   const int new_height = image_data_param.new_height();
@@ -192,14 +195,33 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   const int right_idx = this->layer_param_.image_data_param().right_idx();
   const int bottom_idx = this->layer_param_.image_data_param().bottom_idx();
 
+  // Take the lines of the batch, and let the next prefetch thread go on.
+  vector<std::pair<std::string, int> >& lines = batch_lines_[thread_id];
+  const int lines_size = lines_.size();
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    CHECK_GT(lines_size, lines_id_);
+    lines[item_id] = lines_[lines_id_];
+    // go to the next iter
+    lines_id_++;
+    if (lines_id_ >= lines_size) {
+      // We have reached the end. Restart from the first.
+      DLOG(INFO) << "Restarting data prefetching from start.";
+      lines_id_ = 0;
+      if (this->layer_param_.image_data_param().shuffle()) {
+        ShuffleImages();
+      }
+    }
+  }
+  this->ReadDone(thread_id);
+
   // Reshape according to the first image of each batch
   // on single input batches allows for inputs of varying dimension.
-//  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
+//  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines[0].first,
 //      new_height, new_width, is_color);
-//  CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+//  CHECK(cv_img.data) << "Could not load " << lines[0].first;
 
-  cv::Mat cv_img_origin = ReadImageToCVMat(root_folder + lines_[lines_id_].first, is_color);
-  CHECK(cv_img_origin.data) << "Could not load " << lines_[lines_id_].first;
+  cv::Mat cv_img_origin = ReadImageToCVMat(root_folder + lines[0].first, is_color);
+  CHECK(cv_img_origin.data) << "Could not load " << lines[0].first;
 
   if (left_idx >= 0 && top_idx >= 0 && right_idx >= 0 && bottom_idx >= 0) {
     const int img_width = cv_img_origin.cols;
@@ -211,11 +233,12 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
 
   cv::Mat cv_img;
   cv::resize(cv_img_origin, cv_img, cv::Size(new_width, new_height));
-  CHECK(cv_img.data) << "Could not get patch from " << lines_[lines_id_].first;
+  CHECK(cv_img.data) << "Could not get patch from " << lines[0].first;
 
   // Use data_transformer to infer the expected blob shape from a cv_img.
-  vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
-  this->transformed_data_.Reshape(top_shape);
+  DataTransformer<Dtype>* transformer = this->transformer(thread_id);
+  vector<int> top_shape = transformer->InferBlobShape(cv_img);
+  transformed_data->Reshape(top_shape);
   // Reshape batch according to the batch_size.
   top_shape[0] = batch_size;
   batch->data_.Reshape(top_shape);
@@ -224,18 +247,16 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   Dtype* prefetch_label = batch->label_.mutable_cpu_data();
 
   // datum scales
-  const int lines_size = lines_.size();
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     // get a blob
     timer.Start();
-    CHECK_GT(lines_size, lines_id_);
 
-//    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
+//    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines[item_id].first,
 //        new_height, new_width, is_color);
-//    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+//    CHECK(cv_img.data) << "Could not load " << lines[item_id].first;
 
-    cv::Mat cv_img_origin = ReadImageToCVMat(root_folder + lines_[lines_id_].first, is_color);
-    CHECK(cv_img_origin.data) << "Could not load " << lines_[lines_id_].first;
+    cv::Mat cv_img_origin = ReadImageToCVMat(root_folder + lines[item_id].first, is_color);
+    CHECK(cv_img_origin.data) << "Could not load " << lines[item_id].first;
 
     if (left_idx >= 0 && top_idx >= 0 && right_idx >= 0 && bottom_idx >= 0) {
       const int img_width = cv_img_origin.cols;
@@ -247,27 +268,17 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
 
     cv::Mat cv_img;
     cv::resize(cv_img_origin, cv_img, cv::Size(new_width, new_height));
-    CHECK(cv_img.data) << "Could not get patch from " << lines_[lines_id_].first;
+    CHECK(cv_img.data) << "Could not get patch from " << lines[item_id].first;
 
     read_time += timer.MicroSeconds();
     timer.Start();
     // Apply transformations (mirror, crop...) to the image
     int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
+    transformed_data->set_cpu_data(prefetch_data + offset);
+    transformer->Transform(cv_img, transformed_data);
     trans_time += timer.MicroSeconds();
 
-    prefetch_label[item_id] = lines_[lines_id_].second;
-    // go to the next iter
-    lines_id_++;
-    if (lines_id_ >= lines_size) {
-      // We have reached the end. Restart from the first.
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      lines_id_ = 0;
-      if (this->layer_param_.image_data_param().shuffle()) {
-        ShuffleImages();
-      }
-    }
+    prefetch_label[item_id] = lines[item_id].second;
   }
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layers/int8_conv_layer.hpp"
+#include "caffe/util/im2col.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void Int8ConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  const float input_range =
+      this->layer_param_.quantization_param().input_range();
+  CHECK_GT(input_range, 0) << "Layer " << this->layer_param_.name()
+      << " needs the input_range of quantization_param, as recorded by "
+      << "tools/calibrate_int8.";
+  input_scale_ = 127 / input_range;
+  use_int8_ = this->num_spatial_axes_ == 2 && !this->force_nd_im2col_;
+  if (!use_int8_) {
+    LOG(INFO) << "Layer " << this->layer_param_.name() << " is not 2D "
+        << "convolution; using the CAFFE engine.";
+  }
+}
+
+template <typename Dtype>
+void Int8ConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  if (!use_int8_) {
+    return;
+  }
+  weight_int8_.resize(this->blobs_[0]->count());
+  output_scale_.resize(this->num_output_);
+  input_int8_.resize(this->bottom_dim_);
+  if (!this->is_1x1_) {
+    col_int8_.resize(this->blobs_[0]->count(1) * this->group_ *
+        this->out_spatial_dim_);
+  }
+}
+
+template <typename Dtype>
+void Int8ConvolutionLayer<Dtype>::quantize_weights() {
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const int dim = this->blobs_[0]->count(1);
+  for (int o = 0; o < this->num_output_; ++o) {
+    Dtype max_weight = 0;
+    for (int i = 0; i < dim; ++i) {
+      max_weight = std::max(max_weight, std::abs(weight[o * dim + i]));
+    }
+    // the outputs of all-zero filters are zero whatever the scale
+    const Dtype weight_scale = max_weight > 0 ? 127 / max_weight : 1;
+    caffe_cpu_quantize(dim, weight_scale, weight + o * dim,
+        &weight_int8_[o * dim]);
+    output_scale_[o] = 1 / (input_scale_ * weight_scale);
+  }
+}
+
+template <typename Dtype>
+void Int8ConvolutionLayer<Dtype>::update_weights() {
+  // quantize the filters again only once they have been written or
+  // replaced, as by the solver or by sharing the ones of another net
+  if (this->blobs_[0]->data() == quantized_data_
+      && quantized_data_->version() == quantized_version_) {
+    return;
+  }
+  quantized_data_.reset();
+  quantize_weights();
+  // the floats are freed in the TEST phase, where no backward pass needs
+  // them, unless other blobs share them
+  weights_freed_ = this->phase_ == TEST &&
+      this->blobs_[0]->data().use_count() == 1;
+  if (weights_freed_) {
+    Blob<Dtype> unallocated(this->blobs_[0]->shape());
+    this->blobs_[0]->ShareData(unallocated);
+  }
+  quantized_data_ = this->blobs_[0]->data();
+  quantized_version_ = quantized_data_->version();
+}
+
+template <typename Dtype>
+void Int8ConvolutionLayer<Dtype>::ToProto(LayerParameter* param,
+    bool write_diff) {
+  ConvolutionLayer<Dtype>::ToProto(param, write_diff);
+  if (!weights_freed_ || this->blobs_[0]->data() != quantized_data_
+      || quantized_data_->version() != quantized_version_) {
+    return;
+  }
+  Blob<Dtype> weights(this->blobs_[0]->shape());
+  weights.ShareDiff(*this->blobs_[0]);
+  Dtype* weight = weights.mutable_cpu_data();
+  const int dim = weights.count(1);
+  for (int o = 0; o < this->num_output_; ++o) {
+    for (int i = 0; i < dim; ++i) {
+      weight[o * dim + i] =
+          weight_int8_[o * dim + i] * output_scale_[o] * input_scale_;
+    }
+  }
+  weights.ToProto(param->mutable_blobs(0), write_diff);
+}
+
+template <typename Dtype>
+void Int8ConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!use_int8_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  update_weights();
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* pad = this->pad_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  const int* input_shape = this->conv_input_shape_.cpu_data();
+  // each group multiplies out_channels filters of dim weights by the dim x
+  // spatial_dim columns of its input channels
+  const int out_channels = this->num_output_ / this->group_;
+  const int dim = this->blobs_[0]->count(1);
+  const int spatial_dim = this->out_spatial_dim_;
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      caffe_cpu_quantize(this->bottom_dim_, input_scale_,
+          bottom_data + n * this->bottom_dim_, &input_int8_[0]);
+      const int8_t* col = &input_int8_[0];
+      if (!this->is_1x1_) {
+        im2col_cpu(&input_int8_[0], this->channels_, input_shape[1],
+            input_shape[2], kernel_shape[0], kernel_shape[1], pad[0], pad[1],
+            stride[0], stride[1], dilation[0], dilation[1], &col_int8_[0]);
+        col = &col_int8_[0];
+      }
+      Dtype* output = top_data + n * this->top_dim_;
+      for (int g = 0; g < this->group_; ++g) {
+        caffe_cpu_gemm_int8(out_channels, spatial_dim, dim,
+            &weight_int8_[g * out_channels * dim], col + g * dim * spatial_dim,
+            false, &output_scale_[g * out_channels],
+            static_cast<const Dtype*>(NULL),
+            output + g * out_channels * spatial_dim);
+      }
+      for (int o = 0; o < this->num_output_; ++o) {
+        const Dtype shift = bias ? bias[o] : Dtype(0);
+        for (int j = 0; j < spatial_dim; ++j) {
+          const Dtype value = output[o * spatial_dim + j] + shift;
+          output[o * spatial_dim + j] =
+              this->relu_ ? std::max(value, Dtype(0)) : value;
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(Int8ConvolutionLayer);
+
+}  // namespace caffe
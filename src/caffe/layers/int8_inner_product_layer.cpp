@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layers/int8_inner_product_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void Int8InnerProductLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  InnerProductLayer<Dtype>::LayerSetUp(bottom, top);
+  const float input_range =
+      this->layer_param_.quantization_param().input_range();
+  CHECK_GT(input_range, 0) << "Layer " << this->layer_param_.name()
+      << " needs the input_range of quantization_param, as recorded by "
+      << "tools/calibrate_int8.";
+  input_scale_ = 127 / input_range;
+}
+
+template <typename Dtype>
+void Int8InnerProductLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  InnerProductLayer<Dtype>::Reshape(bottom, top);
+  weight_int8_.resize(caffe_cpu_packed_int8_size(this->N_, this->K_));
+  output_scale_.resize(this->N_);
+  input_int8_.resize(this->M_ * this->K_);
+}
+
+template <typename Dtype>
+void Int8InnerProductLayer<Dtype>::quantize_weights() {
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const int K = this->K_;
+  const int N = this->N_;
+  // weight k of output n, at k * N + n if transposed and n * K + k if not
+  const int k_step = this->transpose_ ? N : 1;
+  const int n_step = this->transpose_ ? 1 : K;
+  vector<Dtype> column(K);
+  vector<int8_t> column_int8(K);
+  vector<int8_t> weight_int8(K * N);
+  for (int n = 0; n < N; ++n) {
+    Dtype max_weight = 0;
+    for (int k = 0; k < K; ++k) {
+      column[k] = weight[n * n_step + k * k_step];
+      max_weight = std::max(max_weight, std::abs(column[k]));
+    }
+    // the outputs of all-zero weights are zero whatever the scale
+    const Dtype weight_scale = max_weight > 0 ? 127 / max_weight : 1;
+    caffe_cpu_quantize(K, weight_scale, &column[0], &column_int8[0]);
+    for (int k = 0; k < K; ++k) {
+      weight_int8[k * N + n] = column_int8[k];
+    }
+    output_scale_[n] = 1 / (input_scale_ * weight_scale);
+  }
+  caffe_cpu_pack_int8(N, K, &weight_int8[0], &weight_int8_[0]);
+}
+
+template <typename Dtype>
+void Int8InnerProductLayer<Dtype>::update_weights() {
+  // quantize the weights again only once they have been written or
+  // replaced, as by the solver or by sharing the ones of another net
+  if (this->blobs_[0]->data() == quantized_data_
+      && quantized_data_->version() == quantized_version_) {
+    return;
+  }
+  quantized_data_.reset();
+  quantize_weights();
+  // With no backward pass in the TEST phase, the floats are freed unless
+  // other blobs share them: the blob takes memory that is only allocated
+  // if read, and ToProto writes the weights the int8 ones stand for.
+  weights_freed_ = this->phase_ == TEST &&
+      this->blobs_[0]->data().use_count() == 1;
+  if (weights_freed_) {
+    Blob<Dtype> unallocated(this->blobs_[0]->shape());
+    this->blobs_[0]->ShareData(unallocated);
+  }
+  quantized_data_ = this->blobs_[0]->data();
+  quantized_version_ = quantized_data_->version();
+}
+
+template <typename Dtype>
+void Int8InnerProductLayer<Dtype>::ToProto(LayerParameter* param,
+    bool write_diff) {
+  InnerProductLayer<Dtype>::ToProto(param, write_diff);
+  if (!weights_freed_ || this->blobs_[0]->data() != quantized_data_
+      || quantized_data_->version() != quantized_version_) {
+    return;
+  }
+  const int K = this->K_;
+  const int N = this->N_;
+  const int k_step = this->transpose_ ? N : 1;
+  const int n_step = this->transpose_ ? 1 : K;
+  vector<int8_t> weight_int8(K * N);
+  caffe_cpu_unpack_int8(N, K, &weight_int8_[0], &weight_int8[0]);
+  Blob<Dtype> weights(this->blobs_[0]->shape());
+  weights.ShareDiff(*this->blobs_[0]);
+  Dtype* weight = weights.mutable_cpu_data();
+  for (int n = 0; n < N; ++n) {
+    for (int k = 0; k < K; ++k) {
+      weight[n * n_step + k * k_step] =
+          weight_int8[k * N + n] * output_scale_[n] * input_scale_;
+    }
+  }
+  weights.ToProto(param->mutable_blobs(0), write_diff);
+}
+
+template <typename Dtype>
+void Int8InnerProductLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  update_weights();
+  const int M = this->M_;
+  const int N = this->N_;
+  caffe_cpu_quantize(M * this->K_, input_scale_, bottom[0]->cpu_data(),
+      &input_int8_[0]);
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  caffe_cpu_gemm_int8(M, N, this->K_, &input_int8_[0], &weight_int8_[0],
+      true, static_cast<const Dtype*>(NULL), &output_scale_[0], top_data);
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int m = 0; m < M; ++m) {
+    for (int n = 0; n < N; ++n) {
+      const Dtype value = top_data[m * N + n] + (bias ? bias[n] : Dtype(0));
+      top_data[m * N + n] = this->relu_ ? std::max(value, Dtype(0)) : value;
+    }
+  }
+}
+
+INSTANTIATE_CLASS(Int8InnerProductLayer);
+
+}  // namespace caffe
@@ -1,5 +1,6 @@
 #include <vector>
 #include <algorithm>
+#include <cmath>
 
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -7,6 +8,15 @@
 
 namespace caffe {
 
+// Number of positions normalized together on the cpu: the channels of a
+// tile are swept twice, so they should stay in cache in between.
+template <typename Dtype>
+static int L2NTileSize(const int channels, const int spatial_dim) {
+  const int kTileBytes = 64 * 1024;
+  const int tile = kTileBytes / (channels * static_cast<int>(sizeof(Dtype)));
+  return std::min(spatial_dim, std::max(tile, 16));
+}
+
 template <typename Dtype>
 void L2NLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -16,81 +26,120 @@ void L2NLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   int width_ = bottom[0]->width();
 
   top[0]->Reshape(num_, channels_, height_, width_);
-  sum_multiplier_.Reshape(1, channels_, 1, 1);
-  Dtype* multiplier_data = sum_multiplier_.mutable_cpu_data();
-  for (int i = 0; i < sum_multiplier_.count(); ++i)
-      multiplier_data[i] = 1.;
-  square_.Reshape(num_, channels_, height_, width_);
-  norm_.Reshape(num_, 1, height_, width_);
-  temp_dot_.Reshape(num_, 1, height_, width_);
+  inv_norm_.Reshape(num_, 1, height_, width_);
+  temp_dot_.Reshape(1, 1, height_, width_);
 }
 
 template <typename Dtype>
 void L2NLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-        const vector<Blob<Dtype>*>& top) {
-    const Dtype* bottom_data = bottom[0]->cpu_data();
-    Dtype* top_data = top[0]->mutable_cpu_data();
-    Dtype* square_data = square_.mutable_cpu_data();
-    Dtype* norm_data = norm_.mutable_cpu_data();
-    int num = bottom[0]->num();
-    int channels = bottom[0]->channels();
-    int dim = bottom[0]->count() / bottom[0]->num();
-    int spatial_dim = bottom[0]->height() * bottom[0]->width();
-    caffe_copy(bottom[0]->count(), bottom_data, top_data);
-    caffe_copy(bottom[0]->count(), bottom_data, square_data);
-    // do the normalization.
+    const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  Dtype* inv_norm_data = inv_norm_.mutable_cpu_data();
+  const int num = bottom[0]->num();
+  const int channels = bottom[0]->channels();
+  const int dim = bottom[0]->count() / num;
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  const Dtype eps = this->layer_param_.l2n_param().eps();
+
+  if (spatial_dim == 1) {
+    // one contiguous vector per sample
     for (int i = 0; i < num; ++i) {
-        // square each element
-        caffe_sqr<Dtype>(dim, square_data + i * dim, square_data + i * dim);
-        // sum acorss the channel
-        caffe_cpu_gemv<Dtype>(CblasTrans, channels, spatial_dim, 1.,
-                square_data + i * dim, sum_multiplier_.cpu_data(), 0.,
-                norm_data + i * spatial_dim);
-        // root the square norm_data
-        caffe_powx<Dtype>(spatial_dim, norm_data + i * spatial_dim, 0.5,
-                norm_data + i * spatial_dim);
-        // division
-        for (int j = 0; j < channels; ++j) {
-            caffe_div(spatial_dim, top_data + top[0]->offset(i, j),
-                norm_data + i * spatial_dim, top_data + top[0]->offset(i,j));
+      const Dtype sum = caffe_cpu_dot(dim, bottom_data + i * dim,
+          bottom_data + i * dim);
+      inv_norm_data[i] = 1 / std::sqrt(sum + eps);
+      caffe_cpu_scale(dim, inv_norm_data[i], bottom_data + i * dim,
+          top_data + i * dim);
+    }
+    return;
+  }
+
+  // Sum the squares over the channels of a tile of positions, then scale
+  // the tile while it is still in cache. The inner loops run over
+  // contiguous positions so the compiler can vectorize them.
+  const int tile = L2NTileSize<Dtype>(channels, spatial_dim);
+  for (int i = 0; i < num; ++i) {
+    for (int s0 = 0; s0 < spatial_dim; s0 += tile) {
+      const int len = std::min(tile, spatial_dim - s0);
+      const Dtype* x = bottom_data + i * dim + s0;
+      Dtype* y = top_data + i * dim + s0;
+      Dtype* inv_norm = inv_norm_data + i * spatial_dim + s0;
+      caffe_set(len, Dtype(0), inv_norm);
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* x_c = x + c * spatial_dim;
+        for (int s = 0; s < len; ++s) {
+          inv_norm[s] += x_c[s] * x_c[s];
+        }
+      }
+      for (int s = 0; s < len; ++s) {
+        inv_norm[s] = 1 / std::sqrt(inv_norm[s] + eps);
+      }
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* x_c = x + c * spatial_dim;
+        Dtype* y_c = y + c * spatial_dim;
+        for (int s = 0; s < len; ++s) {
+          y_c[s] = x_c[s] * inv_norm[s];
         }
+      }
     }
+  }
 }
 
 template <typename Dtype>
 void L2NLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-    const Dtype* top_diff = top[0]->cpu_diff();
-    const Dtype* top_data = top[0]->cpu_data();
-    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    const Dtype* bottom_data = bottom[0]->cpu_data();
-    Dtype* norm_data = norm_.mutable_cpu_data();
-    Dtype* temp_dot_data = temp_dot_.mutable_cpu_data();
-    Dtype* temp_data = square_.mutable_cpu_data(); // just reuse the square_
-    int num = top[0]->num();
-    int channels = top[0]->channels();
-    int dim = top[0]->count() / top[0]->num();
-    int spatial_dim = top[0]->height() * top[0]->width();
-    caffe_copy(top[0]->count(), top_diff, bottom_diff);
+  if (!propagate_down[0]) { return; }
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* top_data = top[0]->cpu_data();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const Dtype* inv_norm_data = inv_norm_.cpu_data();
+  const int num = top[0]->num();
+  const int channels = top[0]->channels();
+  const int dim = top[0]->count() / num;
+  const int spatial_dim = top[0]->height() * top[0]->width();
+
+  // With y = x / norm:
+  // b_diff = t_diff / norm - dot(t_diff, x) / (norm)^3 * x
+  //        = (t_diff - dot(t_diff, y) * y) / norm
+  if (spatial_dim == 1) {
     for (int i = 0; i < num; ++i) {
-        // b_diff = t_diff / norm - dot(t_diff, t_data) / (norm)^2 * bottom_data
-        // compute dot(top_diff, top_data)
-        for (int k = 0; k < spatial_dim; ++k) {
-            temp_dot_data[i*spatial_dim + k] = caffe_cpu_strided_dot<Dtype>(channels,
-                    top_diff + i * dim + k, spatial_dim,
-                    top_data + i * dim + k, spatial_dim) /
-                (norm_data[i*spatial_dim + k] * norm_data[i*spatial_dim + k]);
+      const Dtype dot = caffe_cpu_dot(dim, top_diff + i * dim,
+          top_data + i * dim);
+      caffe_cpu_scale(dim, inv_norm_data[i], top_diff + i * dim,
+          bottom_diff + i * dim);
+      caffe_axpy(dim, -dot * inv_norm_data[i], top_data + i * dim,
+          bottom_diff + i * dim);
+    }
+    return;
+  }
+
+  Dtype* dot = temp_dot_.mutable_cpu_data();
+  const int tile = L2NTileSize<Dtype>(channels, spatial_dim);
+  for (int i = 0; i < num; ++i) {
+    for (int s0 = 0; s0 < spatial_dim; s0 += tile) {
+      const int len = std::min(tile, spatial_dim - s0);
+      const Dtype* dy = top_diff + i * dim + s0;
+      const Dtype* y = top_data + i * dim + s0;
+      Dtype* dx = bottom_diff + i * dim + s0;
+      const Dtype* inv_norm = inv_norm_data + i * spatial_dim + s0;
+      caffe_set(len, Dtype(0), dot);
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* dy_c = dy + c * spatial_dim;
+        const Dtype* y_c = y + c * spatial_dim;
+        for (int s = 0; s < len; ++s) {
+          dot[s] += dy_c[s] * y_c[s];
         }
-        // b_diff = t_diff / norm - dot(t_diff, t_data) / (norm)^2 * bottom_data
-        for (int j = 0; j < channels; ++j) {
-            caffe_div(spatial_dim, bottom_diff + top[0]->offset(i, j),
-                norm_data + i*spatial_dim, bottom_diff + top[0]->offset(i, j));
-            caffe_mul(spatial_dim, bottom_data + top[0]->offset(i, j),
-                temp_dot_data + i*spatial_dim, temp_data + top[0]->offset(i, j));
-            caffe_axpy(spatial_dim, Dtype(-1.0),temp_data + top[0]->offset(i ,j),
-                bottom_diff + top[0]->offset(i, j));
+      }
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* dy_c = dy + c * spatial_dim;
+        const Dtype* y_c = y + c * spatial_dim;
+        Dtype* dx_c = dx + c * spatial_dim;
+        for (int s = 0; s < len; ++s) {
+          dx_c[s] = (dy_c[s] - dot[s] * y_c[s]) * inv_norm[s];
         }
+      }
     }
+  }
 }
 
 
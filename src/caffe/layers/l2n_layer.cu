@@ -5,130 +5,154 @@
 #include "caffe/util/math_functions.hpp"
 #include "caffe/layers/l2n_layer.hpp"
 
-#include "thrust/device_vector.h"
-
 namespace caffe {
 
+// One thread per position: it reads the channels of its position to get the
+// norm and reads them again to write the output; neighbouring threads read
+// neighbouring positions, so both sweeps are coalesced.
 template <typename Dtype>
-    __global__ void kernel_channel_sum(const int num, const int channels,
-                const int spatial_dim, const Dtype* data, Dtype* channel_sum) {
-      CUDA_KERNEL_LOOP(index, num * spatial_dim) {
-          int n = index / spatial_dim;
-          int s = index % spatial_dim;
-          Dtype sum = 0;
-          for (int c = 0; c < channels; ++c) {
-                sum += data[(n * channels + c) * spatial_dim + s];
-              }
-          channel_sum[index] = sum;
-        }
+__global__ void L2NForward(const int num, const int channels,
+    const int spatial_dim, const Dtype eps, const Dtype* in, Dtype* out,
+    Dtype* inv_norm) {
+  CUDA_KERNEL_LOOP(index, num * spatial_dim) {
+    const int n = index / spatial_dim;
+    const int s = index % spatial_dim;
+    const Dtype* x = in + n * channels * spatial_dim + s;
+    Dtype* y = out + n * channels * spatial_dim + s;
+    Dtype sum = 0;
+    for (int c = 0; c < channels; ++c) {
+      sum += x[c * spatial_dim] * x[c * spatial_dim];
+    }
+    const Dtype inv = 1 / sqrt(sum + eps);
+    for (int c = 0; c < channels; ++c) {
+      y[c * spatial_dim] = x[c * spatial_dim] * inv;
     }
+    inv_norm[index] = inv;
+  }
+}
 
 template <typename Dtype>
-    __global__ void kernel_channel_mul(const int num, const int channels,
-                const int spatial_dim, Dtype* data, const Dtype* channel_sum) {
-      CUDA_KERNEL_LOOP(index, num * spatial_dim) {
-          int n = index / spatial_dim;
-          int s = index % spatial_dim;
-          for (int c = 0; c < channels; ++c) {
-                data[(n * channels + c) * spatial_dim + s] *= channel_sum[index];
-              }
-        }
+__global__ void L2NBackward(const int num, const int channels,
+    const int spatial_dim, const Dtype* top_diff, const Dtype* top_data,
+    const Dtype* inv_norm, Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, num * spatial_dim) {
+    const int n = index / spatial_dim;
+    const int s = index % spatial_dim;
+    const int offset = n * channels * spatial_dim + s;
+    Dtype dot = 0;
+    for (int c = 0; c < channels; ++c) {
+      dot += top_diff[offset + c * spatial_dim]
+          * top_data[offset + c * spatial_dim];
     }
+    const Dtype inv = inv_norm[index];
+    for (int c = 0; c < channels; ++c) {
+      bottom_diff[offset + c * spatial_dim] = inv
+          * (top_diff[offset + c * spatial_dim]
+          - dot * top_data[offset + c * spatial_dim]);
+    }
+  }
+}
 
+// Sum of a per-thread value over the block, in shared memory.
 template <typename Dtype>
-    __global__ void kernel_channel_div(const int num, const int channels,
-                const int spatial_dim, Dtype* data, const Dtype* channel_sum) {
-      CUDA_KERNEL_LOOP(index, num * spatial_dim) {
-          int n = index / spatial_dim;
-          int s = index % spatial_dim;
-          for (int c = 0; c < channels; ++c) {
-                data[(n * channels + c) * spatial_dim + s] /= channel_sum[index];
-              }
-        }
+__device__ Dtype L2NBlockSum(Dtype value, Dtype* buffer) {
+  buffer[threadIdx.x] = value;
+  __syncthreads();
+  for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+    if (threadIdx.x < stride) {
+      buffer[threadIdx.x] += buffer[threadIdx.x + stride];
     }
+    __syncthreads();
+  }
+  return buffer[0];
+}
 
+// Without spatial positions one thread per sample leaves the gpu idle, so a
+// block handles each sample and reduces over its channels.
 template <typename Dtype>
-    __global__ void kernel_channel_dot(const int num, const int channels,
-                const int spatial_dim, const Dtype* data_1, const Dtype* data_2,
-                    Dtype* channel_dot) {
-      CUDA_KERNEL_LOOP(index, num * spatial_dim) {
-          int n = index / spatial_dim;
-          int s = index % spatial_dim;
-          Dtype dot = 0;
-          for (int c = 0; c < channels; ++c) {
-                dot += (data_1[(n * channels + c) * spatial_dim + s]
-                                  * data_2[(n * channels + c) * spatial_dim + s]);
-              }
-          channel_dot[index] = dot;
-        }
-    }
+__global__ void L2NForwardVector(const int channels, const Dtype eps,
+    const Dtype* in, Dtype* out, Dtype* inv_norm) {
+  __shared__ Dtype buffer[CAFFE_CUDA_NUM_THREADS];
+  const Dtype* x = in + blockIdx.x * channels;
+  Dtype* y = out + blockIdx.x * channels;
+  Dtype sum = 0;
+  for (int c = threadIdx.x; c < channels; c += blockDim.x) {
+    sum += x[c] * x[c];
+  }
+  const Dtype inv = 1 / sqrt(L2NBlockSum(sum, buffer) + eps);
+  for (int c = threadIdx.x; c < channels; c += blockDim.x) {
+    y[c] = x[c] * inv;
+  }
+  if (threadIdx.x == 0) {
+    inv_norm[blockIdx.x] = inv;
+  }
+}
 
 template <typename Dtype>
-    void L2NLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
-              const  vector<Blob<Dtype>*>& top) {
-      const Dtype* bottom_data = bottom[0]->gpu_data();
-      Dtype* top_data = top[0]->mutable_gpu_data();
-      Dtype* square_data = square_.mutable_gpu_data();
-      Dtype* norm_data = norm_.mutable_gpu_data();
-      int num = bottom[0]->num();
-      int channels = bottom[0]->channels();
-      int spatial_dim = bottom[0]->height() * bottom[0]->width();
-      caffe_copy(bottom[0]->count(), bottom_data, top_data);
-      caffe_copy(bottom[0]->count(), bottom_data, square_data);
-    
-      // square
-      caffe_gpu_powx<Dtype>(bottom[0]->count(), square_data, Dtype(2.0), square_data);
-      //sum cross channel
-      kernel_channel_sum<Dtype><<<CAFFE_GET_BLOCKS(num * spatial_dim),
-          CAFFE_CUDA_NUM_THREADS>>>(num, channels, spatial_dim, square_data,
-                        norm_data);
-      // square root
-      caffe_gpu_powx<Dtype>(num * spatial_dim, norm_data, Dtype(0.5), norm_data);
-      // divide
-      kernel_channel_div<Dtype><<<CAFFE_GET_BLOCKS(num * spatial_dim),
-          CAFFE_CUDA_NUM_THREADS>>>(num, channels, spatial_dim, top_data,
-                        norm_data);
-    }
+__global__ void L2NBackwardVector(const int channels, const Dtype* top_diff,
+    const Dtype* top_data, const Dtype* inv_norm, Dtype* bottom_diff) {
+  __shared__ Dtype buffer[CAFFE_CUDA_NUM_THREADS];
+  const int offset = blockIdx.x * channels;
+  Dtype dot = 0;
+  for (int c = threadIdx.x; c < channels; c += blockDim.x) {
+    dot += top_diff[offset + c] * top_data[offset + c];
+  }
+  dot = L2NBlockSum(dot, buffer);
+  const Dtype inv = inv_norm[blockIdx.x];
+  for (int c = threadIdx.x; c < channels; c += blockDim.x) {
+    bottom_diff[offset + c] = inv
+        * (top_diff[offset + c] - dot * top_data[offset + c]);
+  }
+}
 
 template <typename Dtype>
-    void L2NLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
-                const vector<bool>& propagate_down,
-                const vector<Blob<Dtype>*>& bottom) {
-      const Dtype* top_diff = top[0]->gpu_diff();
-      const Dtype* top_data = top[0]->gpu_data();
-      Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
-      const Dtype* bottom_data = bottom[0]->gpu_data();
-      Dtype* norm_data = norm_.mutable_gpu_data();
-      Dtype* temp_dot_data = temp_dot_.mutable_gpu_data();
-      Dtype* temp_data = square_.mutable_gpu_data();//just reuse the square_
-      int num = top[0]->num();
-      int channels = top[0]->channels();
-      int spatial_dim = top[0]->height() * top[0]->width();
-      caffe_copy(top[0]->count(), top_diff, bottom_diff);
-      caffe_copy(top[0]->count(), bottom_data, temp_data);
-    
-      // b_diff = t_diff / norm - dot(t_diff, t_data) / (norm)^2 * bottom_data
-      // temp_dot_data = dot(t_diff, t_data)
-      kernel_channel_dot<Dtype><<<CAFFE_GET_BLOCKS(num * spatial_dim),
-          CAFFE_CUDA_NUM_THREADS>>>(num, channels, spatial_dim, top_diff, top_data,
-                        temp_dot_data);
-      // temp_dot_data /= (norm)^2
-      caffe_gpu_div<Dtype>(num * spatial_dim, temp_dot_data, norm_data, temp_dot_data);
-      caffe_gpu_div<Dtype>(num * spatial_dim, temp_dot_data, norm_data, temp_dot_data);
-      // bottom_diff = top_diff, bottom_diff /= norm
-      kernel_channel_div<Dtype><<<CAFFE_GET_BLOCKS(num * spatial_dim),
-          CAFFE_CUDA_NUM_THREADS>>>(num, channels, spatial_dim, bottom_diff,
-                        norm_data);
-      // temp_data = bottom_data, temp_data *= temp_dot_data
-      kernel_channel_mul<Dtype><<<CAFFE_GET_BLOCKS(num * spatial_dim),
-          CAFFE_CUDA_NUM_THREADS>>>(num, channels, spatial_dim, temp_data,
-                        temp_dot_data); 
-      // bottom_diff += -temp_data
-      caffe_gpu_axpy<Dtype>(top[0]->count(), Dtype(-1.0), temp_data, 
-                    bottom_diff);
-    }
+void L2NLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->gpu_data();
+  Dtype* top_data = top[0]->mutable_gpu_data();
+  Dtype* inv_norm_data = inv_norm_.mutable_gpu_data();
+  const int num = bottom[0]->num();
+  const int channels = bottom[0]->channels();
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  const Dtype eps = this->layer_param_.l2n_param().eps();
+  if (spatial_dim == 1) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    L2NForwardVector<Dtype><<<num, CAFFE_CUDA_NUM_THREADS>>>(
+        channels, eps, bottom_data, top_data, inv_norm_data);
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    L2NForward<Dtype><<<CAFFE_GET_BLOCKS(num * spatial_dim),
+        CAFFE_CUDA_NUM_THREADS>>>(num, channels, spatial_dim, eps,
+        bottom_data, top_data, inv_norm_data);
+  }
+  CUDA_POST_KERNEL_CHECK;
+}
 
-//INSTANTIATE_CLASS(L2NLayer);
+template <typename Dtype>
+void L2NLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+    const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  const Dtype* top_diff = top[0]->gpu_diff();
+  const Dtype* top_data = top[0]->gpu_data();
+  Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
+  const Dtype* inv_norm_data = inv_norm_.gpu_data();
+  const int num = top[0]->num();
+  const int channels = top[0]->channels();
+  const int spatial_dim = top[0]->height() * top[0]->width();
+  // b_diff = (t_diff - dot(t_diff, t_data) * t_data) / norm
+  if (spatial_dim == 1) {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    L2NBackwardVector<Dtype><<<num, CAFFE_CUDA_NUM_THREADS>>>(
+        channels, top_diff, top_data, inv_norm_data, bottom_diff);
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    L2NBackward<Dtype><<<CAFFE_GET_BLOCKS(num * spatial_dim),
+        CAFFE_CUDA_NUM_THREADS>>>(num, channels, spatial_dim, top_diff,
+        top_data, inv_norm_data, bottom_diff);
+  }
+  CUDA_POST_KERNEL_CHECK;
+}
 
 INSTANTIATE_LAYER_GPU_FUNCS(L2NLayer);
 
@@ -1,3 +1,4 @@
+#include <boost/bind.hpp>
 #include <algorithm>
 #include <vector>
 
@@ -26,15 +27,26 @@ void SoftmaxLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void SoftmaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  Dtype* scale_data = scale_.mutable_cpu_data();
-  int channels = bottom[0]->shape(softmax_axis_);
-  int dim = bottom[0]->count() / outer_num_;
-  caffe_copy(bottom[0]->count(), bottom_data, top_data);
+  const int dim = bottom[0]->count() / outer_num_;
+  Caffe::parallel_for(outer_num_, std::max(Caffe::kParallelGrain / dim, 1),
+      boost::bind(&SoftmaxLayer<Dtype>::Forward_cpu_range, this,
+          bottom[0]->cpu_data(), top[0]->mutable_cpu_data(),
+          scale_.mutable_cpu_data(), sum_multiplier_.cpu_data(), _1, _2));
+}
+
+template <typename Dtype>
+void SoftmaxLayer<Dtype>::Forward_cpu_range(const Dtype* bottom_data,
+    Dtype* top_data, Dtype* scale_data, const Dtype* multiplier_data,
+    int begin, int end) {
+  // each outer index has its own inner_num_ slice of scale_
+  scale_data += begin * inner_num_;
+  int channels = sum_multiplier_.count();
+  int dim = channels * inner_num_;
+  top_data += begin * dim;
+  caffe_copy((end - begin) * dim, bottom_data + begin * dim, top_data);
   // We need to subtract the max to avoid numerical issues, compute the exp,
   // and then normalize.
-  for (int i = 0; i < outer_num_; ++i) {
+  for (int i = begin; i < end; ++i) {
     // initialize scale_data to the first plane
     caffe_copy(inner_num_, bottom_data + i * dim, scale_data);
     for (int j = 0; j < channels; j++) {
@@ -45,17 +57,18 @@ void SoftmaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     }
     // subtraction
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, inner_num_,
-        1, -1., sum_multiplier_.cpu_data(), scale_data, 1., top_data);
+        1, -1., multiplier_data, scale_data, 1., top_data);
     // exponentiation
     caffe_exp<Dtype>(dim, top_data, top_data);
     // sum after exp
     caffe_cpu_gemv<Dtype>(CblasTrans, channels, inner_num_, 1.,
-        top_data, sum_multiplier_.cpu_data(), 0., scale_data);
+        top_data, multiplier_data, 0., scale_data);
     // division
     for (int j = 0; j < channels; j++) {
       caffe_div(inner_num_, top_data, scale_data, top_data);
       top_data += inner_num_;
     }
+    scale_data += inner_num_;
   }
 }
 
@@ -63,14 +76,24 @@ template <typename Dtype>
 void SoftmaxLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
-  const Dtype* top_diff = top[0]->cpu_diff();
-  const Dtype* top_data = top[0]->cpu_data();
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Dtype* scale_data = scale_.mutable_cpu_data();
-  int channels = top[0]->shape(softmax_axis_);
-  int dim = top[0]->count() / outer_num_;
-  caffe_copy(top[0]->count(), top_diff, bottom_diff);
-  for (int i = 0; i < outer_num_; ++i) {
+  const int dim = top[0]->count() / outer_num_;
+  Caffe::parallel_for(outer_num_, std::max(Caffe::kParallelGrain / dim, 1),
+      boost::bind(&SoftmaxLayer<Dtype>::Backward_cpu_range, this,
+          top[0]->cpu_diff(), top[0]->cpu_data(),
+          bottom[0]->mutable_cpu_diff(), scale_.mutable_cpu_data(),
+          sum_multiplier_.cpu_data(), _1, _2));
+}
+
+template <typename Dtype>
+void SoftmaxLayer<Dtype>::Backward_cpu_range(const Dtype* top_diff,
+    const Dtype* top_data, Dtype* bottom_diff, Dtype* scale_data,
+    const Dtype* multiplier_data, int begin, int end) {
+  scale_data += begin * inner_num_;
+  int channels = sum_multiplier_.count();
+  int dim = channels * inner_num_;
+  caffe_copy((end - begin) * dim, top_diff + begin * dim,
+      bottom_diff + begin * dim);
+  for (int i = begin; i < end; ++i) {
     // compute dot(top_diff, top_data) and subtract them from the bottom diff
     for (int k = 0; k < inner_num_; ++k) {
       scale_data[k] = caffe_cpu_strided_dot<Dtype>(channels,
@@ -79,10 +102,12 @@ void SoftmaxLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     }
     // subtraction
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, inner_num_, 1,
-        -1., sum_multiplier_.cpu_data(), scale_data, 1., bottom_diff + i * dim);
+        -1., multiplier_data, scale_data, 1., bottom_diff + i * dim);
+    scale_data += inner_num_;
   }
   // elementwise multiplication
-  caffe_mul(top[0]->count(), bottom_diff, top_data, bottom_diff);
+  caffe_mul((end - begin) * dim, bottom_diff + begin * dim,
+      top_data + begin * dim, bottom_diff + begin * dim);
 }
 
 
@@ -1,6 +1,9 @@
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 
+#include <boost/bind.hpp>
+
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
@@ -12,6 +15,8 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/layers/triplet_image_data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/identity_sampler.hpp"
+#include "caffe/util/image_shards.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -23,60 +28,100 @@ TripletImageDataLayer<Dtype>::~TripletImageDataLayer<Dtype>() {
   this->StopInternalThread();
 }
 
+template <typename Dtype>
+cv::Mat TripletImageDataLayer<Dtype>::ReadImage(int id) const {
+  const TripletImageDataParameter& param =
+      this->layer_param_.triplet_image_data_param();
+  if (!shards_) {
+    cv::Mat cv_img = ReadImageToCVMat(param.root_folder() + image_files_[id],
+        param.new_height(), param.new_width(), param.is_color());
+    CHECK(cv_img.data) << "Could not load " << image_files_[id];
+    return cv_img;
+  }
+  cv::Mat cv_img = DecodeImageToCVMat(shards_->image_data(id),
+      shards_->image_size(id), param.new_height(), param.new_width(),
+      param.is_color());
+  CHECK(cv_img.data) << "Could not decode image at "
+      << shards_->image_offset(id) << " of shard " << shards_->image_shard(id);
+  return cv_img;
+}
+
 template <typename Dtype>
 void TripletImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int new_height = this->layer_param_.triplet_image_data_param().new_height();
   const int new_width  = this->layer_param_.triplet_image_data_param().new_width();
-  const bool is_color  = this->layer_param_.triplet_image_data_param().is_color();
-  string root_folder = this->layer_param_.triplet_image_data_param().root_folder();
 
   const int pair_size = this->layer_param_.triplet_image_data_param().pair_size();
 
   CHECK((new_height == 0 && new_width == 0) ||
       (new_height > 0 && new_width > 0)) << "Current implementation requires "
       "new_height and new_width to be set at the same time.";
-  // Read the file with filenames and labels
-  const string& source = this->layer_param_.triplet_image_data_param().source();
-  LOG(INFO) << "Opening file " << source;
-  std::ifstream infile(source.c_str());
-  string line;
-  size_t pos;
-  int label;
   int image_cnt = 0;
-  while (std::getline(infile, line)) {
-    image_cnt += 1;
-    pos = line.find_last_of(' ');
-    label = atoi(line.substr(pos + 1).c_str());
-
-    if (label2images_.find(label) == label2images_.end())
-      label2images_[label] = vector<std::string>();
-    label2images_[label].push_back(line.substr(0, pos));
+  // label and image ids of every identity of the source
+  vector<int> labels;
+  vector<vector<int> > identity_images;
+  const string& shard_index = this->layer_param_.triplet_image_data_param().shard_index();
+  if (!shard_index.empty()) {
+    LOG(INFO) << "Opening shard index " << shard_index;
+    shards_.reset(new ImageShards(shard_index));
+    labels = shards_->labels();
+    identity_images = shards_->identity_images();
+    image_cnt = shards_->num_images();
+  } else {
+    // Read the file with filenames and labels
+    const string& source = this->layer_param_.triplet_image_data_param().source();
+    LOG(INFO) << "Opening file " << source;
+    std::ifstream infile(source.c_str());
+    string line;
+    size_t pos;
+    int label;
+    map< int, vector<int> > label2images;
+    while (std::getline(infile, line)) {
+      image_cnt += 1;
+      pos = line.find_last_of(' ');
+      label = atoi(line.substr(pos + 1).c_str());
+
+      label2images[label].push_back(image_files_.size());
+      image_files_.push_back(line.substr(0, pos));
+    }
+    map< int, vector<int> >::iterator iter;
+    for (iter = label2images.begin(); iter != label2images.end(); iter++) {
+      labels.push_back(iter->first);
+      identity_images.push_back(vector<int>());
+      identity_images.back().swap(iter->second);
+    }
   }
+  LOG(INFO) << "A total of " << image_cnt << " images of " << labels.size()
+      << " identities.";
 
-  map< int, vector<std::string> >::const_iterator iter;
-  for (iter = label2images_.begin(); iter != label2images_.end(); iter++) {
-    label = iter->first;
-    vector<std::string> images = iter->second;
-    if (images.size() >= pair_size)
-      labels_.push_back(label);
+  // Keep the identities with enough images for a pair group. In data
+  // parallel training every solver samples its own share of them.
+  const int solver_count = this->phase_ == TRAIN ? Caffe::solver_count() : 1;
+  const int solver_rank = this->phase_ == TRAIN ? Caffe::solver_rank() : 0;
+  sampler_.reset(new IdentitySampler(labels, identity_images, pair_size,
+      solver_count, solver_rank));
+  const int num_identities = sampler_->num_identities();
+  if (solver_count > 1) {
+    LOG(INFO) << "Solver " << solver_rank << " of " << solver_count
+        << " samples " << num_identities << " identities.";
   }
 
-  CHECK(!labels_.empty()) << "File is empty";
+  const int batch_size = this->layer_param_.triplet_image_data_param().batch_size();
+  CHECK_GT(batch_size, 0) << "Positive batch size required";
+  const int pair_num = batch_size / pair_size;
+  CHECK_GE(num_identities, pair_num) << "Not enough identities with at least "
+      << pair_size << " images for a batch of " << pair_num << " identities";
 
+  batch_labels_.resize(this->prefetch_threads(), vector<int>(pair_num));
+  batch_images_.resize(this->prefetch_threads(),
+      vector<int>(pair_num * pair_size));
   if (this->layer_param_.triplet_image_data_param().shuffle()) {
     // randomly shuffle data
     LOG(INFO) << "Shuffling data";
     const unsigned int prefetch_rng_seed = caffe_rng_rand();
     prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
-    ShuffleImages();
-  } else {
-    if (this->phase_ == TRAIN && Caffe::solver_rank() > 0 &&
-        this->layer_param_.triplet_image_data_param().rand_skip() == 0) {
-      LOG(WARNING) << "Shuffling or skipping recommended for multi-GPU";
-    }
   }
-  LOG(INFO) << "A total of " << image_cnt << " images.";
 
 //   lines_id_ = 0;
 //   // Check if we would need to randomly skip a few data points
@@ -88,17 +133,12 @@ void TripletImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bo
 //     lines_id_ = skip;
 //   }
 
-  string image_file = label2images_[labels_[0]][0];
   // Read an image, and use it to initialize the top blob.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + image_file,
-                                    new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << image_file;
+  cv::Mat cv_img = ReadImage(sampler_->identity_images()[0][0]);
   // Use data_transformer to infer the expected blob shape from a cv_image.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
   this->transformed_data_.Reshape(top_shape);
   // Reshape prefetch_data and top[0] according to the batch_size.
-  const int batch_size = this->layer_param_.triplet_image_data_param().batch_size();
-  CHECK_GT(batch_size, 0) << "Positive batch size required";
   top_shape[0] = batch_size;
   for (int i = 0; i < this->prefetch_.size(); ++i) {
     this->prefetch_[i]->data_.Reshape(top_shape);
@@ -114,50 +154,62 @@ void TripletImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bo
   for (int i = 0; i < this->prefetch_.size(); ++i) {
     this->prefetch_[i]->label_.Reshape(label_shape);
   }
+
+  const int decode_threads =
+      this->layer_param_.triplet_image_data_param().decode_threads();
+  if (decode_threads > 1) {
+    LOG(INFO) << "Decoding images with " << decode_threads << " threads";
+    for (int i = 0; i < decode_threads; ++i) {
+      decode_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+          new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+      decode_data_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    }
+    decode_pool_.reset(new ThreadPool(decode_threads));
+    group_seeds_.resize(this->prefetch_threads(),
+        vector<unsigned int>(pair_num));
+  }
 }
 
 template <typename Dtype>
-void TripletImageDataLayer<Dtype>::ShuffleImages() {
-  caffe::rng_t* prefetch_rng =
-      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
-//   shuffle(lines_.begin(), lines_.end(), prefetch_rng);
-
-  const int pair_size = this->layer_param_.triplet_image_data_param().pair_size();
-  const int batch_size = this->layer_param_.triplet_image_data_param().batch_size();
-  const int pair_num = batch_size / pair_size;
-  shuffle(labels_.begin(), labels_.end(), prefetch_rng);
-  for (int i = 0; i < pair_num; i++)
-    shuffle(label2images_[labels_[i]].begin(), label2images_[labels_[i]].end(), prefetch_rng);
+void TripletImageDataLayer<Dtype>::SampleBatch(int thread_id) {
+  caffe::rng_t* prefetch_rng = prefetch_rng_ ?
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator()) : NULL;
+  sampler_->Sample(prefetch_rng, &batch_labels_[thread_id],
+      &batch_images_[thread_id]);
 }
 
 // This function is called on prefetch thread
 template <typename Dtype>
-void TripletImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+void TripletImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch,
+    int thread_id) {
   CPUTimer batch_timer;
   batch_timer.Start();
   double read_time = 0;
   double trans_time = 0;
-  CPUTimer timer;
   CHECK(batch->data_.count());
-  CHECK(this->transformed_data_.count());
+  Blob<Dtype>* transformed_data = this->transformed_data(thread_id);
+  CHECK(transformed_data->count());
   TripletImageDataParameter triplet_image_data_param = this->layer_param_.triplet_image_data_param();
   const int batch_size = triplet_image_data_param.batch_size();
-  const int new_height = triplet_image_data_param.new_height();
-  const int new_width = triplet_image_data_param.new_width();
-  const bool is_color = triplet_image_data_param.is_color();
-  string root_folder = triplet_image_data_param.root_folder();
   const int pair_size = triplet_image_data_param.pair_size();
   const int pair_num = batch_size / pair_size;
 
-  string image_file = label2images_[labels_[0]][0];
+  SampleBatch(thread_id);
+  if (decode_pool_) {
+    // draw the seeds in pair group order, so that the batch does not depend
+    // on which thread decodes which group
+    for (int i = 0; i < pair_num; i++)
+      group_seeds_[thread_id][i] = caffe_rng_rand();
+  }
+  this->ReadDone(thread_id);
+
   // Reshape according to the first image of each batch
   // on single input batches allows for inputs of varying dimension.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + image_file,
-      new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << image_file;
+  cv::Mat cv_img = ReadImage(batch_images_[thread_id][0]);
   // Use data_transformer to infer the expected blob shape from a cv_img.
-  vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
-  this->transformed_data_.Reshape(top_shape);
+  DataTransformer<Dtype>* transformer = this->transformer(thread_id);
+  vector<int> top_shape = transformer->InferBlobShape(cv_img);
+  transformed_data->Reshape(top_shape);
   // Reshape batch according to the batch_size.
   top_shape[0] = batch_size;
   batch->data_.Reshape(top_shape);
@@ -165,35 +217,71 @@ void TripletImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   Dtype* prefetch_data = batch->data_.mutable_cpu_data();
   Dtype* prefetch_label = batch->label_.mutable_cpu_data();
 
-  for (int i = 0; i < pair_num; i++) {
-    int label = labels_[i];
-    for (int j = 0; j < pair_size; j++) {
-      timer.Start();
-      cv::Mat cv_img = ReadImageToCVMat(root_folder + label2images_[label][j],
-          new_height, new_width, is_color);
-      CHECK(cv_img.data) << "Could not load " << label2images_[label][j];
-      read_time += timer.MicroSeconds();
-      timer.Start();
-    
-      // Apply transformations (mirror, crop...) to the image
-      int item_id = i*pair_size + j;
-      int offset = batch->data_.offset(item_id);
-      this->transformed_data_.set_cpu_data(prefetch_data + offset);
-      this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-      trans_time += timer.MicroSeconds();
-
-      prefetch_label[item_id] = label;
+  if (decode_pool_) {
+    vector<double> read_times(decode_pool_->size(), 0);
+    vector<double> trans_times(decode_pool_->size(), 0);
+    decode_pool_->Run(boost::bind(
+        &TripletImageDataLayer<Dtype>::DecodePairGroups, this, _1, thread_id,
+        prefetch_data, prefetch_label, &read_times, &trans_times));
+    for (int t = 0; t < decode_pool_->size(); ++t) {
+      read_time += read_times[t];
+      trans_time += trans_times[t];
     }
+  } else {
+    for (int i = 0; i < pair_num; i++)
+      DecodePairGroup(thread_id, i, transformer, transformed_data,
+          prefetch_data, prefetch_label, &read_time, &trans_time);
   }
 
-  ShuffleImages();
-  
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+template <typename Dtype>
+void TripletImageDataLayer<Dtype>::DecodePairGroup(int prefetch_id, int i,
+    DataTransformer<Dtype>* transformer, Blob<Dtype>* transformed_data,
+    Dtype* prefetch_data, Dtype* prefetch_label, double* read_time,
+    double* trans_time) {
+  CPUTimer timer;
+  const int pair_size = this->layer_param_.triplet_image_data_param().pair_size();
+
+  const int label = batch_labels_[prefetch_id][i];
+  for (int j = 0; j < pair_size; j++) {
+    timer.Start();
+    cv::Mat cv_img = ReadImage(batch_images_[prefetch_id][i*pair_size + j]);
+    *read_time += timer.MicroSeconds();
+    timer.Start();
+
+    // Apply transformations (mirror, crop...) to the image
+    int item_id = i*pair_size + j;
+    int offset = item_id * transformed_data->count();
+    transformed_data->set_cpu_data(prefetch_data + offset);
+    transformer->Transform(cv_img, transformed_data);
+    *trans_time += timer.MicroSeconds();
+
+    prefetch_label[item_id] = label;
+  }
+}
+
+template <typename Dtype>
+void TripletImageDataLayer<Dtype>::DecodePairGroups(int thread_id,
+    int prefetch_id, Dtype* prefetch_data, Dtype* prefetch_label,
+    vector<double>* read_times, vector<double>* trans_times) {
+  const int pair_num = this->layer_param_.triplet_image_data_param().batch_size()
+      / this->layer_param_.triplet_image_data_param().pair_size();
+  DataTransformer<Dtype>* transformer = decode_transformers_[thread_id].get();
+  Blob<Dtype>* transformed_data = decode_data_[thread_id].get();
+  transformed_data->Reshape(this->transformed_data(prefetch_id)->shape());
+  for (int i = thread_id; i < pair_num; i += decode_pool_->size()) {
+    transformer->InitRand(group_seeds_[prefetch_id][i]);
+    DecodePairGroup(prefetch_id, i, transformer, transformed_data,
+        prefetch_data, prefetch_label, &(*read_times)[thread_id],
+        &(*trans_times)[thread_id]);
+  }
+}
+
 INSTANTIATE_CLASS(TripletImageDataLayer);
 REGISTER_LAYER_CLASS(TripletImageData);
 
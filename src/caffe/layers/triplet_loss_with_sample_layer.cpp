@@ -15,6 +15,16 @@ namespace caffe {
 		return caffe_rng_rand() % i;
 	}
 
+	template <typename Dtype>
+	void TripletLossWithSampleLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+			const vector<Blob<Dtype>*>& top) {
+		LossLayer<Dtype>::LayerSetUp(bottom, top);
+
+		TripletLossWithSampleParameter loss_param = this->layer_param_.triplet_loss_with_sample_param();
+		CHECK(loss_param.memory_bank_size() == 0 || loss_param.memory_bank_batches() == 0)
+			<< "Specify the memory bank by memory_bank_size or memory_bank_batches, not both.";
+	}
+
 	template <typename Dtype>
 	void TripletLossWithSampleLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 			const vector<Blob<Dtype>*>& top) {
@@ -25,7 +35,77 @@ namespace caffe {
 		int pair_size = loss_param.pair_size();
 
 		dist_.Reshape(bottom[0]->num(), bottom[0]->num(), 1, 1);
+		norm_.Reshape(bottom[0]->num(), 1, 1, 1);
+		// buffers of the gpu path, only allocated when first touched
 		flag_.Reshape(bottom[0]->num(), pair_size, bottom[0]->num(), 1);
+		rand_key_.ReshapeLike(flag_);
+		flag_sum_.Reshape(bottom[0]->num(), pair_size, 1, 1);
+		sum_multiplier_.Reshape(bottom[0]->num(), 1, 1, 1);
+
+		// the bank keeps the current batch next to the earlier ones, so that
+		// slots used as negatives are only overwritten by the next forward
+		int num = bottom[0]->num();
+		int dim = bottom[0]->count() / num;
+		int bank_size = loss_param.memory_bank_size();
+		if (loss_param.memory_bank_batches() > 0)
+			bank_size = loss_param.memory_bank_batches() * num;
+		int capacity = bank_size > 0 ? bank_size + num : 0;
+		if (capacity != bank_capacity_ || bank_feat_.count() != capacity * dim) {
+			bank_capacity_ = capacity;
+			bank_next_ = 0;
+			bank_filled_ = 0;
+			if (capacity > 0) {
+				bank_feat_.Reshape(capacity, dim, 1, 1);
+				bank_label_.Reshape(capacity, 1, 1, 1);
+				bank_norm_.Reshape(capacity, 1, 1, 1);
+				bank_dist_.Reshape(num, capacity, 1, 1);
+			}
+		}
+	}
+
+	template <typename Dtype>
+	bool TripletLossWithSampleLayer<Dtype>::bank_slot_valid(int b, int num) const {
+		if (b >= bank_filled_)
+			return false;
+		// the current batch sits in the num slots before bank_next_
+		int batch_start = (bank_next_ - num + bank_capacity_) % bank_capacity_;
+		return (b - batch_start + bank_capacity_) % bank_capacity_ >= num;
+	}
+
+	template <typename Dtype>
+	void TripletLossWithSampleLayer<Dtype>::update_memory_bank(const vector<Blob<Dtype>*>& bottom) {
+		const Dtype* bottom_data = bottom[0]->cpu_data();
+		const Dtype* label = bottom[1]->cpu_data();
+		int num = bottom[0]->num();
+		int dim = bottom[0]->count() / num;
+		const int capacity = bank_capacity_;
+		const bool euclidean = this->layer_param_.triplet_loss_with_sample_param().distance()
+			== TripletLossWithSampleParameter_Distance_EUCLIDEAN;
+
+		Dtype* bank_feat = bank_feat_.mutable_cpu_data();
+		Dtype* bank_label = bank_label_.mutable_cpu_data();
+		Dtype* bank_norm = bank_norm_.mutable_cpu_data();
+		const Dtype* norm_data = norm_.cpu_data();
+		for (int i = 0; i < num; i++) {
+			int b = (bank_next_ + i) % capacity;
+			caffe_copy(dim, bottom_data + i*dim, bank_feat + b*dim);
+			bank_label[b] = label[i];
+			if (euclidean)
+				bank_norm[b] = norm_data[i];
+		}
+		bank_next_ = (bank_next_ + num) % capacity;
+		bank_filled_ = min(bank_filled_ + num, capacity);
+
+		// distances to every slot; the ones of the current batch or not yet
+		// written are never read
+		Dtype* bank_dist = bank_dist_.mutable_cpu_data();
+		caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num, capacity, dim,
+				Dtype(euclidean ? -2 : -1), bottom_data, bank_feat, Dtype(0), bank_dist);
+		if (euclidean) {
+			for (int i = 0; i < num; i++)
+				for (int b = 0; b < capacity; b++)
+					bank_dist[i*capacity + b] += norm_data[i] + bank_norm[b];
+		}
 	}
 
 	template <typename Dtype>
@@ -47,34 +127,39 @@ namespace caffe {
 		int random_num = num_negative * random_ratio;
 
 		Dtype* dist_data = this->dist_.mutable_cpu_data();
-		Dtype* flag_data = this->flag_.mutable_cpu_data();
-		for (int i = 0; i < num * num; i++)
-			dist_data[i] = 0;
-		for (int i = 0; i < num * pair_size * num; i++)
-			flag_data[i] = 0;
+		triplets_.clear();
+
+		// calculate the distance matrix with a single GEMM over the features
+		if (loss_param.distance() == TripletLossWithSampleParameter_Distance_EUCLIDEAN) {
+			// dist(i, j) = ||x_i||^2 + ||x_j||^2 - 2 * <x_i, x_j>
+			caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num, num, dim,
+					Dtype(-2), bottom_data, bottom_data, Dtype(0), dist_data);
+			Dtype* norm_data = this->norm_.mutable_cpu_data();
+			for (int i = 0; i < num; i++)
+				norm_data[i] = Dtype(-0.5) * dist_data[i*num + i];
+			for (int i = 0; i < num; i++)
+				for (int j = 0; j < num; j++)
+					dist_data[i*num + j] += norm_data[i] + norm_data[j];
+		} else {
+			// dist(i, j) = -<x_i, x_j>
+			caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num, num, dim,
+					Dtype(-1), bottom_data, bottom_data, Dtype(0), dist_data);
+		}
 
-		// calculate the distance
-		for (int i = 0; i < num; i++) {
-			const Dtype* feat_i = bottom_data + (i*dim);
-			for (int j = i+1; j < num; j++) {
-				const Dtype* feat_j = bottom_data + (j*dim);
-				Dtype dist = 0.0;
-				for (int d = 0; d < dim; d++)
-					dist -= feat_i[d] * feat_j[d];
-				// Dtype dist = -caffe_cpu_dot(dim, bottom_data + (i*dim), bottom_data + (j*dim));
-				dist_data[i*num + j] = dist;
-				dist_data[j*num + i] = dist;
-			}
+		const int capacity = bank_capacity_;
+		const Dtype* bank_label = NULL;
+		const Dtype* bank_dist = NULL;
+		if (capacity > 0) {
+			update_memory_bank(bottom);
+			bank_label = bank_label_.cpu_data();
+			bank_dist = bank_dist_.cpu_data();
 		}
 
 		vector<int> hard_neg_ids;
 		vector<int> random_neg_ids;
+		vector<int> selected_ids;
 		vector< pair<Dtype, int> > neg_pairs;
 		for (int i = 0; i < num; i++) {
-			neg_pairs.clear();
-			hard_neg_ids.clear();
-			random_neg_ids.clear();
-
 			int pair_id = i / pair_size;
 			for (int k = pair_id*pair_size; k < (pair_id+1)*pair_size; k++) {
 				if (label[k] != label[i])
@@ -84,6 +169,11 @@ namespace caffe {
 				if (k == i)
 					continue;
 
+				neg_pairs.clear();
+				hard_neg_ids.clear();
+				random_neg_ids.clear();
+				selected_ids.clear();
+
 				for (int j = 0; j < num; j++) {
 					if (label[j] == label[i])
 						continue;
@@ -93,33 +183,52 @@ namespace caffe {
 						neg_pairs.push_back(make_pair(dist_data[i*num + j], j));
 				}
 
-				//when num_negative equals to 0, we should consider all the negative samples.
-				if (num_negative == 0 || neg_pairs.size() <= num_negative) {
-					for (int j = 0; j < neg_pairs.size(); j++) {
-						int id = neg_pairs[j].second;
+				// samples of earlier batches in the memory bank, as num + slot
+				for (int b = 0; b < capacity; b++) {
+					if (!bank_slot_valid(b, num) || bank_label[b] == label[i])
+						continue;
 
-						//the negative sample j is selected by the positive pair <i, k>
-						flag_data[i*pair_size*num + (k%pair_size)*num + id] = 1;
-					}
+					Dtype dist = margin + dist_data[i*num + k] - bank_dist[i*capacity + b];
+					if (dist > Dtype(0.0))
+						neg_pairs.push_back(make_pair(bank_dist[i*capacity + b], num + b));
+				}
 
-					continue;
+				//when num_negative equals to 0, we should consider all the negative samples.
+				if (num_negative == 0 || neg_pairs.size() <= num_negative) {
+					for (int j = 0; j < neg_pairs.size(); j++)
+						selected_ids.push_back(neg_pairs[j].second);
+				} else {
+					sort(neg_pairs.begin(), neg_pairs.end());
+					for (int j = 0; j < num_negative; j++)
+						hard_neg_ids.push_back(neg_pairs[j].second);
+					for (int j = num_negative; j < neg_pairs.size(); j++)
+						random_neg_ids.push_back(neg_pairs[j].second);
+
+					std::random_shuffle(hard_neg_ids.begin(), hard_neg_ids.end(), random_func);
+					for (int j = 0; j < min(hard_num, (int)hard_neg_ids.size()); j++)
+						selected_ids.push_back(hard_neg_ids[j]);
+
+					for (int j = hard_num; j < hard_neg_ids.size(); j++)
+						random_neg_ids.push_back(hard_neg_ids[j]);
+					std::random_shuffle(random_neg_ids.begin(), random_neg_ids.end(), random_func);
+					for (int j = 0; j < min(random_num, (int)random_neg_ids.size()); j++)
+						selected_ids.push_back(random_neg_ids[j]);
+
+					// keep the list in sample order, like a scan over all negatives
+					sort(selected_ids.begin(), selected_ids.end());
 				}
 
-				sort(neg_pairs.begin(), neg_pairs.end());
-				for (int j = 0; j < num_negative; j++)
-					hard_neg_ids.push_back(neg_pairs[j].second);
-				for (int j = num_negative; j < neg_pairs.size(); j++)
-					random_neg_ids.push_back(neg_pairs[j].second);
-
-				std::random_shuffle(hard_neg_ids.begin(), hard_neg_ids.end(), random_func);
-				for (int j = 0; j < min(hard_num, (int)hard_neg_ids.size()); j++)
-					flag_data[i*pair_size*num + (k%pair_size)*num + hard_neg_ids[j]] = 1;
-
-				for (int j = hard_num; j < hard_neg_ids.size(); j++)
-					random_neg_ids.push_back(hard_neg_ids[j]);
-				std::random_shuffle(random_neg_ids.begin(), random_neg_ids.end(), random_func);
-				for (int j = 0; j < min(random_num, (int)random_neg_ids.size()); j++)
-					flag_data[i*pair_size*num + (k%pair_size)*num + random_neg_ids[j]] = 1;
+				//the negative sample j is selected by the positive pair <i, k>
+				for (int j = 0; j < selected_ids.size(); j++) {
+					int neg = selected_ids[j];
+					Triplet triplet;
+					triplet.anchor = i;
+					triplet.positive = k;
+					triplet.negative = neg;
+					triplet.violation = margin + dist_data[i*num + k]
+						- (neg < num ? dist_data[i*num + neg] : bank_dist[i*capacity + neg - num]);
+					triplets_.push_back(triplet);
+				}
 			}
 		}
 	}
@@ -128,45 +237,13 @@ namespace caffe {
 	void TripletLossWithSampleLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 			const vector<Blob<Dtype>*>& top) {
 
-		int num = bottom[0]->num();
-		const Dtype* label = bottom[1]->cpu_data();
-
-		const Dtype* dist_data = this->dist_.cpu_data();
-		const Dtype* flag_data = this->flag_.cpu_data();
-
-		TripletLossWithSampleParameter loss_param = this->layer_param_.triplet_loss_with_sample_param();
-		Dtype margin = loss_param.margin();
-		int pair_size = loss_param.pair_size();
-
 		select_triplet(bottom);
 
+		//<a, p, n>
 		Dtype loss(0.0);
-		Dtype dist(0.0);
-		int triplet_count = 0;
-		for (int i = 0; i < num; i++) {
-			int pair_id = i / pair_size;
-			for (int k = pair_id*pair_size; k < (pair_id+1)*pair_size; k++) {
-				if (label[k] != label[i])
-					continue;
-
-				// do not consider <a, a, n> triplets
-				if (k == i)
-					continue;
-
-				for (int j = 0; j < num; j++) {
-					//the negative sample j is selected by the positive pair <i, k>
-					if (flag_data[i*pair_size*num + (k%pair_size)*num + j] == 0)
-						continue;
-
-					//<a, p, n>
-					dist = margin + dist_data[i*num + k] - dist_data[i*num + j];
-					if (dist > Dtype(0.0)) {
-						loss += dist;
-						triplet_count += 1;
-					}
-				}
-			}
-		}
+		int triplet_count = triplets_.size();
+		for (int t = 0; t < triplet_count; t++)
+			loss += triplets_[t].violation;
 
 		if (triplet_count != 0)
 			loss = loss / triplet_count;
@@ -184,67 +261,72 @@ namespace caffe {
 
 		const Dtype* bottom_data = bottom[0]->cpu_data();
 		Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-		const Dtype* label = bottom[1]->cpu_data();
 
 		int count = bottom[0]->count();
 		int num = bottom[0]->num();
 		int dim = count / num;
 
-		const Dtype* dist_data = this->dist_.cpu_data();
-		const Dtype* flag_data = this->flag_.cpu_data();
-
 		TripletLossWithSampleParameter loss_param = this->layer_param_.triplet_loss_with_sample_param();
-		Dtype margin = loss_param.margin();
-		int pair_size = loss_param.pair_size();
-
-		for (int i = 0; i < count; i++)
-			bottom_diff[i] = 0;
-
-		Dtype dist(0.0);
-		int triplet_count = 0;
-		for (int i = 0; i < num; i++) {
-			const Dtype* anc_feat = bottom_data + i*dim;
-			Dtype* anc_diff = bottom_diff + i*dim;
-
-			int pair_id = i / pair_size;
-			for (int k = pair_id*pair_size; k < (pair_id+1)*pair_size; k++) {
-				if (label[k] != label[i])
-					continue;
+		const bool euclidean =
+			loss_param.distance() == TripletLossWithSampleParameter_Distance_EUCLIDEAN;
 
-				// do not consider <a, a, n> triplets
-				if (k == i)
-					continue;
+		int triplet_count = triplets_.size();
+		if (triplet_count == 0) {
+			caffe_set(count, Dtype(0), bottom_diff);
+			return;
+		}
 
-				const Dtype* pos_feat = bottom_data + k*dim;
-				Dtype* pos_diff = bottom_diff + k*dim;
+		// Every <a, p, n> adds 1 to dL/ddist(a, p) and -1 to dL/ddist(a, n).
+		// The diff of dist_ gathers coeff = dL/ddist + dL/ddist^T, so the
+		// gradient of all triplets is one product of coeff with the features.
+		// Negatives from the memory bank are constants: only dL/ddist goes to
+		// the diff of bank_dist_, and its product with the bank features
+		// reaches the anchors.
+		Dtype* coeff = this->dist_.mutable_cpu_diff();
+		caffe_set(num * num, Dtype(0), coeff);
+		const int capacity = bank_capacity_;
+		Dtype* bank_coeff = NULL;
+		if (capacity > 0) {
+			bank_coeff = bank_dist_.mutable_cpu_diff();
+			caffe_set(num * capacity, Dtype(0), bank_coeff);
+		}
+		for (int t = 0; t < triplet_count; t++) {
+			const Triplet& triplet = triplets_[t];
+			coeff[triplet.anchor*num + triplet.positive] += 1;
+			coeff[triplet.positive*num + triplet.anchor] += 1;
+			if (triplet.negative < num) {
+				coeff[triplet.anchor*num + triplet.negative] -= 1;
+				coeff[triplet.negative*num + triplet.anchor] -= 1;
+			} else {
+				bank_coeff[triplet.anchor*capacity + triplet.negative - num] -= 1;
+			}
+		}
 
+		const Dtype loss_weight = top[0]->cpu_diff()[0];
+		// d(-<a, b>)/da = -b
+		Dtype alpha = -loss_weight / triplet_count;
+		if (euclidean) {
+			// d||a - b||^2/da = 2 * (a - b), i.e. coeff = diag(coeff * 1) - coeff
+			for (int i = 0; i < num; i++) {
+				Dtype* coeff_row = coeff + i*num;
+				Dtype row_sum = 0;
 				for (int j = 0; j < num; j++) {
-					//the negative sample j is selected by the positive pair <i, k>
-					if (flag_data[i*pair_size*num + (k%pair_size)*num + j] == 0)
-						continue;
-
-					const Dtype* neg_feat = bottom_data + j*dim;
-					Dtype* neg_diff = bottom_diff + j*dim;
-
-					//<a, p, n>
-					dist = margin + dist_data[i*num + k] - dist_data[i*num + j];
-					if (dist > Dtype(0.0)) {
-						triplet_count += 1;
-						for (int d = 0; d < dim; d++) {
-							anc_diff[d] += (neg_feat[d] - pos_feat[d]);
-							pos_diff[d] += -anc_feat[d];
-							neg_diff[d] += anc_feat[d];
-						}
-					}
+					row_sum += coeff_row[j];
+					coeff_row[j] = -coeff_row[j];
 				}
+				for (int b = 0; b < capacity; b++)
+					row_sum += bank_coeff[i*capacity + b];
+				coeff_row[i] += row_sum;
 			}
+			alpha = 2 * loss_weight / triplet_count;
+		}
+		caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, num,
+				alpha, coeff, bottom_data, Dtype(0), bottom_diff);
+		if (capacity > 0) {
+			caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, capacity,
+					euclidean ? -alpha : alpha, bank_coeff, bank_feat_.cpu_data(),
+					Dtype(1), bottom_diff);
 		}
-
-		const Dtype loss_weight = 1.0;
-		//const Dtype loss_weight = top[0]->cpu_diff()[0];
-		for (int i = 0; i < count; i++)
-			if (triplet_count != 0)
-				bottom_diff[i] = bottom_diff[i] * loss_weight / triplet_count;
 	}
 
 #ifdef CPU_ONLY
@@ -5,20 +5,322 @@
 
 namespace caffe {
 
+	template <typename Dtype>
+	__global__ void TripletCopyDiagonal(const int num, const Dtype alpha,
+			const Dtype* dist, Dtype* norm) {
+		CUDA_KERNEL_LOOP(i, num) {
+			norm[i] = alpha * dist[i*num + i];
+		}
+	}
+
+	template <typename Dtype>
+	__global__ void TripletAddNorms(const int count, const int num,
+			const Dtype* norm, Dtype* dist) {
+		CUDA_KERNEL_LOOP(index, count) {
+			dist[index] += norm[index / num] + norm[index % num];
+		}
+	}
+
+	// orders two candidate negatives by value, breaking ties by index like
+	// std::sort over pair<Dtype, int> does on the cpu
+	template <typename Dtype>
+	__device__ inline bool triplet_less(const Dtype va, const int a,
+			const Dtype vb, const int b) {
+		return va < vb || (va == vb && a < b);
+	}
+
+	// One block mines the negatives of one (anchor, positive) row of flag_.
+	// Selection follows select_triplet: all violating negatives when
+	// num_negative is 0 or there are few of them, otherwise hard_num picked at
+	// random among the num_negative hardest ones and random_num picked at
+	// random among the rest. Random picks take the candidates with the smallest
+	// rand_key, which is a uniformly random subset like a shuffled prefix.
+	template <typename Dtype>
+	__global__ void TripletSelect(const int num, const int pair_size,
+			const Dtype margin, const int num_negative, const int hard_num,
+			const int random_num, const Dtype* label, const Dtype* dist,
+			const Dtype* rand_key, Dtype* state, Dtype* flag) {
+		const int row = blockIdx.x;
+		const int i = row / pair_size;
+		const int k = (i / pair_size) * pair_size + row % pair_size;
+		const Dtype* dist_row = dist + i * num;
+		const Dtype* key_row = rand_key + row * num;
+		Dtype* state_row = state + row * num;
+		Dtype* flag_row = flag + row * num;
+
+		// do not consider <a, a, n> triplets
+		if (k >= num || k == i || label[k] != label[i]) {
+			for (int j = threadIdx.x; j < num; j += blockDim.x)
+				flag_row[j] = 0;
+			return;
+		}
+
+		const Dtype pos_dist = margin + dist_row[k];
+		int violated = 0;
+		for (int j = 0; j < num; j++)
+			if (label[j] != label[i] && pos_dist - dist_row[j] > Dtype(0.0))
+				violated += 1;
+
+		//when num_negative equals to 0, we should consider all the negative samples.
+		if (num_negative == 0 || violated <= num_negative) {
+			for (int j = threadIdx.x; j < num; j += blockDim.x)
+				flag_row[j] = (label[j] != label[i] &&
+						pos_dist - dist_row[j] > Dtype(0.0)) ? 1 : 0;
+			return;
+		}
+
+		// rank of every violating negative, the hardest one first
+		for (int j = threadIdx.x; j < num; j += blockDim.x) {
+			Dtype rank = -1;
+			if (label[j] != label[i] && pos_dist - dist_row[j] > Dtype(0.0)) {
+				rank = 0;
+				for (int l = 0; l < num; l++)
+					if (label[l] != label[i] && pos_dist - dist_row[l] > Dtype(0.0) &&
+							triplet_less(dist_row[l], l, dist_row[j], j))
+						rank += 1;
+			}
+			flag_row[j] = rank;
+		}
+		__syncthreads();
+
+		// state: 0 not violating, 1 random candidate, 2 picked as hard negative
+		for (int j = threadIdx.x; j < num; j += blockDim.x) {
+			const Dtype rank = flag_row[j];
+			Dtype s = 0;
+			if (rank >= 0) {
+				s = 1;
+				if (rank < num_negative) {
+					int key_rank = 0;
+					for (int l = 0; l < num; l++)
+						if (flag_row[l] >= 0 && flag_row[l] < num_negative &&
+								triplet_less(key_row[l], l, key_row[j], j))
+							key_rank += 1;
+					if (key_rank < hard_num)
+						s = 2;
+				}
+			}
+			state_row[j] = s;
+		}
+		__syncthreads();
+
+		for (int j = threadIdx.x; j < num; j += blockDim.x) {
+			const Dtype s = state_row[j];
+			bool selected = (s == 2);
+			if (s == 1) {
+				int key_rank = 0;
+				for (int l = 0; l < num; l++)
+					if (state_row[l] == 1 && triplet_less(key_row[l], l, key_row[j], j))
+						key_rank += 1;
+				selected = key_rank < random_num;
+			}
+			flag_row[j] = selected ? 1 : 0;
+		}
+	}
+
+	template <typename Dtype>
+	__global__ void TripletLossForward(const int count, const int num,
+			const int pair_size, const Dtype margin, const Dtype* dist,
+			const Dtype* flag, Dtype* loss) {
+		CUDA_KERNEL_LOOP(index, count) {
+			const int j = index % num;
+			const int row = index / num;
+			const int i = row / pair_size;
+			const int k = (i / pair_size) * pair_size + row % pair_size;
+			Dtype value = 0;
+			if (flag[index] != 0) {
+				//<a, p, n>
+				value = margin + dist[i*num + k] - dist[i*num + j];
+				if (value < Dtype(0.0))
+					value = 0;
+			}
+			loss[index] = value;
+		}
+	}
+
+	// coeff(a, b) = dL/ddist(a, b) + dL/ddist(b, a), gathered from flag_ so no
+	// atomics are needed: every selected <i, k, j> adds 1 to dL/ddist(i, k)
+	// and -1 to dL/ddist(i, j).
+	template <typename Dtype>
+	__global__ void TripletPairCoeff(const int count, const int num,
+			const int pair_size, const Dtype* flag, const Dtype* flag_sum,
+			Dtype* coeff) {
+		CUDA_KERNEL_LOOP(index, count) {
+			const int a = index / num;
+			const int b = index % num;
+			Dtype value = 0;
+			if (a / pair_size == b / pair_size) {
+				value += flag_sum[a*pair_size + b % pair_size];
+				value += flag_sum[b*pair_size + a % pair_size];
+			}
+			for (int p = 0; p < pair_size; p++) {
+				value -= flag[(a*pair_size + p)*num + b];
+				value -= flag[(b*pair_size + p)*num + a];
+			}
+			coeff[index] = value;
+		}
+	}
+
+	// coeff = diag(coeff * 1) - coeff, the chain rule through the squared
+	// euclidean distance
+	template <typename Dtype>
+	__global__ void TripletEuclideanCoeff(const int count, const int num,
+			const Dtype* row_sum, Dtype* coeff) {
+		CUDA_KERNEL_LOOP(index, count) {
+			const int a = index / num;
+			const int b = index % num;
+			coeff[index] = (a == b ? row_sum[a] : Dtype(0)) - coeff[index];
+		}
+	}
+
+	template <typename Dtype>
+	void TripletLossWithSampleLayer<Dtype>::select_triplet_gpu(
+			const vector<Blob<Dtype>*>& bottom) {
+		const Dtype* bottom_data = bottom[0]->gpu_data();
+		const Dtype* label = bottom[1]->gpu_data();
+		int count = bottom[0]->count();
+		int num = bottom[0]->num();
+		int dim = count / num;
+
+		TripletLossWithSampleParameter loss_param = this->layer_param_.triplet_loss_with_sample_param();
+		int num_negative = loss_param.num_negative();
+		Dtype random_ratio = loss_param.random_ratio();
+		Dtype hard_ratio = loss_param.hard_ratio();
+		Dtype margin = loss_param.margin();
+		int pair_size = loss_param.pair_size();
+
+		int hard_num = num_negative * hard_ratio;
+		int random_num = num_negative * random_ratio;
+
+		Dtype* dist_data = this->dist_.mutable_gpu_data();
+		if (loss_param.distance() == TripletLossWithSampleParameter_Distance_EUCLIDEAN) {
+			caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num, num, dim,
+					Dtype(-2), bottom_data, bottom_data, Dtype(0), dist_data);
+			Dtype* norm_data = this->norm_.mutable_gpu_data();
+			// NOLINT_NEXT_LINE(whitespace/operators)
+			TripletCopyDiagonal<Dtype><<<CAFFE_GET_BLOCKS(num), CAFFE_CUDA_NUM_THREADS>>>(
+					num, Dtype(-0.5), dist_data, norm_data);
+			CUDA_POST_KERNEL_CHECK;
+			// NOLINT_NEXT_LINE(whitespace/operators)
+			TripletAddNorms<Dtype><<<CAFFE_GET_BLOCKS(num * num), CAFFE_CUDA_NUM_THREADS>>>(
+					num * num, num, norm_data, dist_data);
+			CUDA_POST_KERNEL_CHECK;
+		} else {
+			caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num, num, dim,
+					Dtype(-1), bottom_data, bottom_data, Dtype(0), dist_data);
+		}
+
+		Dtype* rand_key = NULL;
+		Dtype* state = NULL;
+		if (num_negative > 0) {
+			rand_key = this->rand_key_.mutable_gpu_data();
+			state = this->rand_key_.mutable_gpu_diff();
+			caffe_gpu_rng_uniform<Dtype>(this->rand_key_.count(), Dtype(0), Dtype(1),
+					rand_key);
+		}
+		// NOLINT_NEXT_LINE(whitespace/operators)
+		TripletSelect<Dtype><<<num * pair_size, CAFFE_CUDA_NUM_THREADS>>>(
+				num, pair_size, margin, num_negative, hard_num, random_num, label,
+				dist_data, rand_key, state, this->flag_.mutable_gpu_data());
+		CUDA_POST_KERNEL_CHECK;
+	}
+
 	template <typename Dtype>
 	void TripletLossWithSampleLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
-	    const vector<Blob<Dtype>*>& top) {
-	    
-	  Forward_cpu(bottom, top);
+			const vector<Blob<Dtype>*>& top) {
+		// mining against the memory bank runs on the cpu
+		if (bank_capacity_ > 0) {
+			Forward_cpu(bottom, top);
+			return;
+		}
+
+		int num = bottom[0]->num();
+
+		TripletLossWithSampleParameter loss_param = this->layer_param_.triplet_loss_with_sample_param();
+		Dtype margin = loss_param.margin();
+		int pair_size = loss_param.pair_size();
+
+		select_triplet_gpu(bottom);
+
+		// the diff of flag_ holds the loss of every selected triplet
+		const int count = this->flag_.count();
+		// NOLINT_NEXT_LINE(whitespace/operators)
+		TripletLossForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+				count, num, pair_size, margin, this->dist_.gpu_data(),
+				this->flag_.gpu_data(), this->flag_.mutable_gpu_diff());
+		CUDA_POST_KERNEL_CHECK;
+
+		Dtype loss(0.0);
+		Dtype triplets(0.0);
+		caffe_gpu_asum(count, this->flag_.gpu_diff(), &loss);
+		caffe_gpu_asum(count, this->flag_.gpu_data(), &triplets);
+		int triplet_count = static_cast<int>(triplets);
+
+		if (triplet_count != 0)
+			loss = loss / triplet_count;
+		top[0]->mutable_cpu_data()[0] = loss;
+
+		const int magic_number = 2500;
+		if (iter_count_ % magic_number == 0)
+			LOG(INFO) << "Forward totally " << triplet_count << " <a, p, n> triplets.";
+		iter_count_ += 1;
 	}
-	
+
 	template <typename Dtype>
 	void TripletLossWithSampleLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
-	    const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-	    
-	   Backward_cpu(top, propagate_down, bottom);
+			const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+		if (bank_capacity_ > 0) {
+			Backward_cpu(top, propagate_down, bottom);
+			return;
+		}
+
+		const Dtype* bottom_data = bottom[0]->gpu_data();
+		Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
+
+		int count = bottom[0]->count();
+		int num = bottom[0]->num();
+		int dim = count / num;
+
+		TripletLossWithSampleParameter loss_param = this->layer_param_.triplet_loss_with_sample_param();
+		int pair_size = loss_param.pair_size();
+
+		const Dtype* flag_data = this->flag_.gpu_data();
+		Dtype triplets(0.0);
+		caffe_gpu_asum(this->flag_.count(), flag_data, &triplets);
+		if (triplets == 0) {
+			caffe_gpu_set(count, Dtype(0), bottom_diff);
+			return;
+		}
+
+		// number of negatives selected by every (anchor, positive) pair
+		Dtype* ones = this->sum_multiplier_.mutable_gpu_data();
+		caffe_gpu_set(num, Dtype(1), ones);
+		Dtype* flag_sum = this->flag_sum_.mutable_gpu_data();
+		caffe_gpu_gemv<Dtype>(CblasNoTrans, num * pair_size, num, Dtype(1),
+				flag_data, ones, Dtype(0), flag_sum);
+
+		// the diff of dist_ holds the gradient coefficient of every sample pair
+		Dtype* coeff = this->dist_.mutable_gpu_diff();
+		// NOLINT_NEXT_LINE(whitespace/operators)
+		TripletPairCoeff<Dtype><<<CAFFE_GET_BLOCKS(num * num), CAFFE_CUDA_NUM_THREADS>>>(
+				num * num, num, pair_size, flag_data, flag_sum, coeff);
+		CUDA_POST_KERNEL_CHECK;
+
+		const Dtype loss_weight = top[0]->cpu_diff()[0];
+		Dtype alpha = -loss_weight / triplets;
+		if (loss_param.distance() == TripletLossWithSampleParameter_Distance_EUCLIDEAN) {
+			Dtype* row_sum = this->norm_.mutable_gpu_diff();
+			caffe_gpu_gemv<Dtype>(CblasNoTrans, num, num, Dtype(1), coeff, ones,
+					Dtype(0), row_sum);
+			// NOLINT_NEXT_LINE(whitespace/operators)
+			TripletEuclideanCoeff<Dtype><<<CAFFE_GET_BLOCKS(num * num), CAFFE_CUDA_NUM_THREADS>>>(
+					num * num, num, row_sum, coeff);
+			CUDA_POST_KERNEL_CHECK;
+			alpha = 2 * loss_weight / triplets;
+		}
+		caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, dim, num,
+				alpha, coeff, bottom_data, Dtype(0), bottom_diff);
 	}
-	
+
 	INSTANTIATE_LAYER_GPU_FUNCS(TripletLossWithSampleLayer);
 
 }  // namespace caffe
@@ -213,6 +213,9 @@ void WindowDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       }
     }
   }
+  batch_windows_.resize(this->prefetch_threads(),
+      vector<const vector<float>*>(batch_size));
+  batch_mirrors_.resize(this->prefetch_threads(), vector<bool>(batch_size));
 }
 
 template <typename Dtype>
@@ -225,7 +228,7 @@ unsigned int WindowDataLayer<Dtype>::PrefetchRand() {
 
 // This function is called on prefetch thread
 template <typename Dtype>
-void WindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+void WindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch, int thread_id) {
   // At each iteration, sample N windows where N*p are foreground (object)
   // windows and N*(1-p) are background (non-object) windows
   CPUTimer batch_timer;
@@ -242,12 +245,12 @@ void WindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   const bool mirror = this->transform_param_.mirror();
   const float fg_fraction =
       this->layer_param_.window_data_param().fg_fraction();
-  Dtype* mean = NULL;
+  const Dtype* mean = NULL;
   int mean_off = 0;
   int mean_width = 0;
   int mean_height = 0;
   if (this->has_mean_file_) {
-    mean = this->data_mean_.mutable_cpu_data();
+    mean = this->data_mean_.cpu_data();
     mean_off = (this->data_mean_.width() - crop_size) / 2;
     mean_width = this->data_mean_.width();
     mean_height = this->data_mean_.height();
@@ -268,17 +271,29 @@ void WindowDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CHECK_GT(fg_windows_.size(), 0);
   CHECK_GT(bg_windows_.size(), 0);
 
-  // sample from bg set then fg set
+  // Sample the windows of the batch, and let the next prefetch thread go on.
+  vector<const vector<float>*>& windows = batch_windows_[thread_id];
+  vector<bool>& mirrors = batch_mirrors_[thread_id];
   for (int is_fg = 0; is_fg < 2; ++is_fg) {
     for (int dummy = 0; dummy < num_samples[is_fg]; ++dummy) {
-      // sample a window
-      timer.Start();
       const unsigned int rand_index = PrefetchRand();
-      vector<float> window = (is_fg) ?
-          fg_windows_[rand_index % fg_windows_.size()] :
-          bg_windows_[rand_index % bg_windows_.size()];
+      windows[item_id] = (is_fg) ?
+          &fg_windows_[rand_index % fg_windows_.size()] :
+          &bg_windows_[rand_index % bg_windows_.size()];
+      mirrors[item_id] = mirror && PrefetchRand() % 2;
+      item_id++;
+    }
+  }
+  this->ReadDone(thread_id);
 
-      bool do_mirror = mirror && PrefetchRand() % 2;
+  // sample from bg set then fg set
+  item_id = 0;
+  for (int is_fg = 0; is_fg < 2; ++is_fg) {
+    for (int dummy = 0; dummy < num_samples[is_fg]; ++dummy) {
+      // load a sampled window
+      timer.Start();
+      const vector<float>& window = *windows[item_id];
+      bool do_mirror = mirrors[item_id];
 
       // load the image containing the window
       pair<std::string, vector<int> > image =
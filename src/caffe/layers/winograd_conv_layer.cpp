@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/winograd_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// The transform matrices B^T, G and A^T of F(2x2, 3x3) and F(4x4, 3x3),
+// row-major: B^T is (m + 2) x (m + 2), G is (m + 2) x 3, A^T is m x (m + 2).
+static const double kInputF2[4 * 4] = {
+  1,  0, -1,  0,
+  0,  1,  1,  0,
+  0, -1,  1,  0,
+  0,  1,  0, -1
+};
+static const double kFilterF2[4 * 3] = {
+  1,    0,   0,
+  0.5,  0.5, 0.5,
+  0.5, -0.5, 0.5,
+  0,    0,   1
+};
+static const double kOutputF2[2 * 4] = {
+  1, 1,  1,  0,
+  0, 1, -1, -1
+};
+static const double kInputF4[6 * 6] = {
+  4,  0, -5,  0, 1, 0,
+  0, -4, -4,  1, 1, 0,
+  0,  4, -4, -1, 1, 0,
+  0, -2, -1,  2, 1, 0,
+  0,  2, -1, -2, 1, 0,
+  0,  4,  0, -5, 0, 1
+};
+static const double kFilterF4[6 * 3] = {
+  1.0 / 4,        0,         0,
+  -1.0 / 6,  -1.0 / 6,  -1.0 / 6,
+  -1.0 / 6,   1.0 / 6,  -1.0 / 6,
+  1.0 / 24,  1.0 / 12,   1.0 / 6,
+  1.0 / 24, -1.0 / 12,   1.0 / 6,
+  0,                0,         1
+};
+static const double kOutputF4[4 * 6] = {
+  1, 1,  1, 1,  1, 0,
+  0, 1, -1, 2, -2, 0,
+  0, 1,  1, 4,  4, 0,
+  0, 1, -1, 8, -8, 1
+};
+
+// out (R x R) = left (R x K) * in (K x K) * left^T, unrolled by the compiler
+template <int R, int K, typename Dtype>
+static void transform_tile(const Dtype* left, const Dtype* in, Dtype* out) {
+  Dtype tmp[R * K];
+  for (int i = 0; i < R; ++i) {
+    for (int j = 0; j < K; ++j) {
+      Dtype sum = 0;
+      for (int l = 0; l < K; ++l) {
+        sum += left[i * K + l] * in[l * K + j];
+      }
+      tmp[i * K + j] = sum;
+    }
+  }
+  for (int i = 0; i < R; ++i) {
+    for (int j = 0; j < R; ++j) {
+      Dtype sum = 0;
+      for (int l = 0; l < K; ++l) {
+        sum += tmp[i * K + l] * left[j * K + l];
+      }
+      out[i * R + j] = sum;
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* pad = this->pad_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  algorithm_ = GEMM;
+  if (this->num_spatial_axes_ == 2) {
+    if (kernel_shape[0] == 3 && kernel_shape[1] == 3 && stride[0] == 1 &&
+        stride[1] == 1 && dilation[0] == 1 && dilation[1] == 1) {
+      algorithm_ = WINOGRAD;
+    } else if (kernel_shape[0] == 1 && kernel_shape[1] == 1 &&
+        pad[0] == 0 && pad[1] == 0) {
+      algorithm_ = DIRECT_1X1;
+    }
+  }
+  if (algorithm_ == GEMM) {
+    LOG(INFO) << "Layer " << this->layer_param_.name() << " is neither 3x3 "
+        << "with stride 1 nor unpadded 1x1; using the CAFFE engine.";
+  }
+  tile_ = this->layer_param_.convolution_param().winograd_tile();
+  CHECK(tile_ == 2 || tile_ == 4) << "winograd_tile must be 2 or 4.";
+  alpha_ = tile_ + 2;
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  if (algorithm_ == WINOGRAD) {
+    tiles_h_ = (this->output_shape_[0] + tile_ - 1) / tile_;
+    tiles_w_ = (this->output_shape_[1] + tile_ - 1) / tile_;
+    const int tile_size = alpha_ * alpha_;
+    const int tiles = tiles_h_ * tiles_w_;
+    // Transform as many images at once as fit in batch_col_buffer_mb.
+    const size_t batch_bytes = static_cast<size_t>(
+        this->layer_param_.convolution_param().batch_col_buffer_mb()) << 20;
+    const size_t image_bytes = sizeof(Dtype) * tile_size * tiles *
+        (this->channels_ + this->num_output_);
+    winograd_batch_ = std::max<size_t>(1, std::min<size_t>(this->num_,
+        batch_bytes / image_bytes));
+    vector<int> shape(3, tile_size);
+    shape[1] = this->num_output_;
+    shape[2] = this->channels_ / this->group_;
+    weight_transform_.Reshape(shape);
+    shape[1] = this->channels_;
+    shape[2] = winograd_batch_ * tiles;
+    input_transform_.Reshape(shape);
+    shape[1] = this->num_output_;
+    output_transform_.Reshape(shape);
+  } else if (algorithm_ == DIRECT_1X1) {
+    const int* stride = this->stride_.cpu_data();
+    if (stride[0] > 1 || stride[1] > 1) {
+      vector<int> shape(2, this->channels_);
+      shape[1] = this->out_spatial_dim_;
+      strided_input_.Reshape(shape);
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (algorithm_ == GEMM) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  // transform the filters again only once they have been written or
+  // replaced, as by the solver or by sharing the ones of another net
+  const shared_ptr<SyncedMemory>& weight_data = this->blobs_[0]->data();
+  if (algorithm_ == WINOGRAD && (weight_data != transformed_data_.lock()
+      || weight_data->version() != transformed_version_)) {
+    transformed_data_ = weight_data;
+    transformed_version_ = weight_data->version();
+    if (tile_ == 2) {
+      winograd_transform_weights<2>(weight);
+    } else {
+      winograd_transform_weights<4>(weight);
+    }
+  }
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    if (algorithm_ == WINOGRAD) {
+      for (int n = 0; n < this->num_; n += winograd_batch_) {
+        const int batch = std::min(winograd_batch_, this->num_ - n);
+        if (tile_ == 2) {
+          winograd_forward_cpu<2>(bottom_data + n * this->bottom_dim_, batch,
+              top_data + n * this->top_dim_);
+        } else {
+          winograd_forward_cpu<4>(bottom_data + n * this->bottom_dim_, batch,
+              top_data + n * this->top_dim_);
+        }
+      }
+    } else {
+      for (int n = 0; n < this->num_; ++n) {
+        direct_1x1_forward_cpu(bottom_data + n * this->bottom_dim_, weight,
+            top_data + n * this->top_dim_);
+      }
+    }
+    if (this->bias_term_) {
+      const Dtype* bias = this->blobs_[1]->cpu_data();
+      for (int n = 0; n < this->num_; ++n) {
+        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+      }
+    }
+    if (this->relu_) {
+      caffe_cpu_relu(top[i]->count(), top_data, top_data);
+    }
+  }
+}
+
+template <typename Dtype>
+template <int M>
+void WinogradConvolutionLayer<Dtype>::winograd_transform_weights(
+    const Dtype* weights) {
+  const int A = M + 2;
+  Dtype filter_matrix[A * 3];
+  for (int i = 0; i < A * 3; ++i) {
+    filter_matrix[i] = (M == 2 ? kFilterF2 : kFilterF4)[i];
+  }
+  const int matrix_size = this->num_output_ * (this->channels_ / this->group_);
+  Dtype* transform = weight_transform_.mutable_cpu_data();
+  Dtype tile[A * A];
+  for (int i = 0; i < matrix_size; ++i) {
+    transform_tile<A, 3>(filter_matrix, weights + i * 9, tile);
+    for (int e = 0; e < A * A; ++e) {
+      transform[e * matrix_size + i] = tile[e];
+    }
+  }
+}
+
+template <typename Dtype>
+template <int M>
+void WinogradConvolutionLayer<Dtype>::winograd_forward_cpu(
+    const Dtype* input, const int batch, Dtype* output) {
+  const int A = M + 2;
+  Dtype input_matrix[A * A];
+  for (int i = 0; i < A * A; ++i) {
+    input_matrix[i] = (M == 2 ? kInputF2 : kInputF4)[i];
+  }
+  Dtype output_matrix[M * A];
+  for (int i = 0; i < M * A; ++i) {
+    output_matrix[i] = (M == 2 ? kOutputF2 : kOutputF4)[i];
+  }
+  const int channels = this->channels_;
+  const int height = this->conv_input_shape_.cpu_data()[1];
+  const int width = this->conv_input_shape_.cpu_data()[2];
+  const int pad_h = this->pad_.cpu_data()[0];
+  const int pad_w = this->pad_.cpu_data()[1];
+  const int output_h = this->output_shape_[0];
+  const int output_w = this->output_shape_[1];
+  // Tile t of image n is column n * tiles + t of every matrix.
+  const int tiles = tiles_h_ * tiles_w_;
+  const int cols = batch * tiles;
+  Dtype tile[A * A];
+  Dtype transformed[A * A];
+  // Transform the input tiles, which overlap by 2 rows and columns.
+  Dtype* input_transform = input_transform_.mutable_cpu_data();
+  const int input_size = channels * cols;
+  for (int n = 0; n < batch; ++n) {
+    for (int c = 0; c < channels; ++c) {
+      const Dtype* channel = input + n * this->bottom_dim_ +
+          c * height * width;
+      for (int th = 0; th < tiles_h_; ++th) {
+        const int h0 = th * M - pad_h;
+        for (int tw = 0; tw < tiles_w_; ++tw) {
+          const int w0 = tw * M - pad_w;
+          if (h0 >= 0 && h0 + A <= height && w0 >= 0 && w0 + A <= width) {
+            const Dtype* corner = channel + h0 * width + w0;
+            for (int i = 0; i < A; ++i) {
+              for (int j = 0; j < A; ++j) {
+                tile[i * A + j] = corner[i * width + j];
+              }
+            }
+          } else {
+            for (int i = 0; i < A; ++i) {
+              const int h = h0 + i;
+              for (int j = 0; j < A; ++j) {
+                const int w = w0 + j;
+                tile[i * A + j] = (h >= 0 && h < height && w >= 0 &&
+                    w < width) ? channel[h * width + w] : Dtype(0);
+              }
+            }
+          }
+          transform_tile<A, A>(input_matrix, tile, transformed);
+          Dtype* column = input_transform + c * cols + n * tiles +
+              th * tiles_w_ + tw;
+          for (int e = 0; e < A * A; ++e) {
+            column[e * input_size] = transformed[e];
+          }
+        }
+      }
+    }
+  }
+  // One GEMM per tile element and group.
+  const int out_channels = this->num_output_ / this->group_;
+  const int in_channels = channels / this->group_;
+  const int weight_size = this->num_output_ * in_channels;
+  const int output_size = this->num_output_ * cols;
+  const Dtype* weight_transform = weight_transform_.cpu_data();
+  Dtype* output_transform = output_transform_.mutable_cpu_data();
+  for (int e = 0; e < A * A; ++e) {
+    for (int g = 0; g < this->group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, out_channels, cols,
+          in_channels, (Dtype)1.,
+          weight_transform + e * weight_size + g * out_channels * in_channels,
+          input_transform + e * input_size + g * in_channels * cols,
+          (Dtype)0.,
+          output_transform + e * output_size + g * out_channels * cols);
+    }
+  }
+  // Transform back into output tiles, cropped at the bottom and right edge.
+  for (int n = 0; n < batch; ++n) {
+    for (int c = 0; c < this->num_output_; ++c) {
+      Dtype* channel = output + n * this->top_dim_ + c * output_h * output_w;
+      for (int th = 0; th < tiles_h_; ++th) {
+        const int rows = std::min(M, output_h - th * M);
+        for (int tw = 0; tw < tiles_w_; ++tw) {
+          const Dtype* column = output_transform + c * cols + n * tiles +
+              th * tiles_w_ + tw;
+          for (int e = 0; e < A * A; ++e) {
+            tile[e] = column[e * output_size];
+          }
+          transform_tile<M, A>(output_matrix, tile, transformed);
+          const int row_length = std::min(M, output_w - tw * M);
+          Dtype* corner = channel + th * M * output_w + tw * M;
+          for (int i = 0; i < rows; ++i) {
+            for (int j = 0; j < row_length; ++j) {
+              corner[i * output_w + j] = transformed[i * M + j];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::direct_1x1_forward_cpu(
+    const Dtype* input, const Dtype* weights, Dtype* output) {
+  const int stride_h = this->stride_.cpu_data()[0];
+  const int stride_w = this->stride_.cpu_data()[1];
+  const int spatial_dim = this->out_spatial_dim_;
+  if (stride_h > 1 || stride_w > 1) {
+    const int height = this->conv_input_shape_.cpu_data()[1];
+    const int width = this->conv_input_shape_.cpu_data()[2];
+    const int output_h = this->output_shape_[0];
+    const int output_w = this->output_shape_[1];
+    Dtype* strided = strided_input_.mutable_cpu_data();
+    for (int c = 0; c < this->channels_; ++c) {
+      const Dtype* channel = input + c * height * width;
+      for (int h = 0; h < output_h; ++h) {
+        const Dtype* row = channel + h * stride_h * width;
+        for (int w = 0; w < output_w; ++w) {
+          *strided++ = row[w * stride_w];
+        }
+      }
+    }
+    input = strided_input_.cpu_data();
+  }
+  const int out_channels = this->num_output_ / this->group_;
+  const int in_channels = this->channels_ / this->group_;
+  for (int g = 0; g < this->group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, out_channels,
+        spatial_dim, in_channels, (Dtype)1., weights + this->weight_offset_ * g,
+        input + g * in_channels * spatial_dim, (Dtype)0.,
+        output + g * out_channels * spatial_dim);
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
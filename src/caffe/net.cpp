@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <climits>
 #include <map>
 #include <set>
 #include <string>
@@ -12,9 +13,11 @@
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fold_batch_norm.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/memory_pool.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -50,6 +53,29 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  // Fold BatchNorm for inference.
+  fold_batch_norm_ = phase_ == TEST && in_param.fold_batch_norm();
+  folded_chains_.clear();
+  if (fold_batch_norm_) {
+    NetParameter folded_param;
+    map<string, vector<string> > chains;
+    FoldBatchNorm(filtered_param, &folded_param, &chains);
+    // Keep the folded layers, to fold the trained weights in the same way.
+    map<string, int> layer_ids;
+    for (int i = 0; i < filtered_param.layer_size(); ++i) {
+      layer_ids[filtered_param.layer(i).name()] = i;
+    }
+    for (map<string, vector<string> >::const_iterator chain = chains.begin();
+        chain != chains.end(); ++chain) {
+      vector<LayerParameter>& chain_params = folded_chains_[chain->first];
+      for (int j = 0; j < chain->second.size(); ++j) {
+        chain_params.push_back(
+            filtered_param.layer(layer_ids[chain->second[j]]));
+        chain_params.back().clear_blobs();
+      }
+    }
+    filtered_param.CopyFrom(folded_param);
+  }
   LOG_IF(INFO, Caffe::root_solver())
       << "Initializing net from parameters: " << std::endl
       << filtered_param.DebugString();
@@ -253,10 +279,237 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   ShareWeights();
+  // The gradient of a learnable param is complete once Backward has run the
+  // first layer using it.
+  ready_params_.assign(layers_.size(), vector<int>());
+  vector<int> first_layer(learnable_params_.size(), layers_.size());
+  for (int i = 0; i < params_.size(); ++i) {
+    int& first = first_layer[learnable_param_ids_[i]];
+    first = std::min(first, param_layer_indices_[i].first);
+  }
+  for (int i = 0; i < first_layer.size(); ++i) {
+    ready_params_[first_layer[i]].push_back(i);
+  }
+  params_contiguous_ = false;
+  if (param.contiguous_params()) {
+    AllocateContiguousParams();
+  }
+  if (param.memory_reuse() == NetParameter_MemoryReuse_INFERENCE) {
+    PlanMemoryReuse();
+  }
+  half_storage_ = phase_ == TEST && param.half_storage();
+  if (half_storage_ && sizeof(Dtype) != sizeof(float)) {
+    LOG(WARNING) << "Half precision storage needs a float net; keeping "
+        << "the data in full precision.";
+    half_storage_ = false;
+  }
+  if (half_storage_ && MemoryPool::enabled()) {
+    LOG(WARNING) << "Half precision storage frees the float data into the "
+        << "memory pool, which keeps it; keeping the data in full precision.";
+    half_storage_ = false;
+  }
   debug_info_ = param.debug_info();
+  CHECK_GE(param.intra_op_threads(), 0);
+  intra_op_threads_ = param.intra_op_threads();
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 }
 
+// The blobs of a net grouped by the memory they hold, for PlanMemoryReuse.
+// Each group is live from the first layer writing it to the last one
+// reading it; fixed groups keep their own memory.
+struct BlobStorages {
+  explicit BlobStorages(int num_blobs)
+      : parent(num_blobs), start(num_blobs, INT_MAX), end(num_blobs, -1),
+        bytes(num_blobs, 0), fixed(num_blobs, false) {
+    for (int i = 0; i < num_blobs; ++i) { parent[i] = i; }
+  }
+  int Find(int id) {
+    while (parent[id] != id) {
+      id = parent[id] = parent[parent[id]];
+    }
+    return id;
+  }
+  void Merge(int a, int b) {
+    a = Find(a);
+    b = Find(b);
+    if (a == b) { return; }
+    if (b < a) { std::swap(a, b); }
+    parent[b] = a;
+    start[a] = std::min(start[a], start[b]);
+    end[a] = std::max(end[a], end[b]);
+    bytes[a] = std::max(bytes[a], bytes[b]);
+    fixed[a] = fixed[a] || fixed[b];
+  }
+  vector<int> parent;
+  vector<int> start;
+  vector<int> end;
+  vector<size_t> bytes;
+  vector<bool> fixed;
+};
+
+template <typename Dtype>
+void Net<Dtype>::PlanMemoryReuse() {
+  if (phase_ != TEST || std::find(layer_need_backward_.begin(),
+      layer_need_backward_.end(), true) != layer_need_backward_.end()) {
+    LOG(WARNING) << "Inference memory reuse needs a TEST net without "
+        << "backward; keeping separate memory for every blob.";
+    return;
+  }
+  const int num_layers = layers_.size();
+  const int num_blobs = blobs_.size();
+  // The net outputs stay live to the end. The tops of layers without
+  // bottoms are filled from outside (data and input layers) and are fixed.
+  BlobStorages storages(num_blobs);
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    storages.bytes[blob_id] = blobs_[blob_id]->count() * sizeof(Dtype);
+    storages.fixed[blob_id] = (blobs_[blob_id]->count() == 0);
+  }
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = bottom_id_vecs_[layer_id][i];
+      storages.end[blob_id] = std::max(storages.end[blob_id], layer_id);
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = top_id_vecs_[layer_id][i];
+      storages.start[blob_id] = std::min(storages.start[blob_id], layer_id);
+      storages.end[blob_id] = std::max(storages.end[blob_id], layer_id);
+      storages.fixed[blob_id] = storages.fixed[blob_id] ||
+          bottom_id_vecs_[layer_id].empty();
+    }
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    storages.end[net_output_blob_indices_[i]] = num_layers;
+  }
+  // Group the tops that hold the memory of an earlier blob, whether shared
+  // at setup (reshape, ...) or by every Forward (split, flatten), and let a
+  // layer that can run in place write its top over its bottom if nothing
+  // reads the bottom after it. A top only ever shares
+  // the memory of the bottoms of its own or an earlier layer, so the groups
+  // of the bottoms are complete when a layer is visited.
+  map<const SyncedMemory*, int> memory_owner;
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = top_id_vecs_[layer_id][i];
+      if (blobs_[blob_id]->count() == 0) { continue; }
+      const SyncedMemory* memory = blobs_[blob_id]->data().get();
+      if (memory_owner.count(memory)) {
+        storages.Merge(memory_owner[memory], blob_id);
+      } else {
+        memory_owner[memory] = blob_id;
+      }
+    }
+    if (layers_[layer_id]->ForwardSharesData()) {
+      const int bottom_id = bottom_id_vecs_[layer_id][0];
+      for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+        storages.Merge(bottom_id, top_id_vecs_[layer_id][i]);
+      }
+    }
+    if (!layers_[layer_id]->AllowInPlace() ||
+        bottom_id_vecs_[layer_id].size() != 1 ||
+        top_id_vecs_[layer_id].size() != 1) {
+      continue;
+    }
+    const int bottom = storages.Find(bottom_id_vecs_[layer_id][0]);
+    const int top = storages.Find(top_id_vecs_[layer_id][0]);
+    if (bottom != top && storages.end[bottom] == layer_id &&
+        storages.start[top] == layer_id && !storages.fixed[bottom] &&
+        !storages.fixed[top] && storages.bytes[bottom] == storages.bytes[top]) {
+      storages.Merge(bottom, top);
+    }
+  }
+  // Assign the groups to buffers in the order they are written, taking the
+  // smallest free buffer that is large enough, or else growing the largest
+  // free one.
+  vector<pair<int, int> > order;
+  size_t storage_bytes = 0;
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    if (storages.Find(blob_id) == blob_id && !storages.fixed[blob_id]) {
+      order.push_back(std::make_pair(storages.start[blob_id], blob_id));
+      storage_bytes += storages.bytes[blob_id];
+    }
+  }
+  std::sort(order.begin(), order.end());
+  vector<size_t> buffer_bytes;
+  vector<int> buffer_end;
+  vector<int> storage_buffer(num_blobs, -1);
+  for (int i = 0; i < order.size(); ++i) {
+    const int id = order[i].second;
+    const size_t need = storages.bytes[id];
+    int best = -1;
+    for (int k = 0; k < buffer_bytes.size(); ++k) {
+      if (buffer_end[k] >= storages.start[id]) { continue; }
+      const bool fits = buffer_bytes[k] >= need;
+      if (best < 0 || (fits && (buffer_bytes[best] < need ||
+          buffer_bytes[k] < buffer_bytes[best])) ||
+          (!fits && buffer_bytes[best] < need &&
+          buffer_bytes[k] > buffer_bytes[best])) {
+        best = k;
+      }
+    }
+    if (best < 0) {
+      best = buffer_bytes.size();
+      buffer_bytes.push_back(0);
+      buffer_end.push_back(-1);
+    }
+    buffer_bytes[best] = std::max(buffer_bytes[best], need);
+    buffer_end[best] = storages.end[id];
+    storage_buffer[id] = best;
+  }
+  size_t live_bytes = 0;
+  for (int layer_id = 0; layer_id <= num_layers; ++layer_id) {
+    size_t live = 0;
+    for (int i = 0; i < order.size(); ++i) {
+      const int id = order[i].second;
+      if (storages.start[id] <= layer_id && layer_id <= storages.end[id]) {
+        live += storages.bytes[id];
+      }
+    }
+    live_bytes = std::max(live_bytes, live);
+  }
+  vector<shared_ptr<SyncedMemory> > buffers(buffer_bytes.size());
+  size_t reused_bytes = 0;
+  for (int k = 0; k < buffers.size(); ++k) {
+    buffers[k].reset(new SyncedMemory(buffer_bytes[k]));
+    reused_bytes += buffer_bytes[k];
+  }
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    const int id = storages.Find(blob_id);
+    if (!storages.fixed[id]) {
+      blobs_[blob_id]->ShareData(buffers[storage_buffer[id]]);
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Memory reuse: intermediate data takes " << reused_bytes
+      << " bytes in " << buffers.size() << " buffers instead of "
+      << storage_bytes << " bytes in " << order.size() << " (at most "
+      << live_bytes << " bytes are live at once)";
+}
+
+// Copies the learnable params into one arena for their data and one for
+// their diffs, and points them there. The params sharing an owner hold its
+// SyncedMemory, so they follow it.
+template <typename Dtype>
+void Net<Dtype>::AllocateContiguousParams() {
+  int count = 0;
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    count += learnable_params_[i]->count();
+  }
+  if (count == 0) { return; }
+  params_arena_.reset(new Blob<Dtype>(vector<int>(1, count)));
+  Dtype* data = params_arena_->mutable_cpu_data();
+  Dtype* diff = params_arena_->mutable_cpu_diff();
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    Blob<Dtype>* param = learnable_params_[i];
+    caffe_copy(param->count(), param->cpu_data(), data);
+    caffe_copy(param->count(), param->cpu_diff(), diff);
+    param->data()->set_cpu_data(data);
+    param->diff()->set_cpu_data(diff);
+    data += param->count();
+    diff += param->count();
+  }
+  params_contiguous_ = true;
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -514,10 +767,27 @@ void Net<Dtype>::AppendParam(const NetParameter& param, const int layer_id,
   }
 }
 
+// Sets the intra-op threads of the calling thread for the passes of a net
+// with its own intra_op_threads, and restores them afterwards.
+class IntraOpThreadsScope {
+ public:
+  explicit IntraOpThreadsScope(int threads)
+      : previous_(Caffe::intra_op_threads()) {
+    if (threads > 0) {
+      Caffe::set_intra_op_threads(threads);
+    }
+  }
+  ~IntraOpThreadsScope() { Caffe::set_intra_op_threads(previous_); }
+
+ private:
+  const int previous_;
+};
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
+  IntraOpThreadsScope intra_op_threads(intra_op_threads_);
   Dtype loss = 0;
   for (int i = start; i <= end; ++i) {
     for (int c = 0; c < before_forward_.size(); ++c) {
@@ -529,10 +799,57 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
     for (int c = 0; c < after_forward_.size(); ++c) {
       after_forward_[c]->run(i);
     }
+    if (half_storage_ && Caffe::mode() == Caffe::CPU) {
+      StoreHalf(i);
+    }
   }
   return loss;
 }
 
+// The memory of the net inputs and outputs, which they may share with other
+// blobs (split, in place, memory_reuse), stays in float, for the callers
+// holding pointers to it. So do the params shared with blobs outside the
+// net, as by ShareTrainedLayersWith, which the other net may train; the
+// others are converted once, and only their floats freed after that.
+template <typename Dtype>
+void Net<Dtype>::StoreHalf(const int layer_id) {
+  const vector<Blob<Dtype>*>* blob_vecs[2] =
+      { &bottom_vecs_[layer_id], &top_vecs_[layer_id] };
+  const vector<Blob<Dtype>*>* net_blob_vecs[2] =
+      { &net_input_blobs_, &net_output_blobs_ };
+  for (int k = 0; k < 2; ++k) {
+    for (int i = 0; i < blob_vecs[k]->size(); ++i) {
+      Blob<Dtype>* blob = (*blob_vecs[k])[i];
+      if (blob->count() == 0) { continue; }
+      bool is_net_blob = false;
+      for (int n = 0; n < 2; ++n) {
+        const vector<Blob<Dtype>*>& net_blobs = *net_blob_vecs[n];
+        for (int j = 0; j < net_blobs.size(); ++j) {
+          is_net_blob = is_net_blob || (net_blobs[j]->count() > 0 &&
+              net_blobs[j]->data() == blob->data());
+        }
+      }
+      if (!is_net_blob) {
+        blob->data()->store_half();
+      }
+    }
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& params = layers_[layer_id]->blobs();
+  for (int i = 0; i < params.size(); ++i) {
+    const shared_ptr<SyncedMemory>& data = params[i]->data();
+    if (params[i]->count() == 0) { continue; }
+    // the params of the net sharing the memory, by ShareWeights, hold all
+    // references to it unless blobs outside the net share it too
+    int net_references = 0;
+    for (int j = 0; j < params_.size(); ++j) {
+      net_references += params_[j]->data() == data;
+    }
+    if (data.use_count() == net_references) {
+      data->store_half();
+    }
+  }
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFrom(int start) {
   return ForwardFromTo(start, layers_.size() - 1);
@@ -569,6 +886,7 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  IntraOpThreadsScope intra_op_threads(intra_op_threads_);
   for (int i = start; i >= end; --i) {
     for (int c = 0; c < before_backward_.size(); ++c) {
       before_backward_[c]->run(i);
@@ -578,6 +896,11 @@ void Net<Dtype>::BackwardFromTo(int start, int end) {
           top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
       if (debug_info_) { BackwardDebugInfo(i); }
     }
+    if (ready_params_[i].size()) {
+      for (int c = 0; c < params_ready_.size(); ++c) {
+        params_ready_[c]->params_ready(i, ready_params_[i]);
+      }
+    }
     for (int c = 0; c < after_backward_.size(); ++c) {
       after_backward_[c]->run(i);
     }
@@ -691,6 +1014,8 @@ void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
           << source_blob->shape_string() << "; target param shape is "
           << target_blobs[j]->shape_string();
       target_blobs[j]->ShareData(*source_blob);
+      // the param no longer lives in the arena of this net
+      params_contiguous_ = false;
     }
   }
 }
@@ -710,11 +1035,19 @@ void Net<Dtype>::Backward() {
   BackwardFromTo(layers_.size() - 1, 0);
   if (debug_info_) {
     Dtype asum_data = 0, asum_diff = 0, sumsq_data = 0, sumsq_diff = 0;
-    for (int i = 0; i < learnable_params_.size(); ++i) {
-      asum_data += learnable_params_[i]->asum_data();
-      asum_diff += learnable_params_[i]->asum_diff();
-      sumsq_data += learnable_params_[i]->sumsq_data();
-      sumsq_diff += learnable_params_[i]->sumsq_diff();
+    Blob<Dtype>* params = contiguous_params();
+    if (params && Caffe::mode() == Caffe::CPU) {
+      asum_data = params->asum_data();
+      asum_diff = params->asum_diff();
+      sumsq_data = params->sumsq_data();
+      sumsq_diff = params->sumsq_diff();
+    } else {
+      for (int i = 0; i < learnable_params_.size(); ++i) {
+        asum_data += learnable_params_[i]->asum_data();
+        asum_diff += learnable_params_[i]->asum_diff();
+        sumsq_data += learnable_params_[i]->sumsq_data();
+        sumsq_diff += learnable_params_[i]->sumsq_diff();
+      }
     }
     const Dtype l2norm_data = std::sqrt(sumsq_data);
     const Dtype l2norm_diff = std::sqrt(sumsq_diff);
@@ -733,10 +1066,16 @@ void Net<Dtype>::Reshape() {
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
+  map<string, const LayerParameter*> source_layers;
+  if (!folded_chains_.empty()) {
+    for (int i = 0; i < param.layer_size(); ++i) {
+      source_layers[param.layer(i).name()] = &param.layer(i);
+    }
+  }
   int num_source_layers = param.layer_size();
   for (int i = 0; i < num_source_layers; ++i) {
-    const LayerParameter& source_layer = param.layer(i);
-    const string& source_layer_name = source_layer.name();
+    const LayerParameter* source_layer = &param.layer(i);
+    const string& source_layer_name = source_layer->name();
     int target_layer_id = 0;
     while (target_layer_id != layer_names_.size() &&
         layer_names_[target_layer_id] != source_layer_name) {
@@ -746,16 +1085,43 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
       LOG(INFO) << "Ignoring source layer " << source_layer_name;
       continue;
     }
+    // Fold the trained blobs of the layers Init folded into this one, found
+    // by name, whatever their parameters and place in param; without them
+    // the layer is already folded.
+    LayerParameter folded_layer;
+    map<string, vector<LayerParameter> >::const_iterator chain =
+        folded_chains_.find(source_layer_name);
+    if (chain != folded_chains_.end()) {
+      vector<LayerParameter> trained_chain(chain->second);
+      int num_trained = 0;
+      for (int j = 0; j < trained_chain.size(); ++j) {
+        map<string, const LayerParameter*>::const_iterator trained =
+            source_layers.find(trained_chain[j].name());
+        if (trained != source_layers.end()) {
+          trained_chain[j].mutable_blobs()->CopyFrom(trained->second->blobs());
+          ++num_trained;
+        }
+      }
+      if (num_trained > 0) {
+        CHECK_EQ(num_trained, trained_chain.size()) << "Only some of the "
+            << "layers folded into " << source_layer_name << " are in the "
+            << "trained net.";
+        folded_layer.CopyFrom(layers_[target_layer_id]->layer_param());
+        folded_layer.mutable_blobs()->CopyFrom(source_layer->blobs());
+        FoldTrainedBlobs(trained_chain, &folded_layer);
+        source_layer = &folded_layer;
+      }
+    }
     DLOG(INFO) << "Copying source layer " << source_layer_name;
     vector<shared_ptr<Blob<Dtype> > >& target_blobs =
         layers_[target_layer_id]->blobs();
-    CHECK_EQ(target_blobs.size(), source_layer.blobs_size())
+    CHECK_EQ(target_blobs.size(), source_layer->blobs_size())
         << "Incompatible number of blobs for layer " << source_layer_name;
     for (int j = 0; j < target_blobs.size(); ++j) {
-      if (!target_blobs[j]->ShapeEquals(source_layer.blobs(j))) {
+      if (!target_blobs[j]->ShapeEquals(source_layer->blobs(j))) {
         Blob<Dtype> source_blob;
         const bool kReshape = true;
-        source_blob.FromProto(source_layer.blobs(j), kReshape);
+        source_blob.FromProto(source_layer->blobs(j), kReshape);
         LOG(FATAL) << "Cannot copy param " << j << " weights from layer '"
             << source_layer_name << "'; shape mismatch.  Source param shape is "
             << source_blob.shape_string() << "; target param shape is "
@@ -764,7 +1130,7 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
             << "copying from a saved net, rename the layer.";
       }
       const bool kReshape = false;
-      target_blobs[j]->FromProto(source_layer.blobs(j), kReshape);
+      target_blobs[j]->FromProto(source_layer->blobs(j), kReshape);
     }
   }
 }
@@ -792,6 +1158,8 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
   hid_t file_hid = H5Fopen(trained_filename.c_str(), H5F_ACC_RDONLY,
                            H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open " << trained_filename;
+  CHECK(!fold_batch_norm_) << "Cannot fold the HDF5 weights "
+      << trained_filename << "; use binaryproto weights.";
   hid_t data_hid = H5Gopen2(file_hid, "data", H5P_DEFAULT);
   CHECK_GE(data_hid, 0) << "Error reading weights from " << trained_filename;
   int num_layers = hdf5_get_num_links(data_hid);
@@ -908,6 +1276,16 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
 
 template <typename Dtype>
 void Net<Dtype>::Update() {
+  Blob<Dtype>* params = contiguous_params();
+  if (params && Caffe::mode() == Caffe::CPU) {
+    params->Update();
+    // the arena is written past the memory of the params: mark them written
+    // as well, for the layers that keep data derived from them
+    for (int i = 0; i < learnable_params_.size(); ++i) {
+      learnable_params_[i]->mutable_cpu_data();
+    }
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     learnable_params_[i]->Update();
   }
@@ -915,6 +1293,12 @@ void Net<Dtype>::Update() {
 
 template <typename Dtype>
 void Net<Dtype>::ClearParamDiffs() {
+  Blob<Dtype>* params = contiguous_params();
+  if (params && Caffe::mode() == Caffe::CPU) {
+    caffe_set(params->count(), static_cast<Dtype>(0),
+              params->mutable_cpu_diff());
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     Blob<Dtype>* blob = learnable_params_[i];
     switch (Caffe::mode()) {
@@ -1,8 +1,10 @@
+#include <boost/thread.hpp>
 #ifdef USE_NCCL
-
 #include <cuda_runtime.h>
+#endif
 #include <glog/logging.h>
 #include <stdio.h>
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -72,6 +74,328 @@ Params<Dtype>::Params(shared_ptr<Solver<Dtype> > root_solver)
     diff_() {
 }
 
+template<typename Dtype>
+CPUParams<Dtype>::CPUParams(shared_ptr<Solver<Dtype> > root_solver)
+  : Params<Dtype>(root_solver) {
+  data_ = new Dtype[size_];
+  // Copy blob values
+  const vector<Blob<Dtype>*>& net =
+    root_solver->net()->learnable_params();
+  apply_buffers(net, data_, size_, copy);
+
+  diff_ = new Dtype[size_];
+  caffe_set(size_, Dtype(0), diff_);
+}
+
+template<typename Dtype>
+CPUParams<Dtype>::~CPUParams() {
+  delete[] data_;
+  delete[] diff_;
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::Configure(Solver<Dtype>* solver) const {
+  const vector<Blob<Dtype>*>& net =
+    solver->net()->learnable_params();
+  apply_buffers(net, data_, size_, replace_cpu);
+  apply_buffers(net, diff_, size_, replace_cpu_diff);
+  // keep the contiguous params of the net over the params
+  Blob<Dtype>* contiguous = solver->net()->contiguous_params();
+  if (contiguous) {
+    contiguous->data()->set_cpu_data(data_);
+    contiguous->diff()->set_cpu_data(diff_);
+  }
+}
+
+template<typename Dtype>
+GradientBuckets<Dtype>::GradientBuckets(Solver<Dtype>* solver)
+  : iter_size_(solver->param().iter_size()),
+    display_(solver->param().display()),
+    pass_(), buckets_completed_(), buckets_started_() {
+  const vector<Blob<Dtype>*>& params = solver->net()->learnable_params();
+  const size_t bucket_size = std::max<size_t>(1,
+      solver->param().reduce_bucket_mb() * (1 << 20) / sizeof(Dtype));
+  vector<size_t> offsets(params.size() + 1, 0);
+  for (int i = 0; i < params.size(); ++i) {
+    offsets[i + 1] = offsets[i] + params[i]->count();
+  }
+  param_bucket_.resize(params.size());
+  int bucket = -1;
+  for (int i = params.size() - 1; i >= 0; --i) {
+    if (bucket < 0) {
+      bucket = bucket_params_.size();
+      bucket_end_.push_back(offsets[i + 1]);
+      bucket_begin_.push_back(offsets[i + 1]);
+      bucket_params_.push_back(0);
+    }
+    param_bucket_[i] = bucket;
+    bucket_begin_[bucket] = offsets[i];
+    ++bucket_params_[bucket];
+    if (bucket_end_[bucket] - bucket_begin_[bucket] >= bucket_size) {
+      bucket = -1;
+    }
+  }
+  bucket_pending_ = bucket_params_;
+  bucket_started_.assign(bucket_params_.size(), false);
+}
+
+template<typename Dtype>
+void GradientBuckets<Dtype>::params_ready(int layer,
+    const vector<int>& learnable_param_ids) {
+  for (int i = 0; i < learnable_param_ids.size(); ++i) {
+    const int bucket = param_bucket_[learnable_param_ids[i]];
+    if (--bucket_pending_[bucket] > 0) {
+      continue;
+    }
+    bucket_pending_[bucket] = bucket_params_[bucket];
+    if (pass_ == iter_size_ - 1 && !bucket_started_[bucket]) {
+      if (buckets_started_++ == 0) {
+        first_start_ = boost::posix_time::microsec_clock::local_time();
+      }
+      bucket_started_[bucket] = true;
+      bucket_ready(bucket);
+    }
+    if (++buckets_completed_ == num_buckets()) {
+      buckets_completed_ = 0;
+      ++pass_;
+    }
+  }
+}
+
+template<typename Dtype>
+void GradientBuckets<Dtype>::BackwardDone() {
+  backward_done_ = boost::posix_time::microsec_clock::local_time();
+  if (buckets_started_ == 0) {
+    first_start_ = backward_done_;
+  }
+  for (int i = 0; i < num_buckets(); ++i) {
+    if (!bucket_started_[i]) {
+      ++buckets_started_;
+      bucket_started_[i] = true;
+      bucket_ready(i);
+    }
+  }
+}
+
+template<typename Dtype>
+void GradientBuckets<Dtype>::ReductionDone(int iter) {
+  if (display_ && iter % display_ == 0 && Caffe::root_solver()) {
+    const boost::posix_time::ptime done =
+        boost::posix_time::microsec_clock::local_time();
+    const float overlapped =
+        (backward_done_ - first_start_).total_microseconds() / 1000.;
+    const float waited = (done - backward_done_).total_microseconds() / 1000.;
+    LOG(INFO) << "Iteration " << iter << ", gradients reduced in "
+        << num_buckets() << " buckets: " << overlapped
+        << " ms during backward, " << waited << " ms after it ("
+        << (overlapped + waited > 0 ?
+            100 * overlapped / (overlapped + waited) : 0)
+        << "% overlapped)";
+  }
+  bucket_pending_ = bucket_params_;
+  bucket_started_.assign(num_buckets(), false);
+  pass_ = 0;
+  buckets_completed_ = 0;
+  buckets_started_ = 0;
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::CPUSync(shared_ptr<Solver<Dtype> > solver)
+  : CPUParams<Dtype>(solver), GradientBuckets<Dtype>(solver.get()),
+    solver_(solver), rank_(Caffe::solver_rank()), syncs_(), barrier_(),
+    reduce_barrier_() {
+  this->Configure(solver.get());
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::~CPUSync() {
+  // before the queues go
+  this->StopInternalThread();
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::set_replicas(vector<CPUSync<Dtype>*>* syncs,
+                                  boost::barrier* barrier,
+                                  boost::barrier* reduce_barrier) {
+  syncs_ = syncs;
+  barrier_ = barrier;
+  reduce_barrier_ = reduce_barrier;
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Attach() {
+  solver_->add_callback(this);
+  if (solver_->param().layer_wise_reduce()) {
+    solver_->net()->add_params_ready(this);
+    this->StartInternalThread();
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Broadcast() {
+  barrier_->wait();
+  if (rank_ != 0) {
+    caffe_copy(size_, (*syncs_)[0]->data(), data_);
+  }
+  barrier_->wait();
+}
+
+// The bounds of chunk i of n of the flat buffers.
+static size_t chunk_begin(size_t size, int n, int i) {
+  return size * i / n;
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::RingAllreduce(size_t offset, size_t count,
+                                   boost::barrier* barrier) {
+  // Ring allreduce: in step s of the reduce-scatter, each rank r adds
+  // chunk r - s - 1 of rank r - 1, which rank r - 1 has just added to,
+  // into its own. After n - 1 steps rank r holds the sum of chunk r + 1,
+  // which it averages, and the allgather passes the complete chunks on
+  // around the ring in n - 1 more steps. No chunk is read and written in
+  // the same step.
+  const int n = syncs_->size();
+  const Dtype* prev = (*syncs_)[(rank_ + n - 1) % n]->diff() + offset;
+  Dtype* diff = diff_ + offset;
+  for (int step = 0; step < n - 1; ++step) {
+    barrier->wait();
+    const int chunk = (rank_ - step - 1 + 2 * n) % n;
+    const size_t begin = chunk_begin(count, n, chunk);
+    const size_t end = chunk_begin(count, n, chunk + 1);
+    caffe_axpy<Dtype>(end - begin, Dtype(1), prev + begin, diff + begin);
+  }
+  const int reduced = (rank_ + 1) % n;
+  caffe_scal<Dtype>(chunk_begin(count, n, reduced + 1) -
+      chunk_begin(count, n, reduced), Dtype(1) / n,
+      diff + chunk_begin(count, n, reduced));
+  for (int step = 0; step < n - 1; ++step) {
+    barrier->wait();
+    const int chunk = (rank_ - step + n) % n;
+    const size_t begin = chunk_begin(count, n, chunk);
+    const size_t end = chunk_begin(count, n, chunk + 1);
+    caffe_copy<Dtype>(end - begin, prev + begin, diff + begin);
+  }
+  // the next rank may still be reading
+  barrier->wait();
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::bucket_ready(int bucket) {
+  started_.push(bucket);
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::InternalThreadEntry() {
+  try {
+    while (!must_stop()) {
+      const int bucket = started_.pop();
+      // The replicas complete the buckets in the same order, and the
+      // barrier waits for the bucket on all of them.
+      RingAllreduce(this->bucket_offset(bucket), this->bucket_count(bucket),
+                    reduce_barrier_);
+      reduced_.push(bucket);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_gradients_ready() {
+  if (solver_->param().layer_wise_reduce()) {
+    this->BackwardDone();
+    for (int i = 0; i < this->num_buckets(); ++i) {
+      reduced_.pop();
+    }
+    this->ReductionDone(solver_->iter());
+  } else {
+    RingAllreduce(0, size_, barrier_);
+  }
+}
+
+template<typename Dtype>
+class CPUWorker : public InternalThread {
+ public:
+  explicit CPUWorker(shared_ptr<Solver<Dtype> > rank0,
+                     boost::barrier* barrier, boost::barrier* reduce_barrier,
+                     boost::mutex* setup_mutex,
+                     vector<CPUSync<Dtype>*>* syncs, const char* restore)
+    : rank0_(rank0), barrier_(barrier), reduce_barrier_(reduce_barrier),
+      setup_mutex_(setup_mutex), syncs_(syncs), restore_(restore) {
+  }
+  virtual ~CPUWorker() {}
+
+ protected:
+  void InternalThreadEntry() {
+    // Create solver and install callbacks. Layers read their data through
+    // libraries that are not thread safe, like HDF5, while setting up, so
+    // the replicas are set up one at a time.
+    SolverParameter param(rank0_->param());
+    param.set_type(rank0_->type());
+    shared_ptr<Solver<Dtype> > s;
+    {
+      boost::mutex::scoped_lock lock(*setup_mutex_);
+      s.reset(SolverRegistry<Dtype>::CreateSolver(param));
+      if (restore_) {
+        s->Restore(restore_);
+      }
+    }
+    CHECK_EQ(s->type(), rank0_->type());
+    CPUSync<Dtype> sync(s);
+    sync.set_replicas(syncs_, barrier_, reduce_barrier_);
+    sync.Attach();
+    (*syncs_)[Caffe::solver_rank()] = &sync;
+    // Broadcast rank 0 state, once all replicas are there
+    sync.Broadcast();
+    // Solve
+    s->Step(param.max_iter() - s->iter());
+    // Join the communication thread before rank 0 may interrupt this one
+    sync.StopInternalThread();
+    barrier_->wait();
+  }
+
+  shared_ptr<Solver<Dtype> > rank0_;
+  boost::barrier* barrier_;
+  boost::barrier* reduce_barrier_;
+  boost::mutex* setup_mutex_;
+  vector<CPUSync<Dtype>*>* syncs_;
+  const char* restore_;
+};
+
+template<typename Dtype>
+void CPUSync<Dtype>::Run(const char* restore) {
+  const int count = Caffe::solver_count();
+  boost::barrier barrier(count);
+  boost::barrier reduce_barrier(count);
+  boost::mutex setup_mutex;
+  vector<CPUSync<Dtype>*> syncs(count);
+  // Create workers
+  vector<shared_ptr<CPUWorker<Dtype> > > workers(count);
+  for (int i = 1; i < count; ++i) {
+    Caffe::set_solver_rank(i);
+    CPUWorker<Dtype>* w = new CPUWorker<Dtype>(solver_, &barrier,
+        &reduce_barrier, &setup_mutex, &syncs, restore);
+    w->StartInternalThread();
+    workers[i].reset(w);
+  }
+  Caffe::set_solver_rank(0);
+  rank_ = 0;
+  set_replicas(&syncs, &barrier, &reduce_barrier);
+  Attach();
+  syncs[0] = this;
+  // Wait for workers, and run first solver on current thread
+  Broadcast();
+  solver_->Solve();
+  this->StopInternalThread();
+  barrier.wait();
+  // Wait for shutdown
+  for (int i = 1; i < count; ++i) {
+    workers[i]->StopInternalThread();
+  }
+}
+
+#ifdef USE_NCCL
+
 template<typename Dtype>
 GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
   : Params<Dtype>(root_solver) {
@@ -116,6 +440,7 @@ static int getDevice() {
 template<typename Dtype>
 NCCL<Dtype>::NCCL(shared_ptr<Solver<Dtype> > solver)
   : GPUParams<Dtype>(solver, getDevice()),
+    GradientBuckets<Dtype>(solver.get()),
     comm_(), solver_(solver), barrier_() {
   this->Configure(solver.get());
   Init();
@@ -124,6 +449,7 @@ NCCL<Dtype>::NCCL(shared_ptr<Solver<Dtype> > solver)
 template<typename Dtype>
 NCCL<Dtype>::NCCL(shared_ptr<Solver<Dtype> > solver, const string& uid)
   : GPUParams<Dtype>(solver, getDevice()),
+    GradientBuckets<Dtype>(solver.get()),
     solver_(solver), barrier_() {
   this->Configure(solver.get());
   Caffe::set_multiprocess(true);
@@ -199,50 +525,30 @@ void NCCL<Dtype>::Broadcast() {
 }
 
 template<typename Dtype>
-void NCCL<Dtype>::run(int layer) {
-  CHECK(solver_->param().layer_wise_reduce());
-  vector<shared_ptr<Blob<Dtype> > >& blobs =
-    solver_->net()->layers()[layer]->blobs();
-#ifdef DEBUG
-  // Assert blobs are contiguous to reduce in one step (e.g. bias often small)
-  for (int i = 1; i < blobs.size(); ++i) {
-    CHECK_EQ(blobs[i - 1]->gpu_diff() + blobs[i - 1]->count(),
-             blobs[i + 0]->gpu_diff());
-  }
-#endif
-  if (blobs.size() > 0) {
-    // Make sure default stream is done computing gradients. Could be
-    // replaced by cudaEventRecord+cudaStreamWaitEvent to avoid
-    // blocking the default stream, but it's actually slower.
-    CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
-
-    // Reduce asynchronously
-    int size = 0;
-    for (int i = 0; i < blobs.size(); ++i) {
-      size += blobs[i]->count();
-    }
-    if (barrier_) {  // NULL in multi process case
-      barrier_->wait();
-    }
-    NCCL_CHECK(ncclAllReduce(blobs[0]->mutable_gpu_diff(),
-                             blobs[0]->mutable_gpu_diff(),
-                             size,
-                             nccl::dataType<Dtype>::type,
-                             ncclSum, comm_, stream_));
-    caffe_gpu_scal(size, (Dtype) 1.0 / Caffe::solver_count(),
-                   blobs[0]->mutable_gpu_diff(), stream_);
+void NCCL<Dtype>::bucket_ready(int bucket) {
+  // Make sure default stream is done computing gradients. Could be
+  // replaced by cudaEventRecord+cudaStreamWaitEvent to avoid
+  // blocking the default stream, but it's actually slower.
+  CUDA_CHECK(cudaStreamSynchronize(cudaStreamDefault));
+
+  // Reduce asynchronously
+  Dtype* diff = diff_ + this->bucket_offset(bucket);
+  const int size = static_cast<int>(this->bucket_count(bucket));
+  if (barrier_) {  // NULL in multi process case
+    barrier_->wait();
   }
+  NCCL_CHECK(ncclAllReduce(diff, diff, size, nccl::dataType<Dtype>::type,
+                           ncclSum, comm_, stream_));
+  caffe_gpu_scal(size, (Dtype) 1.0 / Caffe::solver_count(), diff, stream_);
 }
 
 template<typename Dtype>
 void NCCL<Dtype>::on_gradients_ready() {
   if (solver_->param().layer_wise_reduce()) {
-    CHECK_EQ(solver_->net()->params().size(),
-             solver_->net()->learnable_params().size())
-      << "Layer-wise reduce is not supported for nets with shared weights.";
-
+    this->BackwardDone();
     // Make sure reduction is done before applying gradients
     CUDA_CHECK(cudaStreamSynchronize(stream_));
+    this->ReductionDone(solver_->iter());
   } else {
     if (barrier_) {  // NULL in multi process case
       barrier_->wait();
@@ -289,7 +595,7 @@ class Worker : public InternalThread {
     nccl.set_barrier(barrier_);
     s->add_callback(&nccl);
     if (s->param().layer_wise_reduce()) {
-      s->net()->add_after_backward(&nccl);
+      s->net()->add_params_ready(&nccl);
     }
     (*nccls_)[Caffe::solver_rank()] = &nccl;
     // Wait for other threads
@@ -343,7 +649,7 @@ void NCCL<Dtype>::Run(const vector<int>& gpus, const char* restore) {
   barrier_ = &barrier;
   solver_->add_callback(this);
   if (solver_->param().layer_wise_reduce()) {
-    solver_->net()->add_after_backward(this);
+    solver_->net()->add_params_ready(this);
   }
   nccls[0] = this;
   // Wait for workers
@@ -361,11 +667,16 @@ void NCCL<Dtype>::Run(const vector<int>& gpus, const char* restore) {
   }
 }
 
-INSTANTIATE_CLASS(Params);
 INSTANTIATE_CLASS(GPUParams);
 INSTANTIATE_CLASS(Worker);
 INSTANTIATE_CLASS(NCCL);
 
-}  // namespace caffe
-
 #endif  // USE_NCCL
+
+INSTANTIATE_CLASS(Params);
+INSTANTIATE_CLASS(GradientBuckets);
+INSTANTIATE_CLASS(CPUParams);
+INSTANTIATE_CLASS(CPUWorker);
+INSTANTIATE_CLASS(CPUSync);
+
+}  // namespace caffe
@@ -170,6 +170,10 @@ void Solver<Dtype>::InitTestNets() {
       net_state.MergeFrom(param_.test_state(i));
     }
     net_params[i].mutable_state()->CopyFrom(net_state);
+    // The test nets share the weights of the train net, so they can't fold
+    // them, nor keep the data they share with it in half precision.
+    net_params[i].set_fold_batch_norm(false);
+    net_params[i].set_half_storage(false);
     LOG(INFO)
         << "Creating test net (#" << i << ") specified by " << sources[i];
     test_nets_[i].reset(new Net<Dtype>(net_params[i]));
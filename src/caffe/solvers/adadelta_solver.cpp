@@ -14,6 +14,7 @@ void AdaDeltaSolver<Dtype>::AdaDeltaPreSolve() {
         this->history_.push_back(
                 shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
   }
+  this->ContiguousHistory();
 }
 
 #ifndef CPU_ONLY
@@ -106,6 +107,32 @@ void AdaDeltaSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdaDeltaSolver<Dtype>::ComputeUpdateValueFused(int param_id, Dtype rate,
+    int begin, int end) {
+  const FusedUpdateParam<Dtype>& param = this->fused_params_[param_id];
+  const Dtype delta = this->param_.delta();
+  const Dtype momentum = this->param_.momentum();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  size_t update_history_offset = this->fused_params_.size();
+  Dtype* history = this->fused_history_[param_id];
+  Dtype* update_history =
+      this->fused_history_[update_history_offset + param_id];
+  for (int i = begin; i < end; ++i) {
+    const Dtype gradient = param.gradient(i);
+    history[i] = momentum * history[i] +
+        (Dtype(1) - momentum) * gradient * gradient;
+    // the RMS of the updates over the RMS of the gradients
+    const Dtype step = gradient *
+        std::sqrt((update_history[i] + delta) / (history[i] + delta));
+    update_history[i] = momentum * update_history[i] +
+        (Dtype(1) - momentum) * step * step;
+    const Dtype update = local_rate * step;
+    param.diff[i] = update;
+    param.data[i] -= update;
+  }
+}
+
 INSTANTIATE_CLASS(AdaDeltaSolver);
 REGISTER_SOLVER_CLASS(AdaDelta);
 
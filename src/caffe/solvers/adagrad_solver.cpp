@@ -63,6 +63,23 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdaGradSolver<Dtype>::ComputeUpdateValueFused(int param_id, Dtype rate,
+    int begin, int end) {
+  const FusedUpdateParam<Dtype>& param = this->fused_params_[param_id];
+  const Dtype delta = this->param_.delta();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  Dtype* history = this->fused_history_[param_id];
+  for (int i = begin; i < end; ++i) {
+    const Dtype gradient = param.gradient(i);
+    history[i] += gradient * gradient;
+    const Dtype update = local_rate * gradient /
+        (std::sqrt(history[i]) + delta);
+    param.diff[i] = update;
+    param.data[i] -= update;
+  }
+}
+
 INSTANTIATE_CLASS(AdaGradSolver);
 REGISTER_SOLVER_CLASS(AdaGrad);
 
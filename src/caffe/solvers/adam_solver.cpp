@@ -14,6 +14,7 @@ void AdamSolver<Dtype>::AdamPreSolve() {
     this->history_.push_back(
             shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
   }
+  this->ContiguousHistory();
 }
 
 #ifndef CPU_ONLY
@@ -88,6 +89,31 @@ void AdamSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdamSolver<Dtype>::ComputeUpdateValueFused(int param_id, Dtype rate,
+    int begin, int end) {
+  const FusedUpdateParam<Dtype>& param = this->fused_params_[param_id];
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  const Dtype beta1 = this->param_.momentum();
+  const Dtype beta2 = this->param_.momentum2();
+  const int t = this->iter_ + 1;
+  const Dtype correction = std::sqrt(Dtype(1) - pow(beta2, t)) /
+      (Dtype(1.) - pow(beta1, t));
+  const Dtype eps_hat = this->param_.delta();
+  size_t update_history_offset = this->fused_params_.size();
+  Dtype* val_m = this->fused_history_[param_id];
+  Dtype* val_v = this->fused_history_[param_id + update_history_offset];
+  for (int i = begin; i < end; ++i) {
+    const Dtype gradient = param.gradient(i);
+    val_m[i] = beta1 * val_m[i] + (Dtype(1) - beta1) * gradient;
+    val_v[i] = beta2 * val_v[i] + (Dtype(1) - beta2) * gradient * gradient;
+    const Dtype update = local_rate * correction * val_m[i] /
+        (std::sqrt(val_v[i]) + eps_hat);
+    param.diff[i] = update;
+    param.data[i] -= update;
+  }
+}
+
 INSTANTIATE_CLASS(AdamSolver);
 REGISTER_SOLVER_CLASS(Adam);
 
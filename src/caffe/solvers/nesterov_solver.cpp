@@ -55,6 +55,26 @@ void NesterovSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void NesterovSolver<Dtype>::ComputeUpdateValueFused(int param_id, Dtype rate,
+    int begin, int end) {
+  const FusedUpdateParam<Dtype>& param = this->fused_params_[param_id];
+  const Dtype momentum = this->param_.momentum();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  Dtype* history = this->fused_history_[param_id];
+  for (int i = begin; i < end; ++i) {
+    // step back then over step
+    const Dtype history_old = history[i];
+    const Dtype history_new = local_rate * param.gradient(i) +
+        momentum * history_old;
+    const Dtype update = (Dtype(1) + momentum) * history_new -
+        momentum * history_old;
+    history[i] = history_new;
+    param.diff[i] = update;
+    param.data[i] -= update;
+  }
+}
+
 INSTANTIATE_CLASS(NesterovSolver);
 REGISTER_SOLVER_CLASS(Nesterov);
 
@@ -1,3 +1,5 @@
+#include <boost/bind.hpp>
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -75,6 +77,26 @@ void SGDSolver<Dtype>::PreSolve() {
     update_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
     temp_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
   }
+  ContiguousHistory();
+}
+
+// With contiguous_params, moves the history into one arena, in the order of
+// history_. Solvers adding history call it again to take it in as well.
+template <typename Dtype>
+void SGDSolver<Dtype>::ContiguousHistory() {
+  if (!this->net_->contiguous_params()) { return; }
+  int count = 0;
+  for (int i = 0; i < history_.size(); ++i) {
+    count += history_[i]->count();
+  }
+  shared_ptr<Blob<Dtype> > arena(new Blob<Dtype>(vector<int>(1, count)));
+  Dtype* data = arena->mutable_cpu_data();
+  for (int i = 0; i < history_.size(); ++i) {
+    caffe_copy(history_[i]->count(), history_[i]->cpu_data(), data);
+    history_[i]->data()->set_cpu_data(data);
+    data += history_[i]->count();
+  }
+  history_arena_ = arena;
 }
 
 template <typename Dtype>
@@ -82,9 +104,17 @@ void SGDSolver<Dtype>::ClipGradients() {
   const Dtype clip_gradients = this->param_.clip_gradients();
   if (clip_gradients < 0) { return; }
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  Blob<Dtype>* contiguous = this->net_->contiguous_params();
+  if (Caffe::mode() != Caffe::CPU) {
+    contiguous = NULL;
+  }
   Dtype sumsq_diff = 0;
-  for (int i = 0; i < net_params.size(); ++i) {
-    sumsq_diff += net_params[i]->sumsq_diff();
+  if (contiguous) {
+    sumsq_diff = contiguous->sumsq_diff();
+  } else {
+    for (int i = 0; i < net_params.size(); ++i) {
+      sumsq_diff += net_params[i]->sumsq_diff();
+    }
   }
   const Dtype l2norm_diff = std::sqrt(sumsq_diff);
   if (l2norm_diff > clip_gradients) {
@@ -92,8 +122,12 @@ void SGDSolver<Dtype>::ClipGradients() {
     LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
         << l2norm_diff << " > " << clip_gradients << ") "
         << "by scale factor " << scale_factor;
-    for (int i = 0; i < net_params.size(); ++i) {
-      net_params[i]->scale_diff(scale_factor);
+    if (contiguous) {
+      contiguous->scale_diff(scale_factor);
+    } else {
+      for (int i = 0; i < net_params.size(); ++i) {
+        net_params[i]->scale_diff(scale_factor);
+      }
     }
   }
 }
@@ -106,6 +140,10 @@ void SGDSolver<Dtype>::ApplyUpdate() {
         << ", lr = " << rate;
   }
   ClipGradients();
+  if (this->param_.fused_update() && Caffe::mode() == Caffe::CPU) {
+    FusedUpdate(rate);
+    return;
+  }
   for (int param_id = 0; param_id < this->net_->learnable_params().size();
        ++param_id) {
     Normalize(param_id);
@@ -115,6 +153,51 @@ void SGDSolver<Dtype>::ApplyUpdate() {
   this->net_->Update();
 }
 
+template <typename Dtype>
+void SGDSolver<Dtype>::FusedUpdate(Dtype rate) {
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  const vector<float>& net_params_weight_decay =
+      this->net_->params_weight_decay();
+  const string& regularization_type = this->param_.regularization_type();
+  CHECK(regularization_type == "L2" || regularization_type == "L1")
+      << "Unknown regularization type: " << regularization_type;
+  // Take the CPU pointers here, as the threads must not move the blobs.
+  fused_params_.resize(net_params.size());
+  fused_offsets_.resize(net_params.size() + 1);
+  fused_offsets_[0] = 0;
+  for (int i = 0; i < net_params.size(); ++i) {
+    FusedUpdateParam<Dtype>& param = fused_params_[i];
+    param.data = net_params[i]->mutable_cpu_data();
+    param.diff = net_params[i]->mutable_cpu_diff();
+    param.scale = Dtype(1.) / this->param_.iter_size();
+    param.decay = this->param_.weight_decay() * net_params_weight_decay[i];
+    param.l1 = regularization_type == "L1";
+    fused_offsets_[i + 1] = fused_offsets_[i] + net_params[i]->count();
+  }
+  fused_history_.resize(history_.size());
+  for (int i = 0; i < history_.size(); ++i) {
+    fused_history_[i] = history_[i]->mutable_cpu_data();
+  }
+  // Per element, the update does a few dozen flops at most.
+  Caffe::parallel_for(fused_offsets_.back(), Caffe::kParallelGrain / 16,
+      boost::bind(&SGDSolver<Dtype>::FusedUpdateBlock, this, rate, _1, _2));
+}
+
+// Updates elements [begin, end) of the params laid end to end.
+template <typename Dtype>
+void SGDSolver<Dtype>::FusedUpdateBlock(Dtype rate, int begin, int end) {
+  int param_id = std::upper_bound(fused_offsets_.begin(),
+      fused_offsets_.end(), begin) - fused_offsets_.begin() - 1;
+  while (begin < end) {
+    const int offset = fused_offsets_[param_id];
+    const int param_end = std::min(end, fused_offsets_[param_id + 1]);
+    ComputeUpdateValueFused(param_id, rate, begin - offset,
+        param_end - offset);
+    begin = param_end;
+    ++param_id;
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::Normalize(int param_id) {
   if (this->param_.iter_size() == 1) { return; }
@@ -242,6 +325,21 @@ void SGDSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void SGDSolver<Dtype>::ComputeUpdateValueFused(int param_id, Dtype rate,
+    int begin, int end) {
+  const FusedUpdateParam<Dtype>& param = fused_params_[param_id];
+  const Dtype momentum = this->param_.momentum();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  Dtype* history = fused_history_[param_id];
+  for (int i = begin; i < end; ++i) {
+    const Dtype update = local_rate * param.gradient(i) + momentum * history[i];
+    history[i] = update;
+    param.diff[i] = update;
+    param.data[i] -= update;
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
   switch (this->param_.snapshot_format()) {
@@ -4,8 +4,11 @@
 
 namespace caffe {
 SyncedMemory::SyncedMemory()
-  : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
-    own_cpu_data_(false), cpu_malloc_use_cuda_(false), own_gpu_data_(false) {
+  : cpu_ptr_(NULL), gpu_ptr_(NULL), half_ptr_(NULL), size_(0),
+    head_(UNINITIALIZED), half_synced_(false), half_malloc_use_cuda_(false),
+    half_pooled_(false), own_cpu_data_(false), cpu_malloc_use_cuda_(false),
+    cpu_pooled_(false), own_gpu_data_(false), gpu_pooled_(false),
+    version_(0) {
 #ifndef CPU_ONLY
 #ifdef DEBUG
   CUDA_CHECK(cudaGetDevice(&device_));
@@ -14,8 +17,11 @@ SyncedMemory::SyncedMemory()
 }
 
 SyncedMemory::SyncedMemory(size_t size)
-  : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
-    own_cpu_data_(false), cpu_malloc_use_cuda_(false), own_gpu_data_(false) {
+  : cpu_ptr_(NULL), gpu_ptr_(NULL), half_ptr_(NULL), size_(size),
+    head_(UNINITIALIZED), half_synced_(false), half_malloc_use_cuda_(false),
+    half_pooled_(false), own_cpu_data_(false), cpu_malloc_use_cuda_(false),
+    cpu_pooled_(false), own_gpu_data_(false), gpu_pooled_(false),
+    version_(0) {
 #ifndef CPU_ONLY
 #ifdef DEBUG
   CUDA_CHECK(cudaGetDevice(&device_));
@@ -26,12 +32,15 @@ SyncedMemory::SyncedMemory(size_t size)
 SyncedMemory::~SyncedMemory() {
   check_device();
   if (cpu_ptr_ && own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_, cpu_malloc_use_cuda_);
+    CaffeFreeHost(cpu_ptr_, size_, cpu_malloc_use_cuda_, cpu_pooled_);
+  }
+  if (half_ptr_) {
+    CaffeFreeHost(half_ptr_, size_ / 2, half_malloc_use_cuda_, half_pooled_);
   }
 
 #ifndef CPU_ONLY
   if (gpu_ptr_ && own_gpu_data_) {
-    CUDA_CHECK(cudaFree(gpu_ptr_));
+    CaffeFreeDevice(gpu_ptr_, size_, gpu_pooled_);
   }
 #endif  // CPU_ONLY
 }
@@ -40,7 +49,7 @@ inline void SyncedMemory::to_cpu() {
   check_device();
   switch (head_) {
   case UNINITIALIZED:
-    CaffeMallocHost(&cpu_ptr_, size_, &cpu_malloc_use_cuda_);
+    CaffeMallocHost(&cpu_ptr_, size_, &cpu_malloc_use_cuda_, &cpu_pooled_);
     caffe_memset(size_, 0, cpu_ptr_);
     head_ = HEAD_AT_CPU;
     own_cpu_data_ = true;
@@ -48,7 +57,7 @@ inline void SyncedMemory::to_cpu() {
   case HEAD_AT_GPU:
 #ifndef CPU_ONLY
     if (cpu_ptr_ == NULL) {
-      CaffeMallocHost(&cpu_ptr_, size_, &cpu_malloc_use_cuda_);
+      CaffeMallocHost(&cpu_ptr_, size_, &cpu_malloc_use_cuda_, &cpu_pooled_);
       own_cpu_data_ = true;
     }
     caffe_gpu_memcpy(size_, gpu_ptr_, cpu_ptr_);
@@ -57,6 +66,13 @@ inline void SyncedMemory::to_cpu() {
     NO_GPU;
 #endif
     break;
+  case HEAD_AT_HALF:
+    CaffeMallocHost(&cpu_ptr_, size_, &cpu_malloc_use_cuda_, &cpu_pooled_);
+    caffe_cpu_half2float(size_ / sizeof(float),
+        static_cast<const uint16_t*>(half_ptr_), static_cast<float*>(cpu_ptr_));
+    head_ = HEAD_AT_CPU;
+    own_cpu_data_ = true;
+    break;
   case HEAD_AT_CPU:
   case SYNCED:
     break;
@@ -66,16 +82,19 @@ inline void SyncedMemory::to_cpu() {
 inline void SyncedMemory::to_gpu() {
   check_device();
 #ifndef CPU_ONLY
+  if (head_ == HEAD_AT_HALF) {
+    to_cpu();
+  }
   switch (head_) {
   case UNINITIALIZED:
-    CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
+    CaffeMallocDevice(&gpu_ptr_, size_, &gpu_pooled_);
     caffe_gpu_memset(size_, 0, gpu_ptr_);
     head_ = HEAD_AT_GPU;
     own_gpu_data_ = true;
     break;
   case HEAD_AT_CPU:
     if (gpu_ptr_ == NULL) {
-      CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
+      CaffeMallocDevice(&gpu_ptr_, size_, &gpu_pooled_);
       own_gpu_data_ = true;
     }
     caffe_gpu_memcpy(size_, cpu_ptr_, gpu_ptr_);
@@ -83,6 +102,7 @@ inline void SyncedMemory::to_gpu() {
     break;
   case HEAD_AT_GPU:
   case SYNCED:
+  case HEAD_AT_HALF:
     break;
   }
 #else
@@ -100,11 +120,13 @@ void SyncedMemory::set_cpu_data(void* data) {
   check_device();
   CHECK(data);
   if (own_cpu_data_) {
-    CaffeFreeHost(cpu_ptr_, cpu_malloc_use_cuda_);
+    CaffeFreeHost(cpu_ptr_, size_, cpu_malloc_use_cuda_, cpu_pooled_);
   }
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
   own_cpu_data_ = false;
+  half_synced_ = false;
+  ++version_;
 }
 
 const void* SyncedMemory::gpu_data() {
@@ -123,11 +145,13 @@ void SyncedMemory::set_gpu_data(void* data) {
 #ifndef CPU_ONLY
   CHECK(data);
   if (own_gpu_data_) {
-    CUDA_CHECK(cudaFree(gpu_ptr_));
+    CaffeFreeDevice(gpu_ptr_, size_, gpu_pooled_);
   }
   gpu_ptr_ = data;
   head_ = HEAD_AT_GPU;
   own_gpu_data_ = false;
+  half_synced_ = false;
+  ++version_;
 #else
   NO_GPU;
 #endif
@@ -137,6 +161,8 @@ void* SyncedMemory::mutable_cpu_data() {
   check_device();
   to_cpu();
   head_ = HEAD_AT_CPU;
+  half_synced_ = false;
+  ++version_;
   return cpu_ptr_;
 }
 
@@ -145,6 +171,8 @@ void* SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
   to_gpu();
   head_ = HEAD_AT_GPU;
+  half_synced_ = false;
+  ++version_;
   return gpu_ptr_;
 #else
   NO_GPU;
@@ -152,12 +180,34 @@ void* SyncedMemory::mutable_gpu_data() {
 #endif
 }
 
+void SyncedMemory::store_half() {
+  check_device();
+  if (head_ != HEAD_AT_CPU || !own_cpu_data_) {
+    return;
+  }
+  CHECK_EQ(size_ % sizeof(float), 0) << "Only float data can be stored in "
+      << "half precision.";
+  if (!half_synced_) {
+    if (half_ptr_ == NULL) {
+      CaffeMallocHost(&half_ptr_, size_ / 2, &half_malloc_use_cuda_,
+          &half_pooled_);
+    }
+    caffe_cpu_float2half(size_ / sizeof(float),
+        static_cast<const float*>(cpu_ptr_), static_cast<uint16_t*>(half_ptr_));
+    half_synced_ = true;
+  }
+  CaffeFreeHost(cpu_ptr_, size_, cpu_malloc_use_cuda_, cpu_pooled_);
+  cpu_ptr_ = NULL;
+  own_cpu_data_ = false;
+  head_ = HEAD_AT_HALF;
+}
+
 #ifndef CPU_ONLY
 void SyncedMemory::async_gpu_push(const cudaStream_t& stream) {
   check_device();
   CHECK(head_ == HEAD_AT_CPU);
   if (gpu_ptr_ == NULL) {
-    CUDA_CHECK(cudaMalloc(&gpu_ptr_, size_));
+    CaffeMallocDevice(&gpu_ptr_, size_, &gpu_pooled_);
     own_gpu_data_ = true;
   }
   const cudaMemcpyKind put = cudaMemcpyHostToDevice;
@@ -1,3 +1,6 @@
+#include <boost/bind.hpp>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 #include "caffe/common.hpp"
@@ -61,4 +64,68 @@ TEST_F(CommonTest, TestRandSeedGPU) {
 
 #endif
 
+// Marks the items of a parallel_for block, and the intra-op threads seen
+// at its start.
+static void MarkBlock(vector<int>* items, vector<int>* threads, int begin,
+    int end) {
+  for (int i = begin; i < end; ++i) {
+    ++(*items)[i];
+  }
+  (*threads)[begin] = Caffe::intra_op_threads();
+}
+
+TEST_F(CommonTest, TestParallelFor) {
+  vector<int> items(1000, 0);
+  vector<int> threads(items.size(), 0);
+  Caffe::set_intra_op_threads(4);
+  // at most 1000 / 300 blocks
+  Caffe::parallel_for(items.size(), 300,
+      boost::bind(&MarkBlock, &items, &threads, _1, _2));
+  Caffe::set_intra_op_threads(1);
+  int blocks = 0;
+  for (int i = 0; i < items.size(); ++i) {
+    EXPECT_EQ(1, items[i]);
+    if (threads[i]) {
+      ++blocks;
+      // the workers run nested calls on themselves
+      EXPECT_EQ(1, threads[i]);
+    }
+  }
+  EXPECT_EQ(3, blocks);
+}
+
+TEST_F(CommonTest, TestParallelForSmall) {
+  vector<int> items(10, 0);
+  vector<int> threads(items.size(), 0);
+  Caffe::set_intra_op_threads(4);
+  Caffe::parallel_for(items.size(), 100,
+      boost::bind(&MarkBlock, &items, &threads, _1, _2));
+  Caffe::set_intra_op_threads(1);
+  for (int i = 0; i < items.size(); ++i) {
+    EXPECT_EQ(1, items[i]);
+  }
+  // one block, on the calling thread
+  EXPECT_EQ(4, threads[0]);
+}
+
+TEST_F(CommonTest, TestParallelForFewerThreads) {
+  // the pool keeps the 4 threads of the first call, and the later calls
+  // split the items over fewer of them
+  const int intra_op_threads[3] = { 4, 2, 3 };
+  for (int t = 0; t < 3; ++t) {
+    vector<int> items(1000, 0);
+    vector<int> threads(items.size(), 0);
+    Caffe::set_intra_op_threads(intra_op_threads[t]);
+    Caffe::parallel_for(items.size(), 1,
+        boost::bind(&MarkBlock, &items, &threads, _1, _2));
+    int blocks = 0;
+    for (int i = 0; i < items.size(); ++i) {
+      EXPECT_EQ(1, items[i]);
+      blocks += threads[i] ? 1 : 0;
+    }
+    EXPECT_EQ(intra_op_threads[t], blocks);
+  }
+  Caffe::set_intra_op_threads(1);
+}
+
 }  // namespace caffe
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,6 +8,8 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/int8_conv_layer.hpp"
+#include "caffe/layers/winograd_conv_layer.hpp"
 
 #ifdef USE_CUDNN
 #include "caffe/layers/cudnn_conv_layer.hpp"
@@ -181,6 +185,20 @@ class ConvolutionLayerTest : public MultiDeviceTest<TypeParam> {
     return this->ref_blob_top_.get();
   }
 
+  // Runs layer on the bottoms and checks the first top against caffe_conv.
+  void CheckAgainstReference(Layer<Dtype>* layer,
+      ConvolutionParameter* convolution_param, Dtype threshold) {
+    layer->SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer->Forward(blob_bottom_vec_, blob_top_vec_);
+    caffe_conv(blob_bottom_vec_[0], convolution_param, layer->blobs(),
+        MakeReferenceTop(blob_top_vec_[0]));
+    const Dtype* top_data = blob_top_vec_[0]->cpu_data();
+    const Dtype* ref_top_data = ref_blob_top_->cpu_data();
+    for (int i = 0; i < blob_top_vec_[0]->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], threshold);
+    }
+  }
+
   Blob<Dtype>* const blob_bottom_;
   Blob<Dtype>* const blob_bottom_2_;
   Blob<Dtype>* const blob_top_;
@@ -495,6 +513,66 @@ TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionGroup) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestBatchedConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  // 1MB fits 4 (float) or 2 (double) of these images, so the last batch
+  // is partial.
+  this->blob_bottom_->Reshape(5, 3, 32, 32);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(36);
+  convolution_param->set_group(3);
+  convolution_param->set_batch_col_buffer_mb(1);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestBatched1x1Convolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(5, 3, 32, 32);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(1);
+  convolution_param->set_num_output(60);
+  convolution_param->set_batch_col_buffer_mb(1);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestSobelConvolution) {
   // Test separable convolution by computing the Sobel operator
   // as a single filter then comparing the result
@@ -811,6 +889,263 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestWinogradF2Convolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_winograd_tile(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  WinogradConvolutionLayer<Dtype> layer(layer_param);
+  this->CheckAgainstReference(&layer, convolution_param, 1e-4);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWinogradNewFilters) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  WinogradConvolutionLayer<Dtype> layer(layer_param);
+  this->CheckAgainstReference(&layer, convolution_param, 1e-4);
+  // the filters transformed at the first pass are stale once written
+  Blob<Dtype>* weights = layer.blobs()[0].get();
+  caffe_scal(weights->count(), Dtype(-2), weights->mutable_cpu_data());
+  this->CheckAgainstReference(&layer, convolution_param, 1e-4);
+  // or replaced by other ones
+  Blob<Dtype> other(weights->shape());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&other);
+  weights->ShareData(other);
+  this->CheckAgainstReference(&layer, convolution_param, 1e-4);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWinogradF4ConvolutionGroup) {
+  typedef typename TypeParam::Dtype Dtype;
+  // 7 x 9 outputs are no multiple of the 4 x 4 tiles
+  this->blob_bottom_->Reshape(2, 6, 9, 11);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->set_num_output(4);
+  convolution_param->set_group(2);
+  convolution_param->set_winograd_tile(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  WinogradConvolutionLayer<Dtype> layer(layer_param);
+  this->CheckAgainstReference(&layer, convolution_param, 1e-3);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWinograd1x1StridedConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(1);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  WinogradConvolutionLayer<Dtype> layer(layer_param);
+  this->CheckAgainstReference(&layer, convolution_param, 1e-4);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWinogradFallback) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  WinogradConvolutionLayer<Dtype> layer(layer_param);
+  this->CheckAgainstReference(&layer, convolution_param, 1e-4);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWinogradGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  this->blob_bottom_vec_.push_back(this->blob_bottom_2_);
+  this->blob_top_vec_.push_back(this->blob_top_2_);
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(2);
+  // F(4x4,3x3) in single precision is too coarse for finite differences
+  convolution_param->set_winograd_tile(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  WinogradConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestInt8ConvolutionExact) {
+  typedef typename TypeParam::Dtype Dtype;
+  // integer inputs and filters with 127 for their largest magnitudes have
+  // scales of 1, and the int8 convolution has no rounding error
+  this->blob_bottom_->Reshape(2, 4, 6, 4);
+  Dtype* bottom_data = this->blob_bottom_->mutable_cpu_data();
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    bottom_data[i] = (i * 37) % 255 - 127;
+  }
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_group(2);
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  layer_param.mutable_quantization_param()->set_input_range(127);
+  Int8ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype>* weights = layer.blobs()[0].get();
+  Dtype* weight_data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); ++i) {
+    weight_data[i] = i % weights->count(1) == 0 ? -127 : (i * 13) % 51 - 25;
+  }
+  this->CheckAgainstReference(&layer, convolution_param, 1e-4);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestInt8Convolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  Dtype input_range = 0;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    input_range = std::max(input_range, std::abs(bottom_data[i]));
+  }
+  layer_param.mutable_quantization_param()->set_input_range(input_range);
+  Int8ConvolutionLayer<Dtype> layer(layer_param);
+  // a few times the rounding error of the sums of int8 products
+  this->CheckAgainstReference(&layer, convolution_param, 0.3);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestInt8Convolution1x1) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  Dtype input_range = 0;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    input_range = std::max(input_range, std::abs(bottom_data[i]));
+  }
+  layer_param.mutable_quantization_param()->set_input_range(input_range);
+  Int8ConvolutionLayer<Dtype> layer(layer_param);
+  // a few times the rounding error of the sums of int8 products
+  this->CheckAgainstReference(&layer, convolution_param, 0.3);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestInt8ConvolutionNewFilters) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  Dtype input_range = 0;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    input_range = std::max(input_range, std::abs(bottom_data[i]));
+  }
+  layer_param.mutable_quantization_param()->set_input_range(input_range);
+  Int8ConvolutionLayer<Dtype> layer(layer_param);
+  this->CheckAgainstReference(&layer, convolution_param, 0.3);
+  // the filters quantized at the first pass are stale once written
+  Blob<Dtype>* weights = layer.blobs()[0].get();
+  caffe_scal(weights->count(), Dtype(-2), weights->mutable_cpu_data());
+  this->CheckAgainstReference(&layer, convolution_param, 0.6);
+  // or replaced by other ones
+  Blob<Dtype> other(weights->shape());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&other);
+  weights->ShareData(other);
+  this->CheckAgainstReference(&layer, convolution_param, 0.3);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestInt8ConvolutionTestPhase) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  layer_param.mutable_quantization_param()->set_input_range(4);
+  Int8ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> weights;
+  weights.CopyFrom(*layer.blobs()[0], false, true);
+  Dtype max_weight = 0;
+  for (int i = 0; i < weights.count(); ++i) {
+    max_weight = std::max(max_weight, std::abs(weights.cpu_data()[i]));
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> top;
+  top.CopyFrom(*this->blob_top_, false, true);
+  // the floats of the filters are freed once quantized, and ToProto writes
+  // the filters the int8 ones stand for
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED, layer.blobs()[0]->data()->head());
+  LayerParameter written;
+  layer.ToProto(&written);
+  Blob<Dtype> written_weights;
+  written_weights.FromProto(written.blobs(0));
+  for (int i = 0; i < weights.count(); ++i) {
+    EXPECT_NEAR(weights.cpu_data()[i], written_weights.cpu_data()[i],
+        max_weight / 254 * 1.001);
+  }
+  // they are quantized again once written
+  layer.blobs()[0]->FromProto(written.blobs(0));
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED, layer.blobs()[0]->data()->head());
+  for (int i = 0; i < top.count(); ++i) {
+    EXPECT_NEAR(top.cpu_data()[i], this->blob_top_->cpu_data()[i], 1e-4);
+  }
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
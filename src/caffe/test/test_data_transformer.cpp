@@ -340,5 +340,64 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+// Rows wider than the vectorized kernels, with a remainder, cropped out of
+// the datum, with a mean file, scaled and possibly mirrored.
+TYPED_TEST(DataTransformTest, TestWideRows) {
+  typedef TypeParam Dtype;
+  const bool unique_pixels = true;
+  const int channels = 2;
+  const int height = 38;
+  const int width = 41;
+  const int crop_size = 35;
+  const int h_off = (height - crop_size) / 2;
+  const int w_off = (width - crop_size) / 2;
+  const Dtype scale = 0.25;
+
+  string mean_file;
+  MakeTempFilename(&mean_file);
+  BlobProto blob_mean;
+  blob_mean.set_num(1);
+  blob_mean.set_channels(channels);
+  blob_mean.set_height(height);
+  blob_mean.set_width(width);
+  for (int j = 0; j < channels * height * width; ++j) {
+    blob_mean.add_data(0.5 * (j % 7));
+  }
+  WriteProtoToBinaryFile(blob_mean, mean_file);
+
+  Datum datum;
+  FillDatum(0, channels, height, width, unique_pixels, &datum);
+  TransformationParameter transform_param;
+  transform_param.set_mean_file(mean_file);
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_scale(scale);
+  transform_param.set_mirror(true);
+  DataTransformer<Dtype> transformer(transform_param, TEST);
+  Caffe::set_random_seed(this->seed_);
+  transformer.InitRand();
+  Blob<Dtype> blob(1, channels, crop_size, crop_size);
+  bool mirrored[2] = {false, false};
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    transformer.Transform(datum, &blob);
+    const bool mirror = blob.data_at(0, 0, 0, 0) !=
+        (static_cast<uint8_t>(h_off * width + w_off)
+         - blob_mean.data(h_off * width + w_off)) * scale;
+    mirrored[mirror] = true;
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < crop_size; ++h) {
+        for (int w = 0; w < crop_size; ++w) {
+          const int index = (c * height + h_off + h) * width + w_off + w;
+          const Dtype expected = (static_cast<uint8_t>(index)
+              - static_cast<Dtype>(blob_mean.data(index))) * scale;
+          EXPECT_EQ(expected,
+              blob.data_at(0, c, h, mirror ? crop_size - 1 - w : w));
+        }
+      }
+    }
+  }
+  EXPECT_TRUE(mirrored[0]);
+  EXPECT_TRUE(mirrored[1]);
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
@@ -117,6 +117,31 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestValueView) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  const char* data;
+  size_t size;
+  if (!cursor->value_view(&data, &size)) {
+    // only LMDB keeps the values in place
+    EXPECT_EQ(DataParameter_DB_LEVELDB, this->backend_);
+    return;
+  }
+  const string first = cursor->value();
+  EXPECT_EQ(first, string(data, size));
+  // still there after the cursor moved on
+  cursor->Next();
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(first, string(data, size));
+  Datum datum;
+  const char* pixels;
+  size_t pixels_size;
+  EXPECT_TRUE(ParseDatumAliasing(data, size, &datum, &pixels, &pixels_size));
+  EXPECT_EQ(datum.channels() * datum.height() * datum.width(), pixels_size);
+  EXPECT_EQ(360, datum.height());
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fold_batch_norm.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class FoldBatchNormTest : public ::testing::Test {
+ protected:
+  void RunFoldTest(
+      const string& input_param_string, const string& output_param_string) {
+    // Test that FoldBatchNorm called on the proto specified by
+    // input_param_string results in the proto specified by
+    // output_param_string.
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    FoldBatchNorm(input_param, &actual_output_param);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+    // Also test idempotence.
+    NetParameter double_fold_param;
+    FoldBatchNorm(actual_output_param, &double_fold_param);
+    EXPECT_EQ(actual_output_param.DebugString(),
+       double_fold_param.DebugString());
+  }
+};
+
+TEST_F(FoldBatchNormTest, TestFoldInPlace) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  convolution_param { num_output: 4 kernel_size: 3 bias_term: false } "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'bn' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'scale' "
+      "  type: 'Scale' "
+      "  scale_param { bias_term: true } "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 2 } "
+      "  bottom: 'conv' "
+      "  top: 'ip' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  convolution_param { num_output: 4 kernel_size: 3 bias_term: true "
+      "    relu: true } "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 2 } "
+      "  bottom: 'conv' "
+      "  top: 'ip' "
+      "} ";
+  this->RunFoldTest(input_proto, expected_output_proto);
+}
+
+TEST_F(FoldBatchNormTest, TestFoldOutOfPlace) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 2 bias_term: false } "
+      "  bottom: 'data' "
+      "  top: 'ip' "
+      "} "
+      "layer { "
+      "  name: 'scale' "
+      "  type: 'Scale' "
+      "  bottom: 'ip' "
+      "  top: 'scale' "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'scale' "
+      "  top: 'relu' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'relu' "
+      "  bottom: 'data' "
+      "} ";
+  // a Scale without a bias doesn't need one in the layer either
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 2 bias_term: false relu: true } "
+      "  bottom: 'data' "
+      "  top: 'relu' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'relu' "
+      "  bottom: 'data' "
+      "} ";
+  this->RunFoldTest(input_proto, expected_output_proto);
+}
+
+TEST_F(FoldBatchNormTest, TestNoFold) {
+  // The output of conv1 is read by another layer than bn1; bn2 normalizes
+  // by the statistics of each batch; a leaky ReLU isn't a ReLU; and the
+  // output of ip is already rectified.
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  convolution_param { num_output: 4 kernel_size: 1 } "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'bn1' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'conv1' "
+      "  top: 'bn1' "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  convolution_param { num_output: 4 kernel_size: 1 } "
+      "  bottom: 'conv1' "
+      "  top: 'conv2' "
+      "} "
+      "layer { "
+      "  name: 'bn2' "
+      "  type: 'BatchNorm' "
+      "  batch_norm_param { use_global_stats: false } "
+      "  bottom: 'conv2' "
+      "  top: 'conv2' "
+      "} "
+      "layer { "
+      "  name: 'conv3' "
+      "  type: 'Convolution' "
+      "  convolution_param { num_output: 4 kernel_size: 1 } "
+      "  bottom: 'bn1' "
+      "  top: 'conv3' "
+      "} "
+      "layer { "
+      "  name: 'relu3' "
+      "  type: 'ReLU' "
+      "  relu_param { negative_slope: 0.1 } "
+      "  bottom: 'conv3' "
+      "  top: 'conv3' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { num_output: 2 relu: true } "
+      "  bottom: 'conv3' "
+      "  top: 'ip' "
+      "} "
+      "layer { "
+      "  name: 'bn_ip' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'ip' "
+      "  top: 'ip' "
+      "} ";
+  this->RunFoldTest(input_proto, input_proto);
+}
+
+template <typename TypeParam>
+class FoldBatchNormNetTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  FoldBatchNormNetTest() : seed_(1701) {}
+
+  // A net of each kind of chain, with the channels of the BatchNorm and
+  // Scale layers on the rows of the weights, and on the columns of the
+  // transposed inner product.
+  void InitNetParam(const bool fold_batch_norm) {
+    const string& proto =
+        "name: 'FoldBatchNormNetwork' "
+        "state { phase: TEST } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  input_param { shape { dim: 2 dim: 3 dim: 6 dim: 5 } } "
+        "  top: 'data' "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  convolution_param { "
+        "    num_output: 4 kernel_size: 3 pad: 1 bias_term: false "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'bn1' "
+        "  type: 'BatchNorm' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'scale1' "
+        "  type: 'Scale' "
+        "  scale_param { bias_term: true } "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'conv2' "
+        "  type: 'Convolution' "
+        "  convolution_param { "
+        "    num_output: 5 kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "    bias_filler { type: 'gaussian' std: 0.3 } "
+        "  } "
+        "  bottom: 'conv1' "
+        "  top: 'conv2' "
+        "} "
+        "layer { "
+        "  name: 'bn2' "
+        "  type: 'BatchNorm' "
+        "  batch_norm_param { eps: 0.01 } "
+        "  bottom: 'conv2' "
+        "  top: 'bn2' "
+        "} "
+        "layer { "
+        "  name: 'relu2' "
+        "  type: 'ReLU' "
+        "  bottom: 'bn2' "
+        "  top: 'bn2' "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 6 transpose: true "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "    bias_filler { type: 'gaussian' std: 0.3 } "
+        "  } "
+        "  bottom: 'bn2' "
+        "  top: 'ip' "
+        "} "
+        "layer { "
+        "  name: 'bn_ip' "
+        "  type: 'BatchNorm' "
+        "  bottom: 'ip' "
+        "  top: 'bn_ip' "
+        "} "
+        "layer { "
+        "  name: 'scale_ip' "
+        "  type: 'Scale' "
+        "  bottom: 'bn_ip' "
+        "  top: 'scale_ip' "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+    param_.set_fold_batch_norm(fold_batch_norm);
+  }
+
+  // Fills the statistics of the BatchNorm layers and the params of the
+  // Scale layers of net, which the fillers leave as the identity.
+  void FillStatistics(Net<Dtype>* net) {
+    FillerParameter filler_param;
+    filler_param.set_std(0.5);
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int i = 0; i < net->layers().size(); ++i) {
+      const string& type = net->layers()[i]->type();
+      vector<shared_ptr<Blob<Dtype> > >& blobs = net->layers()[i]->blobs();
+      if (type == string("BatchNorm")) {
+        filler.Fill(blobs[0].get());
+        caffe_rng_uniform<Dtype>(blobs[1]->count(), Dtype(0.5), Dtype(2),
+            blobs[1]->mutable_cpu_data());
+        // the moving averages are kept scaled by the factor in blobs[2]
+        blobs[2]->mutable_cpu_data()[0] = 2;
+      } else if (type == string("Scale")) {
+        for (int j = 0; j < blobs.size(); ++j) {
+          filler.Fill(blobs[j].get());
+        }
+      }
+    }
+  }
+
+  // Runs net on input and returns its output.
+  vector<Dtype> Forward(Net<Dtype>* net, const Blob<Dtype>& input) {
+    net->input_blobs()[0]->CopyFrom(input);
+    net->Forward();
+    const Blob<Dtype>* output = net->output_blobs()[0];
+    return vector<Dtype>(output->cpu_data(),
+        output->cpu_data() + output->count());
+  }
+
+  void ExpectNear(const vector<Dtype>& expected,
+      const vector<Dtype>& actual) {
+    ASSERT_EQ(expected.size(), actual.size());
+    for (int i = 0; i < expected.size(); ++i) {
+      EXPECT_NEAR(expected[i], actual[i],
+          1e-4 * std::max(Dtype(1), std::fabs(expected[i])));
+    }
+  }
+
+  int seed_;
+  NetParameter param_;
+};
+
+TYPED_TEST_CASE(FoldBatchNormNetTest, TestDtypesAndDevices);
+
+TYPED_TEST(FoldBatchNormNetTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetParam(false);
+  Net<Dtype> net(this->param_);
+  this->FillStatistics(&net);
+  Blob<Dtype> input(2, 3, 6, 5);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&input);
+  const vector<Dtype> expected = this->Forward(&net, input);
+  NetParameter trained_param;
+  net.ToProto(&trained_param);
+
+  // Each chain is folded into one layer, with the trained weights folded
+  // as they are copied.
+  this->InitNetParam(true);
+  Net<Dtype> folded_net(this->param_);
+  ASSERT_EQ(4, folded_net.layers().size());
+  EXPECT_EQ(2, folded_net.layer_by_name("conv1")->blobs().size());
+  EXPECT_EQ(2, folded_net.layer_by_name("conv2")->blobs().size());
+  EXPECT_EQ(2, folded_net.layer_by_name("ip")->blobs().size());
+  EXPECT_TRUE(folded_net.layer_by_name("bn1") == NULL);
+  EXPECT_TRUE(folded_net.has_blob("scale_ip"));
+  folded_net.CopyTrainedLayersFrom(trained_param);
+  this->ExpectNear(expected, this->Forward(&folded_net, input));
+
+  // Weights folded offline are copied as they are.
+  NetParameter folded_trained_param;
+  FoldBatchNorm(trained_param, &folded_trained_param);
+  ASSERT_EQ(4, folded_trained_param.layer_size());
+  Net<Dtype> offline_net(this->param_);
+  offline_net.CopyTrainedLayersFrom(folded_trained_param);
+  this->ExpectNear(expected, this->Forward(&offline_net, input));
+}
+
+TYPED_TEST(FoldBatchNormNetTest, TestForwardFromTrainNet) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  // Weights of the TRAIN net, whose BatchNorm layers normalize by the batch
+  // and where conv2 has another reader, so that they wouldn't fold by
+  // themselves. They still fold as the TEST net did.
+  this->InitNetParam(false);
+  NetParameter train_param(this->param_);
+  train_param.mutable_state()->set_phase(TRAIN);
+  for (int i = 0; i < train_param.layer_size(); ++i) {
+    if (train_param.layer(i).type() == "BatchNorm") {
+      train_param.mutable_layer(i)->mutable_batch_norm_param()
+          ->set_use_global_stats(false);
+    }
+  }
+  LayerParameter* silence_param = train_param.add_layer();
+  silence_param->set_name("silence");
+  silence_param->set_type("Silence");
+  silence_param->add_bottom("conv2");
+  silence_param->add_include()->set_phase(TRAIN);
+  Net<Dtype> train_net(train_param);
+  this->FillStatistics(&train_net);
+  NetParameter trained_param;
+  train_net.ToProto(&trained_param);
+  NetParameter refolded_param;
+  FoldBatchNorm(trained_param, &refolded_param);
+  EXPECT_EQ(trained_param.layer_size(), refolded_param.layer_size());
+
+  Net<Dtype> net(this->param_);
+  net.CopyTrainedLayersFrom(trained_param);
+  Blob<Dtype> input(2, 3, 6, 5);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&input);
+  const vector<Dtype> expected = this->Forward(&net, input);
+
+  this->InitNetParam(true);
+  Net<Dtype> folded_net(this->param_);
+  folded_net.CopyTrainedLayersFrom(trained_param);
+  this->ExpectNear(expected, this->Forward(&folded_net, input));
+}
+
+TYPED_TEST(FoldBatchNormNetTest, TestNoFoldInTrain) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitNetParam(true);
+  this->param_.mutable_state()->set_phase(TRAIN);
+  Net<Dtype> net(this->param_);
+  EXPECT_EQ(11, net.layers().size());
+}
+
+}  // namespace caffe
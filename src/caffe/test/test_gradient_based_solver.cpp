@@ -8,9 +8,12 @@
 #include "gtest/gtest.h"
 
 #include "caffe/common.hpp"
+#include "caffe/filler.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/sgd_solvers.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/format.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -26,7 +29,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), layer_wise_reduce_(true), fused_update_(true),
+      contiguous_params_(false) {
         input_file_ = new string(
         CMAKE_SOURCE_DIR "caffe/test/test_data/solver_data_list.txt" CMAKE_EXT);
       }
@@ -39,11 +43,15 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
 #ifdef USE_NCCL
   shared_ptr<NCCL<Dtype> > nccl_;
 #endif
+  shared_ptr<CPUSync<Dtype> > cpu_sync_;
   int seed_;
   // Dimensions are determined by generate_sample_data.py
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  bool layer_wise_reduce_;
+  bool fused_update_;
+  bool contiguous_params_;
   Dtype delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -87,9 +95,13 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
        "lr_policy: 'fixed' "
        "iter_size: " << iter_size << " "
        "device_id: " << device_id << " "
-       "layer_wise_reduce: " << (!share_) << " "
+       "layer_wise_reduce: " << layer_wise_reduce_ << " "
+       // one bucket per param
+       "reduce_bucket_mb: 0 "
+       "fused_update: " << fused_update_ << " "
        "net_param { "
        "  name: 'TestNetwork' "
+       "  contiguous_params: " << contiguous_params_ << " "
        "  layer { "
        "    name: 'data' "
        "    type: 'HDF5Data' "
@@ -194,6 +206,12 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
     if (devices == 1) {
       this->solver_->Solve();
+    } else if (Caffe::mode() == Caffe::CPU) {
+      LOG(INFO) << "Multi-CPU test on " << devices << " workers";
+      Caffe::set_solver_count(devices);
+      this->cpu_sync_.reset(new CPUSync<Dtype>(this->solver_));
+      this->cpu_sync_->Run(from_snapshot);
+      Caffe::set_solver_count(1);
     } else {
       LOG(INFO) << "Multi-GPU test on " << devices << " devices";
       vector<int> gpus;
@@ -459,8 +477,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
       const int iter_to_check = 0) {
     const int kNum = num_;
     const int kIterSize = 1;
-    // Test over all numbers of devices.
-    int available_devices = 1;
+    // Test over all numbers of devices, or of worker threads on the CPU.
+    int available_devices = Caffe::mode() == Caffe::CPU ? 3 : 1;
 #ifdef USE_NCCL
     if (Caffe::mode() == Caffe::GPU) {
       CUDA_CHECK(cudaGetDeviceCount(&available_devices));
@@ -656,6 +674,30 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingPerBlob) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->fused_update_ = false;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingContiguous) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->contiguous_params_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -691,6 +733,18 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingNoLayerWise) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.5;
+  const int kNumIters = 4;
+  this->layer_wise_reduce_ = false;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -702,6 +756,18 @@ TYPED_TEST(SGDSolverTest, TestSnapshot) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestSnapshotContiguous) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->contiguous_params_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -755,6 +821,18 @@ TYPED_TEST(AdaGradSolverTest, TestAdaGradLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(AdaGradSolverTest, TestLeastSquaresUpdateWithEverythingPerBlob) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  this->fused_update_ = false;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(AdaGradSolverTest,
       TestAdaGradLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
@@ -889,6 +967,18 @@ TYPED_TEST(NesterovSolverTest, TestNesterovLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(NesterovSolverTest, TestLeastSquaresUpdateWithEverythingPerBlob) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->fused_update_ = false;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(NesterovSolverTest,
            TestNesterovLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
@@ -1018,6 +1108,30 @@ TYPED_TEST(AdaDeltaSolverTest, TestAdaDeltaLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(AdaDeltaSolverTest, TestLeastSquaresUpdateWithEverythingPerBlob) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.95;
+  const int kNumIters = 4;
+  this->fused_update_ = false;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(AdaDeltaSolverTest, TestLeastSquaresUpdateWithEverythingContiguous) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.1;
+  const Dtype kWeightDecay = 0.1;
+  const Dtype kMomentum = 0.95;
+  const int kNumIters = 4;
+  this->contiguous_params_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(AdaDeltaSolverTest,
            TestAdaDeltaLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
@@ -1121,6 +1235,30 @@ TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(AdamSolverTest, TestLeastSquaresUpdateWithEverythingPerBlob) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->fused_update_ = false;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
+TYPED_TEST(AdamSolverTest, TestLeastSquaresUpdateWithEverythingContiguous) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->contiguous_params_ = true;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(AdamSolverTest, TestAdamLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -1167,6 +1305,18 @@ TYPED_TEST(AdamSolverTest, TestSnapshot) {
   }
 }
 
+TYPED_TEST(AdamSolverTest, TestSnapshotContiguous) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->contiguous_params_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(AdamSolverTest, TestSnapshotShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -1223,6 +1373,18 @@ TYPED_TEST(RMSPropSolverTest, TestRMSPropLeastSquaresUpdateWithEverything) {
   }
 }
 
+TYPED_TEST(RMSPropSolverTest, TestLeastSquaresUpdateWithEverythingPerBlob) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.0;
+  const int kNumIters = 4;
+  this->fused_update_ = false;
+  for (int i = 0; i <= kNumIters; ++i) {
+    this->TestLeastSquaresUpdate(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(RMSPropSolverTest,
       TestRMSPropLeastSquaresUpdateWithEverythingShare) {
   typedef typename TypeParam::Dtype Dtype;
@@ -1282,4 +1444,225 @@ TYPED_TEST(RMSPropSolverTest, TestSnapshotShare) {
   }
 }
 
+// Exposes ApplyUpdate, to update the params from diffs set by the test.
+template <typename SolverType>
+class UpdateOnlySolver : public SolverType {
+ public:
+  explicit UpdateOnlySolver(const SolverParameter& param)
+      : SolverType(param) {}
+  void Update(int iter) {
+    this->iter_ = iter;
+    this->ApplyUpdate();
+  }
+};
+
+// A net of num_layers inner products of num_output outputs each, with
+// random weights and biases.
+static NetParameter InnerProductStack(int num_layers, int num_output) {
+  NetParameter net_param;
+  LayerParameter* data = net_param.add_layer();
+  data->set_name("data");
+  data->set_type("DummyData");
+  data->add_top("data");
+  BlobShape* shape = data->mutable_dummy_data_param()->add_shape();
+  shape->add_dim(2);
+  shape->add_dim(num_output);
+  for (int i = 0; i < num_layers; ++i) {
+    LayerParameter* ip = net_param.add_layer();
+    ip->set_name("ip" + format_int(i));
+    ip->set_type("InnerProduct");
+    ip->add_bottom(i == 0 ? "data" : "ip" + format_int(i - 1));
+    ip->add_top("ip" + format_int(i));
+    ip->add_param()->set_lr_mult(1);
+    ParamSpec* bias_spec = ip->add_param();
+    bias_spec->set_lr_mult(2);
+    bias_spec->set_decay_mult(0);
+    InnerProductParameter* ip_param = ip->mutable_inner_product_param();
+    ip_param->set_num_output(num_output);
+    ip_param->mutable_weight_filler()->set_type("gaussian");
+    ip_param->mutable_bias_filler()->set_type("gaussian");
+  }
+  return net_param;
+}
+
+// Checks that the fused CPU update, split over several threads, gives the
+// params, diffs and history of the per-param steps.
+template <typename Dtype>
+class FusedUpdateTest : public ::testing::Test {
+ protected:
+  FusedUpdateTest() : fused_contiguous_(false) {
+    Caffe::set_mode(Caffe::CPU);
+    param_.mutable_net_param()->CopyFrom(InnerProductStack(3, 120));
+    param_.set_base_lr(0.01);
+    param_.set_lr_policy("fixed");
+    param_.set_weight_decay(0.1);
+    param_.set_iter_size(2);
+  }
+  virtual ~FusedUpdateTest() {
+    Caffe::set_intra_op_threads(1);
+  }
+
+  template <typename SolverType>
+  void CheckFused() {
+    param_.set_fused_update(false);
+    Caffe::set_random_seed(1701);
+    UpdateOnlySolver<SolverType> per_blob(param_);
+    param_.set_fused_update(true);
+    param_.mutable_net_param()->set_contiguous_params(fused_contiguous_);
+    Caffe::set_random_seed(1701);
+    UpdateOnlySolver<SolverType> fused(param_);
+    if (fused_contiguous_) {
+      ExpectContiguous(fused.net()->learnable_params());
+      vector<Blob<Dtype>*> history;
+      for (int i = 0; i < fused.history().size(); ++i) {
+        history.push_back(fused.history()[i].get());
+      }
+      ExpectContiguous(history);
+    }
+    const vector<Blob<Dtype>*>& params = per_blob.net()->learnable_params();
+    const vector<Blob<Dtype>*>& fused_params =
+        fused.net()->learnable_params();
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int iter = 0; iter < 3; ++iter) {
+      Caffe::set_random_seed(1702 + iter);
+      for (int i = 0; i < params.size(); ++i) {
+        temp_.ReshapeLike(*params[i]);
+        filler.Fill(&temp_);
+        caffe_copy(temp_.count(), temp_.cpu_data(),
+            params[i]->mutable_cpu_diff());
+        caffe_copy(temp_.count(), temp_.cpu_data(),
+            fused_params[i]->mutable_cpu_diff());
+      }
+      Caffe::set_intra_op_threads(1);
+      per_blob.Update(iter);
+      Caffe::set_intra_op_threads(3);
+      fused.Update(iter);
+      for (int i = 0; i < params.size(); ++i) {
+        ExpectNear(*params[i], *fused_params[i]);
+      }
+      for (int i = 0; i < per_blob.history().size(); ++i) {
+        ExpectNear(*per_blob.history()[i], *fused.history()[i]);
+      }
+    }
+  }
+
+  void ExpectContiguous(const vector<Blob<Dtype>*>& blobs) {
+    for (int i = 1; i < blobs.size(); ++i) {
+      EXPECT_EQ(blobs[i - 1]->cpu_data() + blobs[i - 1]->count(),
+          blobs[i]->cpu_data());
+    }
+  }
+
+  void ExpectNear(const Blob<Dtype>& expected, const Blob<Dtype>& blob) {
+    const Dtype kPrecision = 1e-4;
+    ASSERT_EQ(expected.count(), blob.count());
+    for (int i = 0; i < blob.count(); ++i) {
+      const Dtype data = expected.cpu_data()[i];
+      EXPECT_NEAR(data, blob.cpu_data()[i],
+          kPrecision * std::max(Dtype(1), std::fabs(data)));
+      const Dtype diff = expected.cpu_diff()[i];
+      EXPECT_NEAR(diff, blob.cpu_diff()[i],
+          kPrecision * std::max(Dtype(1), std::fabs(diff)));
+    }
+  }
+
+  SolverParameter param_;
+  // whether the fused solver keeps its params and history in arenas
+  bool fused_contiguous_;
+  Blob<Dtype> temp_;
+};
+
+TYPED_TEST_CASE(FusedUpdateTest, TestDtypes);
+
+TYPED_TEST(FusedUpdateTest, TestSGD) {
+  this->param_.set_momentum(0.9);
+  this->template CheckFused<SGDSolver<TypeParam> >();
+}
+
+TYPED_TEST(FusedUpdateTest, TestSGDL1) {
+  this->param_.set_momentum(0.9);
+  this->param_.set_regularization_type("L1");
+  this->template CheckFused<SGDSolver<TypeParam> >();
+}
+
+TYPED_TEST(FusedUpdateTest, TestNesterov) {
+  this->param_.set_momentum(0.9);
+  this->template CheckFused<NesterovSolver<TypeParam> >();
+}
+
+TYPED_TEST(FusedUpdateTest, TestAdaGrad) {
+  this->template CheckFused<AdaGradSolver<TypeParam> >();
+}
+
+TYPED_TEST(FusedUpdateTest, TestRMSProp) {
+  this->template CheckFused<RMSPropSolver<TypeParam> >();
+}
+
+TYPED_TEST(FusedUpdateTest, TestAdaDelta) {
+  this->param_.set_momentum(0.95);
+  this->param_.set_delta(1e-6);
+  this->template CheckFused<AdaDeltaSolver<TypeParam> >();
+}
+
+TYPED_TEST(FusedUpdateTest, TestAdam) {
+  this->param_.set_momentum(0.9);
+  this->template CheckFused<AdamSolver<TypeParam> >();
+}
+
+TYPED_TEST(FusedUpdateTest, TestSGDContiguousClipped) {
+  this->param_.set_momentum(0.9);
+  this->param_.set_clip_gradients(1);
+  this->fused_contiguous_ = true;
+  this->template CheckFused<SGDSolver<TypeParam> >();
+}
+
+TYPED_TEST(FusedUpdateTest, TestAdamContiguous) {
+  this->param_.set_momentum(0.9);
+  this->fused_contiguous_ = true;
+  this->template CheckFused<AdamSolver<TypeParam> >();
+}
+
+// Times the update of a net of many small params, as in deep residual
+// nets, per param and fused.
+template <typename SolverType>
+static void TimeUpdate(SolverParameter param, const char* name) {
+  const int iterations = 50;
+  float ms[2];
+  for (int fused = 0; fused < 2; ++fused) {
+    param.set_fused_update(fused);
+    UpdateOnlySolver<SolverType> solver(param);
+    const vector<Blob<float>*>& params = solver.net()->learnable_params();
+    for (int i = 0; i < params.size(); ++i) {
+      caffe_set(params[i]->count(), 1e-3f, params[i]->mutable_cpu_diff());
+    }
+    CPUTimer timer;
+    timer.Start();
+    for (int i = 0; i < iterations; ++i) {
+      solver.Update(i);
+    }
+    ms[fused] = timer.MilliSeconds() / iterations;
+  }
+  LOG(INFO) << name << ": per param " << ms[0] << " ms, fused " << ms[1]
+      << " ms";
+}
+
+TEST(FusedUpdateBenchmarkTest, DISABLED_TestSolvers) {
+  Caffe::set_mode(Caffe::CPU);
+  SolverParameter param;
+  // 300 params of 64 x 64 weights or 64 biases
+  param.mutable_net_param()->CopyFrom(InnerProductStack(150, 64));
+  param.set_base_lr(0.01);
+  param.set_lr_policy("fixed");
+  param.set_weight_decay(1e-4);
+  param.set_iter_size(2);
+  TimeUpdate<AdaGradSolver<float> >(param, "AdaGrad");
+  TimeUpdate<RMSPropSolver<float> >(param, "RMSProp");
+  param.set_momentum(0.9);
+  TimeUpdate<SGDSolver<float> >(param, "SGD");
+  TimeUpdate<NesterovSolver<float> >(param, "Nesterov");
+  TimeUpdate<AdaDeltaSolver<float> >(param, "AdaDelta");
+  TimeUpdate<AdamSolver<float> >(param, "Adam");
+}
+
 }  // namespace caffe
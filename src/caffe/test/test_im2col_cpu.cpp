@@ -0,0 +1,145 @@
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/im2col.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Checks that the CPU lowering gives the same results on several threads
+// as on one.
+template <typename Dtype>
+class Im2colCPUTest : public ::testing::Test {
+ protected:
+  Im2colCPUTest()
+      : blob_im_(new Blob<Dtype>(1, 16, 32, 31)),
+        blob_col_(new Blob<Dtype>(1, 16 * 9, 16, 16)),
+        blob_ref_(new Blob<Dtype>()) {
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_im_);
+    filler.Fill(blob_col_);
+  }
+  virtual ~Im2colCPUTest() {
+    Caffe::set_intra_op_threads(1);
+    delete blob_im_;
+    delete blob_col_;
+    delete blob_ref_;
+  }
+
+  void ExpectEqualToRef(const Blob<Dtype>& blob) {
+    ASSERT_EQ(blob_ref_->count(), blob.count());
+    for (int i = 0; i < blob.count(); ++i) {
+      EXPECT_EQ(blob_ref_->cpu_data()[i], blob.cpu_data()[i]);
+    }
+  }
+
+  // 3x3 kernel, pad 1, stride 2, dilation 1, over blob_im_
+  void Im2col(Blob<Dtype>* col) {
+    im2col_cpu(blob_im_->cpu_data(), 16, 32, 31, 3, 3, 1, 1, 2, 2, 1, 1,
+        col->mutable_cpu_data());
+  }
+  void Col2im(Blob<Dtype>* im) {
+    col2im_cpu(blob_col_->cpu_data(), 16, 32, 31, 3, 3, 1, 1, 2, 2, 1, 1,
+        im->mutable_cpu_data());
+  }
+
+  Blob<Dtype>* const blob_im_;
+  Blob<Dtype>* const blob_col_;
+  Blob<Dtype>* const blob_ref_;
+};
+
+TYPED_TEST_CASE(Im2colCPUTest, TestDtypes);
+
+TYPED_TEST(Im2colCPUTest, TestIm2colThreads) {
+  this->blob_ref_->ReshapeLike(*this->blob_col_);
+  this->Im2col(this->blob_ref_);
+  Caffe::set_intra_op_threads(4);
+  this->Im2col(this->blob_col_);
+  this->ExpectEqualToRef(*this->blob_col_);
+}
+
+TYPED_TEST(Im2colCPUTest, TestCol2imThreads) {
+  this->blob_ref_->ReshapeLike(*this->blob_im_);
+  this->Col2im(this->blob_ref_);
+  Caffe::set_intra_op_threads(3);
+  this->Col2im(this->blob_im_);
+  this->ExpectEqualToRef(*this->blob_im_);
+}
+
+TYPED_TEST(Im2colCPUTest, TestIm2colNDThreads) {
+  // the image as 2 channels of 8 x 32 x 31 volumes, with a 3 x 3 x 3 kernel
+  const int im_shape[] = {2, 8, 32, 31};
+  const int col_shape[] = {2 * 27, 8, 32, 31};
+  const int kernel_shape[] = {3, 3, 3};
+  const int pad[] = {1, 1, 1};
+  const int stride[] = {1, 1, 1};
+  const int dilation[] = {1, 1, 1};
+  vector<int> shape(col_shape, col_shape + 4);
+  this->blob_col_->Reshape(shape);
+  this->blob_ref_->Reshape(shape);
+  im2col_nd_cpu(this->blob_im_->cpu_data(), 3, im_shape, col_shape,
+      kernel_shape, pad, stride, dilation,
+      this->blob_ref_->mutable_cpu_data());
+  Caffe::set_intra_op_threads(4);
+  im2col_nd_cpu(this->blob_im_->cpu_data(), 3, im_shape, col_shape,
+      kernel_shape, pad, stride, dilation,
+      this->blob_col_->mutable_cpu_data());
+  this->ExpectEqualToRef(*this->blob_col_);
+  // and back, with the kernel offsets of each channel summed up
+  this->blob_ref_->ReshapeLike(*this->blob_im_);
+  Caffe::set_intra_op_threads(1);
+  col2im_nd_cpu(this->blob_col_->cpu_data(), 3, im_shape, col_shape,
+      kernel_shape, pad, stride, dilation,
+      this->blob_ref_->mutable_cpu_data());
+  Caffe::set_intra_op_threads(4);
+  col2im_nd_cpu(this->blob_col_->cpu_data(), 3, im_shape, col_shape,
+      kernel_shape, pad, stride, dilation,
+      this->blob_im_->mutable_cpu_data());
+  this->ExpectEqualToRef(*this->blob_im_);
+}
+
+// The lowering of a 64 x 56 x 56 image for a 3 x 3 convolution, on one
+// thread and on all cores.
+TEST(Im2colBenchmarkTest, DISABLED_TestThreads) {
+  const int channels = 64;
+  const int size = 56;
+  const int iterations = 50;
+  Blob<float> im(1, channels, size, size);
+  Blob<float> col(1, channels * 9, size, size);
+  FillerParameter filler_param;
+  GaussianFiller<float> filler(filler_param);
+  filler.Fill(&im);
+  const int max_threads = std::max(1,
+      static_cast<int>(boost::thread::hardware_concurrency()));
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    Caffe::set_intra_op_threads(threads);
+    CPUTimer timer;
+    timer.Start();
+    for (int i = 0; i < iterations; ++i) {
+      im2col_cpu(im.cpu_data(), channels, size, size, 3, 3, 1, 1, 1, 1, 1, 1,
+          col.mutable_cpu_data());
+    }
+    const float im2col_ms = timer.MilliSeconds() / iterations;
+    timer.Start();
+    for (int i = 0; i < iterations; ++i) {
+      col2im_cpu(col.cpu_data(), channels, size, size, 3, 3, 1, 1, 1, 1, 1, 1,
+          im.mutable_cpu_data());
+    }
+    const float col2im_ms = timer.MilliSeconds() / iterations;
+    LOG(INFO) << threads << " threads: im2col " << im2col_ms << " ms, col2im "
+        << col2im_ms << " ms";
+  }
+  Caffe::set_intra_op_threads(1);
+}
+
+}  // namespace caffe
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,6 +8,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/layers/int8_inner_product_layer.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -239,6 +242,70 @@ TYPED_TEST(InnerProductLayerTest, TestForwardNoBatch) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestInt8Forward) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  Blob<Dtype> ref_top;
+  vector<Blob<Dtype>*> ref_top_vec(1, &ref_top);
+  for (int transpose = 0; transpose < 2; ++transpose) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->set_transpose(transpose);
+    inner_product_param->mutable_weight_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    // the range of the uniform input
+    layer_param.mutable_quantization_param()->set_input_range(1);
+    InnerProductLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, ref_top_vec);
+    layer.Forward(this->blob_bottom_vec_, ref_top_vec);
+    Int8InnerProductLayer<Dtype> int8_layer(layer_param);
+    int8_layer.blobs() = layer.blobs();
+    int8_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    int8_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const Dtype* data = this->blob_top_->cpu_data();
+    const Dtype* ref_data = ref_top.cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      // a few times the rounding error of the sums of int8 products
+      EXPECT_NEAR(data[i], ref_data[i], 0.2);
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestInt8TestPhase) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->set_transpose(true);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  layer_param.mutable_quantization_param()->set_input_range(1);
+  Int8InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> weights;
+  weights.CopyFrom(*layer.blobs()[0], false, true);
+  Dtype max_weight = 0;
+  for (int i = 0; i < weights.count(); ++i) {
+    max_weight = std::max(max_weight, std::abs(weights.cpu_data()[i]));
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // the floats are freed, and ToProto writes the dequantized weights
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED, layer.blobs()[0]->data()->head());
+  LayerParameter written;
+  layer.ToProto(&written);
+  Blob<Dtype> written_weights;
+  written_weights.FromProto(written.blobs(0));
+  ASSERT_EQ(weights.count(), written_weights.count());
+  for (int i = 0; i < weights.count(); ++i) {
+    EXPECT_NEAR(weights.cpu_data()[i], written_weights.cpu_data()[i],
+        max_weight / 254 * 1.001);
+  }
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   this->blob_bottom_vec_.push_back(this->blob_bottom_);
@@ -0,0 +1,151 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Checks that the CPU layers split over the intra-op threads give the same
+// results as on one thread. The blobs are large enough for every layer to
+// run in several blocks.
+template <typename Dtype>
+class IntraOpThreadsTest : public ::testing::Test {
+ protected:
+  IntraOpThreadsTest()
+      : blob_bottom_a_(new Blob<Dtype>(4, 8, 40, 40)),
+        blob_bottom_b_(new Blob<Dtype>(4, 8, 40, 40)),
+        blob_top_(new Blob<Dtype>()) {
+    Caffe::set_random_seed(1701);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_a_);
+    filler.Fill(blob_bottom_b_);
+    blob_bottom_vec_.push_back(blob_bottom_a_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~IntraOpThreadsTest() {
+    Caffe::set_intra_op_threads(1);
+    delete blob_bottom_a_;
+    delete blob_bottom_b_;
+    delete blob_top_;
+  }
+
+  // Runs Forward and Backward of a new layer, and returns the top data and
+  // the bottom diffs.
+  vector<Dtype> Run(const LayerParameter& layer_param) {
+    shared_ptr<Layer<Dtype> > layer =
+        LayerRegistry<Dtype>::CreateLayer(layer_param);
+    layer->SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer->Forward(blob_bottom_vec_, blob_top_vec_);
+    Caffe::set_random_seed(1702);
+    caffe_rng_gaussian<Dtype>(blob_top_->count(), Dtype(0), Dtype(1),
+        blob_top_->mutable_cpu_diff());
+    vector<bool> propagate_down(blob_bottom_vec_.size(), true);
+    layer->Backward(blob_top_vec_, propagate_down, blob_bottom_vec_);
+    vector<Dtype> results(blob_top_->cpu_data(),
+        blob_top_->cpu_data() + blob_top_->count());
+    for (int i = 0; i < blob_bottom_vec_.size(); ++i) {
+      const Dtype* diff = blob_bottom_vec_[i]->cpu_diff();
+      results.insert(results.end(), diff,
+          diff + blob_bottom_vec_[i]->count());
+    }
+    return results;
+  }
+
+  void CheckThreads(const LayerParameter& layer_param, Dtype threshold) {
+    Caffe::set_intra_op_threads(1);
+    const vector<Dtype> expected = Run(layer_param);
+    Caffe::set_intra_op_threads(3);
+    const vector<Dtype> results = Run(layer_param);
+    ASSERT_EQ(expected.size(), results.size());
+    for (int i = 0; i < results.size(); ++i) {
+      EXPECT_NEAR(expected[i], results[i], threshold);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_a_;
+  Blob<Dtype>* const blob_bottom_b_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(IntraOpThreadsTest, TestDtypes);
+
+TYPED_TEST(IntraOpThreadsTest, TestReLU) {
+  LayerParameter layer_param;
+  layer_param.set_type("ReLU");
+  layer_param.mutable_relu_param()->set_negative_slope(0.01);
+  this->CheckThreads(layer_param, 0);
+}
+
+TYPED_TEST(IntraOpThreadsTest, TestEltwiseSum) {
+  this->blob_bottom_vec_.push_back(this->blob_bottom_b_);
+  LayerParameter layer_param;
+  layer_param.set_type("Eltwise");
+  EltwiseParameter* eltwise_param = layer_param.mutable_eltwise_param();
+  eltwise_param->set_operation(EltwiseParameter_EltwiseOp_SUM);
+  eltwise_param->add_coeff(1);
+  eltwise_param->add_coeff(-0.5);
+  this->CheckThreads(layer_param, 0);
+}
+
+TYPED_TEST(IntraOpThreadsTest, TestEltwiseMax) {
+  this->blob_bottom_vec_.push_back(this->blob_bottom_b_);
+  LayerParameter layer_param;
+  layer_param.set_type("Eltwise");
+  layer_param.mutable_eltwise_param()->set_operation(
+      EltwiseParameter_EltwiseOp_MAX);
+  this->CheckThreads(layer_param, 0);
+}
+
+TYPED_TEST(IntraOpThreadsTest, TestMaxPooling) {
+  LayerParameter layer_param;
+  layer_param.set_type("Pooling");
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  this->CheckThreads(layer_param, 0);
+}
+
+TYPED_TEST(IntraOpThreadsTest, TestAvePooling) {
+  LayerParameter layer_param;
+  layer_param.set_type("Pooling");
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pad(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_AVE);
+  this->CheckThreads(layer_param, 0);
+}
+
+TYPED_TEST(IntraOpThreadsTest, TestLRN) {
+  LayerParameter layer_param;
+  layer_param.set_type("LRN");
+  this->CheckThreads(layer_param, 0);
+}
+
+TYPED_TEST(IntraOpThreadsTest, TestSoftmax) {
+  LayerParameter layer_param;
+  layer_param.set_type("Softmax");
+  this->CheckThreads(layer_param, 0);
+}
+
+TYPED_TEST(IntraOpThreadsTest, TestBatchNorm) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.set_type("BatchNorm");
+  // the row sums may be added up in another order
+  this->CheckThreads(layer_param, Dtype(1e-4));
+}
+
+}  // namespace caffe
@@ -420,5 +420,57 @@ TEST_F(IOTest, TestDecodeDatumToCVMatContentNative) {
   }
 }
 
+TEST_F(IOTest, TestParseDatumAliasing) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  Datum datum;
+  EXPECT_TRUE(ReadImageToDatum(filename, 7, &datum));
+  datum.add_float_data(0.5);
+  string serialized;
+  EXPECT_TRUE(datum.SerializeToString(&serialized));
+  Datum parsed;
+  const char* data;
+  size_t data_size;
+  EXPECT_TRUE(ParseDatumAliasing(serialized.data(), serialized.size(),
+      &parsed, &data, &data_size));
+  EXPECT_EQ(0, parsed.data().size());
+  EXPECT_EQ(datum.channels(), parsed.channels());
+  EXPECT_EQ(datum.height(), parsed.height());
+  EXPECT_EQ(datum.width(), parsed.width());
+  EXPECT_EQ(7, parsed.label());
+  EXPECT_FALSE(parsed.encoded());
+  ASSERT_EQ(1, parsed.float_data_size());
+  EXPECT_EQ(0.5, parsed.float_data(0));
+  // the pixels are not copied
+  EXPECT_GE(data, serialized.data());
+  EXPECT_LE(data + data_size, serialized.data() + serialized.size());
+  EXPECT_EQ(datum.data(), string(data, data_size));
+}
+
+TEST_F(IOTest, TestDecodeDatumToCVMatAliasing) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  Datum datum;
+  EXPECT_TRUE(ReadImageToDatum(filename, 0, std::string("jpg"), &datum));
+  string serialized;
+  EXPECT_TRUE(datum.SerializeToString(&serialized));
+  Datum parsed;
+  const char* data;
+  size_t data_size;
+  EXPECT_TRUE(ParseDatumAliasing(serialized.data(), serialized.size(),
+      &parsed, &data, &data_size));
+  EXPECT_TRUE(parsed.encoded());
+  cv::Mat cv_img = DecodeDatumToCVMat(parsed, data, data_size, true);
+  cv::Mat cv_img_ref = DecodeDatumToCVMat(datum, true);
+  ASSERT_EQ(cv_img_ref.rows, cv_img.rows);
+  ASSERT_EQ(cv_img_ref.cols, cv_img.cols);
+  for (int h = 0; h < cv_img.rows; ++h) {
+    for (int w = 0; w < cv_img.cols; ++w) {
+      for (int c = 0; c < 3; ++c) {
+        EXPECT_EQ(cv_img_ref.at<cv::Vec3b>(h, w)[c],
+            cv_img.at<cv::Vec3b>(h, w)[c]);
+      }
+    }
+  }
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
@@ -0,0 +1,119 @@
+#include <cmath>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/l2n_layer.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class L2NLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+ protected:
+  L2NLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_top_(new Blob<Dtype>()) {
+    // fill the values
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~L2NLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  void TestForwardUnitNorm() {
+    LayerParameter layer_param;
+    L2NLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    int num = this->blob_bottom_->num();
+    int channels = this->blob_bottom_->channels();
+    int height = this->blob_bottom_->height();
+    int width = this->blob_bottom_->width();
+
+    for (int i = 0; i < num; ++i) {
+      for (int k = 0; k < height; ++k) {
+        for (int l = 0; l < width; ++l) {
+          Dtype norm = 0;
+          for (int j = 0; j < channels; ++j) {
+            Dtype data = this->blob_bottom_->data_at(i, j, k, l);
+            norm += data * data;
+          }
+          norm = std::sqrt(norm);
+          for (int j = 0; j < channels; ++j) {
+            // expect the input direction with unit length
+            EXPECT_NEAR(this->blob_bottom_->data_at(i, j, k, l) / norm,
+                this->blob_top_->data_at(i, j, k, l), 1e-4);
+          }
+        }
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(L2NLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(L2NLayerTest, TestForward) {
+  this->TestForwardUnitNorm();
+}
+
+TYPED_TEST(L2NLayerTest, TestForwardVector) {
+  this->blob_bottom_->Reshape(5, 70, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<typename TypeParam::Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  this->TestForwardUnitNorm();
+}
+
+TYPED_TEST(L2NLayerTest, TestForwardInPlace) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  L2NLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> in_place(this->blob_bottom_->shape());
+  in_place.CopyFrom(*this->blob_bottom_);
+  vector<Blob<Dtype>*> in_place_vec(1, &in_place);
+  L2NLayer<Dtype> in_place_layer(layer_param);
+  in_place_layer.SetUp(in_place_vec, in_place_vec);
+  in_place_layer.Forward(in_place_vec, in_place_vec);
+  for (int i = 0; i < in_place.count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], in_place.cpu_data()[i], 1e-6);
+  }
+}
+
+TYPED_TEST(L2NLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  L2NLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(L2NLayerTest, TestGradientVector) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(4, 6, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  L2NLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
@@ -1,6 +1,8 @@
 #include <stdint.h>  // for uint32_t & uint64_t
 #include <time.h>
+#include <algorithm>
 #include <cmath>  // for std::fabs
+#include <vector>
 
 #include "gtest/gtest.h"
 
@@ -119,6 +121,114 @@ TYPED_TEST(CPUMathFunctionsTest, TestCopy) {
   }
 }
 
+TYPED_TEST(CPUMathFunctionsTest, TestQuantize) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  // the gaussian values beyond 1 saturate
+  const TypeParam scale = 127;
+  vector<int8_t> y(n);
+  caffe_cpu_quantize<TypeParam>(n, scale, x, &y[0]);
+  for (int i = 0; i < n; ++i) {
+    const TypeParam expected = std::min(std::max(x[i] * scale,
+        TypeParam(-127)), TypeParam(127));
+    EXPECT_LE(std::fabs(y[i] - expected), 0.5);
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestPackInt8) {
+  // N and K are no multiples of the panels and of 4
+  const int N = 37;
+  const int K = 6;
+  vector<int8_t> B(K * N);
+  for (int i = 0; i < B.size(); ++i) {
+    B[i] = caffe_rng_rand() % 255 - 127;
+  }
+  vector<int8_t> packed(caffe_cpu_packed_int8_size(N, K));
+  caffe_cpu_pack_int8(N, K, &B[0], &packed[0]);
+  vector<int8_t> unpacked(K * N);
+  caffe_cpu_unpack_int8(N, K, &packed[0], &unpacked[0]);
+  EXPECT_TRUE(B == unpacked);
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestGemmInt8) {
+  // M and N span more than one block of rows and of columns, with rows and
+  // columns left over, and K is no multiple of 4
+  const int M = 70;
+  const int N = 37;
+  const int K = 70;
+  vector<int8_t> A(M * K);
+  vector<int8_t> B(K * N);
+  for (int i = 0; i < A.size(); ++i) {
+    A[i] = caffe_rng_rand() % 255 - 127;
+  }
+  for (int i = 0; i < B.size(); ++i) {
+    B[i] = caffe_rng_rand() % 255 - 127;
+  }
+  vector<int8_t> packed(caffe_cpu_packed_int8_size(N, K));
+  caffe_cpu_pack_int8(N, K, &B[0], &packed[0]);
+  vector<TypeParam> row_scale(M);
+  vector<TypeParam> col_scale(N);
+  for (int i = 0; i < M; ++i) {
+    row_scale[i] = i % 3 + 1;
+  }
+  for (int j = 0; j < N; ++j) {
+    col_scale[j] = j % 2 ? -1 : 2;
+  }
+  vector<TypeParam> C(M * N);
+  vector<TypeParam> C_packed(M * N);
+  vector<TypeParam> C_scaled(M * N);
+  caffe_cpu_gemm_int8(M, N, K, &A[0], &B[0], false,
+      static_cast<const TypeParam*>(NULL), static_cast<const TypeParam*>(NULL),
+      &C[0]);
+  caffe_cpu_gemm_int8(M, N, K, &A[0], &packed[0], true,
+      static_cast<const TypeParam*>(NULL), static_cast<const TypeParam*>(NULL),
+      &C_packed[0]);
+  caffe_cpu_gemm_int8(M, N, K, &A[0], &packed[0], true, &row_scale[0],
+      &col_scale[0], &C_scaled[0]);
+  for (int i = 0; i < M; ++i) {
+    for (int j = 0; j < N; ++j) {
+      int32_t expected = 0;
+      for (int k = 0; k < K; ++k) {
+        expected += A[i * K + k] * B[k * N + j];
+      }
+      EXPECT_EQ(expected, C[i * N + j]);
+      EXPECT_EQ(expected, C_packed[i * N + j]);
+      EXPECT_EQ(expected * row_scale[i] * col_scale[j],
+          C_scaled[i * N + j]);
+    }
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestHalf) {
+  // every half but the NaNs converts to float and back unchanged
+  vector<uint16_t> half(1 << 16);
+  for (int i = 0; i < half.size(); ++i) {
+    half[i] = i;
+  }
+  vector<float> value(half.size());
+  caffe_cpu_half2float(half.size(), &half[0], &value[0]);
+  vector<uint16_t> round_trip(half.size());
+  caffe_cpu_float2half(value.size(), &value[0], &round_trip[0]);
+  for (int i = 0; i < half.size(); ++i) {
+    if (!std::isnan(value[i])) {
+      EXPECT_EQ(round_trip[i], half[i]);
+    }
+  }
+  EXPECT_EQ(value[0x3c00], 1);
+  EXPECT_EQ(value[0xc000], -2);
+  EXPECT_EQ(value[0x7bff], 65504);
+  EXPECT_EQ(value[0x0001], std::pow(2.0f, -24));
+  // rounding to nearest even, overflow and underflow
+  const float x[] = { 1 + std::pow(2.0f, -11), 1 + 3 * std::pow(2.0f, -11),
+      65520, -1e-8 };
+  const uint16_t expected[] = { 0x3c00, 0x3c02, 0x7c00, 0x8000 };
+  uint16_t y[4];
+  caffe_cpu_float2half(4, x, y);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(y[i], expected[i]);
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -0,0 +1,157 @@
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/memory_pool.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class MemoryPoolTest : public ::testing::Test {
+ protected:
+  static void AllocateAndFree(int thread_id, MemoryPool* pool) {
+    for (int round = 0; round < 10; ++round) {
+      vector<char*> blocks;
+      for (int i = 1; i <= 20; ++i) {
+        const size_t size = i * 1000 + thread_id;
+        char* block = static_cast<char*>(pool->Allocate(size));
+        block[0] = block[size - 1] = static_cast<char>(thread_id);
+        blocks.push_back(block);
+      }
+      for (int i = 0; i < blocks.size(); ++i) {
+        const size_t size = (i + 1) * 1000 + thread_id;
+        EXPECT_EQ(thread_id, blocks[i][0]);
+        EXPECT_EQ(thread_id, blocks[i][size - 1]);
+        pool->Free(blocks[i], size);
+      }
+    }
+  }
+};
+
+TEST_F(MemoryPoolTest, TestClassSize) {
+  EXPECT_EQ(256, MemoryPool::ClassSize(0));
+  EXPECT_EQ(256, MemoryPool::ClassSize(256));
+  EXPECT_EQ(320, MemoryPool::ClassSize(257));
+  EXPECT_EQ(1024, MemoryPool::ClassSize(1000));
+  EXPECT_EQ(1280, MemoryPool::ClassSize(1025));
+  for (size_t size = 1; size < (size_t(1) << 34); size = size * 3 + 1) {
+    const size_t class_size = MemoryPool::ClassSize(size);
+    EXPECT_GE(class_size, size);
+    EXPECT_LE(class_size, std::max<size_t>(256, size + size / 4));
+    EXPECT_EQ(class_size, MemoryPool::ClassSize(class_size));
+  }
+}
+
+TEST_F(MemoryPoolTest, TestReuse) {
+  MemoryPool pool(MemoryPool::HOST);
+  void* block = pool.Allocate(5000);
+  pool.Free(block, 5000);
+  // any size of the same class gets the block back
+  EXPECT_EQ(block, pool.Allocate(4900));
+  void* other = pool.Allocate(4900);
+  EXPECT_NE(block, other);
+  pool.Free(block, 4900);
+  pool.Free(other, 4900);
+  MemoryPool::Stats stats = pool.stats();
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(2, stats.misses);
+  EXPECT_EQ(2 * MemoryPool::ClassSize(5000), stats.reserved);
+  EXPECT_EQ(stats.reserved, stats.peak_reserved);
+  EXPECT_EQ(stats.reserved, stats.cached);
+}
+
+TEST_F(MemoryPoolTest, TestTrim) {
+  MemoryPool pool(MemoryPool::HOST);
+  void* kept = pool.Allocate(100000);
+  pool.Free(pool.Allocate(300000), 300000);
+  pool.Trim();
+  MemoryPool::Stats stats = pool.stats();
+  EXPECT_EQ(0, stats.cached);
+  EXPECT_EQ(MemoryPool::ClassSize(100000), stats.reserved);
+  EXPECT_EQ(MemoryPool::ClassSize(100000) + MemoryPool::ClassSize(300000),
+      stats.peak_reserved);
+  pool.Free(kept, 100000);
+}
+
+TEST_F(MemoryPoolTest, TestThreads) {
+  MemoryPool pool(MemoryPool::HOST);
+  const int num_threads = 4;
+  {
+    ThreadPool threads(num_threads);
+    threads.Run(boost::bind(&MemoryPoolTest::AllocateAndFree, _1, &pool));
+    MemoryPool::Stats stats = pool.stats();
+    EXPECT_EQ(num_threads * 10 * 20, stats.hits + stats.misses);
+    EXPECT_EQ(stats.reserved, stats.cached);
+  }
+  // the free lists of the exited threads are shared now
+  AllocateAndFree(0, &pool);
+  MemoryPool::Stats stats = pool.stats();
+  EXPECT_EQ(stats.reserved, stats.cached);
+  pool.Trim();
+  EXPECT_EQ(0, pool.stats().reserved);
+}
+
+TEST_F(MemoryPoolTest, TestSyncedMemory) {
+  Caffe::set_mode(Caffe::CPU);
+  MemoryPool::set_enabled(true);
+  void* block;
+  {
+    SyncedMemory mem(3000);
+    block = mem.mutable_cpu_data();
+    caffe_memset(mem.size(), 1, block);
+  }
+  // reused memory starts zeroed as well
+  SyncedMemory mem(3000);
+  EXPECT_EQ(block, mem.cpu_data());
+  for (int i = 0; i < mem.size(); ++i) {
+    EXPECT_EQ(0, static_cast<const char*>(mem.cpu_data())[i]);
+  }
+  MemoryPool::set_enabled(false);
+}
+
+// Transient blobs of a different shape for every request, as in inference
+// with dynamic input shapes.
+static float ReshapePerRequest(int num_requests) {
+  srand(1701);
+  CPUTimer timer;
+  timer.Start();
+  for (int r = 0; r < num_requests; ++r) {
+    const int num = 1 + rand() % 16;  // NOLINT(caffe/random_fn)
+    const int size = 28 + rand() % 29;  // NOLINT(caffe/random_fn)
+    Blob<float> data(num, 3, size * 4, size * 4);
+    Blob<float> conv(num, 64, size, size);
+    Blob<float> pool(num, 64, size / 2, size / 2);
+    data.mutable_cpu_data();
+    conv.mutable_cpu_data();
+    pool.mutable_cpu_data();
+  }
+  timer.Stop();
+  return timer.MilliSeconds();
+}
+
+TEST(MemoryPoolBenchmarkTest, DISABLED_TestReshapePerRequest) {
+  Caffe::set_mode(Caffe::CPU);
+  const int num_requests = 1000;
+  const float system_ms = ReshapePerRequest(num_requests);
+  MemoryPool::set_enabled(true);
+  const float pool_ms = ReshapePerRequest(num_requests);
+  MemoryPool::set_enabled(false);
+  MemoryPool::Stats stats = MemoryPool::Get(MemoryPool::HOST).stats();
+  LOG(INFO) << num_requests << " requests: system allocator " << system_ms
+      << " ms, memory pool " << pool_ms << " ms; pool hits " << stats.hits
+      << ", misses " << stats.misses << ", peak reserved "
+      << stats.peak_reserved << " bytes";
+  MemoryPool::Get(MemoryPool::HOST).Trim();
+}
+
+}  // namespace caffe
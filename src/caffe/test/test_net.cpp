@@ -11,6 +11,7 @@
 #include "caffe/net.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/memory_pool.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -564,6 +565,50 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitContiguousParamsNet(const bool contiguous_params) {
+    ostringstream proto;
+    proto <<
+        "name: 'ContiguousParamsNetwork' "
+        "contiguous_params: " << contiguous_params << " "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    shape { dim: 10 dim: 10 } "
+        "    shape { dim: 10 dim: 5 } "
+        "    data_filler { type: 'gaussian' } "
+        "  } "
+        "  top: 'data1' "
+        "  top: 'data2' "
+        "} ";
+    // ip1 and ip2 share their weights but not their biases
+    const char* layers[][3] = {{"ip1", "data1", "10"}, {"ip2", "ip1", "10"},
+        {"ip3", "ip2", "5"}};
+    for (int i = 0; i < 3; ++i) {
+      proto <<
+          "layer { "
+          "  name: '" << layers[i][0] << "' "
+          "  type: 'InnerProduct' "
+          "  inner_product_param { "
+          "    num_output: " << layers[i][2] << " "
+          "    weight_filler { type: 'gaussian' std: 0.1 } "
+          "    bias_filler { type: 'gaussian' std: 0.1 } "
+          "  } "
+          "  param { name: '" << (i < 2 ? "sharedweights" : "") << "' } "
+          "  bottom: '" << layers[i][1] << "' "
+          "  top: '" << layers[i][0] << "' "
+          "} ";
+    }
+    proto <<
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'EuclideanLoss' "
+        "  bottom: 'data2' "
+        "  bottom: 'ip3' "
+        "} ";
+    InitNetFromProtoString(proto.str());
+  }
+
   virtual void InitReshapableNet() {
     const string& proto =
         "name: 'ReshapableNetwork' "
@@ -783,6 +828,82 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitMemoryReuseNet(const Phase phase, const bool reuse,
+      const bool half_storage = false) {
+    string proto =
+        "name: 'MemoryReuseNetwork' "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { "
+        "    shape: { dim: 2 dim: 3 dim: 4 dim: 5 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'ip1' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'ip1' "
+        "  top: 'relu1' "
+        "} "
+        "layer { "
+        "  name: 'ip2' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'relu1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'tanh2' "
+        "  type: 'TanH' "
+        "  bottom: 'ip2' "
+        "  top: 'tanh2' "
+        "} "
+        "layer { "
+        "  name: 'ip3' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'tanh2' "
+        "  top: 'ip3' "
+        "  inner_product_param { "
+        "    num_output: 10 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'relu1' "
+        "  bottom: 'ip3' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'norm' "
+        "  type: 'L2N' "
+        "  bottom: 'sum' "
+        "  top: 'norm' "
+        "} ";
+    if (reuse) {
+      proto += "memory_reuse: INFERENCE ";
+    }
+    if (half_storage) {
+      proto += "half_storage: true ";
+    }
+    InitNetFromProtoFileWithState(proto, phase);
+  }
+
   virtual void InitAllInOneNet(Phase phase = caffe::TRAIN,
       const int level = 0, const vector<string>* stages = NULL) {
     string proto =
@@ -1216,6 +1337,52 @@ TYPED_TEST(NetTest, TestSharedWeightsDiffNet) {
   }
 }
 
+// Records the params reported ready, in order.
+template <typename Dtype>
+class ParamsReadyRecorder : public Net<Dtype>::ParamsReadyCallback {
+ public:
+  vector<int> layers_;
+  vector<int> params_;
+
+ protected:
+  void params_ready(int layer, const vector<int>& learnable_param_ids) {
+    for (int i = 0; i < learnable_param_ids.size(); ++i) {
+      layers_.push_back(layer);
+      params_.push_back(learnable_param_ids[i]);
+    }
+  }
+};
+
+TYPED_TEST(NetTest, TestParamsReady) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitUnsharedWeightsNet();
+  ParamsReadyRecorder<Dtype> recorder;
+  this->net_->add_params_ready(&recorder);
+  this->net_->Forward();
+  this->net_->Backward();
+  // innerproduct2 first, each with its own weights
+  const vector<string>& names = this->net_->layer_names();
+  ASSERT_EQ(2, recorder.params_.size());
+  EXPECT_EQ("innerproduct2", names[recorder.layers_[0]]);
+  EXPECT_EQ(1, recorder.params_[0]);
+  EXPECT_EQ("innerproduct1", names[recorder.layers_[1]]);
+  EXPECT_EQ(0, recorder.params_[1]);
+}
+
+TYPED_TEST(NetTest, TestParamsReadySharedWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitSharedWeightsNet();
+  ParamsReadyRecorder<Dtype> recorder;
+  this->net_->add_params_ready(&recorder);
+  this->net_->Forward();
+  this->net_->Backward();
+  // the shared weights are complete after the first layer using them
+  const vector<string>& names = this->net_->layer_names();
+  ASSERT_EQ(1, recorder.params_.size());
+  EXPECT_EQ("innerproduct1", names[recorder.layers_[0]]);
+  EXPECT_EQ(0, recorder.params_[0]);
+}
+
 TYPED_TEST(NetTest, TestSharedWeightsUpdate) {
   typedef typename TypeParam::Dtype Dtype;
   Caffe::set_random_seed(this->seed_);
@@ -1342,6 +1509,60 @@ TYPED_TEST(NetTest, TestSharedWeightsResume) {
   }
 }
 
+TYPED_TEST(NetTest, TestContiguousParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kNumIters = 2;
+  Caffe::set_random_seed(this->seed_);
+  this->InitContiguousParamsNet(false);
+  shared_ptr<Net<Dtype> > ref_net = this->net_;
+  EXPECT_TRUE(ref_net->contiguous_params() == NULL);
+  for (int iter = 0; iter < kNumIters; ++iter) {
+    ref_net->ClearParamDiffs();
+    ref_net->ForwardBackward();
+    ref_net->Update();
+  }
+  Caffe::set_random_seed(this->seed_);
+  this->InitContiguousParamsNet(true);
+  Net<Dtype>* net = this->net_.get();
+  // The params are laid end to end in the blob of contiguous params, and
+  // the shared weights are held once.
+  const Blob<Dtype>* params = net->contiguous_params();
+  ASSERT_TRUE(params != NULL);
+  const vector<Blob<Dtype>*>& learnable_params = net->learnable_params();
+  ASSERT_EQ(5, learnable_params.size());
+  int offset = 0;
+  for (int i = 0; i < learnable_params.size(); ++i) {
+    EXPECT_EQ(params->cpu_data() + offset, learnable_params[i]->cpu_data());
+    EXPECT_EQ(params->cpu_diff() + offset, learnable_params[i]->cpu_diff());
+    offset += learnable_params[i]->count();
+  }
+  EXPECT_EQ(offset, params->count());
+  EXPECT_EQ(net->layers()[1]->blobs()[0]->cpu_data(),
+      net->layers()[2]->blobs()[0]->cpu_data());
+  // Training gives the same params as with separate buffers.
+  for (int iter = 0; iter < kNumIters; ++iter) {
+    net->ClearParamDiffs();
+    net->ForwardBackward();
+    net->Update();
+  }
+  for (int i = 0; i < learnable_params.size(); ++i) {
+    const Blob<Dtype>* ref_param = ref_net->learnable_params()[i];
+    for (int j = 0; j < ref_param->count(); ++j) {
+      EXPECT_EQ(ref_param->cpu_data()[j], learnable_params[i]->cpu_data()[j]);
+      EXPECT_EQ(ref_param->cpu_diff()[j], learnable_params[i]->cpu_diff()[j]);
+    }
+  }
+  net->ClearParamDiffs();
+  for (int i = 0; i < learnable_params.size(); ++i) {
+    for (int j = 0; j < learnable_params[i]->count(); ++j) {
+      EXPECT_EQ(0, learnable_params[i]->cpu_diff()[j]);
+    }
+  }
+  // Once a net shares the params of another, they leave its arena.
+  net->ShareTrainedLayersWith(ref_net.get());
+  EXPECT_TRUE(net->contiguous_params() == NULL);
+}
+
 TYPED_TEST(NetTest, TestParamPropagateDown) {
   typedef typename TypeParam::Dtype Dtype;
   const bool kBiasTerm = true, kForceBackward = false;
@@ -2601,4 +2822,102 @@ TYPED_TEST(NetTest, TestAllInOneNetDeploy) {
   ASSERT_TRUE(found_data);
 }
 
+TYPED_TEST(NetTest, TestMemoryReuse) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitMemoryReuseNet(caffe::TEST, false);
+  shared_ptr<Net<Dtype> > ref_net = this->net_;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(ref_net->input_blobs()[0]);
+  ref_net->Forward();
+  // The TEST net reuses memory but computes the same output.
+  this->InitMemoryReuseNet(caffe::TEST, true);
+  Net<Dtype>* net = this->net_.get();
+  net->ShareTrainedLayersWith(ref_net.get());
+  net->input_blobs()[0]->CopyFrom(*ref_net->input_blobs()[0]);
+  net->Forward();
+  const Blob<Dtype>* ref_output = ref_net->output_blobs()[0];
+  const Blob<Dtype>* output = net->output_blobs()[0];
+  ASSERT_EQ(ref_output->count(), output->count());
+  for (int i = 0; i < output->count(); ++i) {
+    EXPECT_FLOAT_EQ(ref_output->cpu_data()[i], output->cpu_data()[i]);
+  }
+  // ReLU and TanH run in place; the sum, read after tanh2 is dead, takes
+  // the memory of ip2 and L2N writes over it in place.
+  EXPECT_EQ(net->blob_by_name("ip1")->data(),
+      net->blob_by_name("relu1")->data());
+  EXPECT_EQ(net->blob_by_name("ip2")->data(),
+      net->blob_by_name("tanh2")->data());
+  EXPECT_EQ(net->blob_by_name("ip2")->data(),
+      net->blob_by_name("sum")->data());
+  EXPECT_EQ(net->blob_by_name("sum")->data(),
+      net->blob_by_name("norm")->data());
+  EXPECT_NE(net->blob_by_name("relu1")->data(),
+      net->blob_by_name("ip3")->data());
+  EXPECT_NE(net->blob_by_name("data")->data(),
+      net->blob_by_name("ip1")->data());
+  // A TRAIN net keeps separate memory for every blob.
+  this->InitMemoryReuseNet(caffe::TRAIN, true);
+  EXPECT_NE(this->net_->blob_by_name("ip1")->data(),
+      this->net_->blob_by_name("relu1")->data());
+}
+
+TYPED_TEST(NetTest, TestHalfStorage) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitMemoryReuseNet(caffe::TEST, false);
+  shared_ptr<Net<Dtype> > ref_net = this->net_;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(ref_net->input_blobs()[0]);
+  ref_net->Forward();
+  NetParameter trained_param;
+  ref_net->ToProto(&trained_param);
+  // With or without memory reuse, the net keeps its data in half precision
+  // and computes nearly the same output.
+  for (int reuse = 0; reuse < 2; ++reuse) {
+    this->InitMemoryReuseNet(caffe::TEST, reuse, true);
+    Net<Dtype>* net = this->net_.get();
+    net->CopyTrainedLayersFrom(trained_param);
+    net->input_blobs()[0]->CopyFrom(*ref_net->input_blobs()[0]);
+    net->Forward();
+    const Blob<Dtype>* ref_output = ref_net->output_blobs()[0];
+    const Blob<Dtype>* output = net->output_blobs()[0];
+    ASSERT_EQ(ref_output->count(), output->count());
+    for (int i = 0; i < output->count(); ++i) {
+      EXPECT_NEAR(ref_output->cpu_data()[i], output->cpu_data()[i], 1e-2);
+    }
+    // only float nets in CPU mode store half precision
+    const bool half = Caffe::mode() == Caffe::CPU &&
+        sizeof(Dtype) == sizeof(float);
+    EXPECT_EQ(half, net->blob_by_name("relu1")->data()->head() ==
+        SyncedMemory::HEAD_AT_HALF);
+    EXPECT_EQ(half, net->params()[0]->data()->head() ==
+        SyncedMemory::HEAD_AT_HALF);
+    // the inputs and the outputs stay in float
+    EXPECT_NE(SyncedMemory::HEAD_AT_HALF,
+        net->input_blobs()[0]->data()->head());
+    EXPECT_NE(SyncedMemory::HEAD_AT_HALF,
+        net->blob_by_name("norm")->data()->head());
+  }
+  // The params shared with another net stay in float, in both nets.
+  this->InitMemoryReuseNet(caffe::TEST, false, true);
+  Net<Dtype>* net = this->net_.get();
+  net->ShareTrainedLayersWith(ref_net.get());
+  net->input_blobs()[0]->CopyFrom(*ref_net->input_blobs()[0]);
+  net->Forward();
+  for (int i = 0; i < net->params().size(); ++i) {
+    EXPECT_NE(SyncedMemory::HEAD_AT_HALF, net->params()[i]->data()->head());
+    EXPECT_NE(SyncedMemory::HEAD_AT_HALF,
+        ref_net->params()[i]->data()->head());
+  }
+  // The memory pool would keep the floats freed, so the data stays in float.
+  MemoryPool::set_enabled(true);
+  this->InitMemoryReuseNet(caffe::TEST, false, true);
+  MemoryPool::set_enabled(false);
+  this->net_->input_blobs()[0]->CopyFrom(*ref_net->input_blobs()[0]);
+  this->net_->Forward();
+  EXPECT_NE(SyncedMemory::HEAD_AT_HALF,
+      this->net_->blob_by_name("relu1")->data()->head());
+}
+
 }  // namespace caffe
@@ -0,0 +1,57 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/sequencer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class SequencerTest : public ::testing::Test {
+ protected:
+  // Appends the turns thread_id, thread_id + num_threads, ... to out.
+  static void Append(Sequencer* sequencer, int thread_id, int num_threads,
+      int num_turns, vector<int>* out) {
+    for (int seq = thread_id; seq < num_turns; seq += num_threads) {
+      sequencer->Wait(seq);
+      out->push_back(seq);
+      sequencer->Done(seq);
+    }
+  }
+};
+
+TEST_F(SequencerTest, TestTurnsInOrder) {
+  const int num_threads = 4;
+  const int num_turns = 200;
+  Sequencer sequencer;
+  vector<int> out;
+  boost::thread_group threads;
+  // started in reverse, so most threads have to wait for the earlier ones
+  for (int i = num_threads - 1; i >= 0; --i) {
+    threads.create_thread(boost::bind(&SequencerTest::Append, &sequencer, i,
+        num_threads, num_turns, &out));
+  }
+  threads.join_all();
+  ASSERT_EQ(num_turns, out.size());
+  for (int i = 0; i < num_turns; ++i) {
+    EXPECT_EQ(i, out[i]);
+  }
+  EXPECT_EQ(num_turns, sequencer.next());
+}
+
+TEST_F(SequencerTest, TestDoneTwice) {
+  Sequencer sequencer;
+  sequencer.Wait(0);
+  sequencer.Done(0);
+  sequencer.Done(0);
+  EXPECT_EQ(1, sequencer.next());
+  sequencer.Wait(1);
+  sequencer.Done(1);
+  EXPECT_EQ(2, sequencer.next());
+}
+
+}  // namespace caffe
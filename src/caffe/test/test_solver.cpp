@@ -106,4 +106,62 @@ TYPED_TEST(SolverTest, TestInitTrainTestNets) {
   EXPECT_TRUE(this->solver_->test_nets()[1]->has_layer("accuracy"));
 }
 
+TYPED_TEST(SolverTest, TestHalfStorageTestNets) {
+  typedef typename TypeParam::Dtype Dtype;
+  // the test nets share the weights of the train net, which training with
+  // no learning rate leaves as they are, in float
+  const string& proto =
+     "base_lr: 0 "
+     "lr_policy: 'fixed' "
+     "test_interval: 1 "
+     "test_iter: 1 "
+     "net_param { "
+     "  name: 'TestNetwork' "
+     "  half_storage: true "
+     "  layer { "
+     "    name: 'data' "
+     "    type: 'DummyData' "
+     "    dummy_data_param { "
+     "      shape { dim: 5 dim: 2 dim: 3 dim: 4 } "
+     "      shape { dim: 5 } "
+     "      data_filler { type: 'gaussian' } "
+     "      data_filler { type: 'constant' } "
+     "    } "
+     "    top: 'data' "
+     "    top: 'label' "
+     "  } "
+     "  layer { "
+     "    name: 'innerprod' "
+     "    type: 'InnerProduct' "
+     "    inner_product_param { "
+     "      num_output: 10 "
+     "      weight_filler { type: 'gaussian' } "
+     "    } "
+     "    bottom: 'data' "
+     "    top: 'innerprod' "
+     "  } "
+     "  layer { "
+     "    name: 'loss' "
+     "    type: 'SoftmaxWithLoss' "
+     "    bottom: 'innerprod' "
+     "    bottom: 'label' "
+     "  } "
+     "} ";
+  this->InitSolverFromProtoString(proto);
+  const vector<Blob<Dtype>*>& params =
+      this->solver_->net()->learnable_params();
+  vector<shared_ptr<Blob<Dtype> > > initial_params(params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    initial_params[i].reset(new Blob<Dtype>());
+    initial_params[i]->CopyFrom(*params[i], false, true);
+  }
+  this->solver_->Step(2);
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_NE(SyncedMemory::HEAD_AT_HALF, params[i]->data()->head());
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(initial_params[i]->cpu_data()[j], params[i]->cpu_data()[j]);
+    }
+  }
+}
+
 }  // namespace caffe
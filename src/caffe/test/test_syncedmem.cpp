@@ -122,4 +122,35 @@ TEST_F(SyncedMemoryTest, TestGPUWrite) {
 
 #endif
 
+TEST_F(SyncedMemoryTest, TestStoreHalf) {
+  const int count = 10;
+  SyncedMemory mem(count * sizeof(float));
+  float* cpu_data = static_cast<float*>(mem.mutable_cpu_data());
+  for (int i = 0; i < count; ++i) {
+    cpu_data[i] = i - 4.5;
+  }
+  // 1 + 2^-12 rounds to 1 in half precision
+  cpu_data[count - 1] = 1 + 1.0 / 4096;
+  mem.store_half();
+  EXPECT_EQ(mem.head(), SyncedMemory::HEAD_AT_HALF);
+  const float* half_data = static_cast<const float*>(mem.cpu_data());
+  EXPECT_EQ(mem.head(), SyncedMemory::HEAD_AT_CPU);
+  for (int i = 0; i < count - 1; ++i) {
+    EXPECT_EQ(half_data[i], i - 4.5);
+  }
+  EXPECT_EQ(half_data[count - 1], 1);
+  // writes are stored again
+  float* write_data = static_cast<float*>(mem.mutable_cpu_data());
+  write_data[0] = 2;
+  mem.store_half();
+  EXPECT_EQ(mem.head(), SyncedMemory::HEAD_AT_HALF);
+  EXPECT_EQ(static_cast<const float*>(mem.cpu_data())[0], 2);
+  // memory set from outside stays as it is
+  float external[count] = { 0 };
+  mem.set_cpu_data(external);
+  mem.store_half();
+  EXPECT_EQ(mem.head(), SyncedMemory::HEAD_AT_CPU);
+  EXPECT_EQ(mem.cpu_data(), external);
+}
+
 }  // namespace caffe
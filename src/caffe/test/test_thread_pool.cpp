@@ -0,0 +1,63 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {
+ protected:
+  static void Fill(int thread_id, int num_threads, vector<int>* out) {
+    for (int i = thread_id; i < out->size(); i += num_threads) {
+      (*out)[i] = i * i + thread_id;
+    }
+  }
+};
+
+TEST_F(ThreadPoolTest, TestRunsEveryThreadOnce) {
+  const int num_threads = 4;
+  ThreadPool pool(num_threads);
+  EXPECT_EQ(num_threads, pool.size());
+  for (int run = 0; run < 10; ++run) {
+    vector<int> out(101, -1);
+    pool.Run(boost::bind(&ThreadPoolTest::Fill, _1, num_threads, &out));
+    for (int i = 0; i < out.size(); ++i) {
+      EXPECT_EQ(i * i + i % num_threads, out[i]);
+    }
+  }
+}
+
+TEST_F(ThreadPoolTest, TestSingleThread) {
+  ThreadPool pool(1);
+  vector<int> out(7, -1);
+  pool.Run(boost::bind(&ThreadPoolTest::Fill, _1, 1, &out));
+  for (int i = 0; i < out.size(); ++i) {
+    EXPECT_EQ(i * i, out[i]);
+  }
+}
+
+TEST_F(ThreadPoolTest, TestRunFromSeveralThreads) {
+  const int num_threads = 3;
+  ThreadPool pool(num_threads);
+  vector<vector<int> > outs(4, vector<int>(57, -1));
+  boost::thread_group callers;
+  for (int i = 0; i < outs.size(); ++i) {
+    callers.create_thread(boost::bind(&ThreadPool::Run, &pool,
+        boost::function<void(int)>(boost::bind(&ThreadPoolTest::Fill, _1,
+            num_threads, &outs[i]))));
+  }
+  callers.join_all();
+  for (int j = 0; j < outs.size(); ++j) {
+    for (int i = 0; i < outs[j].size(); ++i) {
+      EXPECT_EQ(i * i + i % num_threads, outs[j][i]);
+    }
+  }
+}
+
+}  // namespace caffe
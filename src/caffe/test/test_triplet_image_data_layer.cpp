@@ -0,0 +1,396 @@
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#endif  // USE_OPENCV
+
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/identity_sampler.hpp"
+#include "caffe/util/image_shards.hpp"
+#include "caffe/util/io.hpp"
+
+#ifdef USE_OPENCV
+#include "caffe/layers/triplet_image_data_layer.hpp"
+#endif  // USE_OPENCV
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// The images of the tests, with the identity of each.
+static void GetTestImages(vector<string>* files, vector<int>* labels) {
+  const char* kFiles[] = { "cat.jpg", "fish-bike.jpg", "cat_gray.jpg",
+      "cat.jpg", "fish-bike.jpg", "cat.jpg" };
+  const int kLabels[] = { 3, 3, 7, 7, 9, 9 };
+  for (int i = 0; i < 6; ++i) {
+    files->push_back(string(EXAMPLES_SOURCE_DIR "images/") + kFiles[i]);
+    labels->push_back(kLabels[i]);
+  }
+}
+
+class ImageShardsTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    GetTestImages(&files_, &labels_);
+    string folder;
+    MakeTempDir(&folder);
+    prefix_ = folder + "/images";
+  }
+
+  // Packs the test images as tools/convert_imageshards does, stored as the
+  // files are, with an identity of no images at the end.
+  void WriteShards(size_t shard_limit) {
+    ImageShardWriter writer(prefix_, shard_limit);
+    for (int i = 0; i < files_.size(); ++i) {
+      if (i == 0 || labels_[i] != labels_[i - 1]) {
+        writer.AddIdentity(labels_[i]);
+      }
+      Datum datum;
+      ASSERT_TRUE(ReadFileToDatum(files_[i], labels_[i], &datum));
+      writer.AddImage(datum.data());
+    }
+    writer.AddIdentity(11);
+    writer.Finish();
+  }
+
+  // Checks that shards hold the test images in their order.
+  void CheckImages(const ImageShards& shards) {
+    ASSERT_EQ(files_.size(), shards.num_images());
+    const int kExpectedLabels[] = { 3, 7, 9, 11 };
+    ASSERT_EQ(4, shards.labels().size());
+    int id = 0;
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_EQ(kExpectedLabels[i], shards.labels()[i]);
+      const vector<int>& images = shards.identity_images()[i];
+      EXPECT_EQ(i < 3 ? 2 : 0, images.size());
+      for (int j = 0; j < images.size(); ++j) {
+        EXPECT_EQ(id, images[j]);
+        Datum datum;
+        ASSERT_TRUE(ReadFileToDatum(files_[id], &datum));
+        EXPECT_EQ(datum.data(), string(shards.image_data(id),
+            shards.image_size(id)));
+        ++id;
+      }
+    }
+  }
+
+  vector<string> files_;
+  vector<int> labels_;
+  string prefix_;
+};
+
+TEST_F(ImageShardsTest, TestRoundTrip) {
+  this->WriteShards(1 << 20);
+  ImageShards shards(this->prefix_ + ".index");
+  ImageShardIndex index;
+  ReadProtoFromBinaryFileOrDie(this->prefix_ + ".index", &index);
+  ASSERT_EQ(1, index.shard_size());
+  EXPECT_EQ("images_00000.shard", index.shard(0));
+  this->CheckImages(shards);
+}
+
+TEST_F(ImageShardsTest, TestShardPerIdentity) {
+  // Every identity fills its shard, so the last one, of no images, is left
+  // with an empty shard.
+  this->WriteShards(1);
+  ImageShards shards(this->prefix_ + ".index");
+  ImageShardIndex index;
+  ReadProtoFromBinaryFileOrDie(this->prefix_ + ".index", &index);
+  ASSERT_EQ(4, index.shard_size());
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(i, index.identity(i).shard());
+  }
+  this->CheckImages(shards);
+}
+
+class IdentitySamplerTest : public ::testing::Test {
+ protected:
+  // Identity i has label 10 * i and 4 + i % 3 images, with ids 100 * i + j.
+  void InitIdentities(int num_identities) {
+    labels_.clear();
+    identity_images_.clear();
+    for (int i = 0; i < num_identities; ++i) {
+      labels_.push_back(10 * i);
+      identity_images_.push_back(vector<int>());
+      for (int j = 0; j < 4 + i % 3; ++j) {
+        identity_images_.back().push_back(100 * i + j);
+      }
+    }
+  }
+
+  // Checks that the batch holds different identities with pair_size
+  // different images of their own each.
+  void CheckBatch(const vector<int>& batch_labels,
+      const vector<int>& batch_images, int pair_size) {
+    ASSERT_EQ(batch_labels.size() * pair_size, batch_images.size());
+    set<int> labels;
+    for (int i = 0; i < batch_labels.size(); ++i) {
+      EXPECT_TRUE(labels.insert(batch_labels[i]).second);
+      set<int> images;
+      for (int j = 0; j < pair_size; ++j) {
+        const int image = batch_images[i * pair_size + j];
+        EXPECT_EQ(batch_labels[i], image / 100 * 10);
+        EXPECT_TRUE(images.insert(image).second);
+      }
+    }
+  }
+
+  vector<int> labels_;
+  vector<vector<int> > identity_images_;
+};
+
+TEST_F(IdentitySamplerTest, TestBatches) {
+  this->InitIdentities(10);
+  IdentitySampler sampler(this->labels_, this->identity_images_, 3, 1, 0);
+  EXPECT_EQ(10, sampler.num_identities());
+  rng_t rng(1701);
+  vector<int> batch_labels(4);
+  vector<int> batch_images;
+  for (int iter = 0; iter < 20; ++iter) {
+    sampler.Sample(&rng, &batch_labels, &batch_images);
+    this->CheckBatch(batch_labels, batch_images, 3);
+  }
+}
+
+TEST_F(IdentitySamplerTest, TestEpochs) {
+  // 11 identities make 3 batches of 3 an epoch, and leave 2 out of each.
+  this->InitIdentities(11);
+  IdentitySampler sampler(this->labels_, this->identity_images_, 2, 1, 0);
+  rng_t rng(1701);
+  vector<int> batch_labels(3);
+  vector<int> batch_images;
+  map<int, vector<int> > identity_uses;
+  for (int epoch = 0; epoch < 12; ++epoch) {
+    set<int> epoch_labels;
+    for (int batch = 0; batch < 3; ++batch) {
+      sampler.Sample(&rng, &batch_labels, &batch_images);
+      EXPECT_EQ(epoch, sampler.epoch());
+      this->CheckBatch(batch_labels, batch_images, 2);
+      for (int i = 0; i < 3; ++i) {
+        EXPECT_TRUE(epoch_labels.insert(batch_labels[i]).second);
+        vector<int>& uses = identity_uses[batch_labels[i]];
+        uses.push_back(batch_images[i * 2]);
+        uses.push_back(batch_images[i * 2 + 1]);
+      }
+    }
+    EXPECT_EQ(9, epoch_labels.size());
+  }
+  // Each identity goes through its images in rounds of as many visits as
+  // it has pairs of images, none of them twice in a round.
+  for (int i = 0; i < 11; ++i) {
+    const vector<int>& uses = identity_uses[10 * i];
+    EXPECT_GT(uses.size(), 0);
+    const int round = this->identity_images_[i].size() / 2 * 2;
+    for (int begin = 0; begin < uses.size(); begin += round) {
+      const int end = std::min<int>(begin + round, uses.size());
+      set<int> images(uses.begin() + begin, uses.begin() + end);
+      EXPECT_EQ(end - begin, images.size());
+    }
+  }
+}
+
+TEST_F(IdentitySamplerTest, TestEpochsInOrder) {
+  // Without shuffling, each epoch takes the identities in order, and each
+  // identity its images.
+  this->InitIdentities(5);
+  IdentitySampler sampler(this->labels_, this->identity_images_, 2, 1, 0);
+  vector<int> batch_labels(2);
+  vector<int> batch_images;
+  for (int epoch = 0; epoch < 4; ++epoch) {
+    for (int batch = 0; batch < 2; ++batch) {
+      sampler.Sample(NULL, &batch_labels, &batch_images);
+      EXPECT_EQ(epoch, sampler.epoch());
+      for (int i = 0; i < 2; ++i) {
+        const int id = batch * 2 + i;
+        EXPECT_EQ(10 * id, batch_labels[i]);
+        // the images start over once too few are left for a pair
+        const int visits = this->identity_images_[id].size() / 2;
+        const int first = epoch % visits * 2;
+        EXPECT_EQ(100 * id + first, batch_images[i * 2]);
+        EXPECT_EQ(100 * id + first + 1, batch_images[i * 2 + 1]);
+      }
+    }
+  }
+}
+
+TEST_F(IdentitySamplerTest, TestSeed) {
+  this->InitIdentities(10);
+  IdentitySampler sampler(this->labels_, this->identity_images_, 2, 1, 0);
+  IdentitySampler same_sampler(this->labels_, this->identity_images_, 2, 1,
+      0);
+  IdentitySampler other_sampler(this->labels_, this->identity_images_, 2, 1,
+      0);
+  rng_t rng(1701);
+  rng_t same_rng(1701);
+  rng_t other_rng(1702);
+  vector<int> batch_labels(4);
+  vector<int> batch_images;
+  vector<int> same_labels(4);
+  vector<int> same_images;
+  vector<int> other_labels(4);
+  vector<int> other_images;
+  bool differ = false;
+  for (int iter = 0; iter < 10; ++iter) {
+    sampler.Sample(&rng, &batch_labels, &batch_images);
+    same_sampler.Sample(&same_rng, &same_labels, &same_images);
+    other_sampler.Sample(&other_rng, &other_labels, &other_images);
+    EXPECT_TRUE(batch_labels == same_labels);
+    EXPECT_TRUE(batch_images == same_images);
+    differ = differ || batch_images != other_images;
+  }
+  EXPECT_TRUE(differ);
+}
+
+TEST_F(IdentitySamplerTest, TestSolverShares) {
+  // Identities 1, 2, 4, 5, 7 and 8 have the 5 images of a pair group, the
+  // even ones for the first of two solvers and the odd ones for the other.
+  this->InitIdentities(10);
+  const int kExpectedLabels[2][3] = { { 20, 40, 80 }, { 10, 50, 70 } };
+  for (int rank = 0; rank < 2; ++rank) {
+    IdentitySampler sampler(this->labels_, this->identity_images_, 5, 2,
+        rank);
+    ASSERT_EQ(3, sampler.num_identities());
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_EQ(kExpectedLabels[rank][i], sampler.labels()[i]);
+    }
+    // batches draw only from the identities of the share
+    rng_t rng(1701);
+    vector<int> batch_labels(2);
+    vector<int> batch_images;
+    for (int iter = 0; iter < 6; ++iter) {
+      sampler.Sample(&rng, &batch_labels, &batch_images);
+      this->CheckBatch(batch_labels, batch_images, 5);
+      for (int i = 0; i < 2; ++i) {
+        EXPECT_EQ(rank, batch_labels[i] / 10 % 2);
+      }
+    }
+  }
+}
+
+#ifdef USE_OPENCV
+TEST_F(ImageShardsTest, TestDecode) {
+  this->WriteShards(1 << 20);
+  ImageShards shards(this->prefix_ + ".index");
+  for (int i = 0; i < this->files_.size(); ++i) {
+    cv::Mat expected = ReadImageToCVMat(this->files_[i], 0, 0, true);
+    cv::Mat actual = DecodeImageToCVMat(shards.image_data(i),
+        shards.image_size(i), 0, 0, true);
+    ASSERT_TRUE(actual.data);
+    ASSERT_EQ(expected.rows, actual.rows);
+    ASSERT_EQ(expected.cols, actual.cols);
+    EXPECT_EQ(0, cv::norm(expected, actual, cv::NORM_INF));
+  }
+}
+
+template <typename TypeParam>
+class TripletImageDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  TripletImageDataLayerTest()
+      : seed_(1701),
+        blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    Caffe::set_random_seed(seed_);
+    GetTestImages(&files_, &labels_);
+    MakeTempFilename(&source_);
+    std::ofstream outfile(source_.c_str(), std::ofstream::out);
+    for (int i = 0; i < files_.size(); ++i) {
+      outfile << files_[i] << " " << labels_[i] << std::endl;
+    }
+    outfile.close();
+  }
+
+  virtual ~TripletImageDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  // Two identities of two images a batch, resized to one size.
+  void InitParam(LayerParameter* param) {
+    TripletImageDataParameter* data_param =
+        param->mutable_triplet_image_data_param();
+    data_param->set_batch_size(4);
+    data_param->set_pair_size(2);
+    data_param->set_new_height(24);
+    data_param->set_new_width(32);
+  }
+
+  int seed_;
+  vector<string> files_;
+  vector<int> labels_;
+  string source_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(TripletImageDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(TripletImageDataLayerTest, TestReadShards) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The same batches come from the shards as from the files they pack.
+  string folder;
+  MakeTempDir(&folder);
+  const string prefix = folder + "/images";
+  ImageShardWriter writer(prefix, 1);
+  for (int i = 0; i < this->files_.size(); ++i) {
+    if (i == 0 || this->labels_[i] != this->labels_[i - 1]) {
+      writer.AddIdentity(this->labels_[i]);
+    }
+    Datum datum;
+    ASSERT_TRUE(ReadFileToDatum(this->files_[i], &datum));
+    writer.AddImage(datum.data());
+  }
+  writer.Finish();
+
+  LayerParameter file_param;
+  this->InitParam(&file_param);
+  file_param.mutable_triplet_image_data_param()->set_source(this->source_);
+  TripletImageDataLayer<Dtype> file_layer(file_param);
+  Blob<Dtype> file_data;
+  Blob<Dtype> file_label;
+  vector<Blob<Dtype>*> file_top_vec;
+  file_top_vec.push_back(&file_data);
+  file_top_vec.push_back(&file_label);
+  file_layer.SetUp(this->blob_bottom_vec_, file_top_vec);
+
+  LayerParameter shard_param;
+  this->InitParam(&shard_param);
+  shard_param.mutable_triplet_image_data_param()->set_shard_index(
+      prefix + ".index");
+  TripletImageDataLayer<Dtype> shard_layer(shard_param);
+  shard_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(4, this->blob_top_data_->num());
+  EXPECT_EQ(3, this->blob_top_data_->channels());
+  EXPECT_EQ(24, this->blob_top_data_->height());
+  EXPECT_EQ(32, this->blob_top_data_->width());
+
+  for (int iter = 0; iter < 3; ++iter) {
+    file_layer.Forward(this->blob_bottom_vec_, file_top_vec);
+    shard_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_EQ(file_label.cpu_data()[i],
+          this->blob_top_label_->cpu_data()[i]);
+    }
+    for (int i = 0; i < file_data.count(); ++i) {
+      EXPECT_EQ(file_data.cpu_data()[i], this->blob_top_data_->cpu_data()[i]);
+    }
+  }
+}
+#endif  // USE_OPENCV
+
+}  // namespace caffe
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <vector>
 
@@ -8,6 +9,8 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/triplet_loss_with_sample_layer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -48,6 +51,31 @@ class TripletLossWithSampleLayerTest : public MultiDeviceTest<TypeParam> {
     delete blob_bottom_label_;
     delete blob_top_loss_;
   }
+
+  static Dtype SquaredDistance(const Dtype* a, const Dtype* b,
+      const int dim) {
+    Dtype dist = 0;
+    for (int d = 0; d < dim; d++) {
+      dist += (a[d] - b[d]) * (a[d] - b[d]);
+    }
+    return dist;
+  }
+
+  // Shrinks the batch to 32 samples of dimension 4 so the loss stays well
+  // conditioned in float for the gradient checks below.
+  void UseSmallBatch() {
+    blob_bottom_data_->Reshape(32, 4, 1, 1);
+    blob_bottom_label_->Reshape(32, 1, 1, 1);
+    FillerParameter filler_param;
+    filler_param.set_min(-1.0);
+    filler_param.set_max(1.0);
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_data_);
+    for (int i = 0; i < 32; i++) {
+      blob_bottom_label_->mutable_cpu_data()[i] = i / 2;
+    }
+  }
+
   Blob<Dtype>* const blob_bottom_data_;
   Blob<Dtype>* const blob_bottom_label_;
   Blob<Dtype>* const blob_top_loss_;
@@ -109,4 +137,292 @@ TYPED_TEST(TripletLossWithSampleLayerTest, TestForward) {
   EXPECT_NEAR(triplet_count * full_loss, accum_loss, 1e-4);
 }
 
+TYPED_TEST(TripletLossWithSampleLayerTest, TestForwardEuclidean) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TripletLossWithSampleParameter* loss_param =
+      layer_param.mutable_triplet_loss_with_sample_param();
+  loss_param->set_distance(TripletLossWithSampleParameter_Distance_EUCLIDEAN);
+  TripletLossWithSampleLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Dtype full_loss = this->blob_top_loss_->cpu_data()[0];
+
+  const Dtype margin = loss_param->margin();
+  const int pair_size = loss_param->pair_size();
+  const int num = this->blob_bottom_label_->count();
+  const int dim = this->blob_bottom_data_->count() / num;
+  const Dtype* bottom_data = this->blob_bottom_data_->cpu_data();
+  const Dtype* label = this->blob_bottom_label_->cpu_data();
+  Dtype accum_loss = 0;
+  int triplet_count = 0;
+  for (int i = 0; i < num; i++) {
+    int pair_id = i / pair_size;
+    for (int k = pair_id*pair_size; k < (pair_id+1)*pair_size; k++) {
+      if (label[i] != label[k] || k == i)
+        continue;
+
+      Dtype dist_ik = this->SquaredDistance(bottom_data+(i*dim),
+          bottom_data+(k*dim), dim);
+      for (int j = 0; j < num; j++) {
+        if (label[j] == label[i])
+          continue;
+
+        Dtype dist_ij = this->SquaredDistance(bottom_data+(i*dim),
+            bottom_data+(j*dim), dim);
+        if (margin + dist_ik - dist_ij > Dtype(0.0)) {
+          triplet_count += 1;
+          accum_loss += margin + dist_ik - dist_ij;
+        }
+      }
+    }
+  }
+  EXPECT_GT(triplet_count, 0);
+  EXPECT_NEAR(full_loss, accum_loss / triplet_count, 1e-4);
+}
+
+TYPED_TEST(TripletLossWithSampleLayerTest, TestGradientAllTripletsActive) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  // inner products of the small batch stay within [-4, 4], so with this
+  // margin every triplet is active and the loss is smooth around the
+  // checked points
+  layer_param.mutable_triplet_loss_with_sample_param()->set_margin(10);
+  this->UseSmallBatch();
+  TripletLossWithSampleLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+
+TYPED_TEST(TripletLossWithSampleLayerTest, TestGradientEuclidean) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TripletLossWithSampleParameter* loss_param =
+      layer_param.mutable_triplet_loss_with_sample_param();
+  loss_param->set_distance(TripletLossWithSampleParameter_Distance_EUCLIDEAN);
+  // squared distances of the small batch stay below 16, so with this margin
+  // every triplet is active
+  loss_param->set_margin(20);
+  this->UseSmallBatch();
+  TripletLossWithSampleLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+
+TYPED_TEST(TripletLossWithSampleLayerTest, TestForwardHardNegatives) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TripletLossWithSampleParameter* loss_param =
+      layer_param.mutable_triplet_loss_with_sample_param();
+  // keep only the hardest violating negatives, so the mining is deterministic
+  loss_param->set_num_negative(5);
+  loss_param->set_hard_ratio(1);
+  loss_param->set_random_ratio(0);
+  TripletLossWithSampleLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Dtype full_loss = this->blob_top_loss_->cpu_data()[0];
+
+  const Dtype margin = loss_param->margin();
+  const int pair_size = loss_param->pair_size();
+  const int num_negative = loss_param->num_negative();
+  const int num = this->blob_bottom_label_->count();
+  const int dim = this->blob_bottom_data_->count() / num;
+  const Dtype* bottom_data = this->blob_bottom_data_->cpu_data();
+  const Dtype* label = this->blob_bottom_label_->cpu_data();
+  Dtype accum_loss = 0;
+  int triplet_count = 0;
+  for (int i = 0; i < num; i++) {
+    int pair_id = i / pair_size;
+    for (int k = pair_id*pair_size; k < (pair_id+1)*pair_size; k++) {
+      if (label[i] != label[k] || k == i)
+        continue;
+
+      Dtype dist_ik = -caffe_cpu_dot(dim, bottom_data+(i*dim), bottom_data+(k*dim));
+      vector<Dtype> violations;
+      for (int j = 0; j < num; j++) {
+        if (label[j] == label[i])
+          continue;
+
+        Dtype dist_ij = -caffe_cpu_dot(dim, bottom_data+(i*dim), bottom_data+(j*dim));
+        if (margin + dist_ik - dist_ij > Dtype(0.0)) {
+          violations.push_back(margin + dist_ik - dist_ij);
+        }
+      }
+      // the hardest negatives are the closest ones, with the largest violation
+      std::sort(violations.rbegin(), violations.rend());
+      for (int j = 0; j < std::min(num_negative, (int)violations.size()); j++) {
+        triplet_count += 1;
+        accum_loss += violations[j];
+      }
+    }
+  }
+  EXPECT_GT(triplet_count, 0);
+  EXPECT_NEAR(full_loss, accum_loss / triplet_count, 1e-4);
+}
+
+TYPED_TEST(TripletLossWithSampleLayerTest, TestForwardMemoryBank) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TripletLossWithSampleParameter* loss_param =
+      layer_param.mutable_triplet_loss_with_sample_param();
+  // every triplet is active, so all negatives of both batches are used
+  loss_param->set_margin(10);
+  loss_param->set_memory_bank_batches(1);
+  this->UseSmallBatch();
+  TripletLossWithSampleLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> bank;
+  bank.CopyFrom(*this->blob_bottom_data_, false, true);
+
+  FillerParameter filler_param;
+  filler_param.set_min(-1.0);
+  filler_param.set_max(1.0);
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_data_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Dtype full_loss = this->blob_top_loss_->cpu_data()[0];
+
+  const Dtype margin = loss_param->margin();
+  const int num = this->blob_bottom_label_->count();
+  const int dim = this->blob_bottom_data_->count() / num;
+  const Dtype* bottom_data = this->blob_bottom_data_->cpu_data();
+  const Dtype* bank_data = bank.cpu_data();
+  const Dtype* label = this->blob_bottom_label_->cpu_data();
+  Dtype accum_loss = 0;
+  int triplet_count = 0;
+  for (int i = 0; i < num; i++) {
+    int k = i ^ 1;
+    Dtype dist_ik = -caffe_cpu_dot(dim, bottom_data+(i*dim), bottom_data+(k*dim));
+    for (int j = 0; j < num; j++) {
+      if (label[j] == label[i])
+        continue;
+
+      // the previous batch had the same labels
+      Dtype dist_ij = -caffe_cpu_dot(dim, bottom_data+(i*dim), bottom_data+(j*dim));
+      Dtype dist_ib = -caffe_cpu_dot(dim, bottom_data+(i*dim), bank_data+(j*dim));
+      accum_loss += 2 * margin + 2 * dist_ik - dist_ij - dist_ib;
+      triplet_count += 2;
+    }
+  }
+  EXPECT_EQ(triplet_count, num * (num - 2) * 2);
+  EXPECT_NEAR(full_loss, accum_loss / triplet_count, 1e-4);
+}
+
+TYPED_TEST(TripletLossWithSampleLayerTest, TestBackwardMemoryBank) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  TripletLossWithSampleParameter* loss_param =
+      layer_param.mutable_triplet_loss_with_sample_param();
+  loss_param->set_distance(TripletLossWithSampleParameter_Distance_EUCLIDEAN);
+  loss_param->set_margin(20);
+  loss_param->set_memory_bank_size(32);
+  this->UseSmallBatch();
+  TripletLossWithSampleLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> bank;
+  bank.CopyFrom(*this->blob_bottom_data_, false, true);
+
+  FillerParameter filler_param;
+  filler_param.set_min(-1.0);
+  filler_param.set_max(1.0);
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_data_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype loss_weight = 2;
+  this->blob_top_loss_->mutable_cpu_diff()[0] = loss_weight;
+  vector<bool> propagate_down(2, false);
+  propagate_down[0] = true;
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+
+  // d(||a - p||^2 - ||a - n||^2) is 2 * (n - p) for the anchor, 2 * (p - a)
+  // for the positive and 2 * (a - n) for a negative of the batch, while the
+  // negatives of the bank get nothing
+  const int num = this->blob_bottom_label_->count();
+  const int dim = this->blob_bottom_data_->count() / num;
+  const Dtype* x = this->blob_bottom_data_->cpu_data();
+  const Dtype* bank_data = bank.cpu_data();
+  const Dtype* label = this->blob_bottom_label_->cpu_data();
+  vector<Dtype> expected(num * dim, 0);
+  int triplet_count = 0;
+  for (int a = 0; a < num; a++) {
+    int p = a ^ 1;
+    for (int j = 0; j < num; j++) {
+      if (label[j] == label[a])
+        continue;
+
+      for (int d = 0; d < dim; d++) {
+        const Dtype n = x[j*dim + d];
+        const Dtype b = bank_data[j*dim + d];
+        expected[a*dim + d] += 2 * (n - x[p*dim + d]) + 2 * (b - x[p*dim + d]);
+        expected[p*dim + d] += 4 * (x[p*dim + d] - x[a*dim + d]);
+        expected[j*dim + d] += 2 * (x[a*dim + d] - n);
+      }
+      triplet_count += 2;
+    }
+  }
+  const Dtype* bottom_diff = this->blob_bottom_data_->cpu_diff();
+  for (int i = 0; i < num * dim; i++) {
+    EXPECT_NEAR(bottom_diff[i], loss_weight * expected[i] / triplet_count, 1e-4);
+  }
+}
+
+// Times the scalar triple loop select_triplet used to build the distance
+// matrix against the single GEMM it uses now. Run it explicitly with
+//   --gtest_also_run_disabled_tests --gtest_filter='TripletDistance*'
+TEST(TripletDistanceBenchmarkTest, DISABLED_TestGemmSpeedup) {
+  Caffe::set_mode(Caffe::CPU);
+  const int dim = 512;
+  for (int num = 128; num <= 2048; num *= 2) {
+    Blob<float> feat(num, dim, 1, 1);
+    Blob<float> loop_dist(num, num, 1, 1);
+    Blob<float> gemm_dist(num, num, 1, 1);
+    FillerParameter filler_param;
+    filler_param.set_min(-1.0);
+    filler_param.set_max(1.0);
+    UniformFiller<float> filler(filler_param);
+    filler.Fill(&feat);
+    const float* feat_data = feat.cpu_data();
+    float* loop_data = loop_dist.mutable_cpu_data();
+    float* gemm_data = gemm_dist.mutable_cpu_data();
+
+    CPUTimer timer;
+    timer.Start();
+    for (int i = 0; i < num; i++) {
+      for (int j = i+1; j < num; j++) {
+        float dist = 0.0;
+        for (int d = 0; d < dim; d++)
+          dist -= feat_data[i*dim + d] * feat_data[j*dim + d];
+        loop_data[i*num + j] = dist;
+        loop_data[j*num + i] = dist;
+      }
+    }
+    timer.Stop();
+    const float loop_ms = timer.MilliSeconds();
+
+    timer.Start();
+    caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, num, num, dim,
+        -1., feat_data, feat_data, 0., gemm_data);
+    timer.Stop();
+    const float gemm_ms = timer.MilliSeconds();
+
+    for (int i = 0; i < num; i++) {
+      for (int j = 0; j < num; j++) {
+        if (i != j) {
+          EXPECT_NEAR(loop_data[i*num + j], gemm_data[i*num + j], 1e-3);
+        }
+      }
+    }
+    LOG(INFO) << "num " << num << ", dim " << dim << ": loop " << loop_ms
+        << " ms, gemm " << gemm_ms << " ms, speedup "
+        << loop_ms / std::max(gemm_ms, 1e-3f) << "x";
+  }
+}
+
 }  // namespace caffe
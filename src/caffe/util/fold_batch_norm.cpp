@@ -0,0 +1,276 @@
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/fold_batch_norm.hpp"
+
+namespace caffe {
+
+namespace {
+
+// The layers a chain may fold, in the order they have to come in.
+enum FoldStage { NOT_FOLDABLE, FOLD_BATCH_NORM, FOLD_SCALE, FOLD_RELU };
+
+FoldStage GetFoldStage(const LayerParameter& layer_param) {
+  if (layer_param.bottom_size() != 1 || layer_param.top_size() != 1) {
+    return NOT_FOLDABLE;
+  }
+  const string& type = layer_param.type();
+  if (type == "BatchNorm") {
+    // A BatchNorm set to normalize by the statistics of each batch can't be.
+    const BatchNormParameter& bn_param = layer_param.batch_norm_param();
+    if (bn_param.has_use_global_stats() && !bn_param.use_global_stats()) {
+      return NOT_FOLDABLE;
+    }
+    return FOLD_BATCH_NORM;
+  } else if (type == "Scale") {
+    // Only a scale per channel, learned as a param, can be.
+    const ScaleParameter& scale_param = layer_param.scale_param();
+    if (scale_param.axis() != 1 || scale_param.num_axes() != 1) {
+      return NOT_FOLDABLE;
+    }
+    return FOLD_SCALE;
+  } else if (type == "ReLU") {
+    if (layer_param.relu_param().negative_slope() != 0) {
+      return NOT_FOLDABLE;
+    }
+    return FOLD_RELU;
+  }
+  return NOT_FOLDABLE;
+}
+
+// Returns the index of the first layer after layer_id that reads blob_name,
+// or param.layer_size() if none does before it is written again.
+int NextReader(const NetParameter& param, const int layer_id,
+    const string& blob_name) {
+  for (int i = layer_id + 1; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      if (layer_param.bottom(j) == blob_name) {
+        return i;
+      }
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      if (layer_param.top(j) == blob_name) {
+        return param.layer_size();
+      }
+    }
+  }
+  return param.layer_size();
+}
+
+vector<double> BlobValues(const BlobProto& blob) {
+  if (blob.double_data_size() > 0) {
+    return vector<double>(blob.double_data().begin(),
+        blob.double_data().end());
+  }
+  return vector<double>(blob.data().begin(), blob.data().end());
+}
+
+// Sets the values of blob in the precision it holds them in.
+void SetBlobValues(const vector<double>& values, BlobProto* blob) {
+  const bool is_double = blob->double_data_size() > 0;
+  blob->clear_data();
+  blob->clear_double_data();
+  for (int i = 0; i < values.size(); ++i) {
+    if (is_double) {
+      blob->add_double_data(values[i]);
+    } else {
+      blob->add_data(values[i]);
+    }
+  }
+}
+
+}  // namespace
+
+void FoldTrainedBlobs(const vector<LayerParameter>& chain,
+    LayerParameter* layer_param) {
+  int num_output;
+  bool transpose = false;
+  bool bias_term;
+  if (layer_param->type() == "Convolution") {
+    num_output = layer_param->convolution_param().num_output();
+    bias_term = layer_param->convolution_param().bias_term();
+  } else {
+    CHECK_EQ(layer_param->type(), "InnerProduct");
+    num_output = layer_param->inner_product_param().num_output();
+    transpose = layer_param->inner_product_param().transpose();
+    bias_term = layer_param->inner_product_param().bias_term();
+  }
+  // BatchNorm and Scale make each output channel c an affine function of
+  // what the layer computes, scale[c] * y + shift[c].
+  vector<double> scale(num_output, 1);
+  vector<double> shift(num_output, 0);
+  for (int i = 0; i < chain.size(); ++i) {
+    const LayerParameter& chain_param = chain[i];
+    if (chain_param.type() == "BatchNorm") {
+      CHECK_EQ(chain_param.blobs_size(), 3) << "BatchNorm layer '"
+          << chain_param.name() << "' has no statistics to fold.";
+      const vector<double> mean = BlobValues(chain_param.blobs(0));
+      const vector<double> variance = BlobValues(chain_param.blobs(1));
+      const vector<double> factor = BlobValues(chain_param.blobs(2));
+      CHECK_EQ(mean.size(), num_output) << "BatchNorm layer '"
+          << chain_param.name() << "' doesn't match the outputs of '"
+          << layer_param->name() << "'.";
+      CHECK_EQ(variance.size(), num_output);
+      CHECK_EQ(factor.size(), 1);
+      // as BatchNormLayer scales the moving averages
+      const double scale_factor = factor[0] == 0 ? 0 : 1 / factor[0];
+      const double eps = chain_param.batch_norm_param().eps();
+      for (int c = 0; c < num_output; ++c) {
+        const double inv_std =
+            1 / std::sqrt(variance[c] * scale_factor + eps);
+        scale[c] *= inv_std;
+        shift[c] = (shift[c] - mean[c] * scale_factor) * inv_std;
+      }
+    } else if (chain_param.type() == "Scale") {
+      const bool scale_bias = chain_param.scale_param().bias_term();
+      CHECK_EQ(chain_param.blobs_size(), 1 + scale_bias) << "Scale layer '"
+          << chain_param.name() << "' has no trained scale to fold.";
+      const vector<double> gamma = BlobValues(chain_param.blobs(0));
+      CHECK_EQ(gamma.size(), num_output) << "Scale layer '"
+          << chain_param.name() << "' doesn't match the outputs of '"
+          << layer_param->name() << "'.";
+      const vector<double> beta = scale_bias ?
+          BlobValues(chain_param.blobs(1)) : vector<double>(num_output, 0);
+      CHECK_EQ(beta.size(), num_output);
+      for (int c = 0; c < num_output; ++c) {
+        scale[c] *= gamma[c];
+        shift[c] = shift[c] * gamma[c] + beta[c];
+      }
+    }
+  }
+  // The weights of output c are the rows of the filters or the inner
+  // product, or its columns if transposed.
+  vector<double> weights = BlobValues(layer_param->blobs(0));
+  CHECK_EQ(weights.size() % num_output, 0);
+  const int dim = weights.size() / num_output;
+  for (int i = 0; i < weights.size(); ++i) {
+    weights[i] *= scale[transpose ? i % num_output : i / dim];
+  }
+  SetBlobValues(weights, layer_param->mutable_blobs(0));
+  if (!bias_term) {
+    return;
+  }
+  if (layer_param->blobs_size() < 2) {
+    // a new bias, in the precision of the weights
+    BlobProto* bias_blob = layer_param->add_blobs();
+    bias_blob->mutable_shape()->add_dim(num_output);
+    for (int c = 0; c < num_output; ++c) {
+      if (layer_param->blobs(0).double_data_size() > 0) {
+        bias_blob->add_double_data(0);
+      } else {
+        bias_blob->add_data(0);
+      }
+    }
+  }
+  vector<double> bias = BlobValues(layer_param->blobs(1));
+  CHECK_EQ(bias.size(), num_output);
+  for (int c = 0; c < num_output; ++c) {
+    bias[c] = bias[c] * scale[c] + shift[c];
+  }
+  SetBlobValues(bias, layer_param->mutable_blobs(1));
+}
+
+void FoldBatchNorm(const NetParameter& param, NetParameter* param_folded,
+    map<string, vector<string> >* folded_chains) {
+  param_folded->CopyFrom(param);
+  param_folded->clear_layer();
+  vector<bool> is_folded(param.layer_size(), false);
+  for (int i = 0; i < param.layer_size(); ++i) {
+    if (is_folded[i]) {
+      continue;
+    }
+    LayerParameter* layer_param = param_folded->add_layer();
+    layer_param->CopyFrom(param.layer(i));
+    if (layer_param->bottom_size() != 1 || layer_param->top_size() != 1) {
+      continue;
+    }
+    // The channels of the output have to be on the axis BatchNorm and Scale
+    // work on, and the output not already rectified.
+    const string& type = layer_param->type();
+    bool bias_term;
+    if (type == "Convolution") {
+      const ConvolutionParameter& conv_param =
+          layer_param->convolution_param();
+      if (conv_param.axis() != 1 || conv_param.relu()) {
+        continue;
+      }
+      bias_term = conv_param.bias_term();
+    } else if (type == "InnerProduct") {
+      const InnerProductParameter& ip_param =
+          layer_param->inner_product_param();
+      if (ip_param.axis() != 1 || ip_param.relu()) {
+        continue;
+      }
+      bias_term = ip_param.bias_term();
+    } else {
+      continue;
+    }
+    // Follow the output down the chain, as long as each layer of it is the
+    // only reader of the output of the one before.
+    vector<int> chain;
+    string blob_name = layer_param->top(0);
+    FoldStage stage = NOT_FOLDABLE;
+    int last_id = i;
+    while (true) {
+      const int next_id = NextReader(param, last_id, blob_name);
+      if (next_id == param.layer_size()) {
+        break;
+      }
+      const LayerParameter& next_param = param.layer(next_id);
+      const FoldStage next_stage = GetFoldStage(next_param);
+      if (next_stage <= stage || (next_param.top(0) != blob_name &&
+          NextReader(param, next_id, blob_name) != param.layer_size())) {
+        break;
+      }
+      chain.push_back(next_id);
+      stage = next_stage;
+      last_id = next_id;
+      blob_name = next_param.top(0);
+    }
+    if (chain.empty()) {
+      continue;
+    }
+    bool relu = false;
+    vector<LayerParameter> chain_params;
+    for (int j = 0; j < chain.size(); ++j) {
+      const LayerParameter& chain_param = param.layer(chain[j]);
+      chain_params.push_back(chain_param);
+      if (folded_chains) {
+        (*folded_chains)[layer_param->name()].push_back(chain_param.name());
+      }
+      switch (GetFoldStage(chain_param)) {
+      case FOLD_BATCH_NORM:
+        bias_term = true;
+        break;
+      case FOLD_SCALE:
+        bias_term = bias_term || chain_param.scale_param().bias_term();
+        break;
+      case FOLD_RELU:
+        relu = true;
+        break;
+      default:
+        LOG(FATAL) << "Unknown fold stage";
+      }
+      is_folded[chain[j]] = true;
+      LOG(INFO) << "Folding layer '" << chain_param.name() << "' into '"
+          << layer_param->name() << "'";
+    }
+    if (type == "Convolution") {
+      layer_param->mutable_convolution_param()->set_bias_term(bias_term);
+      layer_param->mutable_convolution_param()->set_relu(relu);
+    } else {
+      layer_param->mutable_inner_product_param()->set_bias_term(bias_term);
+      layer_param->mutable_inner_product_param()->set_relu(relu);
+    }
+    if (layer_param->blobs_size() > 0) {
+      FoldTrainedBlobs(chain_params, layer_param);
+    }
+    layer_param->set_top(0, blob_name);
+  }
+}
+
+}  // namespace caffe
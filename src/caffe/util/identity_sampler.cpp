@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/util/identity_sampler.hpp"
+
+namespace caffe {
+
+IdentitySampler::IdentitySampler(const vector<int>& labels,
+    const vector<vector<int> >& identity_images, int pair_size,
+    int solver_count, int solver_rank)
+    : pair_size_(pair_size), identity_cursor_(0), epoch_(0) {
+  CHECK_EQ(labels.size(), identity_images.size());
+  CHECK_GT(pair_size, 0);
+  CHECK_GT(solver_count, 0);
+  for (int i = 0; i < labels.size(); ++i) {
+    if (identity_images[i].size() < pair_size
+        || i % solver_count != solver_rank) {
+      continue;
+    }
+    labels_.push_back(labels[i]);
+    identity_images_.push_back(identity_images[i]);
+  }
+  identity_order_.resize(labels_.size());
+  for (int i = 0; i < identity_order_.size(); ++i) {
+    identity_order_[i] = i;
+  }
+  image_cursor_.assign(labels_.size(), 0);
+}
+
+void IdentitySampler::Sample(rng_t* rng, vector<int>* batch_labels,
+    vector<int>* batch_images) {
+  const int pair_num = batch_labels->size();
+  const int num_identities = identity_order_.size();
+  CHECK_LE(pair_num, num_identities) << "Not enough identities for a batch";
+  batch_images->resize(pair_num * pair_size_);
+  if (identity_cursor_ + pair_num > num_identities) {
+    identity_cursor_ = 0;
+    ++epoch_;
+    DLOG(INFO) << "Starting epoch " << epoch_ << " of the identities.";
+  }
+  for (int i = 0; i < pair_num; ++i) {
+    // shuffle lazily: draw the next identity among the ones not visited yet
+    // in this epoch, so a batch costs O(batch_size)
+    if (rng) {
+      const int k = identity_cursor_
+          + (*rng)() % (num_identities - identity_cursor_);
+      std::swap(identity_order_[identity_cursor_], identity_order_[k]);
+    }
+    const int id = identity_order_[identity_cursor_++];
+    (*batch_labels)[i] = labels_[id];
+
+    // the same for the images of the identity, pair_size different ones
+    vector<int>& images = identity_images_[id];
+    const int num_images = images.size();
+    int& image_cursor = image_cursor_[id];
+    if (image_cursor + pair_size_ > num_images) {
+      image_cursor = 0;
+    }
+    for (int j = 0; j < pair_size_; ++j) {
+      if (rng) {
+        const int k = image_cursor
+            + (*rng)() % (num_images - image_cursor);
+        std::swap(images[image_cursor], images[k]);
+      }
+      (*batch_images)[i * pair_size_ + j] = images[image_cursor++];
+    }
+  }
+}
+
+}  // namespace caffe
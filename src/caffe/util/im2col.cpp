@@ -1,5 +1,8 @@
+#include <boost/ref.hpp>
+#include <algorithm>
 #include <vector>
 
+#include "caffe/common.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
 
@@ -15,6 +18,59 @@ inline bool is_a_ge_zero_and_a_lt_b(int a, int b) {
   return static_cast<unsigned>(a) < static_cast<unsigned>(b);
 }
 
+// Calls range(begin, end) on blocks of [0, size) on the intra-op threads,
+// where range writes work elements in all.
+template <typename Range>
+static void parallel_range(int size, int64_t work, const Range& range) {
+  if (size <= 0) {
+    return;
+  }
+  const int64_t item_work = std::max<int64_t>(work / size, 1);
+  const int grain = std::max<int64_t>(Caffe::kParallelGrain / item_work, 1);
+  Caffe::parallel_for(size, grain,
+      boost::function<void(int, int)>(boost::cref(range)));
+}
+
+// Lowers the rows [begin, end) of the column buffer, one row per channel
+// and kernel offset.
+template <typename Dtype>
+struct Im2colRows {
+  const Dtype* data_im;
+  int height, width, kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+      dilation_h, dilation_w, output_h, output_w;
+  Dtype* data_col;
+  int col_stride;
+
+  void operator()(int begin, int end) const {
+    for (int row = begin; row < end; ++row) {
+      const int kernel_col = row % kernel_w;
+      const int kernel_row = (row / kernel_w) % kernel_h;
+      const Dtype* im = data_im +
+          (row / (kernel_h * kernel_w)) * height * width;
+      Dtype* col = data_col + static_cast<int64_t>(row) * col_stride;
+      int input_row = -pad_h + kernel_row * dilation_h;
+      for (int output_rows = output_h; output_rows; output_rows--) {
+        if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
+          for (int output_cols = output_w; output_cols; output_cols--) {
+            *(col++) = 0;
+          }
+        } else {
+          int input_col = -pad_w + kernel_col * dilation_w;
+          for (int output_col = output_w; output_col; output_col--) {
+            if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
+              *(col++) = im[input_row * width + input_col];
+            } else {
+              *(col++) = 0;
+            }
+            input_col += stride_w;
+          }
+        }
+        input_row += stride_h;
+      }
+    }
+  }
+};
+
 template <typename Dtype>
 void im2col_cpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -26,32 +82,28 @@ void im2col_cpu(const Dtype* data_im, const int channels,
     (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
   const int output_w = (width + 2 * pad_w -
     (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
-  const int channel_size = height * width;
-  for (int channel = channels; channel--; data_im += channel_size) {
-    for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
-      for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
-        int input_row = -pad_h + kernel_row * dilation_h;
-        for (int output_rows = output_h; output_rows; output_rows--) {
-          if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
-            for (int output_cols = output_w; output_cols; output_cols--) {
-              *(data_col++) = 0;
-            }
-          } else {
-            int input_col = -pad_w + kernel_col * dilation_w;
-            for (int output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                *(data_col++) = data_im[input_row * width + input_col];
-              } else {
-                *(data_col++) = 0;
-              }
-              input_col += stride_w;
-            }
-          }
-          input_row += stride_h;
-        }
-      }
-    }
-  }
+  im2col_cpu(data_im, channels, height, width, kernel_h, kernel_w,
+      pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w, data_col,
+      output_h * output_w);
+}
+
+template <typename Dtype>
+void im2col_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    Dtype* data_col, const int col_stride) {
+  const int output_h = (height + 2 * pad_h -
+    (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int output_w = (width + 2 * pad_w -
+    (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  const Im2colRows<Dtype> rows = { data_im, height, width, kernel_h,
+      kernel_w, pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+      output_h, output_w, data_col, col_stride };
+  const int num_rows = channels * kernel_h * kernel_w;
+  parallel_range(num_rows,
+      static_cast<int64_t>(num_rows) * output_h * output_w, rows);
 }
 
 // Explicit instantiation
@@ -65,76 +117,124 @@ template void im2col_cpu<double>(const double* data_im, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, const int dilation_h, const int dilation_w,
     double* data_col);
+template void im2col_cpu<float>(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    float* data_col, const int col_stride);
+template void im2col_cpu<double>(const double* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    double* data_col, const int col_stride);
+// for the int8 input of the INT8 convolution engine
+template void im2col_cpu<int8_t>(const int8_t* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    int8_t* data_col);
 
+// Lowers (im2col) or accumulates back (col2im) the items [begin, end) of an
+// N-d image: single column channels for im2col, and whole image channels
+// for col2im, whose kernel offsets all add into the same pixels.
 template <typename Dtype>
-inline void im2col_nd_core_cpu(const Dtype* data_input, const bool im2col,
-    const int num_spatial_axes, const int* im_shape, const int* col_shape,
-    const int* kernel_shape, const int* pad, const int* stride,
-    const int* dilation, Dtype* data_output) {
-  if (!im2col) {
-    int im_size = im_shape[0];
+struct Im2colNdItems {
+  const Dtype* data_input;
+  bool im2col;
+  int num_spatial_axes;
+  const int* im_shape;
+  const int* col_shape;
+  const int* kernel_shape;
+  const int* pad;
+  const int* stride;
+  const int* dilation;
+  Dtype* data_output;
+
+  void operator()(int begin, int end) const {
+    int kernel_size = 1;
     for (int i = 0; i < num_spatial_axes; ++i) {
-      im_size *= im_shape[1 + i];
+      kernel_size *= kernel_shape[i];
     }
-    caffe_set(im_size, Dtype(0), data_output);
-  }
-  int kernel_size = 1;
-  for (int i = 0; i < num_spatial_axes; ++i) {
-    kernel_size *= kernel_shape[i];
-  }
-  const int channels_col = col_shape[0];
-  vector<int> d_offset(num_spatial_axes, 0);
-  vector<int> d_iter(num_spatial_axes, 0);
-  for (int c_col = 0; c_col < channels_col; ++c_col) {
-    // Loop over spatial axes in reverse order to compute a per-axis offset.
-    int offset = c_col;
-    for (int d_i = num_spatial_axes - 1; d_i >= 0; --d_i) {
-      if (d_i < num_spatial_axes - 1) {
-        offset /= kernel_shape[d_i + 1];
+    int c_col_begin = begin;
+    int c_col_end = end;
+    if (!im2col) {
+      int im_channel_size = 1;
+      for (int i = 0; i < num_spatial_axes; ++i) {
+        im_channel_size *= im_shape[1 + i];
       }
-      d_offset[d_i] = offset % kernel_shape[d_i];
+      caffe_set((end - begin) * im_channel_size, Dtype(0),
+          data_output + begin * im_channel_size);
+      c_col_begin = begin * kernel_size;
+      c_col_end = end * kernel_size;
     }
-    for (bool incremented = true; incremented; ) {
-      // Loop over spatial axes in forward order to compute the indices in the
-      // image and column, and whether the index lies in the padding.
-      int index_col = c_col;
-      int index_im = c_col / kernel_size;
-      bool is_padding = false;
-      for (int d_i = 0; d_i < num_spatial_axes; ++d_i) {
-        const int d = d_iter[d_i];
-        const int d_im = d * stride[d_i] - pad[d_i] +
-            d_offset[d_i] * dilation[d_i];
-        is_padding |= d_im < 0 || d_im >= im_shape[d_i + 1];
-        index_col *= col_shape[d_i + 1];
-        index_col += d;
-        index_im *= im_shape[d_i + 1];
-        index_im += d_im;
-      }
-      if (im2col) {
-        if (is_padding) {
-          data_output[index_col] = 0;
-        } else {
-          data_output[index_col] = data_input[index_im];
-        }
-      } else if (!is_padding) {  // col2im
-        data_output[index_im] += data_input[index_col];
-      }
-      // Loop over spatial axes in reverse order to choose an index,
-      // like counting.
-      incremented = false;
+    vector<int> d_offset(num_spatial_axes, 0);
+    vector<int> d_iter(num_spatial_axes, 0);
+    for (int c_col = c_col_begin; c_col < c_col_end; ++c_col) {
+      // Loop over spatial axes in reverse order to compute a per-axis
+      // offset.
+      int offset = c_col;
       for (int d_i = num_spatial_axes - 1; d_i >= 0; --d_i) {
-        const int d_max = col_shape[d_i + 1];
-        DCHECK_LT(d_iter[d_i], d_max);
-        if (d_iter[d_i] == d_max - 1) {
-          d_iter[d_i] = 0;
-        } else {  // d_iter[d_i] < d_max - 1
-          ++d_iter[d_i];
-          incremented = true;
-          break;
+        if (d_i < num_spatial_axes - 1) {
+          offset /= kernel_shape[d_i + 1];
         }
+        d_offset[d_i] = offset % kernel_shape[d_i];
       }
-    }  // while(incremented) {
-  }  // for (int c = 0; c < channels_col; ++c) {
+      for (bool incremented = true; incremented; ) {
+        // Loop over spatial axes in forward order to compute the indices in
+        // the image and column, and whether the index lies in the padding.
+        int index_col = c_col;
+        int index_im = c_col / kernel_size;
+        bool is_padding = false;
+        for (int d_i = 0; d_i < num_spatial_axes; ++d_i) {
+          const int d = d_iter[d_i];
+          const int d_im = d * stride[d_i] - pad[d_i] +
+              d_offset[d_i] * dilation[d_i];
+          is_padding |= d_im < 0 || d_im >= im_shape[d_i + 1];
+          index_col *= col_shape[d_i + 1];
+          index_col += d;
+          index_im *= im_shape[d_i + 1];
+          index_im += d_im;
+        }
+        if (im2col) {
+          if (is_padding) {
+            data_output[index_col] = 0;
+          } else {
+            data_output[index_col] = data_input[index_im];
+          }
+        } else if (!is_padding) {  // col2im
+          data_output[index_im] += data_input[index_col];
+        }
+        // Loop over spatial axes in reverse order to choose an index,
+        // like counting.
+        incremented = false;
+        for (int d_i = num_spatial_axes - 1; d_i >= 0; --d_i) {
+          const int d_max = col_shape[d_i + 1];
+          DCHECK_LT(d_iter[d_i], d_max);
+          if (d_iter[d_i] == d_max - 1) {
+            d_iter[d_i] = 0;
+          } else {  // d_iter[d_i] < d_max - 1
+            ++d_iter[d_i];
+            incremented = true;
+            break;
+          }
+        }
+      }  // while(incremented) {
+    }  // for (int c = 0; c < channels_col; ++c) {
+  }
+};
+
+template <typename Dtype>
+inline void im2col_nd_core_cpu(const Dtype* data_input, const bool im2col,
+    const int num_spatial_axes, const int* im_shape, const int* col_shape,
+    const int* kernel_shape, const int* pad, const int* stride,
+    const int* dilation, Dtype* data_output) {
+  const Im2colNdItems<Dtype> items = { data_input, im2col, num_spatial_axes,
+      im_shape, col_shape, kernel_shape, pad, stride, dilation, data_output };
+  int64_t col_size = col_shape[0];
+  for (int i = 0; i < num_spatial_axes; ++i) {
+    col_size *= col_shape[1 + i];
+  }
+  parallel_range(im2col ? col_shape[0] : im_shape[0], col_size, items);
 }
 
 template <typename Dtype>
@@ -159,6 +259,46 @@ template void im2col_nd_cpu<double>(const double* data_im,
     const int* kernel_shape, const int* pad, const int* stride,
     const int* dilation, double* data_col);
 
+// Accumulates the image channels [begin, end) back from the column buffer.
+template <typename Dtype>
+struct Col2imChannels {
+  const Dtype* data_col;
+  int height, width, kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+      dilation_h, dilation_w, output_h, output_w;
+  Dtype* data_im;
+
+  void operator()(int begin, int end) const {
+    const int channel_size = height * width;
+    caffe_set((end - begin) * channel_size, Dtype(0),
+        data_im + begin * channel_size);
+    const Dtype* col = data_col +
+        static_cast<int64_t>(begin) * kernel_h * kernel_w * output_h * output_w;
+    for (int channel = begin; channel < end; ++channel) {
+      Dtype* im = data_im + channel * channel_size;
+      for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
+        for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
+          int input_row = -pad_h + kernel_row * dilation_h;
+          for (int output_rows = output_h; output_rows; output_rows--) {
+            if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
+              col += output_w;
+            } else {
+              int input_col = -pad_w + kernel_col * dilation_w;
+              for (int output_col = output_w; output_col; output_col--) {
+                if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
+                  im[input_row * width + input_col] += *col;
+                }
+                col++;
+                input_col += stride_w;
+              }
+            }
+            input_row += stride_h;
+          }
+        }
+      }
+    }
+  }
+};
+
 template <typename Dtype>
 void col2im_cpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -166,34 +306,15 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     const int stride_h, const int stride_w,
     const int dilation_h, const int dilation_w,
     Dtype* data_im) {
-  caffe_set(height * width * channels, Dtype(0), data_im);
   const int output_h = (height + 2 * pad_h -
     (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
   const int output_w = (width + 2 * pad_w -
     (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
-  const int channel_size = height * width;
-  for (int channel = channels; channel--; data_im += channel_size) {
-    for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
-      for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
-        int input_row = -pad_h + kernel_row * dilation_h;
-        for (int output_rows = output_h; output_rows; output_rows--) {
-          if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
-            data_col += output_w;
-          } else {
-            int input_col = -pad_w + kernel_col * dilation_w;
-            for (int output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                data_im[input_row * width + input_col] += *data_col;
-              }
-              data_col++;
-              input_col += stride_w;
-            }
-          }
-          input_row += stride_h;
-        }
-      }
-    }
-  }
+  const Col2imChannels<Dtype> image_channels = { data_col, height, width,
+      kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w, dilation_h,
+      dilation_w, output_h, output_w, data_im };
+  parallel_range(channels, static_cast<int64_t>(channels) * kernel_h *
+      kernel_w * output_h * output_w, image_channels);
 }
 
 // Explicit instantiation
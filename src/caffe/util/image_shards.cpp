@@ -0,0 +1,113 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/util/format.hpp"
+#include "caffe/util/image_shards.hpp"
+#include "caffe/util/io.hpp"
+
+namespace caffe {
+
+ImageShardWriter::ImageShardWriter(const string& prefix, size_t shard_limit)
+    : prefix_(prefix), shard_limit_(shard_limit), shard_bytes_(0) {}
+
+void ImageShardWriter::AddIdentity(int label) {
+  if (!shard_.is_open() || shard_bytes_ >= shard_limit_) {
+    CloseShard();
+    const string suffix =
+        "_" + format_int(index_.shard_size(), 5) + ".shard";
+    shard_.open((prefix_ + suffix).c_str(),
+        std::ios::out | std::ios::binary | std::ios::trunc);
+    CHECK(shard_.is_open()) << "Failed to open shard " << prefix_ + suffix;
+    // the index lies next to the shards
+    const size_t slash = prefix_.find_last_of('/');
+    index_.add_shard((slash == string::npos ? prefix_ :
+        prefix_.substr(slash + 1)) + suffix);
+    shard_bytes_ = 0;
+  }
+  ImageShardIndex::Identity* identity = index_.add_identity();
+  identity->set_label(label);
+  identity->set_shard(index_.shard_size() - 1);
+}
+
+void ImageShardWriter::AddImage(const string& data) {
+  CHECK_GT(index_.identity_size(), 0) << "Images need an identity";
+  ImageShardIndex::Identity* identity =
+      index_.mutable_identity(index_.identity_size() - 1);
+  shard_.write(data.data(), data.size());
+  identity->add_offset(shard_bytes_);
+  identity->add_size(data.size());
+  shard_bytes_ += data.size();
+}
+
+void ImageShardWriter::Finish() {
+  CloseShard();
+  WriteProtoToBinaryFile(index_, prefix_ + ".index");
+}
+
+void ImageShardWriter::CloseShard() {
+  if (!shard_.is_open()) {
+    return;
+  }
+  shard_.close();
+  CHECK(!shard_.fail()) << "Failed to write shard " << index_.shard_size() - 1;
+}
+
+ImageShards::ImageShards(const string& index_file) {
+  ImageShardIndex index;
+  ReadProtoFromBinaryFileOrDie(index_file, &index);
+  const size_t slash = index_file.find_last_of('/');
+  const string folder = slash == string::npos ? "" :
+      index_file.substr(0, slash + 1);
+  for (int i = 0; i < index.shard_size(); ++i) {
+    const string shard_file = folder + index.shard(i);
+    int fd = open(shard_file.c_str(), O_RDONLY);
+    CHECK_NE(fd, -1) << "Could not open shard " << shard_file;
+    struct stat st;
+    CHECK_EQ(fstat(fd, &st), 0) << "Could not stat shard " << shard_file;
+    // an empty shard, of identities without readable images, can't be
+    // mapped and has nothing to read
+    void* data = NULL;
+    if (st.st_size > 0) {
+      data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      CHECK(data != MAP_FAILED) << "Could not map shard " << shard_file;
+      // pairs are read from random identities
+      madvise(data, st.st_size, MADV_RANDOM);
+    }
+    close(fd);
+    shard_data_.push_back(static_cast<const char*>(data));
+    shard_size_.push_back(st.st_size);
+  }
+  for (int i = 0; i < index.identity_size(); ++i) {
+    const ImageShardIndex::Identity& identity = index.identity(i);
+    CHECK_LT(identity.shard(), shard_data_.size())
+        << "Identity " << identity.label() << " refers to a missing shard";
+    CHECK_EQ(identity.offset_size(), identity.size_size());
+    labels_.push_back(identity.label());
+    identity_images_.push_back(vector<int>());
+    vector<int>& images = identity_images_.back();
+    for (int j = 0; j < identity.offset_size(); ++j) {
+      CHECK_LE(identity.offset(j) + identity.size(j),
+          shard_size_[identity.shard()]) << "Image " << j << " of identity "
+          << identity.label() << " lies outside its shard";
+      images.push_back(image_shard_.size());
+      image_shard_.push_back(identity.shard());
+      image_offset_.push_back(identity.offset(j));
+      image_size_.push_back(identity.size(j));
+    }
+  }
+}
+
+ImageShards::~ImageShards() {
+  for (int i = 0; i < shard_data_.size(); ++i) {
+    if (shard_data_[i]) {
+      munmap(const_cast<char*>(shard_data_[i]), shard_size_[i]);
+    }
+  }
+}
+
+}  // namespace caffe
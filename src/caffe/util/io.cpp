@@ -1,7 +1,9 @@
 #include <fcntl.h>
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/wire_format_lite.h>
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -30,6 +32,7 @@ using google::protobuf::io::CodedInputStream;
 using google::protobuf::io::ZeroCopyOutputStream;
 using google::protobuf::io::CodedOutputStream;
 using google::protobuf::Message;
+using google::protobuf::internal::WireFormatLite;
 
 bool ReadProtoFromTextFile(const char* filename, Message* proto) {
   int fd = open(filename, O_RDONLY);
@@ -102,6 +105,26 @@ cv::Mat ReadImageToCVMat(const string& filename) {
   return ReadImageToCVMat(filename, 0, 0, true);
 }
 
+cv::Mat DecodeImageToCVMat(const char* data, const size_t size,
+    const int height, const int width, const bool is_color) {
+  cv::Mat cv_img;
+  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+    CV_LOAD_IMAGE_GRAYSCALE);
+  // wrap the bytes without copying them
+  cv::Mat buffer(1, size, CV_8UC1, const_cast<char*>(data));
+  cv::Mat cv_img_origin = cv::imdecode(buffer, cv_read_flag);
+  if (!cv_img_origin.data) {
+    LOG(ERROR) << "Could not decode image";
+    return cv_img_origin;
+  }
+  if (height > 0 && width > 0) {
+    cv::resize(cv_img_origin, cv_img, cv::Size(width, height));
+  } else {
+    cv_img = cv_img_origin;
+  }
+  return cv_img;
+}
+
 // Do the file extension and encoding match?
 static bool matchExt(const std::string & fn,
                      std::string en) {
@@ -162,26 +185,66 @@ bool ReadFileToDatum(const string& filename, const int label,
   }
 }
 
+bool ParseDatumAliasing(const char* buffer, size_t size, Datum* datum,
+    const char** data, size_t* data_size) {
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(buffer), size);
+  *data = NULL;
+  *data_size = 0;
+  // The other fields are small: copy them out and parse them as usual.
+  string fields;
+  {
+    google::protobuf::io::StringOutputStream fields_stream(&fields);
+    CodedOutputStream output(&fields_stream);
+    const uint32_t data_tag = WireFormatLite::MakeTag(
+        Datum::kDataFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+    while (const uint32_t tag = input.ReadTag()) {
+      if (tag == data_tag) {
+        uint32_t length;
+        if (!input.ReadVarint32(&length)) {
+          return false;
+        }
+        *data = buffer + input.CurrentPosition();
+        *data_size = length;
+        if (!input.Skip(length)) {
+          return false;
+        }
+      } else if (!WireFormatLite::SkipField(&input, tag, &output)) {
+        return false;
+      }
+    }
+  }
+  return input.ConsumedEntireMessage() && datum->ParseFromString(fields);
+}
+
 #ifdef USE_OPENCV
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum) {
+  return DecodeDatumToCVMatNative(datum, datum.data().data(),
+      datum.data().size());
+}
+cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color) {
+  return DecodeDatumToCVMat(datum, datum.data().data(), datum.data().size(),
+      is_color);
+}
+cv::Mat DecodeDatumToCVMatNative(const Datum& datum, const char* data,
+    size_t size) {
   cv::Mat cv_img;
   CHECK(datum.encoded()) << "Datum not encoded";
-  const string& data = datum.data();
-  std::vector<char> vec_data(data.c_str(), data.c_str() + data.size());
-  cv_img = cv::imdecode(vec_data, -1);
+  // wrap the bytes without copying them
+  cv::Mat buffer(1, size, CV_8UC1, const_cast<char*>(data));
+  cv_img = cv::imdecode(buffer, -1);
   if (!cv_img.data) {
     LOG(ERROR) << "Could not decode datum ";
   }
   return cv_img;
 }
-cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color) {
+cv::Mat DecodeDatumToCVMat(const Datum& datum, const char* data,
+    size_t size, bool is_color) {
   cv::Mat cv_img;
   CHECK(datum.encoded()) << "Datum not encoded";
-  const string& data = datum.data();
-  std::vector<char> vec_data(data.c_str(), data.c_str() + data.size());
+  cv::Mat buffer(1, size, CV_8UC1, const_cast<char*>(data));
   int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
     CV_LOAD_IMAGE_GRAYSCALE);
-  cv_img = cv::imdecode(vec_data, cv_read_flag);
+  cv_img = cv::imdecode(buffer, cv_read_flag);
   if (!cv_img.data) {
     LOG(ERROR) << "Could not decode datum ";
   }
@@ -1,7 +1,18 @@
+#include <boost/bind.hpp>
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+// The x86 kernels are compiled for their instruction sets by the target
+// attribute, and chosen by cpuid at run time, whatever the build flags.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAFFE_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
 #include <limits>
+#include <vector>
 
 #include "caffe/common.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -372,4 +383,414 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
   cblas_dscal(n, alpha, y, 1);
 }
 
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype scale, const Dtype* x,
+    int8_t* y) {
+  for (int i = 0; i < n; ++i) {
+    const Dtype value =
+        std::min(std::max(scale * x[i], Dtype(-127)), Dtype(127));
+    // rounds half away from zero, as the cast truncates
+    y[i] = static_cast<int8_t>(value < 0 ? value - Dtype(0.5)
+        : value + Dtype(0.5));
+  }
+}
+
+template
+void caffe_cpu_quantize<float>(const int n, const float scale,
+    const float* x, int8_t* y);
+template
+void caffe_cpu_quantize<double>(const int n, const double scale,
+    const double* x, int8_t* y);
+
+// The int8 GEMM has two kernels. With AVX2 it computes C in tiles of up to
+// kInt8TileRows rows by a panel of kInt8PanelColumns columns, over blocks
+// of up to kInt8BlockRows rows of a panel, with B packed in panels. The
+// portable kernel sums rows of B, kGemmInt8Columns columns at once into a
+// buffer that stays in L1, and reads B as it is.
+static const int kInt8PanelColumns = 16;
+static const int kInt8TileRows = 4;
+static const int kInt8BlockRows = 64;
+static const int kGemmInt8Columns = 256;
+
+#ifdef CAFFE_X86_DISPATCH
+static bool cpu_has_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+#endif
+
+// whether B is packed in panels, for the AVX2 kernel
+static bool int8_panels() {
+#ifdef CAFFE_X86_DISPATCH
+  return cpu_has_avx2();
+#else
+  return false;
+#endif
+}
+
+static inline int int8_padded_k(const int K) {
+  return (K + 3) / 4 * 4;
+}
+
+int caffe_cpu_packed_int8_size(const int N, const int K) {
+  if (!int8_panels()) {
+    return K * N;
+  }
+  return (N + kInt8PanelColumns - 1) / kInt8PanelColumns * kInt8PanelColumns
+      * int8_padded_k(K);
+}
+
+// Packs columns [column, column + kInt8PanelColumns) of B into panel: for
+// each 4 rows, the 4 values of each column in turn, 0 past N and K.
+static void pack_int8_panel(const int N, const int K, const int8_t* B,
+    const int column, int8_t* panel) {
+  const int columns = std::min(kInt8PanelColumns, N - column);
+  if (columns < kInt8PanelColumns || int8_padded_k(K) != K) {
+    std::fill(panel, panel + int8_padded_k(K) * kInt8PanelColumns, 0);
+  }
+  for (int k = 0; k < K; ++k) {
+    const int8_t* b = B + k * N + column;
+    int8_t* p = panel + k / 4 * 4 * kInt8PanelColumns + k % 4;
+    if (columns == kInt8PanelColumns) {
+      for (int j = 0; j < kInt8PanelColumns; ++j) {
+        p[j * 4] = b[j];
+      }
+    } else {
+      for (int j = 0; j < columns; ++j) {
+        p[j * 4] = b[j];
+      }
+    }
+  }
+}
+
+void caffe_cpu_pack_int8(const int N, const int K, const int8_t* B,
+    int8_t* packed) {
+  if (!int8_panels()) {
+    std::copy(B, B + K * N, packed);
+    return;
+  }
+  const int panel_size = int8_padded_k(K) * kInt8PanelColumns;
+  for (int column = 0; column < N; column += kInt8PanelColumns) {
+    pack_int8_panel(N, K, B, column,
+        packed + column / kInt8PanelColumns * panel_size);
+  }
+}
+
+void caffe_cpu_unpack_int8(const int N, const int K, const int8_t* packed,
+    int8_t* B) {
+  if (!int8_panels()) {
+    std::copy(packed, packed + K * N, B);
+    return;
+  }
+  const int panel_size = int8_padded_k(K) * kInt8PanelColumns;
+  for (int k = 0; k < K; ++k) {
+    for (int n = 0; n < N; ++n) {
+      B[k * N + n] = packed[n / kInt8PanelColumns * panel_size +
+          (k / 4 * kInt8PanelColumns + n % kInt8PanelColumns) * 4 + k % 4];
+    }
+  }
+}
+
+// The arguments of caffe_cpu_gemm_int8, more than boost::bind takes.
+template <typename Dtype>
+struct GemmInt8 {
+  int M, N, K;
+  const int8_t* A;
+  const int8_t* B;
+  bool B_packed;
+  const Dtype* row_scale;
+  const Dtype* col_scale;
+  Dtype* C;
+};
+
+// Scales rows x columns int32 sums, rows sum_stride apart, into C at row i
+// and column j.
+template <typename Dtype>
+static inline void gemm_int8_store(const GemmInt8<Dtype>& gemm, const int i,
+    const int j, const int rows, const int columns, const int32_t* sum,
+    const int sum_stride) {
+  for (int r = 0; r < rows; ++r) {
+    const Dtype scale = gemm.row_scale ? gemm.row_scale[i + r] : Dtype(1);
+    Dtype* c = gemm.C + (i + r) * gemm.N + j;
+    for (int l = 0; l < columns; ++l) {
+      c[l] = sum[r * sum_stride + l] * scale *
+          (gemm.col_scale ? gemm.col_scale[j + l] : Dtype(1));
+    }
+  }
+}
+
+#ifdef CAFFE_X86_DISPATCH
+// Sums the products of rows of A (row stride K) and a panel into a tile of
+// rows x kInt8PanelColumns, 4 rows of the panel at a time: pmaddubsw
+// multiplies the unsigned |a| by b with the sign of a, exactly as |a|, |b|
+// <= 127, and adds pairs of products into int16, which pmaddwd adds into
+// int32.
+template <int rows>
+__attribute__((target("avx2")))
+static void gemm_int8_tile_avx2(const int K, const int8_t* A,
+    const int8_t* panel, int32_t* tile) {
+  __m256i sum[rows][2];
+  for (int r = 0; r < rows; ++r) {
+    sum[r][0] = _mm256_setzero_si256();
+    sum[r][1] = _mm256_setzero_si256();
+  }
+  const __m256i ones = _mm256_set1_epi16(1);
+  const int whole_k = K / 4 * 4;
+  for (int k = 0; k < K; k += 4) {
+    const __m256i* b = reinterpret_cast<const __m256i*>(
+        panel + k * kInt8PanelColumns);
+    const __m256i b0 = _mm256_loadu_si256(b);
+    const __m256i b1 = _mm256_loadu_si256(b + 1);
+    for (int r = 0; r < rows; ++r) {
+      // the 4 values of the row, 0 past K as the panel is
+      int32_t a4 = 0;
+      if (k < whole_k) {
+        std::memcpy(&a4, A + r * K + k, 4);
+      } else {
+        std::memcpy(&a4, A + r * K + k, K - k);
+      }
+      const __m256i a = _mm256_set1_epi32(a4);
+      const __m256i a_abs = _mm256_abs_epi8(a);
+      sum[r][0] = _mm256_add_epi32(sum[r][0], _mm256_madd_epi16(
+          _mm256_maddubs_epi16(a_abs, _mm256_sign_epi8(b0, a)), ones));
+      sum[r][1] = _mm256_add_epi32(sum[r][1], _mm256_madd_epi16(
+          _mm256_maddubs_epi16(a_abs, _mm256_sign_epi8(b1, a)), ones));
+    }
+  }
+  for (int r = 0; r < rows; ++r) {
+    __m256i* t = reinterpret_cast<__m256i*>(tile + r * kInt8PanelColumns);
+    _mm256_storeu_si256(t, sum[r][0]);
+    _mm256_storeu_si256(t + 1, sum[r][1]);
+  }
+}
+
+// Computes items [begin, end) of C, each a block of rows of a panel. The
+// items of a panel are consecutive, so an unpacked B is packed once a panel.
+template <typename Dtype>
+static void gemm_int8_panels(const GemmInt8<Dtype>& gemm, int begin,
+    int end) {
+  const int panel_size = int8_padded_k(gemm.K) * kInt8PanelColumns;
+  const int blocks = (gemm.M + kInt8BlockRows - 1) / kInt8BlockRows;
+  vector<int8_t> buffer(gemm.B_packed ? 0 : panel_size);
+  int buffer_panel = -1;
+  int32_t tile[kInt8TileRows * kInt8PanelColumns];
+  for (int item = begin; item < end; ++item) {
+    const int p = item / blocks;
+    const int column = p * kInt8PanelColumns;
+    const int8_t* panel = gemm.B + p * panel_size;
+    if (!gemm.B_packed) {
+      if (buffer_panel != p) {
+        pack_int8_panel(gemm.N, gemm.K, gemm.B, column, &buffer[0]);
+        buffer_panel = p;
+      }
+      panel = &buffer[0];
+    }
+    const int row_end =
+        std::min(gemm.M, (item % blocks + 1) * kInt8BlockRows);
+    for (int i = item % blocks * kInt8BlockRows; i < row_end;
+         i += kInt8TileRows) {
+      const int rows = std::min(kInt8TileRows, row_end - i);
+      const int8_t* a = gemm.A + i * gemm.K;
+      switch (rows) {
+      case 1: gemm_int8_tile_avx2<1>(gemm.K, a, panel, tile); break;
+      case 2: gemm_int8_tile_avx2<2>(gemm.K, a, panel, tile); break;
+      case 3: gemm_int8_tile_avx2<3>(gemm.K, a, panel, tile); break;
+      default: gemm_int8_tile_avx2<4>(gemm.K, a, panel, tile); break;
+      }
+      gemm_int8_store(gemm, i, column, rows,
+          std::min(kInt8PanelColumns, gemm.N - column), tile,
+          kInt8PanelColumns);
+    }
+  }
+}
+#endif
+
+// Adds the rows of B, columns wide, weighted by the row a of A to sum.
+// The compiler vectorizes the inner loop, at -O2 only for a constant
+// number of columns.
+template <int columns>
+static inline void gemm_int8_row(const int N, const int K, const int8_t* a,
+    const int8_t* B, int32_t* sum) {
+  for (int k = 0; k < K; ++k) {
+    const int32_t a_k = a[k];
+    // cheap to skip: InnerProduct has its rectified input as A, often zero,
+    // while convolution has its filters as A and seldom skips any
+    if (a_k == 0) {
+      continue;
+    }
+    const int8_t* b = B + k * N;
+    for (int j = 0; j < columns; ++j) {
+      sum[j] += a_k * b[j];
+    }
+  }
+}
+
+// Computes items [begin, end) of C, each up to kGemmInt8Columns columns of
+// a row, by the portable kernel.
+template <typename Dtype>
+static void gemm_int8_rows(const GemmInt8<Dtype>& gemm, int begin,
+    int end) {
+  const int N = gemm.N;
+  const int K = gemm.K;
+  const int blocks = (N + kGemmInt8Columns - 1) / kGemmInt8Columns;
+  int32_t sum[kGemmInt8Columns];
+  for (int item = begin; item < end; ++item) {
+    const int i = item / blocks;
+    const int column = item % blocks * kGemmInt8Columns;
+    const int columns = std::min(kGemmInt8Columns, N - column);
+    std::fill(sum, sum + kGemmInt8Columns, 0);
+    if (columns == kGemmInt8Columns) {
+      gemm_int8_row<kGemmInt8Columns>(N, K, gemm.A + i * K,
+          gemm.B + column, sum);
+    } else {
+      for (int k = 0; k < K; ++k) {
+        const int32_t a_k = gemm.A[i * K + k];
+        const int8_t* b = gemm.B + k * N + column;
+        for (int j = 0; j < columns; ++j) {
+          sum[j] += a_k * b[j];
+        }
+      }
+    }
+    gemm_int8_store(gemm, i, column, 1, columns, sum, 0);
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_gemm_int8(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, const bool B_packed,
+    const Dtype* row_scale, const Dtype* col_scale, Dtype* C) {
+  const GemmInt8<Dtype> gemm =
+      { M, N, K, A, B, B_packed, row_scale, col_scale, C };
+#ifdef CAFFE_X86_DISPATCH
+  if (int8_panels()) {
+    const int panels = (N + kInt8PanelColumns - 1) / kInt8PanelColumns;
+    const int blocks = (M + kInt8BlockRows - 1) / kInt8BlockRows;
+    const int grain = std::max(Caffe::kParallelGrain / (std::min(M,
+        kInt8BlockRows) * int8_padded_k(K) * kInt8PanelColumns), 1);
+    Caffe::parallel_for(panels * blocks, grain,
+        boost::bind(&gemm_int8_panels<Dtype>, boost::cref(gemm), _1, _2));
+    return;
+  }
+#endif
+  // packed B is B itself for the portable kernel
+  const int blocks = (N + kGemmInt8Columns - 1) / kGemmInt8Columns;
+  const int grain =
+      std::max(Caffe::kParallelGrain / (K * kGemmInt8Columns), 1);
+  Caffe::parallel_for(M * blocks, grain,
+      boost::bind(&gemm_int8_rows<Dtype>, boost::cref(gemm), _1, _2));
+}
+
+template
+void caffe_cpu_gemm_int8<float>(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, const bool B_packed,
+    const float* row_scale, const float* col_scale, float* C);
+template
+void caffe_cpu_gemm_int8<double>(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, const bool B_packed,
+    const double* row_scale, const double* col_scale, double* C);
+
+// The conversions of single values, by the bits of the floats: normal
+// halves have 5 exponent bits biased by 15 and 10 mantissa bits, where
+// floats have 8 biased by 127 and 23.
+static inline uint16_t float2half(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint32_t sign = bits & 0x80000000u;
+  bits ^= sign;
+  uint16_t half;
+  if (bits >= 0x47800000u) {
+    // beyond the half range: infinity, or NaN for NaN
+    half = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+  } else if (bits < 0x38800000u) {
+    // a subnormal half or zero: adding 0.5 aligns the mantissa bits of the
+    // half with the lowest ones of the float, rounded by the addition
+    float aligned;
+    std::memcpy(&aligned, &bits, sizeof(aligned));
+    aligned += 0.5f;
+    std::memcpy(&bits, &aligned, sizeof(bits));
+    half = bits - 0x3f000000u;
+  } else {
+    // rebias the exponent, and round the 13 dropped bits to nearest even
+    const uint32_t odd = (bits >> 13) & 1;
+    bits += 0xc8000fffu + odd;
+    half = bits >> 13;
+  }
+  return half | (sign >> 16);
+}
+
+static inline float half2float(const uint16_t half) {
+  uint32_t bits = (half & 0x7fffu) << 13;
+  const uint32_t exponent = bits & 0x0f800000u;
+  bits += 0x38000000u;
+  if (exponent == 0x0f800000u) {
+    // infinity or NaN
+    bits += 0x38000000u;
+  } else if (exponent == 0) {
+    // subnormal or zero: renormalize
+    bits += 0x00800000u;
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    value -= 6.103515625e-05f;
+    std::memcpy(&bits, &value, sizeof(bits));
+  }
+  bits |= static_cast<uint32_t>(half & 0x8000u) << 16;
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+#ifdef CAFFE_X86_DISPATCH
+static bool cpu_has_f16c() {
+  static const bool f16c = __builtin_cpu_supports("f16c")
+      && __builtin_cpu_supports("avx");
+  return f16c;
+}
+
+// The conversions of eight values at a time by F16C, up to the last whole
+// eight; they return how many were converted.
+__attribute__((target("f16c,avx")))
+static int float2half_f16c(const int n, const float* x, uint16_t* y) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i),
+        _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT));
+  }
+  return i;
+}
+
+__attribute__((target("f16c,avx")))
+static int half2float_f16c(const int n, const uint16_t* x, float* y) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i))));
+  }
+  return i;
+}
+#endif
+
+void caffe_cpu_float2half(const int n, const float* x, uint16_t* y) {
+  int i = 0;
+#ifdef CAFFE_X86_DISPATCH
+  if (cpu_has_f16c()) {
+    i = float2half_f16c(n, x, y);
+  }
+#endif
+  for (; i < n; ++i) {
+    y[i] = float2half(x[i]);
+  }
+}
+
+void caffe_cpu_half2float(const int n, const uint16_t* x, float* y) {
+  int i = 0;
+#ifdef CAFFE_X86_DISPATCH
+  if (cpu_has_f16c()) {
+    i = half2float_f16c(n, x, y);
+  }
+#endif
+  for (; i < n; ++i) {
+    y[i] = half2float(x[i]);
+  }
+}
+
 }  // namespace caffe
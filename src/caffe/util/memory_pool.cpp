@@ -0,0 +1,300 @@
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <vector>
+
+#ifdef USE_MKL
+  #include "mkl.h"
+#endif
+
+#include "caffe/util/memory_pool.hpp"
+
+namespace caffe {
+
+// Classes up to 256 bytes, then four per power of two.
+static const int kNumClasses = 1 + (64 - 8) * 4;
+
+static int ClassIndex(size_t size, size_t* class_size) {
+  if (size <= 256) {
+    *class_size = 256;
+    return 0;
+  }
+  int log = 0;
+  for (size_t s = size - 1; s >>= 1; ) { ++log; }
+  // 2^log < size <= 2^(log + 1), in steps of 2^(log - 2)
+  const int shift = log - 2;
+  const size_t steps = ((size - 1) >> shift) + 1;
+  *class_size = steps << shift;
+  return 1 + (log - 8) * 4 + static_cast<int>(steps - 5);
+}
+
+static void* SystemMalloc(MemoryPool::Kind kind, size_t size) {
+  void* ptr = NULL;
+  switch (kind) {
+  case MemoryPool::HOST:
+#ifdef USE_MKL
+    ptr = mkl_malloc(size ? size : 1, 64);
+#else
+    ptr = malloc(size);
+#endif
+    break;
+  case MemoryPool::PINNED_HOST:
+#ifndef CPU_ONLY
+    if (cudaMallocHost(&ptr, size) != cudaSuccess) {
+      cudaGetLastError();
+      ptr = NULL;
+    }
+#else
+    NO_GPU;
+#endif
+    break;
+  case MemoryPool::DEVICE:
+#ifndef CPU_ONLY
+    if (cudaMalloc(&ptr, size) != cudaSuccess) {
+      cudaGetLastError();
+      ptr = NULL;
+    }
+#else
+    NO_GPU;
+#endif
+    break;
+  }
+  return ptr;
+}
+
+static void SystemFree(MemoryPool::Kind kind, void* ptr) {
+  switch (kind) {
+  case MemoryPool::HOST:
+#ifdef USE_MKL
+    mkl_free(ptr);
+#else
+    free(ptr);
+#endif
+    break;
+  case MemoryPool::PINNED_HOST:
+#ifndef CPU_ONLY
+    CUDA_CHECK(cudaFreeHost(ptr));
+#endif
+    break;
+  case MemoryPool::DEVICE:
+#ifndef CPU_ONLY
+    CUDA_CHECK(cudaFree(ptr));
+#endif
+    break;
+  }
+}
+
+class MemoryPool::sync {
+ public:
+  // The free lists of one thread. The owner thread takes the lock of its
+  // cache on every use; it is only contended while stats() or Trim() run.
+  struct ThreadCache {
+    explicit ThreadCache(sync* pool)
+        : pool(pool), free(kNumClasses), cached(0), hits(0) {}
+    sync* pool;
+    boost::mutex mutex;
+    vector<vector<void*> > free;
+    size_t cached;
+    uint64_t hits;
+  };
+
+  sync()
+      : free(kNumClasses), cached(0), reserved(0),
+        peak_reserved(0), hits(0), misses(0), thread_cache(&Retire) {}
+
+  ThreadCache* local_cache() {
+    ThreadCache* cache = thread_cache.get();
+    if (!cache) {
+      cache = new ThreadCache(this);
+      thread_cache.reset(cache);
+      boost::mutex::scoped_lock lock(mutex);
+      caches.push_back(cache);
+    }
+    return cache;
+  }
+
+  // Called when a thread exits: hand its free lists over to all threads.
+  static void Retire(ThreadCache* cache) {
+    sync* pool = cache->pool;
+    boost::mutex::scoped_lock lock(pool->mutex);
+    pool->caches.erase(std::find(pool->caches.begin(), pool->caches.end(),
+        cache));
+    for (int c = 0; c < kNumClasses; ++c) {
+      pool->free[c].insert(pool->free[c].end(), cache->free[c].begin(),
+          cache->free[c].end());
+    }
+    pool->cached += cache->cached;
+    pool->hits += cache->hits;
+    delete cache;
+  }
+
+  // guards everything below but thread_cache
+  boost::mutex mutex;
+  vector<vector<void*> > free;
+  size_t cached;
+  size_t reserved;
+  size_t peak_reserved;
+  // hits on the shared free lists and of retired thread caches
+  uint64_t hits;
+  uint64_t misses;
+  vector<ThreadCache*> caches;
+  boost::thread_specific_ptr<ThreadCache> thread_cache;
+};
+
+static bool pool_enabled_ = false;
+
+MemoryPool::MemoryPool(Kind kind)
+    : kind_(kind), sync_(new sync()) {
+}
+
+MemoryPool::~MemoryPool() {
+  // retire the cache of this thread before freeing all free lists
+  sync_->thread_cache.reset();
+  Trim();
+}
+
+MemoryPool& MemoryPool::Get(Kind kind) {
+  // The pools live as long as the process, as threads may still return
+  // memory to them during static destruction.
+  static boost::mutex mutex;
+  static MemoryPool* host = NULL;
+  static MemoryPool* pinned_host = NULL;
+  static vector<MemoryPool*> device;
+  boost::mutex::scoped_lock lock(mutex);
+  switch (kind) {
+  case HOST:
+    if (!host) { host = new MemoryPool(HOST); }
+    return *host;
+  case PINNED_HOST:
+    if (!pinned_host) { pinned_host = new MemoryPool(PINNED_HOST); }
+    return *pinned_host;
+  case DEVICE:
+    break;
+  }
+  int current = 0;
+#ifndef CPU_ONLY
+  CUDA_CHECK(cudaGetDevice(&current));
+#else
+  NO_GPU;
+#endif
+  if (device.size() <= current) {
+    device.resize(current + 1, NULL);
+  }
+  if (!device[current]) { device[current] = new MemoryPool(DEVICE); }
+  return *device[current];
+}
+
+bool MemoryPool::enabled() {
+  return pool_enabled_;
+}
+
+void MemoryPool::set_enabled(bool enabled) {
+  pool_enabled_ = enabled;
+}
+
+size_t MemoryPool::ClassSize(size_t size) {
+  size_t class_size;
+  ClassIndex(size, &class_size);
+  return class_size;
+}
+
+void* MemoryPool::Allocate(size_t size) {
+  size_t class_size;
+  const int c = ClassIndex(size, &class_size);
+  sync::ThreadCache* cache = sync_->local_cache();
+  {
+    boost::mutex::scoped_lock lock(cache->mutex);
+    if (!cache->free[c].empty()) {
+      void* ptr = cache->free[c].back();
+      cache->free[c].pop_back();
+      cache->cached -= class_size;
+      ++cache->hits;
+      return ptr;
+    }
+  }
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex);
+    if (!sync_->free[c].empty()) {
+      void* ptr = sync_->free[c].back();
+      sync_->free[c].pop_back();
+      sync_->cached -= class_size;
+      ++sync_->hits;
+      return ptr;
+    }
+  }
+  void* ptr = SystemMalloc(kind_, class_size);
+  if (!ptr) {
+    // out of memory: give the cached blocks back and try again
+    Trim();
+    ptr = SystemMalloc(kind_, class_size);
+  }
+  CHECK(ptr) << "allocation of size " << size << " failed";
+  boost::mutex::scoped_lock lock(sync_->mutex);
+  sync_->reserved += class_size;
+  sync_->peak_reserved = std::max(sync_->peak_reserved, sync_->reserved);
+  ++sync_->misses;
+  return ptr;
+}
+
+void MemoryPool::Free(void* ptr, size_t size) {
+  size_t class_size;
+  const int c = ClassIndex(size, &class_size);
+  sync::ThreadCache* cache = sync_->local_cache();
+  {
+    boost::mutex::scoped_lock lock(cache->mutex);
+    if (cache->cached + class_size <= kThreadCacheBytes) {
+      cache->free[c].push_back(ptr);
+      cache->cached += class_size;
+      return;
+    }
+  }
+  boost::mutex::scoped_lock lock(sync_->mutex);
+  sync_->free[c].push_back(ptr);
+  sync_->cached += class_size;
+}
+
+void MemoryPool::Trim() {
+  vector<void*> blocks;
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex);
+    for (int i = 0; i < sync_->caches.size(); ++i) {
+      sync::ThreadCache* cache = sync_->caches[i];
+      boost::mutex::scoped_lock cache_lock(cache->mutex);
+      for (int c = 0; c < kNumClasses; ++c) {
+        blocks.insert(blocks.end(), cache->free[c].begin(),
+            cache->free[c].end());
+        cache->free[c].clear();
+      }
+      sync_->reserved -= cache->cached;
+      cache->cached = 0;
+    }
+    for (int c = 0; c < kNumClasses; ++c) {
+      blocks.insert(blocks.end(), sync_->free[c].begin(),
+          sync_->free[c].end());
+      sync_->free[c].clear();
+    }
+    sync_->reserved -= sync_->cached;
+    sync_->cached = 0;
+  }
+  for (int i = 0; i < blocks.size(); ++i) {
+    SystemFree(kind_, blocks[i]);
+  }
+}
+
+MemoryPool::Stats MemoryPool::stats() {
+  Stats stats;
+  boost::mutex::scoped_lock lock(sync_->mutex);
+  stats.reserved = sync_->reserved;
+  stats.peak_reserved = sync_->peak_reserved;
+  stats.cached = sync_->cached;
+  stats.hits = sync_->hits;
+  stats.misses = sync_->misses;
+  for (int i = 0; i < sync_->caches.size(); ++i) {
+    sync::ThreadCache* cache = sync_->caches[i];
+    boost::mutex::scoped_lock cache_lock(cache->mutex);
+    stats.cached += cache->cached;
+    stats.hits += cache->hits;
+  }
+  return stats;
+}
+
+}  // namespace caffe
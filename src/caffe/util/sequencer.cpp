@@ -0,0 +1,40 @@
+#include <boost/thread.hpp>
+
+#include "caffe/util/sequencer.hpp"
+
+namespace caffe {
+
+class Sequencer::sync {
+ public:
+  mutable boost::mutex mutex_;
+  boost::condition_variable condition_;
+};
+
+Sequencer::Sequencer()
+    : sync_(new sync()), next_(0) {
+}
+
+void Sequencer::Wait(uint64_t seq) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (next_ < seq) {
+    sync_->condition_.wait(lock);
+  }
+}
+
+void Sequencer::Done(uint64_t seq) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  if (next_ != seq) {
+    CHECK_GT(next_, seq) << "Turn " << seq << " ended before its own.";
+    return;
+  }
+  ++next_;
+  lock.unlock();
+  sync_->condition_.notify_all();
+}
+
+uint64_t Sequencer::next() const {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return next_;
+}
+
+}  // namespace caffe
@@ -0,0 +1,80 @@
+#include <boost/thread.hpp>
+#include <exception>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+class ThreadPool::sync {
+ public:
+  boost::mutex mutex_;
+  // held for a whole Run, so that callers on several threads take turns
+  boost::mutex run_mutex_;
+  boost::condition_variable start_;
+  boost::condition_variable done_;
+};
+
+ThreadPool::ThreadPool(int num_threads)
+    : sync_(new sync()), generation_(0), pending_(0), stop_(false) {
+  CHECK_GT(num_threads, 0) << "A thread pool needs at least one thread.";
+  try {
+    for (int i = 0; i < num_threads; ++i) {
+      threads_.push_back(shared_ptr<boost::thread>(
+          new boost::thread(&ThreadPool::entry, this, i)));
+    }
+  } catch (std::exception& e) {
+    LOG(FATAL) << "Thread exception: " << e.what();
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    stop_ = true;
+  }
+  sync_->start_.notify_all();
+  for (int i = 0; i < threads_.size(); ++i) {
+    threads_[i]->join();
+  }
+}
+
+void ThreadPool::Run(const boost::function<void(int)>& task) {
+  // the workers may write into memory owned by the caller, so do not let
+  // an interruption of the calling thread return before they are done
+  boost::this_thread::disable_interruption no_interruption;
+  boost::mutex::scoped_lock run_lock(sync_->run_mutex_);
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  task_ = task;
+  pending_ = threads_.size();
+  ++generation_;
+  sync_->start_.notify_all();
+  while (pending_ > 0) {
+    sync_->done_.wait(lock);
+  }
+  task_.clear();
+}
+
+void ThreadPool::entry(int thread_id) {
+  int generation = 0;
+  while (true) {
+    boost::function<void(int)> task;
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex_);
+      while (!stop_ && generation_ == generation) {
+        sync_->start_.wait(lock);
+      }
+      if (stop_) {
+        return;
+      }
+      generation = generation_;
+      task = task_;
+    }
+    task(thread_id);
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    if (--pending_ == 0) {
+      sync_->done_.notify_one();
+    }
+  }
+}
+
+}  // namespace caffe
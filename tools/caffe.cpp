@@ -54,6 +54,14 @@ DEFINE_string(sigint_effect, "stop",
 DEFINE_string(sighup_effect, "snapshot",
              "Optional; action to take when a SIGHUP signal is received: "
              "snapshot, stop or none.");
+DEFINE_bool(memory_pool, false,
+    "Optional; keep freed blob memory for reuse by later allocations.");
+DEFINE_int32(cpu_workers, 1,
+    "Optional; the number of solver replicas training in parallel when "
+    "training on the CPU, each on its own thread and share of the data.");
+DEFINE_int32(intra_op_threads, 1,
+    "Optional; the number of threads each solver or net splits CPU layers "
+    "over.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -210,6 +218,8 @@ int train() {
   if (gpus.size() == 0) {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    CHECK_GE(FLAGS_cpu_workers, 1);
+    Caffe::set_solver_count(FLAGS_cpu_workers);
   } else {
     ostringstream s;
     for (int i = 0; i < gpus.size(); ++i) {
@@ -253,6 +263,9 @@ int train() {
 #else
     LOG(FATAL) << "Multi-GPU execution not available - rebuild with USE_NCCL";
 #endif
+  } else if (gpus.size() == 0 && FLAGS_cpu_workers > 1) {
+    caffe::CPUSync<float> sync(solver);
+    sync.Run(FLAGS_snapshot.size() > 0 ? FLAGS_snapshot.c_str() : NULL);
   } else {
     solver->Solve();
   }
@@ -388,7 +401,7 @@ int time() {
     forward_timer.Start();
     for (int i = 0; i < layers.size(); ++i) {
       timer.Start();
-      layers[i]->Forward(bottom_vecs[i], top_vecs[i]);
+      caffe_net.ForwardFromTo(i, i);
       forward_time_per_layer[i] += timer.MicroSeconds();
     }
     forward_time += forward_timer.MicroSeconds();
@@ -441,6 +454,8 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::MemoryPool::set_enabled(FLAGS_memory_pool);
+  Caffe::set_intra_op_threads(FLAGS_intra_op_threads);
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
@@ -0,0 +1,137 @@
+// This is a script to calibrate a trained net for the INT8 engines of the
+// Convolution and InnerProduct layers: it runs the net over a sample of the
+// data, records the largest magnitude of the input of each such layer, and
+// writes the net with the INT8 engine and these ranges set. It then runs
+// the float and the quantized net side by side over the same sample and
+// reports how far the outputs of the quantized net are from those of the
+// float one. Both nets read the data of the data layer in its order, which
+// therefore shouldn't be shuffled or randomly mirrored.
+// Usage:
+//    calibrate_int8 pretrained_net_param calibration_proto_file
+//        num_mini_batches quantized_proto_file
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using std::map;
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: "
+        << "calibrate_int8 pretrained_net_param calibration_proto_file "
+        << "num_mini_batches quantized_proto_file";
+    return 1;
+  }
+  Caffe::set_mode(Caffe::CPU);
+  const int num_mini_batches = atoi(argv[3]);
+  CHECK_GT(num_mini_batches, 0);
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(string(argv[2]), &net_param);
+  net_param.mutable_state()->set_phase(TEST);
+  Net<float> net(net_param);
+  net.CopyTrainedLayersFrom(string(argv[1]));
+
+  // Run the net a layer at a time, to see the input of each layer before
+  // the blobs are written again.
+  map<string, float> input_ranges;
+  for (int batch = 0; batch < num_mini_batches; ++batch) {
+    for (int i = 0; i < net.layers().size(); ++i) {
+      const string type = net.layers()[i]->type();
+      if (type == "Convolution" || type == "InnerProduct") {
+        const Blob<float>* input = net.bottom_vecs()[i][0];
+        const float* data = input->cpu_data();
+        float& range = input_ranges[net.layer_names()[i]];
+        for (int j = 0; j < input->count(); ++j) {
+          range = std::max(range, std::abs(data[j]));
+        }
+      }
+      net.ForwardFromTo(i, i);
+    }
+  }
+
+  NetParameter quantized_param(net_param);
+  for (int i = 0; i < quantized_param.layer_size(); ++i) {
+    LayerParameter* layer_param = quantized_param.mutable_layer(i);
+    map<string, float>::const_iterator range =
+        input_ranges.find(layer_param->name());
+    if (range == input_ranges.end()) {
+      continue;
+    }
+    if (range->second == 0) {
+      LOG(INFO) << "Layer " << layer_param->name() << " only had zero "
+          << "input; leaving it in float.";
+      continue;
+    }
+    LOG(INFO) << "Layer " << layer_param->name() << " input range "
+        << range->second;
+    if (layer_param->type() == "Convolution") {
+      layer_param->mutable_convolution_param()->set_engine(
+          ConvolutionParameter_Engine_INT8);
+    } else {
+      layer_param->mutable_inner_product_param()->set_engine(
+          InnerProductParameter_Engine_INT8);
+    }
+    layer_param->mutable_quantization_param()->set_input_range(
+        range->second);
+  }
+  WriteProtoToTextFile(quantized_param, argv[4]);
+  LOG(INFO) << "Wrote quantized NetParameter text proto to " << argv[4];
+
+  // Compare the outputs of the quantized net with those of a fresh float
+  // net, which reads the sample from its start again.
+  Net<float> float_net(net_param);
+  float_net.CopyTrainedLayersFrom(string(argv[1]));
+  Net<float> int8_net(quantized_param);
+  int8_net.CopyTrainedLayersFrom(string(argv[1]));
+  const int num_outputs = float_net.output_blobs().size();
+  CHECK_EQ(num_outputs, int8_net.output_blobs().size());
+  vector<double> float_sum(num_outputs, 0);
+  vector<double> int8_sum(num_outputs, 0);
+  vector<double> float_squares(num_outputs, 0);
+  vector<double> error_squares(num_outputs, 0);
+  vector<double> max_error(num_outputs, 0);
+  vector<int> counts(num_outputs, 0);
+  for (int batch = 0; batch < num_mini_batches; ++batch) {
+    float_net.Forward();
+    int8_net.Forward();
+    for (int j = 0; j < num_outputs; ++j) {
+      const Blob<float>* float_output = float_net.output_blobs()[j];
+      const Blob<float>* int8_output = int8_net.output_blobs()[j];
+      CHECK_EQ(float_output->count(), int8_output->count());
+      const float* float_data = float_output->cpu_data();
+      const float* int8_data = int8_output->cpu_data();
+      for (int k = 0; k < float_output->count(); ++k) {
+        const double error = int8_data[k] - float_data[k];
+        float_sum[j] += float_data[k];
+        int8_sum[j] += int8_data[k];
+        float_squares[j] += float_data[k] * float_data[k];
+        error_squares[j] += error * error;
+        max_error[j] = std::max(max_error[j], std::abs(error));
+      }
+      counts[j] += float_output->count();
+    }
+  }
+  for (int j = 0; j < num_outputs; ++j) {
+    const string& name =
+        float_net.blob_names()[float_net.output_blob_indices()[j]];
+    LOG(INFO) << "Output " << name << ": float mean "
+        << float_sum[j] / counts[j] << ", int8 mean "
+        << int8_sum[j] / counts[j] << ", relative L2 error "
+        << std::sqrt(error_squares[j] / std::max(float_squares[j], 1e-20))
+        << ", max abs error " << max_error[j];
+  }
+  return 0;
+}
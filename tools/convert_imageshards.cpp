@@ -0,0 +1,123 @@
+// This program packs a set of images into shard files for the
+// TripletImageData layer, with the images of each identity stored next to
+// each other, and writes an ImageShardIndex that locates them.
+// Usage:
+//   convert_imageshards [FLAGS] ROOTFOLDER/ LISTFILE OUTPUT_PREFIX
+//
+// where ROOTFOLDER is the root folder that holds all the images, and LISTFILE
+// should be a list of files as well as their labels, in the format as
+//   subfolder1/file1.JPEG 7
+//   ....
+// It writes OUTPUT_PREFIX_00000.shard, OUTPUT_PREFIX_00001.shard, ... and
+// OUTPUT_PREFIX.index, to be given as shard_index to the layer.
+
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/image_shards.hpp"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_bool(gray, false,
+    "When this option is on, treat images as grayscale ones");
+DEFINE_int32(resize_width, 0, "Width images are resized to");
+DEFINE_int32(resize_height, 0, "Height images are resized to");
+DEFINE_string(encode_type, "",
+    "Optional: What type should we encode the image as ('png','jpg',...). "
+    "By default the files are stored as they are.");
+DEFINE_int32(shard_size_mb, 1024,
+    "A new shard is started once a shard grows past this size; the images "
+    "of an identity are never split across shards");
+
+int main(int argc, char** argv) {
+#ifdef USE_OPENCV
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Pack a set of images into the shards read by\n"
+        "the TripletImageData layer.\n"
+        "Usage:\n"
+        "    convert_imageshards [FLAGS] ROOTFOLDER/ LISTFILE OUTPUT_PREFIX\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc < 4) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_imageshards");
+    return 1;
+  }
+
+  const bool is_color = !FLAGS_gray;
+  const string encode_type = FLAGS_encode_type;
+  const int resize_height = std::max<int>(0, FLAGS_resize_height);
+  const int resize_width = std::max<int>(0, FLAGS_resize_width);
+  const size_t shard_limit = static_cast<size_t>(FLAGS_shard_size_mb) << 20;
+
+  // group the images by identity
+  std::ifstream infile(argv[2]);
+  std::map<int, std::vector<std::string> > label2files;
+  std::string line;
+  size_t pos;
+  int label;
+  int num_files = 0;
+  while (std::getline(infile, line)) {
+    pos = line.find_last_of(' ');
+    label = atoi(line.substr(pos + 1).c_str());
+    label2files[label].push_back(line.substr(0, pos));
+    ++num_files;
+  }
+  LOG(INFO) << "A total of " << num_files << " images of "
+      << label2files.size() << " identities.";
+
+  const std::string root_folder(argv[1]);
+  ImageShardWriter writer(argv[3], shard_limit);
+  Datum datum;
+  int count = 0;
+  std::map<int, std::vector<std::string> >::const_iterator iter;
+  for (iter = label2files.begin(); iter != label2files.end(); ++iter) {
+    writer.AddIdentity(iter->first);
+    const std::vector<std::string>& files = iter->second;
+    for (int i = 0; i < files.size(); ++i) {
+      std::string enc = encode_type;
+      if (!enc.size()) {
+        // Guess the encoding type from the file name
+        size_t p = files[i].rfind('.');
+        if (p == files[i].npos) {
+          LOG(WARNING) << "Failed to guess the encoding of '" << files[i]
+              << "'";
+        } else {
+          enc = files[i].substr(p);
+          std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+        }
+      }
+      if (!ReadImageToDatum(root_folder + files[i], iter->first,
+          resize_height, resize_width, is_color, enc, &datum)) {
+        continue;
+      }
+      CHECK(datum.encoded()) << "Could not encode " << files[i];
+      writer.AddImage(datum.data());
+
+      if (++count % 1000 == 0) {
+        LOG(INFO) << "Processed " << count << " files.";
+      }
+    }
+  }
+  writer.Finish();
+  LOG(INFO) << "Processed " << count << " files into "
+      << writer.index().shard_size() << " shards.";
+#else
+  LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
+#endif  // USE_OPENCV
+  return 0;
+}
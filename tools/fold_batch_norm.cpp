@@ -0,0 +1,61 @@
+// This is a script to fold the BatchNorm, Scale and ReLU layers of a trained
+// net into the Convolution and InnerProduct layers before them, for a
+// smaller and faster net to deploy; see FoldBatchNorm.
+// Usage:
+//    fold_batch_norm net_proto_file_in weights_file_in net_proto_file_out
+//        weights_file_out
+
+#include <map>
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/fold_batch_norm.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using std::map;
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: "
+        << "fold_batch_norm net_proto_file_in weights_file_in "
+        << "net_proto_file_out weights_file_out";
+    return 1;
+  }
+
+  NetParameter net_param;
+  NetParameter weights_param;
+  ReadNetParamsFromTextFileOrDie(string(argv[1]), &net_param);
+  ReadNetParamsFromBinaryFileOrDie(string(argv[2]), &weights_param);
+  // Give the layers of the net their trained blobs, so that the net and the
+  // weights are folded alike, and the weights of the layers that aren't in
+  // the net are left out.
+  map<string, const LayerParameter*> trained_layers;
+  for (int i = 0; i < weights_param.layer_size(); ++i) {
+    trained_layers[weights_param.layer(i).name()] = &weights_param.layer(i);
+  }
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    LayerParameter* layer_param = net_param.mutable_layer(i);
+    map<string, const LayerParameter*>::const_iterator trained =
+        trained_layers.find(layer_param->name());
+    if (trained != trained_layers.end()) {
+      layer_param->mutable_blobs()->CopyFrom(trained->second->blobs());
+    }
+  }
+
+  NetParameter folded_param;
+  FoldBatchNorm(net_param, &folded_param);
+  WriteProtoToBinaryFile(folded_param, argv[4]);
+  for (int i = 0; i < folded_param.layer_size(); ++i) {
+    folded_param.mutable_layer(i)->clear_blobs();
+  }
+  WriteProtoToTextFile(folded_param, argv[3]);
+
+  LOG(INFO) << "Wrote folded NetParameter text proto to " << argv[3]
+      << " and its weights to " << argv[4];
+  return 0;
+}